@@ -1,82 +1,145 @@
 // -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
 
+#include <algorithm>
+#include <array>
 #include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <format>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <optional>
+#include <random>
+#include <utility>
+#include <vector>
 
 #include "glm.h"
 
+#include "gfx/TerrainGenerator.h"
 #include "gfx/Uniforms.h"
 #include "Application.h"
+#include "Culling.h"
 #include "Curve.h"
+#include "Models.h"
 #include "Noise.h"
+#include "Ocean.h"
 #include "Terrain.h"
+#include "TerrainLod.h"
 
 Application::Application(GLFWwindow *window)
     : m_window{window},
       m_window_width{0},
       m_window_height{0},
-      m_gfx{window, true}
+      m_gfx{window, true},
+      m_noise{NOISE_SEED},
+      m_terrain_meshes{},
+      m_terrain_lod{},
+      m_terrain_gpu_generation_checked{false},
+      m_threads{},
+      m_camera_distance{5.0f},
+      m_terrain_max_radius{2.0f},
+      m_model{1.0},
+      m_view_projection{}
 {
     glfwGetFramebufferSize(window, &m_window_width, &m_window_height);
     glfwSetWindowUserPointer(m_window, this);
     glfwSetKeyCallback(m_window, keypressCallback);
 
-    const Perlin base_noise{2.0, 2.0, 2.0};
-    const Octave octave_noise{base_noise, 4, 0.3};
-    CubicSpline spline;
-    spline
-        .addControlPoint(-1.0, -1.0)
-        .addControlPoint(-0.5, -0.5)
-        .addControlPoint(0.0, -0.1)
-        .addControlPoint(0.5, 0.8)
-        .addControlPoint(0.75, 1.2)
-        .addControlPoint(1.0, 1.2);
-    const Curve curved_noise{octave_noise, spline};
+    // Nothing is generated here; the LOD terrain is drawn as its chunks
+    // arrive, and the single mesh can be switched to once a level is built.
+    uint64_t chunk_budget = std::min(TERRAIN_CHUNK_BUDGET, m_gfx.deviceLocalHeadroom() / TERRAIN_CHUNK_HEADROOM_SHARE);
+    m_terrain_lod = std::make_unique<TerrainLod>(
+        2.0f, m_noise.function(), m_threads, chunk_budget,
+        TerrainLod::DEFAULT_RESOLUTION, TERRAIN_TILE_DIRECTORY
+    );
+    if (m_terrain_lod->hasTiles()) {
+        std::cout << "Streaming terrain tiles to level " << m_terrain_lod->tileMaxLevel()
+                  << " from " << TERRAIN_TILE_DIRECTORY << std::endl;
+    }
+    m_gfx.setTerrainChunkTopology(
+        m_terrain_lod->chunkIndices(),
+        m_terrain_lod->verticesPerChunk(),
+        m_terrain_lod->capacity(),
+        m_terrain_lod->uploadsPerFrame()
+    );
+    m_gfx.setTerrainChunksEnabled(true);
+    reportVertexCache("Terrain chunk", m_terrain_lod->chunkIndices());
 
-    Terrain terrain{2.0, 5, curved_noise};
-    m_gfx.setTerrainGeometry(terrain.vertices(), terrain.elements());
+    const TerrainChunkGenerator &generator = m_terrain_lod->generator();
+    m_gfx.setTerrainChunkNoise(m_noise.tables(), generator.radius(), generator.resolution());
+    m_terrain_gpu_generation_checked = checkTerrainGeneration();
+    setTerrainGpuGeneration(m_terrain_gpu_generation_checked);
 
-    Ocean ocean{1.97f, 5};
-    m_gfx.setOceanGeometry(ocean.vertices(), ocean.indices());
+    // Coarsest first, since it's quickest and covers every altitude.
+    for (int level = TERRAIN_MIN_LEVEL; level <= TERRAIN_MAX_LEVEL; ++level) {
+        m_threads.submit([this, level] {
+            m_terrain_meshes.push(loadOrBuildTerrain(level));
+        });
+    }
 
-    gfx::ViewProjectionTransform vp_xform{};
+    std::unique_ptr<Ocean> ocean = loadOrBuildOcean(OCEAN_RADIUS, 5);
+    m_gfx.setOceanGeometry(ocean->refinements(), ocean->vertices(), ocean->indices(), ocean->shortIndices());
+    m_gfx.setOceanSurface(ocean->radius(), ocean->color());
+    reportVertexCache("Ocean", ocean->indices());
 
-    vp_xform.view = glm::lookAt(
-        glm::vec3{0.0, 0.0, 5.0},
-        glm::vec3{0.0, 0.0, 0.0},
-        glm::vec3{0.0, 1.0, 0.0});
-    vp_xform.view_inv = glm::inverse(vp_xform.view);
-    vp_xform.projection = glm::perspectiveFov(
-        20.0f,
-        static_cast<float>(m_window_width),
-        static_cast<float>(m_window_height),
-        0.1f, 100.0f);
-    vp_xform.projection[1][1] *= -1;
-    m_gfx.setViewProjectionTransform(vp_xform);
+    updateProjection();
+    updateCamera(0.0f);
     m_gfx.enableLight(0, { -1.0, -1.0, -1.0 });
+    m_gfx.setPointLights(placeCityLights());
+    m_gfx.setLightClusterRange(LIGHT_CLUSTER_NEAR, LIGHT_CLUSTER_FAR);
+    m_gfx.setAtmosphereParameters(gfx::AtmosphereParameters::earthLike(OCEAN_RADIUS, ATMOSPHERE_TOP_RADIUS));
 
     uint32_t num_frames = m_gfx.numFrames();
     for (uint32_t i = 0; i < num_frames; ++i) {
         m_gfx.writeViewProjectionTransform(i);
         m_gfx.writeLightList(i);
+        m_gfx.writePointLights(i);
     }
 }
 
 void Application::run() {
-    glm::mat4x4 model{1.0};
-
     try {
         static auto start_time = std::chrono::high_resolution_clock::now();
+        auto report_time = start_time;
+        auto memory_report_time = start_time;
+        auto last_time = start_time;
+        uint32_t report_frames = 0;
         while (!glfwWindowShouldClose(m_window)) {
             auto current_time = std::chrono::high_resolution_clock::now();
             float time = std::chrono::duration<float, std::chrono::seconds::period>(current_time - start_time).count();
-            model = glm::rotate(glm::mat4x4{1.0}, time * glm::radians(15.0f), glm::vec3{0.0, 1.0, 0.0});
+            float frame_elapsed = std::chrono::duration<float, std::chrono::seconds::period>(current_time - last_time).count();
+            last_time = current_time;
 
-            m_gfx.setTerrainTransform(model);
-            m_gfx.setOceanTransform(model);
+            float report_elapsed = std::chrono::duration<float, std::chrono::seconds::period>(current_time - report_time).count();
+            if (report_elapsed >= REPORT_INTERVAL_SECONDS && report_frames > 0) {
+                reportStats(report_elapsed, report_frames);
+                report_time = current_time;
+                report_frames = 0;
+            }
+            float memory_report_elapsed = std::chrono::duration<float, std::chrono::seconds::period>(current_time - memory_report_time).count();
+            if (memory_report_elapsed >= MEMORY_REPORT_INTERVAL_SECONDS) {
+                reportMemory();
+                memory_report_time = current_time;
+            }
+            ++report_frames;
+            m_model = glm::rotate(glm::mat4x4{1.0}, time * glm::radians(15.0f), glm::vec3{0.0, 1.0, 0.0});
+            updateCamera(frame_elapsed);
+
+            // Wait for this frame's previous use to finish before rewriting
+            // its uniforms.
+            uint32_t image_index = m_gfx.startFrame();
+            m_gfx.setTerrainTransform(m_model);
+            m_gfx.setOceanTransform(m_model);
+            m_gfx.setOceanTime(time);
             m_gfx.writeTerrainTransform();
             m_gfx.writeOceanTransform();
-            uint32_t image_index = m_gfx.startFrame();
+            m_gfx.writeViewProjectionTransform();
+            takeTerrainMeshes();
+            updateTerrainLevel();
+            if (m_gfx.terrainChunksEnabled()) {
+                updateTerrainLod();
+            }
             m_gfx.drawFrame(image_index);
             m_gfx.presentFrame(image_index);
             glfwPollEvents();
@@ -88,6 +151,308 @@ void Application::run() {
     }
 }
 
+Application::TerrainMesh Application::loadOrBuildTerrain(int level) const {
+    // Split into 20 * 4^2 patches for culling.
+    const int patch_refinements = 2;
+    uint64_t key = Terrain::cacheKey(2.0f, level, m_noise.function(), patch_refinements, ICOSPHERE_INDEX_WIDTH);
+    std::filesystem::path path = std::filesystem::path{MESH_CACHE_DIRECTORY} / std::format("terrain-{}-{:016x}.mesh", level, key);
+
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<Terrain> terrain = Terrain::load(path, key);
+    if (terrain) {
+        float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << std::format("Loaded terrain level {} from {} in {:.1f} ms", level, path.string(), ms) << std::endl;
+        VertexCacheStats vertex_cache = analyzeVertexCache(terrain->elements());
+        return TerrainMesh{std::move(terrain), vertex_cache};
+    }
+
+    terrain = std::make_unique<Terrain>(2.0f, level, m_noise.function(), patch_refinements, ICOSPHERE_INDEX_WIDTH);
+    float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << std::format("Built terrain level {} in {:.1f} ms", level, ms) << std::endl;
+    try {
+        terrain->save(path, key);
+    } catch (std::runtime_error &e) {
+        std::cerr << "Couldn't cache terrain level " << level << ": " << e.what() << "\n";
+    }
+    VertexCacheStats vertex_cache = analyzeVertexCache(terrain->elements());
+    return TerrainMesh{std::move(terrain), vertex_cache};
+}
+
+std::unique_ptr<Ocean> Application::loadOrBuildOcean(float radius, int level) const {
+    uint64_t key = Ocean::cacheKey(radius, level, ICOSPHERE_INDEX_WIDTH);
+    std::filesystem::path path = std::filesystem::path{MESH_CACHE_DIRECTORY} / std::format("ocean-{}-{:016x}.mesh", level, key);
+
+    std::unique_ptr<Ocean> ocean = Ocean::load(path, key);
+    if (ocean) {
+        return ocean;
+    }
+
+    ocean = std::make_unique<Ocean>(radius, level, ICOSPHERE_INDEX_WIDTH);
+    try {
+        ocean->save(path, key);
+    } catch (std::runtime_error &e) {
+        std::cerr << "Couldn't cache ocean level " << level << ": " << e.what() << "\n";
+    }
+    return ocean;
+}
+
+void Application::updateCamera(float elapsed) {
+    // W and S zoom in and out, slowing down close to the surface.
+    float zoom = 0.0f;
+    if (glfwGetKey(m_window, GLFW_KEY_W) == GLFW_PRESS) {
+        zoom -= 1.0f;
+    }
+    if (glfwGetKey(m_window, GLFW_KEY_S) == GLFW_PRESS) {
+        zoom += 1.0f;
+    }
+    float altitude = (m_camera_distance - MIN_CAMERA_DISTANCE) * std::exp(zoom * elapsed);
+    m_camera_distance = std::clamp(MIN_CAMERA_DISTANCE + altitude, MIN_CAMERA_DISTANCE, MAX_CAMERA_DISTANCE);
+
+    m_view_projection.view = glm::lookAt(
+        glm::vec3{0.0, 0.0, m_camera_distance},
+        glm::vec3{0.0, 0.0, 0.0},
+        glm::vec3{0.0, 1.0, 0.0});
+    m_view_projection.view_inv = glm::inverse(m_view_projection.view);
+    m_gfx.setViewProjectionTransform(m_view_projection);
+}
+
+std::vector<gfx::PointLight> Application::placeCityLights() const {
+    // Points spread evenly over the sphere, raised by the same noise as the
+    // terrain, keeping those above the sea. Seeded, so the lights are in the
+    // same places from run to run.
+    std::mt19937 rng{NOISE_SEED};
+    std::normal_distribution<float> normal{0.0f, 1.0f};
+    std::uniform_real_distribution<float> unit{0.0f, 1.0f};
+    const NoiseFunction &noise = m_noise.function();
+
+    std::vector<gfx::PointLight> lights;
+    lights.reserve(CITY_LIGHT_COUNT);
+    for (uint32_t attempt = 0; lights.size() < CITY_LIGHT_COUNT && attempt < 20 * CITY_LIGHT_COUNT; ++attempt) {
+        glm::vec3 dir{normal(rng), normal(rng), normal(rng)};
+        if (glm::dot(dir, dir) < 1e-6f) {
+            continue;
+        }
+        glm::vec3 pos = glm::normalize(dir) * 2.0f;
+        pos *= noise(pos.x, pos.y, pos.z)/8.0 + 1.0;
+        if (glm::length(pos) < OCEAN_RADIUS) {
+            continue;
+        }
+
+        float warmth = unit(rng);
+        lights.push_back(gfx::PointLight{
+            .position = pos * 1.005f,
+            .radius = CITY_LIGHT_RADIUS * (0.5f + unit(rng)),
+            .color = glm::vec3{1.0f, 0.6f + 0.3f * warmth, 0.2f + 0.4f * warmth} * 0.5f,
+            .padding = 0.0f,
+        });
+    }
+    return lights;
+}
+
+void Application::updateProjection() {
+    if (m_gfx.reverseDepth()) {
+        // As glm::perspectiveFov, with the far plane at infinity and depth
+        // running from 1 at the near plane down to 0.
+        float h = 1.0f / std::tan(0.5f * FIELD_OF_VIEW);
+        float w = h * static_cast<float>(m_window_height) / static_cast<float>(m_window_width);
+        glm::mat4x4 projection{0.0f};
+        projection[0][0] = w;
+        projection[1][1] = h;
+        projection[2][3] = -1.0f;
+        projection[3][2] = REVERSE_DEPTH_NEAR_PLANE;
+        m_view_projection.projection = projection;
+    } else {
+        m_view_projection.projection = glm::perspectiveFov(
+            FIELD_OF_VIEW,
+            static_cast<float>(m_window_width),
+            static_cast<float>(m_window_height),
+            NEAR_PLANE, FAR_PLANE);
+    }
+    m_view_projection.projection[1][1] *= -1;
+}
+
+bool Application::checkTerrainGeneration() {
+    // Chunks that aren't in the tiles are generated on the GPU only if it
+    // makes them as the CPU does.
+    std::optional<gfx::TerrainGenerationError> error = gfx::compareTerrainGeneration(
+        m_terrain_lod->generator(),
+        [this](const std::vector<TerrainChunkGeneration> &chunks) {
+            return m_gfx.generateTerrainChunksNow(chunks);
+        }
+    );
+    if (!error) {
+        std::cerr << "Couldn't generate terrain chunks on the GPU to check them\n";
+        return false;
+    }
+
+    bool matches = error->withinTolerance();
+    std::cout << std::format(
+        "GPU terrain generation is within {:.2g} of the CPU's positions and {:.2g} degrees of its normals over {} chunks{}",
+        error->position, error->normal, error->chunks, matches ? "" : ", too far to use"
+    ) << std::endl;
+    return matches;
+}
+
+void Application::setTerrainGpuGeneration(bool enabled) {
+    // Chunks generated on the GPU are bounded by the noise's whole range.
+    if (enabled) {
+        TerrainNoiseTables tables = m_noise.tables();
+        float radius = m_terrain_lod->generator().radius();
+        m_terrain_lod->boundSurface(
+            radius * static_cast<float>(tables.min_value/8.0 + 1.0),
+            radius * static_cast<float>(tables.max_value/8.0 + 1.0)
+        );
+    }
+    m_terrain_lod->setGpuGeneration(enabled);
+}
+
+void Application::updateTerrainLod() {
+    // Chunks are selected in model space, like the patch culling.
+    const gfx::ViewProjectionTransform &vp = m_view_projection;
+    Frustum frustum = extractFrustum(vp.projection * vp.view * m_model);
+    glm::vec4 eye4 = glm::inverse(m_model) * vp.view_inv * glm::vec4{0.0f, 0.0f, 0.0f, 1.0f};
+    glm::vec3 eye = glm::vec3{eye4} / eye4.w;
+    float projection_scale = m_window_height / (2.0f * std::tan(FIELD_OF_VIEW / 2.0f));
+
+    m_terrain_lod->update(eye, frustum, projection_scale);
+    m_gfx.uploadTerrainChunks(m_terrain_lod->takeUploads());
+    m_gfx.generateTerrainChunks(m_terrain_lod->takeGenerations());
+    m_gfx.setTerrainChunkDraws(m_terrain_lod->drawSlots());
+    m_gfx.setTerrainChunkShadowCasters(m_terrain_lod->shadowCasters());
+}
+
+void Application::takeTerrainMeshes() {
+    for (const TerrainMesh &mesh : m_terrain_meshes.takeAll()) {
+        const std::unique_ptr<Terrain> &terrain = mesh.terrain;
+        m_gfx.setTerrainGeometry(
+            terrain->refinements(),
+            terrain->vertices(), terrain->elements(), terrain->shortElements(),
+            terrain->patches(), terrain->meshlets(),
+            terrain->minRadius(), terrain->maxRadius()
+        );
+        m_terrain_max_radius = std::max(m_terrain_max_radius, terrain->maxRadius());
+        std::cout << "Terrain level " << terrain->refinements() << " ready" << std::endl;
+        reportVertexCache(std::format("Terrain level {}", terrain->refinements()), mesh.vertex_cache);
+    }
+}
+
+void Application::updateTerrainLevel() {
+    // Altitude above the highest peak, so that no vertex is closer to the
+    // eye than this.
+    float altitude = std::max(m_camera_distance - m_terrain_max_radius, 1e-3f);
+    int desired = TERRAIN_MIN_LEVEL + static_cast<int>(std::floor(std::log2(TERRAIN_COARSE_ALTITUDE / altitude)));
+    desired = std::clamp(desired, TERRAIN_MIN_LEVEL, TERRAIN_MAX_LEVEL);
+
+    // Until it's built, use the nearest level that is.
+    int level = -1;
+    for (int d = 0; d <= TERRAIN_MAX_LEVEL - TERRAIN_MIN_LEVEL && level < 0; ++d) {
+        if (desired - d >= TERRAIN_MIN_LEVEL && m_gfx.hasTerrainLevel(desired - d)) {
+            level = desired - d;
+        } else if (desired + d <= TERRAIN_MAX_LEVEL && m_gfx.hasTerrainLevel(desired + d)) {
+            level = desired + d;
+        }
+    }
+    if (level < 0) {
+        return;
+    }
+    m_gfx.setTerrainLevel(level);
+
+    // Morph to the parent level over the top half of this level's altitude
+    // range, so it matches the coarser mesh exactly where they switch.
+    if (level == TERRAIN_MIN_LEVEL) {
+        m_gfx.setTerrainMorphRange(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+    } else {
+        float coarsen_altitude = TERRAIN_COARSE_ALTITUDE / static_cast<float>(1 << (level - TERRAIN_MIN_LEVEL));
+        m_gfx.setTerrainMorphRange(0.5f * coarsen_altitude, coarsen_altitude);
+    }
+}
+
+void Application::reportVertexCache(const std::string &name, const std::vector<uint32_t> &elements) {
+    reportVertexCache(name, analyzeVertexCache(elements));
+}
+
+void Application::reportVertexCache(const std::string &name, const VertexCacheStats &stats) {
+    std::cout << std::format("{} vertex cache: ACMR {:.3f}, ATVR {:.3f}", name, stats.acmr, stats.atvr) << std::endl;
+}
+
+void Application::reportStats(float elapsed, uint32_t frames) {
+    const gfx::RenderStats &stats = m_gfx.stats();
+    if (m_gfx.terrainChunksEnabled()) {
+        TerrainLodStats lod = m_terrain_lod->stats();
+        std::cout << std::format(
+            "{:.2f} ms/frame ({:.1f} fps), {} shadow cascades drawn, terrain chunks: {} drawn, {} resident of {} ({:.1f} of {:.1f} MiB), "
+            "{} pending, {} loaded, {} generated, {} evicted, {} dropped",
+            1000.0f * elapsed / frames, frames / elapsed, stats.shadow_cascades_drawn,
+            stats.terrain_chunks_drawn, lod.resident, lod.capacity,
+            lod.resident_bytes / 1048576.0, lod.budget_bytes / 1048576.0,
+            lod.pending, lod.loaded, lod.generated, lod.evicted, lod.dropped
+        ) << std::endl;
+    } else {
+        std::cout << std::format(
+            "{:.2f} ms/frame ({:.1f} fps), {} shadow cascades drawn, terrain level {}, {}: {} drawn, {} culled of {}",
+            1000.0f * elapsed / frames, frames / elapsed, stats.shadow_cascades_drawn, m_gfx.terrainLevel(),
+            m_gfx.terrainCullMode() == gfx::CullMode::eMesh ? "meshlets" : "patches",
+            stats.terrain_patches_drawn, stats.terrain_patches_culled, stats.terrain_patches
+        ) << std::endl;
+    }
+    reportPipelineStatistics();
+}
+
+void Application::reportPipelineStatistics() {
+    // Taken even when off, to drop the last frames counted before it was.
+    std::vector<gfx::PassStatistics> passes = m_gfx.takePipelineStatistics();
+    if (!m_gfx.pipelineStatisticsEnabled()) {
+        return;
+    }
+
+    // Millions per frame. Vertices in against vertex shader invocations
+    // shows how well the post-transform cache does, primitives clipped
+    // against those in how many reach the rasterizer, and fragments how
+    // much overdraw there is.
+    for (const gfx::PassStatistics &pass : passes) {
+        auto per_frame = [&pass](uint64_t count) {
+            return count / (1e6 * std::max(pass.frames, 1u));
+        };
+        std::cout << std::format(
+            "  {}{}: {:.3f} M vertices in, {:.3f} M shaded; {:.3f} M primitives in, {:.3f} M clipped, {:.3f} M out; {:.3f} M fragments",
+            pass.name,
+            pass.pass == gfx::DrawPass::eDepthPrepass ? " depth" : pass.pass == gfx::DrawPass::eShadow ? " shadow" : "",
+            per_frame(pass.totals.input_vertices), per_frame(pass.totals.vertex_shader_invocations),
+            per_frame(pass.totals.input_primitives), per_frame(pass.totals.clipping_invocations),
+            per_frame(pass.totals.clipping_primitives), per_frame(pass.totals.fragment_shader_invocations)
+        ) << std::endl;
+    }
+}
+
+void Application::reportMemory() {
+    gfx::MemoryStats stats = m_gfx.memoryStats();
+    constexpr double MIB = 1024.0 * 1024.0;
+    std::cout << std::format(
+        "GPU memory: {} allocations in {} blocks, {:.1f} of {:.1f} MiB used, {} unused ranges (largest {:.1f} MiB){}",
+        stats.allocation_count, stats.block_count, stats.allocation_bytes / MIB, stats.block_bytes / MIB,
+        stats.unused_range_count, stats.unused_range_size_max / MIB,
+        stats.driver_budget ? "" : ", budgets estimated"
+    ) << std::endl;
+    for (size_t i = 0; i < stats.heaps.size(); ++i) {
+        const gfx::MemoryHeapStats &heap = stats.heaps[i];
+        std::cout << std::format(
+            "  heap {}{}: {:.1f} of {:.1f} MiB budget ({:.1f} MiB heap), {} allocations in {} blocks",
+            i, heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal ? " (device local)" : "",
+            heap.usage / MIB, heap.budget / MIB, heap.size / MIB, heap.allocation_count, heap.block_count
+        ) << std::endl;
+    }
+}
+
+void Application::writeMemoryStats() {
+    std::ofstream out{MEMORY_STATS_PATH};
+    out << m_gfx.memoryStatsJson(true);
+    if (!out) {
+        std::cerr << "Couldn't write " << MEMORY_STATS_PATH << std::endl;
+        return;
+    }
+    std::cout << "Wrote " << MEMORY_STATS_PATH << std::endl;
+}
+
 void Application::keypressCallback(GLFWwindow *window, int key, int scancode, int action, int mods) {
     Application *app = (Application*)glfwGetWindowUserPointer(window);
     if (app != nullptr) {
@@ -98,6 +463,50 @@ void Application::keypressCallback(GLFWwindow *window, int key, int scancode, in
 void Application::handleKeypress(GLFWwindow *window, int key, int scancode, int action, int mods) {
     if (key == GLFW_KEY_ESCAPE) {
         glfwSetWindowShouldClose(m_window, GLFW_TRUE);
+    } else if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+        // On to the next mode the device can do; eNone always can.
+        const int num_modes = static_cast<int>(gfx::CullMode::eMesh) + 1;
+        int mode = static_cast<int>(m_gfx.terrainCullMode());
+        do {
+            mode = (mode + 1) % num_modes;
+        } while (!m_gfx.terrainCullModeSupported(static_cast<gfx::CullMode>(mode)));
+        m_gfx.setTerrainCullMode(static_cast<gfx::CullMode>(mode));
+        const char *names[] = { "none", "cpu", "gpu", "mesh" };
+        std::cout << "Terrain culling: " << names[static_cast<int>(m_gfx.terrainCullMode())] << std::endl;
+    } else if (key == GLFW_KEY_L && action == GLFW_PRESS) {
+        m_gfx.setTerrainChunksEnabled(!m_gfx.terrainChunksEnabled());
+        std::cout << "Terrain: " << (m_gfx.terrainChunksEnabled() ? "chunked LOD" : "single mesh") << std::endl;
+    } else if (key == GLFW_KEY_Z && action == GLFW_PRESS) {
+        // Takes effect with the next frame's view projection transform.
+        m_gfx.setReverseDepth(!m_gfx.reverseDepth());
+        updateProjection();
+        std::cout << "Depth: " << (m_gfx.reverseDepth() ? "reversed, infinite far plane" : "standard") << std::endl;
+    } else if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+        m_gfx.setDepthPrepass(!m_gfx.depthPrepass());
+        std::cout << "Terrain depth prepass: " << (m_gfx.depthPrepass() ? "on" : "off") << std::endl;
+    } else if (key == GLFW_KEY_Q && action == GLFW_PRESS) {
+        if (!m_gfx.capabilities().pipeline_statistics) {
+            std::cout << "Pipeline statistics: not supported" << std::endl;
+        } else {
+            m_gfx.setPipelineStatisticsEnabled(!m_gfx.pipelineStatisticsEnabled());
+            std::cout << "Pipeline statistics: " << (m_gfx.pipelineStatisticsEnabled() ? "on" : "off") << std::endl;
+        }
+    } else if (key == GLFW_KEY_A && action == GLFW_PRESS) {
+        m_gfx.setAtmosphereEnabled(!m_gfx.atmosphereEnabled());
+        std::cout << "Atmosphere: " << (m_gfx.atmosphereEnabled() ? "on" : "off") << std::endl;
+    } else if (key == GLFW_KEY_H && action == GLFW_PRESS) {
+        m_gfx.setShadowsEnabled(!m_gfx.shadowsEnabled());
+        std::cout << "Shadows: " << (m_gfx.shadowsEnabled() ? "on" : "off") << std::endl;
+    } else if (key == GLFW_KEY_G && action == GLFW_PRESS) {
+        if (m_terrain_gpu_generation_checked) {
+            setTerrainGpuGeneration(!m_terrain_lod->gpuGeneration());
+        }
+        std::cout << "Terrain chunk generation: " << (m_terrain_lod->gpuGeneration() ? "gpu" : "cpu") << std::endl;
+    } else if (key == GLFW_KEY_M && action == GLFW_PRESS) {
+        reportMemory();
+        writeMemoryStats();
+    } else if ((key == GLFW_KEY_W || key == GLFW_KEY_S) && action != GLFW_RELEASE) {
+        // Held keys are polled in updateCamera().
     } else {
         const char *key_name = glfwGetKeyName(key, scancode);
         if (key_name == nullptr) {
@@ -3,9 +3,22 @@
 #ifndef _VPLANET_APPLICATION_H_
 #define _VPLANET_APPLICATION_H_
 
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "glm.h"
 #include "vulkan.h"
 
 #include "gfx/System.h"
+#include "gfx/Uniforms.h"
+#include "CompletionQueue.h"
+#include "Curve.h"
+#include "Noise.h"
+#include "Ocean.h"
+#include "Terrain.h"
+#include "TerrainLod.h"
+#include "ThreadPool.h"
 
 class Application {
 public:
@@ -17,9 +30,99 @@ public:
     void handleKeypress(GLFWwindow *window, int key, int scancode, int action, int mods);
 
 private:
+    static constexpr float REPORT_INTERVAL_SECONDS = 5.0f;
+    static constexpr float MEMORY_REPORT_INTERVAL_SECONDS = 30.0f;
+    static constexpr const char *MEMORY_STATS_PATH = "memory-stats.json";
+    static constexpr float FIELD_OF_VIEW = 20.0f;
+    static constexpr float MIN_CAMERA_DISTANCE = 2.4f;
+    static constexpr float MAX_CAMERA_DISTANCE = 20.0f;
+
+    // Clip planes for the standard depth range. Reversed float depth keeps
+    // its precision all the way out, so it has no far plane and can bring
+    // the near plane right down to the ground.
+    static constexpr float NEAR_PLANE = 0.1f;
+    static constexpr float FAR_PLANE = 100.0f;
+    static constexpr float REVERSE_DEPTH_NEAR_PLANE = 0.001f;
+
+    // GPU memory for LOD terrain chunks; about 4000 at the default
+    // resolution. Smaller devices get a share of what they have free.
+    static constexpr uint64_t TERRAIN_CHUNK_BUDGET = 40ull << 20;
+    static constexpr uint64_t TERRAIN_CHUNK_HEADROOM_SHARE = 4;
+
+    // Mesh refinement levels kept resident. The coarsest is used from
+    // TERRAIN_COARSE_ALTITUDE up, and each finer level below half the
+    // altitude of the one before.
+    static constexpr int TERRAIN_MIN_LEVEL = 4;
+    static constexpr int TERRAIN_MAX_LEVEL = 7;
+    static constexpr float TERRAIN_COARSE_ALTITUDE = 4.0f;
+
+    // Icospheres are drawn with 16-bit indices, in batches of up to 65535
+    // vertices once they outgrow one.
+    static constexpr IndexWidth ICOSPHERE_INDEX_WIDTH = IndexWidth::e16;
+
+    // The terrain is the same from run to run, so the generated meshes are
+    // cached in here, relative to the working directory.
+    static constexpr uint32_t NOISE_SEED = 1;
+    static constexpr const char *MESH_CACHE_DIRECTORY = "mesh-cache";
+
+    // LOD terrain chunks are streamed from here if vplanet_bake has baked
+    // the same planet into it, and generated otherwise.
+    static constexpr const char *TERRAIN_TILE_DIRECTORY = "terrain-tiles";
+
+    // Lights scattered over the land, binned into clusters between the
+    // nearest the camera gets to the ground and the far side of the planet.
+    static constexpr uint32_t CITY_LIGHT_COUNT = 3000;
+    static constexpr float CITY_LIGHT_RADIUS = 0.05f;
+    static constexpr float OCEAN_RADIUS = 1.97f;
+    static constexpr float LIGHT_CLUSTER_NEAR = 0.05f;
+    static constexpr float LIGHT_CLUSTER_FAR = MAX_CAMERA_DISTANCE + 2.0f;
+
+    // The air reaches from the sea up to the nearest the camera gets.
+    static constexpr float ATMOSPHERE_TOP_RADIUS = MIN_CAMERA_DISTANCE;
+
+    // A terrain level loaded or built in the background, with its vertex
+    // cache behaviour measured there too, since that walks every element.
+    struct TerrainMesh {
+        std::unique_ptr<Terrain> terrain;
+        VertexCacheStats vertex_cache;
+    };
+
+    TerrainMesh loadOrBuildTerrain(int level) const;
+    std::unique_ptr<Ocean> loadOrBuildOcean(float radius, int level) const;
+    std::vector<gfx::PointLight> placeCityLights() const;
+    void updateProjection();
+    void updateCamera(float elapsed);
+    bool checkTerrainGeneration();
+    void setTerrainGpuGeneration(bool enabled);
+    void updateTerrainLod();
+    void takeTerrainMeshes();
+    void updateTerrainLevel();
+    void reportStats(float elapsed, uint32_t frames);
+    void reportPipelineStatistics();
+    void reportMemory();
+    void writeMemoryStats();
+    void reportVertexCache(const std::string &name, const std::vector<uint32_t> &elements);
+    void reportVertexCache(const std::string &name, const VertexCacheStats &stats);
+
     GLFWwindow *m_window;
     int m_window_width, m_window_height;
     gfx::System m_gfx;
+
+    // Terrain is generated in the background while the app runs, so the
+    // noise has to live as long as the application.
+    TerrainNoise m_noise;
+    CompletionQueue<TerrainMesh> m_terrain_meshes;
+    std::unique_ptr<TerrainLod> m_terrain_lod;
+    bool m_terrain_gpu_generation_checked;
+
+    // Declared after everything the jobs use, so it is destroyed (and has
+    // finished every job) first.
+    ThreadPool m_threads;
+
+    float m_camera_distance;
+    float m_terrain_max_radius;
+    glm::mat4x4 m_model;
+    gfx::ViewProjectionTransform m_view_projection;
 };
 
 #endif
@@ -0,0 +1,60 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#ifndef _VPLANET_COMPLETION_QUEUE_H_
+#define _VPLANET_COMPLETION_QUEUE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <utility>
+#include <vector>
+
+// Lock-free hand-off of results from any number of producer threads to a
+// single consumer. Producers push onto an intrusive stack with a CAS; the
+// consumer swaps out the whole stack at once and gets the results back in
+// the order they were pushed.
+template <typename T>
+class CompletionQueue {
+public:
+    CompletionQueue() : m_head{nullptr} {}
+    CompletionQueue(const CompletionQueue &other) = delete;
+
+    ~CompletionQueue() {
+        Node *node = m_head.exchange(nullptr, std::memory_order_acquire);
+        while (node != nullptr) {
+            Node *next = node->next;
+            delete node;
+            node = next;
+        }
+    }
+
+    CompletionQueue &operator=(const CompletionQueue &other) = delete;
+
+    void push(T value) {
+        Node *node = new Node{std::move(value), m_head.load(std::memory_order_relaxed)};
+        while (!m_head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed)) {}
+    }
+
+    // Only call from the consumer thread.
+    std::vector<T> takeAll() {
+        std::vector<T> values;
+        Node *node = m_head.exchange(nullptr, std::memory_order_acquire);
+        while (node != nullptr) {
+            values.push_back(std::move(node->value));
+            Node *next = node->next;
+            delete node;
+            node = next;
+        }
+        std::reverse(values.begin(), values.end());
+        return values;
+    }
+
+private:
+    struct Node {
+        T value;
+        Node *next;
+    };
+
+    std::atomic<Node*> m_head;
+};
+
+#endif
@@ -0,0 +1,68 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#include "glm.h"
+
+#include "Culling.h"
+
+Frustum extractFrustum(const glm::mat4x4 &m) {
+    // Gribb / Hartmann plane extraction, for a 0..1 clip space depth range
+    // (see GLM_FORCE_DEPTH_ZERO_TO_ONE in glm.h). With reversed depth the
+    // near and far planes trade places, and an infinite far plane comes out
+    // as (0, 0, 0, near), which nothing is outside of.
+    glm::vec4 row0{m[0][0], m[1][0], m[2][0], m[3][0]};
+    glm::vec4 row1{m[0][1], m[1][1], m[2][1], m[3][1]};
+    glm::vec4 row2{m[0][2], m[1][2], m[2][2], m[3][2]};
+    glm::vec4 row3{m[0][3], m[1][3], m[2][3], m[3][3]};
+
+    Frustum rv{{
+        row3 + row0, // left
+        row3 - row0, // right
+        row3 + row1, // bottom
+        row3 - row1, // top
+        row2,        // near
+        row3 - row2, // far
+    }};
+
+    for (glm::vec4 &plane : rv.planes) {
+        float len = glm::length(glm::vec3{plane.x, plane.y, plane.z});
+        if (len > 0.0f) {
+            plane /= len;
+        }
+    }
+
+    return rv;
+}
+
+bool sphereInFrustum(const Frustum &frustum, const glm::vec3 &center, float radius) {
+    for (const glm::vec4 &plane : frustum.planes) {
+        if (glm::dot(glm::vec3{plane.x, plane.y, plane.z}, center) + plane.w < -radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool sphereBelowHorizon(const glm::vec3 &eye, float occluder_radius, float max_radius, const glm::vec3 &center, float radius) {
+    float eye_dist = glm::length(eye);
+    float center_dist = glm::length(center);
+    if (occluder_radius <= 0.0f || eye_dist <= occluder_radius || center_dist <= radius) {
+        return false;
+    }
+
+    // A point at height h above the center can be seen from the eye if the
+    // angle between them is less than the sum of the angles from each of
+    // them to their horizon tangent points on the occluder.
+    float theta = std::acos(std::clamp(glm::dot(center, eye) / (center_dist * eye_dist), -1.0f, 1.0f));
+    float spread = std::asin(radius / center_dist);
+    float horizon = std::acos(occluder_radius / eye_dist) + std::acos(std::min(occluder_radius / max_radius, 1.0f));
+    return theta - spread > horizon;
+}
+
+bool coneBackFacing(const glm::vec3 &eye, const glm::vec3 &center, float radius, const glm::vec3 &cone_axis, float cone_cutoff) {
+    glm::vec3 view = center - eye;
+    return glm::dot(view, cone_axis) >= cone_cutoff * glm::length(view) + radius;
+}
@@ -0,0 +1,30 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#ifndef _VPLANET_CULLING_H_
+#define _VPLANET_CULLING_H_
+
+#include <array>
+
+#include "glm.h"
+
+// Frustum planes as (normal, distance), with normals pointing into the
+// frustum and normalized so that dot(plane.xyz, p) + plane.w is a signed
+// distance.
+struct Frustum {
+    std::array<glm::vec4, 6> planes;
+};
+
+Frustum extractFrustum(const glm::mat4x4 &view_projection);
+
+bool sphereInFrustum(const Frustum &frustum, const glm::vec3 &center, float radius);
+
+// True if a sphere lies entirely past the horizon of a planet whose surface
+// is at least occluder_radius from the origin and at most max_radius.
+bool sphereBelowHorizon(const glm::vec3 &eye, float occluder_radius, float max_radius, const glm::vec3 &center, float radius);
+
+// True if every triangle inside the sphere faces away from the eye, given a
+// cone containing all their normals. cone_cutoff is the sine of the cone's
+// half angle.
+bool coneBackFacing(const glm::vec3 &eye, const glm::vec3 &center, float radius, const glm::vec3 &cone_axis, float cone_cutoff);
+
+#endif
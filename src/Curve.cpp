@@ -13,6 +13,21 @@ CubicSpline::CubicSpline()
 
 CubicSpline::~CubicSpline() {}
 
+void CubicSpline::fingerprint(Fingerprint &fp) const {
+    fp.add(m_cps.size());
+    for (const auto &cp : m_cps) {
+        fp.add(cp.first).add(cp.second);
+    }
+}
+
+const std::vector<std::pair<double, double> > &CubicSpline::controlPoints() const {
+    return m_cps;
+}
+
+const std::vector<double> &CubicSpline::coefficients() const {
+    return m_coeffs;
+}
+
 CubicSpline& CubicSpline::addControlPoint(double x, double y) {
     double epsilon = std::numeric_limits<double>::epsilon();
     for (auto cp : m_cps) {
@@ -5,6 +5,8 @@
 
 #include <vector>
 
+#include "Fingerprint.h"
+
 class CubicSpline {
 public:
     CubicSpline();
@@ -14,6 +16,13 @@ public:
 
     double operator()(double x) const;
 
+    // The control points in order of x, and the spline's second derivative
+    // at each of them, which are all it takes to evaluate it elsewhere.
+    const std::vector<std::pair<double, double> > &controlPoints() const;
+    const std::vector<double> &coefficients() const;
+
+    void fingerprint(Fingerprint &fp) const;
+
 private:
     void generateCoeffs();
 
@@ -0,0 +1,45 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+
+#ifndef _VPLANET_FINGERPRINT_H_
+#define _VPLANET_FINGERPRINT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <type_traits>
+
+// 64-bit FNV-1a over everything that goes into generating something, so
+// that what was generated can be cached and found again. Good enough to
+// tell parameter sets apart; not meant to stand up to anyone trying.
+class Fingerprint {
+public:
+    Fingerprint()
+        : m_hash{OFFSET_BASIS}
+    {}
+
+    Fingerprint &addBytes(std::span<const std::byte> bytes) {
+        for (std::byte b : bytes) {
+            m_hash ^= static_cast<uint64_t>(b);
+            m_hash *= PRIME;
+        }
+        return *this;
+    }
+
+    template <typename T>
+    Fingerprint &add(const T &value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        return addBytes(std::as_bytes(std::span<const T, 1>{&value, 1}));
+    }
+
+    uint64_t value() const {
+        return m_hash;
+    }
+
+private:
+    static constexpr uint64_t OFFSET_BASIS = 14695981039346656037ull;
+    static constexpr uint64_t PRIME = 1099511628211ull;
+
+    uint64_t m_hash;
+};
+
+#endif
@@ -0,0 +1,235 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <optional>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "MeshCache.h"
+
+namespace {
+    const char MAGIC[8] = { 'V', 'P', 'L', 'M', 'E', 'S', 'H', '\0' };
+
+    struct FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t num_sections;
+        uint64_t key;
+    };
+
+    uint64_t alignUp(uint64_t offset) {
+        return (offset + MESH_CACHE_ALIGNMENT - 1) / MESH_CACHE_ALIGNMENT * MESH_CACHE_ALIGNMENT;
+    }
+}
+
+std::shared_ptr<const MappedFile> MappedFile::open(const std::filesystem::path &path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    // The mapping holds its own reference to the file.
+    size_t size = static_cast<size_t>(st.st_size);
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+
+    return std::shared_ptr<const MappedFile>(new MappedFile(data, size, FileAccess::eMap));
+}
+
+std::shared_ptr<const MappedFile> MappedFile::read(const std::filesystem::path &path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    // Aligned like the sections in the file, so they can be used in place.
+    size_t size = static_cast<size_t>(st.st_size);
+    std::byte *data = static_cast<std::byte *>(::operator new[](size, std::align_val_t{MESH_CACHE_ALIGNMENT}));
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, data + done, size - done, static_cast<off_t>(done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += static_cast<size_t>(n);
+    }
+    ::close(fd);
+    if (done < size) {
+        ::operator delete[](data, std::align_val_t{MESH_CACHE_ALIGNMENT});
+        return nullptr;
+    }
+
+    return std::shared_ptr<const MappedFile>(new MappedFile(data, size, FileAccess::eRead));
+}
+
+MappedFile::MappedFile(const void *data, size_t size, FileAccess access)
+    : m_data{data},
+      m_size{size},
+      m_access{access}
+{}
+
+MappedFile::~MappedFile() {
+    if (m_access == FileAccess::eMap) {
+        munmap(const_cast<void *>(m_data), m_size);
+    } else {
+        ::operator delete[](const_cast<void *>(m_data), std::align_val_t{MESH_CACHE_ALIGNMENT});
+    }
+}
+
+std::span<const std::byte> MappedFile::bytes() const {
+    return { static_cast<const std::byte *>(m_data), m_size };
+}
+
+std::optional<MeshCacheReader> MeshCacheReader::open(
+    const std::filesystem::path &path,
+    uint64_t key,
+    FileAccess access
+) {
+    std::shared_ptr<const MappedFile> file = access == FileAccess::eMap ? MappedFile::open(path) : MappedFile::read(path);
+    if (!file) {
+        return std::nullopt;
+    }
+
+    std::span<const std::byte> bytes = file->bytes();
+    if (bytes.size() < sizeof(FileHeader)) {
+        std::cerr << "Ignoring truncated mesh cache " << path << "\n";
+        return std::nullopt;
+    }
+
+    // Mappings are page aligned and reads MESH_CACHE_ALIGNMENT aligned, so
+    // the header and section table are aligned too.
+    const FileHeader *header = reinterpret_cast<const FileHeader *>(bytes.data());
+    if (std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0) {
+        std::cerr << "Ignoring mesh cache " << path << " with the wrong magic number\n";
+        return std::nullopt;
+    }
+    if (header->version != MESH_CACHE_VERSION || header->key != key) {
+        return std::nullopt;
+    }
+
+    uint64_t table_end = sizeof(FileHeader) + static_cast<uint64_t>(header->num_sections) * sizeof(MeshCacheSection);
+    if (table_end > bytes.size()) {
+        std::cerr << "Ignoring truncated mesh cache " << path << "\n";
+        return std::nullopt;
+    }
+
+    std::span<const MeshCacheSection> sections{
+        reinterpret_cast<const MeshCacheSection *>(bytes.data() + sizeof(FileHeader)), header->num_sections
+    };
+    for (const MeshCacheSection &section : sections) {
+        bool in_bounds = section.element_size > 0 &&
+            section.offset % MESH_CACHE_ALIGNMENT == 0 &&
+            section.offset <= bytes.size() &&
+            section.count <= (bytes.size() - section.offset) / section.element_size;
+        if (!in_bounds) {
+            std::cerr << "Ignoring mesh cache " << path << " with a section out of bounds\n";
+            return std::nullopt;
+        }
+    }
+
+    return MeshCacheReader{std::move(file), sections};
+}
+
+MeshCacheReader::MeshCacheReader(std::shared_ptr<const MappedFile> file, std::span<const MeshCacheSection> sections)
+    : m_file{std::move(file)},
+      m_sections{sections}
+{}
+
+const std::shared_ptr<const MappedFile> &MeshCacheReader::file() const {
+    return m_file;
+}
+
+std::optional<std::span<const std::byte>> MeshCacheReader::rawSection(uint32_t id, size_t element_size) const {
+    for (const MeshCacheSection &section : m_sections) {
+        if (section.id == id) {
+            if (section.element_size != element_size) {
+                return std::nullopt;
+            }
+            return m_file->bytes().subspan(section.offset, section.count * section.element_size);
+        }
+    }
+    return std::nullopt;
+}
+
+MeshCacheWriter::MeshCacheWriter(uint64_t key)
+    : m_key{key},
+      m_sections{}
+{}
+
+void MeshCacheWriter::write(const std::filesystem::path &path) const {
+    FileHeader header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = MESH_CACHE_VERSION;
+    header.num_sections = static_cast<uint32_t>(m_sections.size());
+    header.key = m_key;
+
+    std::vector<MeshCacheSection> entries;
+    uint64_t offset = alignUp(sizeof(FileHeader) + m_sections.size() * sizeof(MeshCacheSection));
+    for (const PendingSection &section : m_sections) {
+        entries.push_back({ section.id, section.element_size, offset, section.data.size() / section.element_size });
+        offset = alignUp(offset + section.data.size());
+    }
+
+    // Named uniquely, since other processes, possibly on other machines,
+    // may be writing the same file into a shared directory.
+    std::filesystem::create_directories(path.parent_path());
+    std::random_device random;
+    std::filesystem::path tmp_path = path;
+    tmp_path += std::format(".{:08x}{:08x}.tmp", random(), random());
+    {
+        std::ofstream out{tmp_path, std::ios::binary | std::ios::trunc};
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(MeshCacheSection));
+
+        const char padding[MESH_CACHE_ALIGNMENT] = {};
+        uint64_t written = sizeof(header) + entries.size() * sizeof(MeshCacheSection);
+        for (size_t i = 0; i < m_sections.size(); ++i) {
+            out.write(padding, entries[i].offset - written);
+            out.write(reinterpret_cast<const char *>(m_sections[i].data.data()), m_sections[i].data.size());
+            written = entries[i].offset + m_sections[i].data.size();
+        }
+
+        out.flush();
+        if (!out) {
+            out.close();
+            std::error_code ec;
+            std::filesystem::remove(tmp_path, ec);
+            throw std::runtime_error("Error writing mesh cache " + tmp_path.string());
+        }
+    }
+    std::filesystem::rename(tmp_path, path);
+}
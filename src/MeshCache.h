@@ -0,0 +1,144 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+
+#ifndef _VPLANET_MESH_CACHE_H_
+#define _VPLANET_MESH_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+
+// Generated meshes are saved in a simple binary format: a header, a table
+// of sections, and each section's data aligned to MESH_CACHE_ALIGNMENT. A
+// loaded file is mapped read-only and its sections used where they lie, so
+// there's nothing to parse. Files carry a key fingerprinting everything
+// that went into the mesh; one with the wrong version, key or layout is
+// treated as missing. Bump the version whenever a cached type changes, or
+// the icosphere elements that cached vertices are ordered for.
+const uint32_t MESH_CACHE_VERSION = 2;
+const size_t MESH_CACHE_ALIGNMENT = 16;
+
+// An entry of a file's section table. Offsets are from the start of the
+// file.
+struct MeshCacheSection {
+    uint32_t id;
+    uint32_t element_size;
+    uint64_t offset;
+    uint64_t count;
+};
+
+// How a file is brought into memory. Mapping suits big files whose data is
+// used where it lies. Reading suits small files that are copied out and
+// dropped, which would otherwise pay to set up and tear down a mapping
+// each.
+enum class FileAccess {
+    eMap,
+    eRead,
+};
+
+// A whole file mapped read-only, or read into an aligned buffer.
+class MappedFile {
+public:
+    // Null if the file can't be opened or mapped.
+    static std::shared_ptr<const MappedFile> open(const std::filesystem::path &path);
+    // Null if the file can't be opened or read.
+    static std::shared_ptr<const MappedFile> read(const std::filesystem::path &path);
+
+    MappedFile(const MappedFile &other) = delete;
+    ~MappedFile();
+
+    MappedFile &operator=(const MappedFile &other) = delete;
+
+    std::span<const std::byte> bytes() const;
+
+private:
+    MappedFile(const void *data, size_t size, FileAccess access);
+
+    const void *m_data;
+    size_t m_size;
+    FileAccess m_access;
+};
+
+class MeshCacheReader {
+public:
+    // Nothing if the file is missing, from another version, or for another
+    // key. A file that's there but malformed is reported and ignored.
+    static std::optional<MeshCacheReader> open(
+        const std::filesystem::path &path,
+        uint64_t key,
+        FileAccess access = FileAccess::eMap
+    );
+
+    // Nothing if there's no such section, or its elements aren't T-sized.
+    // The span stays valid as long as file() does.
+    template <typename T>
+    std::optional<std::span<const T>> section(uint32_t id) const {
+        std::optional<std::span<const std::byte>> bytes = rawSection(id, sizeof(T));
+        if (!bytes) {
+            return std::nullopt;
+        }
+        return std::span<const T>{reinterpret_cast<const T *>(bytes->data()), bytes->size() / sizeof(T)};
+    }
+
+    // As section(), copied out into a vector.
+    template <typename T>
+    std::optional<std::vector<T>> copySection(uint32_t id) const {
+        std::optional<std::span<const T>> data = section<T>(id);
+        if (!data) {
+            return std::nullopt;
+        }
+        return std::vector<T>(data->begin(), data->end());
+    }
+
+    const std::shared_ptr<const MappedFile> &file() const;
+
+private:
+    MeshCacheReader(std::shared_ptr<const MappedFile> file, std::span<const MeshCacheSection> sections);
+
+    std::optional<std::span<const std::byte>> rawSection(uint32_t id, size_t element_size) const;
+
+    std::shared_ptr<const MappedFile> m_file;
+    std::span<const MeshCacheSection> m_sections;
+};
+
+class MeshCacheWriter {
+public:
+    explicit MeshCacheWriter(uint64_t key);
+
+    // The data isn't copied, so it has to outlive write().
+    template <typename T>
+    MeshCacheWriter &addSection(uint32_t id, std::span<const T> data) {
+        m_sections.push_back({ id, sizeof(T), std::as_bytes(data) });
+        return *this;
+    }
+
+    template <typename T>
+    MeshCacheWriter &addSection(uint32_t id, const std::vector<T> &data) {
+        return addSection(id, std::span<const T>{data});
+    }
+
+    // Written beside the destination and renamed into place, so a reader
+    // never sees half a file. Throws std::runtime_error if it can't be.
+    void write(const std::filesystem::path &path) const;
+
+private:
+    struct PendingSection {
+        uint32_t id;
+        uint32_t element_size;
+        std::span<const std::byte> data;
+    };
+
+    uint64_t m_key;
+    std::vector<PendingSection> m_sections;
+};
+
+// Element lists aren't cached: every mesh of a refinement level shares the
+// one from icosphereElements(), so files hold their vertices in its order.
+// Each kind of file numbers its sections from here.
+const uint32_t MESH_CACHE_FIRST_USER_SECTION = 16;
+
+#endif
@@ -1,8 +1,14 @@
 // -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
 
 #include <algorithm>
+#include <cassert>
 #include <cmath>
+#include <deque>
+#include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -25,11 +31,18 @@ std::pair<unsigned int, unsigned int> edgeKey(unsigned int e1, unsigned int e2)
     return std::pair<unsigned int, unsigned int>{std::min(e1, e2), std::max(e1, e2)};
 }
 
-PositionsAndElements refine(const PositionsAndElements &old_vertices) {
+PositionsAndElements refine(const PositionsAndElements &old_vertices, std::vector<VertexParents> *parents = nullptr) {
     PositionsAndElements new_vertices;
     std::map<std::pair<unsigned int, unsigned int>, unsigned int> edge_map;
     new_vertices.positions = old_vertices.positions;
 
+    if (parents != nullptr) {
+        parents->clear();
+        for (unsigned int i = 0; i < old_vertices.positions.size(); ++i) {
+            parents->push_back({ i, i });
+        }
+    }
+
     for (unsigned int i = 0; i < old_vertices.elements.size(); i += 3) {
         unsigned int
             e1 = old_vertices.elements[i+0],
@@ -45,18 +58,27 @@ PositionsAndElements refine(const PositionsAndElements &old_vertices) {
         if (e12 == edge_map.end()) {
             e12 = edge_map.insert({ edgeKey(e1, e2), static_cast<unsigned int>(new_vertices.positions.size()) }).first;
             new_vertices.positions.push_back((p1 + p2) * 0.5f);
+            if (parents != nullptr) {
+                parents->push_back({ e1, e2 });
+            }
         }
 
         auto e23 = edge_map.find(edgeKey(e2, e3));
         if (e23 == edge_map.end()) {
             e23 = edge_map.insert({ edgeKey(e2, e3), static_cast<unsigned int>(new_vertices.positions.size()) }).first;
             new_vertices.positions.push_back((p2 + p3) * 0.5f);
+            if (parents != nullptr) {
+                parents->push_back({ e2, e3 });
+            }
         }
 
         auto e13 = edge_map.find(edgeKey(e1, e3));
         if (e13 == edge_map.end()) {
             e13 = edge_map.insert({ edgeKey(e1, e3), static_cast<unsigned int>(new_vertices.positions.size()) }).first;
             new_vertices.positions.push_back((p1 + p3) * 0.5f);
+            if (parents != nullptr) {
+                parents->push_back({ e1, e3 });
+            }
         }
 
         new_vertices.elements.push_back(e1);
@@ -80,17 +102,521 @@ PositionsAndElements refine(const PositionsAndElements &old_vertices) {
 }
 
 
+namespace {
+    // Vertex and triangle order for an icosphere, shared by every sphere of
+    // the same level. vertex_order gives the refine() index of each vertex.
+    struct IcosphereLayout {
+        std::vector<unsigned int> elements;
+        std::vector<unsigned int> vertex_order;
+    };
+
+    std::shared_ptr<const IcosphereLayout> icosphereLayout(int refinements) {
+        static std::mutex cache_mutex;
+        static std::map<int, std::shared_ptr<const IcosphereLayout>> cache;
+
+        {
+            std::lock_guard<std::mutex> lock{cache_mutex};
+            auto it = cache.find(refinements);
+            if (it != cache.end()) {
+                return it->second;
+            }
+        }
+
+        // Build outside the lock so other levels aren't held up. If two
+        // threads race on the same level, the first to finish wins.
+        PositionsAndElements pne = icosahedron();
+        for (int i = 0; i < refinements; ++i) {
+            pne = refine(pne);
+        }
+        auto layout = std::make_shared<IcosphereLayout>();
+        layout->elements = std::move(pne.elements);
+        optimizeVertexCache(layout->elements, icospherePatches(refinements, ICOSPHERE_MAX_PATCH_REFINEMENTS));
+        layout->vertex_order = optimizeVertexFetch(layout->elements, static_cast<unsigned int>(pne.positions.size()));
+
+        std::lock_guard<std::mutex> lock{cache_mutex};
+        return cache.try_emplace(refinements, std::move(layout)).first->second;
+    }
+
+    // Put the vertices of a freshly refined icosphere in the layout's order.
+    PositionsAndElements applyLayout(const PositionsAndElements &pne, const IcosphereLayout &layout, float radius) {
+        PositionsAndElements rv;
+        rv.elements = layout.elements;
+        rv.positions.reserve(pne.positions.size());
+        for (unsigned int old_index : layout.vertex_order) {
+            rv.positions.push_back(glm::normalize(pne.positions[old_index]) * radius);
+        }
+        return rv;
+    }
+}
+
 PositionsAndElements icosphere(float radius, int refinements) {
     PositionsAndElements rv = icosahedron();
     for (int i = 0; i < refinements; ++i) {
         rv = refine(rv);
     }
-    for (auto &pos : rv.positions) {
-        pos = glm::normalize(pos) * radius;
+    return applyLayout(rv, *icosphereLayout(refinements), radius);
+}
+
+PositionsAndElements icosphere(float radius, int refinements, std::vector<VertexParents> &parents) {
+    PositionsAndElements rv = icosahedron();
+    std::vector<VertexParents> refined_parents;
+    for (unsigned int i = 0; i < rv.positions.size(); ++i) {
+        refined_parents.push_back({ i, i });
+    }
+    for (int i = 0; i < refinements; ++i) {
+        rv = refine(rv, i + 1 == refinements ? &refined_parents : nullptr);
+    }
+
+    std::shared_ptr<const IcosphereLayout> layout = icosphereLayout(refinements);
+    std::vector<unsigned int> new_index(layout->vertex_order.size());
+    for (unsigned int i = 0; i < layout->vertex_order.size(); ++i) {
+        new_index[layout->vertex_order[i]] = i;
+    }
+    parents.clear();
+    parents.reserve(layout->vertex_order.size());
+    for (unsigned int old_index : layout->vertex_order) {
+        const VertexParents &parent = refined_parents[old_index];
+        parents.push_back({ new_index[parent.first], new_index[parent.second] });
+    }
+    return applyLayout(rv, *layout, radius);
+}
+
+std::vector<PatchRange> icospherePatches(int refinements, int patch_refinements) {
+    // refine() replaces each triangle with its four children in place, so
+    // every triangle of the level-n sphere which descends from a given
+    // level-p triangle lives in one contiguous block of 4^(n-p) triangles.
+    // The cache optimization only shuffles triangles within blocks of
+    // ICOSPHERE_MAX_PATCH_REFINEMENTS.
+    patch_refinements = std::clamp(patch_refinements, 0, std::min(refinements, ICOSPHERE_MAX_PATCH_REFINEMENTS));
+    unsigned int num_patches = (ICOSAHEDRON_ELEM_COUNT / 3) << (2 * patch_refinements);
+    unsigned int patch_elements = 3u << (2 * (refinements - patch_refinements));
+
+    std::vector<PatchRange> rv;
+    rv.reserve(num_patches);
+    for (unsigned int i = 0; i < num_patches; ++i) {
+        rv.push_back({ i * patch_elements, patch_elements });
     }
     return rv;
 }
 
+std::shared_ptr<const std::vector<unsigned int>> icosphereElements(int refinements) {
+    std::shared_ptr<const IcosphereLayout> layout = icosphereLayout(refinements);
+    return std::shared_ptr<const std::vector<unsigned int>>(layout, &layout->elements);
+}
+
+std::shared_ptr<const ShortElements> icosphereShortElements(int refinements) {
+    static std::mutex cache_mutex;
+    static std::map<int, std::shared_ptr<const ShortElements>> cache;
+
+    {
+        std::lock_guard<std::mutex> lock{cache_mutex};
+        auto it = cache.find(refinements);
+        if (it != cache.end()) {
+            return it->second;
+        }
+    }
+
+    std::shared_ptr<const IcosphereLayout> layout = icosphereLayout(refinements);
+    auto narrowed = std::make_shared<const ShortElements>(
+        narrowElements(layout->elements, icospherePatches(refinements, ICOSPHERE_MAX_PATCH_REFINEMENTS))
+    );
+
+    std::lock_guard<std::mutex> lock{cache_mutex};
+    return cache.try_emplace(refinements, std::move(narrowed)).first->second;
+}
+
+void icosphereElements(
+    int refinements,
+    IndexWidth index_width,
+    std::shared_ptr<const std::vector<unsigned int>> &elements,
+    std::shared_ptr<const ShortElements> &short_elements
+) {
+    if (index_width == IndexWidth::e16) {
+        short_elements = icosphereShortElements(refinements);
+        elements = std::shared_ptr<const std::vector<unsigned int>>(short_elements, &short_elements->wide_elements);
+    } else {
+        short_elements.reset();
+        elements = icosphereElements(refinements);
+    }
+}
+
+namespace {
+    const unsigned int FORSYTH_CACHE_SIZE = 32;
+
+    float forsythVertexScore(int cache_position, unsigned int remaining_triangles) {
+        if (remaining_triangles == 0) {
+            return -1.0f;
+        }
+
+        // The last triangle's vertices get a fixed score, so that the next
+        // triangle doesn't just reuse its edge and stripify.
+        float score = 0.0f;
+        if (cache_position >= 0) {
+            if (cache_position < 3) {
+                score = 0.75f;
+            } else {
+                float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+                score = std::pow(1.0f - (cache_position - 3) * scaler, 1.5f);
+            }
+        }
+
+        // Favour vertices with few triangles left, to finish them off
+        // rather than leaving lone triangles behind.
+        score += 2.0f / std::sqrt(static_cast<float>(remaining_triangles));
+        return score;
+    }
+
+    // Forsyth's algorithm on one run of triangles, with vertices renumbered
+    // locally.
+    void forsythReorder(unsigned int *elements, unsigned int num_elements) {
+        unsigned int num_triangles = num_elements / 3;
+        if (num_triangles < 2) {
+            return;
+        }
+
+        std::vector<unsigned int> local(elements, elements + num_elements);
+        std::vector<unsigned int> vertices = local;
+        std::sort(vertices.begin(), vertices.end());
+        vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+        for (unsigned int &e : local) {
+            e = static_cast<unsigned int>(std::lower_bound(vertices.begin(), vertices.end(), e) - vertices.begin());
+        }
+        unsigned int num_vertices = static_cast<unsigned int>(vertices.size());
+
+        // Triangles using each vertex, with the ones still to be emitted at
+        // the front of each vertex's list.
+        std::vector<unsigned int> remaining(num_vertices, 0);
+        for (unsigned int e : local) {
+            ++remaining[e];
+        }
+        std::vector<unsigned int> first_triangle(num_vertices + 1, 0);
+        for (unsigned int v = 0; v < num_vertices; ++v) {
+            first_triangle[v + 1] = first_triangle[v] + remaining[v];
+        }
+        std::vector<unsigned int> vertex_triangles(num_elements);
+        std::vector<unsigned int> fill = first_triangle;
+        for (unsigned int i = 0; i < num_elements; ++i) {
+            vertex_triangles[fill[local[i]]++] = i / 3;
+        }
+
+        std::vector<int> cache_position(num_vertices, -1);
+        std::vector<float> vertex_score(num_vertices);
+        for (unsigned int v = 0; v < num_vertices; ++v) {
+            vertex_score[v] = forsythVertexScore(-1, remaining[v]);
+        }
+        std::vector<float> triangle_score(num_triangles);
+        std::vector<bool> emitted(num_triangles, false);
+        for (unsigned int t = 0; t < num_triangles; ++t) {
+            triangle_score[t] = vertex_score[local[3*t]] + vertex_score[local[3*t+1]] + vertex_score[local[3*t+2]];
+        }
+
+        std::vector<unsigned int> cache, next_cache;
+        cache.reserve(FORSYTH_CACHE_SIZE + 3);
+        next_cache.reserve(FORSYTH_CACHE_SIZE + 3);
+        unsigned int scan_from = 0;
+        int best = -1;
+        for (unsigned int out = 0; out < num_triangles; ++out) {
+            // When nothing in the cache has triangles left, start afresh
+            // from the best of the rest.
+            if (best < 0) {
+                float best_score = -1.0f;
+                while (emitted[scan_from]) {
+                    ++scan_from;
+                }
+                for (unsigned int t = scan_from; t < num_triangles; ++t) {
+                    if (!emitted[t] && triangle_score[t] > best_score) {
+                        best_score = triangle_score[t];
+                        best = static_cast<int>(t);
+                    }
+                }
+            }
+
+            unsigned int t = static_cast<unsigned int>(best);
+            emitted[t] = true;
+            std::copy(&local[3*t], &local[3*t] + 3, &elements[3*out]);
+
+            // Take the triangle off its vertices' lists.
+            next_cache.clear();
+            for (unsigned int k = 0; k < 3; ++k) {
+                unsigned int v = local[3*t + k];
+                unsigned int *begin = &vertex_triangles[first_triangle[v]];
+                unsigned int *end = begin + remaining[v];
+                std::iter_swap(std::find(begin, end, t), end - 1);
+                --remaining[v];
+                next_cache.push_back(v);
+            }
+            for (unsigned int v : cache) {
+                if (std::find(next_cache.begin(), next_cache.end(), v) == next_cache.end()) {
+                    next_cache.push_back(v);
+                }
+            }
+
+            // Rescore everything that was in the cache, and the triangles
+            // they're still part of.
+            for (unsigned int i = 0; i < next_cache.size(); ++i) {
+                unsigned int v = next_cache[i];
+                cache_position[v] = i < FORSYTH_CACHE_SIZE ? static_cast<int>(i) : -1;
+                vertex_score[v] = forsythVertexScore(cache_position[v], remaining[v]);
+            }
+            best = -1;
+            float best_score = -1.0f;
+            for (unsigned int v : next_cache) {
+                for (unsigned int i = 0; i < remaining[v]; ++i) {
+                    unsigned int u = vertex_triangles[first_triangle[v] + i];
+                    triangle_score[u] = vertex_score[local[3*u]] + vertex_score[local[3*u+1]] + vertex_score[local[3*u+2]];
+                    if (triangle_score[u] > best_score) {
+                        best_score = triangle_score[u];
+                        best = static_cast<int>(u);
+                    }
+                }
+            }
+
+            if (next_cache.size() > FORSYTH_CACHE_SIZE) {
+                next_cache.resize(FORSYTH_CACHE_SIZE);
+            }
+            std::swap(cache, next_cache);
+        }
+
+        for (unsigned int i = 0; i < num_elements; ++i) {
+            elements[i] = vertices[elements[i]];
+        }
+    }
+}
+
+void optimizeVertexCache(std::vector<unsigned int> &elements, const std::vector<PatchRange> &ranges) {
+    for (const PatchRange &range : ranges) {
+        forsythReorder(elements.data() + range.first_element, range.element_count);
+    }
+}
+
+std::vector<unsigned int> optimizeVertexFetch(std::vector<unsigned int> &elements, unsigned int num_vertices) {
+    const unsigned int UNUSED = std::numeric_limits<unsigned int>::max();
+    std::vector<unsigned int> new_index(num_vertices, UNUSED);
+    std::vector<unsigned int> order;
+    order.reserve(num_vertices);
+
+    for (unsigned int &e : elements) {
+        if (new_index[e] == UNUSED) {
+            new_index[e] = static_cast<unsigned int>(order.size());
+            order.push_back(e);
+        }
+        e = new_index[e];
+    }
+    for (unsigned int v = 0; v < num_vertices; ++v) {
+        if (new_index[v] == UNUSED) {
+            order.push_back(v);
+        }
+    }
+    return order;
+}
+
+VertexCacheStats analyzeVertexCache(const std::vector<unsigned int> &elements, unsigned int cache_size) {
+    std::deque<unsigned int> cache;
+    std::unordered_set<unsigned int> used;
+    unsigned int misses = 0;
+    for (unsigned int e : elements) {
+        used.insert(e);
+        if (std::find(cache.begin(), cache.end(), e) == cache.end()) {
+            ++misses;
+            cache.push_back(e);
+            if (cache.size() > cache_size) {
+                cache.pop_front();
+            }
+        }
+    }
+
+    VertexCacheStats stats{0.0f, 0.0f};
+    if (!elements.empty()) {
+        stats.acmr = static_cast<float>(misses) / (elements.size() / 3);
+        stats.atvr = static_cast<float>(misses) / used.size();
+    }
+    return stats;
+}
+
+namespace {
+    // Bounding sphere and normal cone, computed the same way as the terrain
+    // patches' bounds.
+    void computeMeshletBounds(Meshlet &meshlet, const Meshlets &meshlets, const std::vector<glm::vec3> &positions) {
+        glm::vec3 lo{std::numeric_limits<float>::max()};
+        glm::vec3 hi{-std::numeric_limits<float>::max()};
+        for (uint32_t i = 0; i < meshlet.vertex_count; ++i) {
+            const glm::vec3 &p = positions[meshlets.vertices[meshlet.vertex_offset + i]];
+            lo = glm::min(lo, p);
+            hi = glm::max(hi, p);
+        }
+        meshlet.center = (lo + hi) * 0.5f;
+        meshlet.radius = 0.0f;
+        for (uint32_t i = 0; i < meshlet.vertex_count; ++i) {
+            const glm::vec3 &p = positions[meshlets.vertices[meshlet.vertex_offset + i]];
+            meshlet.radius = std::max(meshlet.radius, glm::length(p - meshlet.center));
+        }
+
+        std::vector<glm::vec3> facet_normals;
+        facet_normals.reserve(meshlet.triangle_count);
+        glm::vec3 axis{0.0f};
+        for (uint32_t t = 0; t < meshlet.triangle_count; ++t) {
+            uint32_t packed = meshlets.triangles[meshlet.triangle_offset + t];
+            const uint32_t *local = &meshlets.vertices[meshlet.vertex_offset];
+            const glm::vec3 &v1 = positions[local[packed & 0xff]];
+            const glm::vec3 &v2 = positions[local[(packed >> 8) & 0xff]];
+            const glm::vec3 &v3 = positions[local[(packed >> 16) & 0xff]];
+            glm::vec3 cross = glm::cross(v2 - v1, v3 - v1);
+            if (glm::length(cross) > 0.0f) {
+                facet_normals.push_back(glm::normalize(cross));
+                axis += facet_normals.back();
+            }
+        }
+
+        // A cone wider than a hemisphere can never be entirely back facing.
+        if (facet_normals.empty() || glm::length(axis) == 0.0f) {
+            meshlet.cone_axis = glm::vec3{0.0f, 0.0f, 1.0f};
+            meshlet.cone_cutoff = 2.0f;
+        } else {
+            meshlet.cone_axis = glm::normalize(axis);
+            float min_dot = 1.0f;
+            for (const glm::vec3 &n : facet_normals) {
+                min_dot = std::min(min_dot, glm::dot(n, meshlet.cone_axis));
+            }
+            meshlet.cone_cutoff = min_dot <= 0.0f ? 2.0f : std::sqrt(1.0f - min_dot * min_dot);
+        }
+    }
+}
+
+Meshlets buildMeshlets(const PositionsAndElements &pne, unsigned int max_vertices, unsigned int max_triangles) {
+    assert(max_vertices <= 256 && max_triangles > 0);
+
+    Meshlets rv;
+    rv.triangles.reserve(pne.elements.size() / 3);
+
+    // Local index of each vertex in the meshlet being built.
+    const uint32_t NOT_LOCAL = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> local(pne.positions.size(), NOT_LOCAL);
+
+    Meshlet current{};
+    auto finish = [&]() {
+        if (current.triangle_count == 0) {
+            return;
+        }
+        computeMeshletBounds(current, rv, pne.positions);
+        rv.meshlets.push_back(current);
+        for (uint32_t i = 0; i < current.vertex_count; ++i) {
+            local[rv.vertices[current.vertex_offset + i]] = NOT_LOCAL;
+        }
+        current = Meshlet{};
+        current.vertex_offset = static_cast<uint32_t>(rv.vertices.size());
+        current.triangle_offset = static_cast<uint32_t>(rv.triangles.size());
+    };
+
+    for (size_t i = 0; i + 2 < pne.elements.size(); i += 3) {
+        const unsigned int *tri = &pne.elements[i];
+        uint32_t new_vertices = 0;
+        for (int k = 0; k < 3; ++k) {
+            if (local[tri[k]] == NOT_LOCAL && std::find(tri, tri + k, tri[k]) == tri + k) {
+                ++new_vertices;
+            }
+        }
+        if (current.vertex_count + new_vertices > max_vertices || current.triangle_count >= max_triangles) {
+            finish();
+        }
+
+        uint32_t packed = 0;
+        for (int k = 0; k < 3; ++k) {
+            if (local[tri[k]] == NOT_LOCAL) {
+                local[tri[k]] = current.vertex_count++;
+                rv.vertices.push_back(tri[k]);
+            }
+            packed |= local[tri[k]] << (8 * k);
+        }
+        rv.triangles.push_back(packed);
+        ++current.triangle_count;
+    }
+    finish();
+
+    return rv;
+}
+
+ShortElements narrowElements(
+    const std::vector<unsigned int> &elements,
+    const std::vector<PatchRange> &ranges,
+    unsigned int max_vertices
+) {
+    assert(max_vertices >= 3 && max_vertices <= SHORT_INDEX_MAX_VERTICES + 1);
+
+    ShortElements rv;
+    rv.elements.reserve(elements.size());
+    rv.wide_elements.reserve(elements.size());
+
+    // Index of each original vertex in the batch being built.
+    const unsigned int NOT_LOCAL = std::numeric_limits<unsigned int>::max();
+    unsigned int num_vertices = elements.empty() ? 0 : *std::max_element(elements.begin(), elements.end()) + 1;
+    std::vector<unsigned int> local(num_vertices, NOT_LOCAL);
+    std::vector<unsigned int> counted_for(num_vertices, NOT_LOCAL);
+
+    IndexBatch batch{0, 0, 0};
+    auto finish = [&]() {
+        if (batch.element_count == 0) {
+            return;
+        }
+        rv.batches.push_back(batch);
+        for (unsigned int i = batch.base_vertex; i < rv.vertex_order.size(); ++i) {
+            local[rv.vertex_order[i]] = NOT_LOCAL;
+        }
+        batch = IndexBatch{
+            .first_element = batch.first_element + batch.element_count,
+            .element_count = 0,
+            .base_vertex = static_cast<unsigned int>(rv.vertex_order.size()),
+        };
+    };
+
+    for (unsigned int r = 0; r < ranges.size(); ++r) {
+        const PatchRange &range = ranges[r];
+        assert(range.first_element == batch.first_element + batch.element_count);
+        const unsigned int *begin = elements.data() + range.first_element;
+        const unsigned int *end = begin + range.element_count;
+
+        // Count the range's new vertices without taking them yet.
+        unsigned int batch_vertices = static_cast<unsigned int>(rv.vertex_order.size()) - batch.base_vertex;
+        unsigned int fresh = 0;
+        for (const unsigned int *e = begin; e != end; ++e) {
+            if (local[*e] == NOT_LOCAL && counted_for[*e] != r) {
+                counted_for[*e] = r;
+                ++fresh;
+            }
+        }
+        if (batch_vertices + fresh > max_vertices) {
+            finish();
+        }
+
+        // A range too big for a batch of its own is split between batches
+        // a triangle at a time.
+        bool split = fresh > max_vertices;
+        for (const unsigned int *tri = begin; tri != end; tri += 3) {
+            if (split) {
+                unsigned int tri_fresh = 0;
+                for (const unsigned int *e = tri; e != tri + 3; ++e) {
+                    tri_fresh += local[*e] == NOT_LOCAL ? 1 : 0;
+                }
+                if (rv.vertex_order.size() - batch.base_vertex + tri_fresh > max_vertices) {
+                    finish();
+                }
+            }
+
+            for (const unsigned int *e = tri; e != tri + 3; ++e) {
+                if (local[*e] == NOT_LOCAL) {
+                    local[*e] = static_cast<unsigned int>(rv.vertex_order.size()) - batch.base_vertex;
+                    rv.vertex_order.push_back(*e);
+                }
+                rv.elements.push_back(static_cast<uint16_t>(local[*e]));
+                rv.wide_elements.push_back(batch.base_vertex + local[*e]);
+            }
+            batch.element_count += 3;
+        }
+    }
+    finish();
+
+    return rv;
+}
+
 std::vector<glm::vec3> computeNormals(const PositionsAndElements &pne) {
     std::vector<glm::vec3> normals{pne.positions.size()};
 
@@ -150,6 +676,28 @@ std::vector<glm::vec3> computeNormals(const PositionsAndElements &pne) {
     return normals;
 }
 
+glm::vec2 octahedralEncode(const glm::vec3 &v) {
+    // Project onto the octahedron |x| + |y| + |z| = 1, then fold the lower
+    // half over the diagonals.
+    glm::vec3 n = v / (std::abs(v.x) + std::abs(v.y) + std::abs(v.z));
+    glm::vec2 e{n.x, n.y};
+    if (n.z < 0.0f) {
+        e = glm::vec2{
+            (1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+            (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f),
+        };
+    }
+    return e;
+}
+
+uint16_t quantizeUnorm16(float x) {
+    return static_cast<uint16_t>(std::lround(std::clamp(x, 0.0f, 1.0f) * 65535.0f));
+}
+
+int16_t quantizeSnorm16(float x) {
+    return static_cast<int16_t>(std::lround(std::clamp(x, -1.0f, 1.0f) * 32767.0f));
+}
+
 extern const double PHI = (1.0 + std::sqrt(5.0)) / 2.0;
 
 extern const double ICOSAHEDRON_VERTICES[12][3] = {
@@ -3,6 +3,8 @@
 #ifndef _PLANET_MODELS_H_
 #define _PLANET_MODELS_H_
 
+#include <cstdint>
+#include <memory>
 #include <vector>
 
 #include "glm.h"
@@ -12,11 +14,154 @@ struct PositionsAndElements {
     std::vector<unsigned int> elements;
 };
 
+// A contiguous run of triangles in an icosphere's element list.
+struct PatchRange {
+    unsigned int first_element;
+    unsigned int element_count;
+};
+
+// Width of the indices a mesh is drawn with.
+enum class IndexWidth {
+    e16,
+    e32,
+};
+
+// A run of elements which are drawn with base_vertex added to them.
+struct IndexBatch {
+    unsigned int first_element;
+    unsigned int element_count;
+    unsigned int base_vertex;
+};
+
+// An element list narrowed to 16 bits. Batches are runs of whole patches
+// with no more than 65535 vertices between them, and a patch with more than
+// that on its own (the icosphere's, from refinement 11) is split between
+// batches. Each batch gets its own copy of the vertices it uses, so
+// vertices on the edges between batches are duplicated. vertex_order gives the original index of each vertex of the
+// narrowed mesh, and wide_elements are the elements with their batch's base
+// vertex added back, for anything that wants 32-bit indices into it.
+struct ShortElements {
+    std::vector<uint16_t> elements;
+    std::vector<IndexBatch> batches;
+    std::vector<unsigned int> vertex_order;
+    std::vector<unsigned int> wide_elements;
+};
+
+const unsigned int SHORT_INDEX_MAX_VERTICES = 65535;
+
+// The two vertices of the previous refinement level whose edge a vertex
+// splits. Vertices carried over from the previous level are their own
+// parents.
+struct VertexParents {
+    unsigned int first;
+    unsigned int second;
+};
+
+// Post-transform vertex cache behaviour of an element list, from a FIFO
+// cache simulation. ACMR is vertices transformed per triangle (0.5 at best
+// for a large regular mesh, 3 at worst) and ATVR is vertices transformed
+// per vertex used (1 at best).
+struct VertexCacheStats {
+    float acmr;
+    float atvr;
+};
+
+// Icosphere triangles are reordered for the vertex cache within each block
+// descending from one triangle of this level, so patches can be no finer.
+const int ICOSPHERE_MAX_PATCH_REFINEMENTS = 2;
+
+// Meshlet size limits, small enough for one mesh shader workgroup on any
+// device that has them.
+const unsigned int MESHLET_MAX_VERTICES = 64;
+const unsigned int MESHLET_MAX_TRIANGLES = 124;
+
+// A small cluster of triangles along with the bounds used to cull it. The
+// cone cutoff is the sine of the cone's half angle, as for terrain patches.
+// The layout matches Meshlet in terrain_mesh.slang.
+struct Meshlet {
+    glm::vec3 center;
+    float radius;
+    glm::vec3 cone_axis;
+    float cone_cutoff;
+    uint32_t vertex_offset;
+    uint32_t triangle_offset;
+    uint32_t vertex_count;
+    uint32_t triangle_count;
+};
+
+// Each meshlet has a run of vertex indices into the mesh, and a run of
+// triangles whose corners index into that run. A triangle's three local
+// indices are packed into the low three bytes of a word.
+struct Meshlets {
+    std::vector<Meshlet> meshlets;
+    std::vector<uint32_t> vertices;
+    std::vector<uint32_t> triangles;
+};
+
 PositionsAndElements icosahedron();
+
+// Icospheres come out with their triangles ordered for the vertex cache and
+// their vertices in order of first use.
 PositionsAndElements icosphere(float radius, int refinements);
+PositionsAndElements icosphere(float radius, int refinements, std::vector<VertexParents> &parents);
+std::vector<PatchRange> icospherePatches(int refinements, int patch_refinements);
+
+// The element list of an icosphere only depends on its refinement level, so
+// every sphere of the same level shares one copy. Safe to call from any
+// thread.
+std::shared_ptr<const std::vector<unsigned int>> icosphereElements(int refinements);
+
+// The same, narrowed to 16 bits in batches of the finest icosphere patches.
+// Also shared, and safe to call from any thread.
+std::shared_ptr<const ShortElements> icosphereShortElements(int refinements);
+
+// Whichever of the two a mesh of the given index width is drawn with:
+// icosphereElements() and no short elements, or icosphereShortElements()
+// and its wide elements.
+void icosphereElements(
+    int refinements,
+    IndexWidth index_width,
+    std::shared_ptr<const std::vector<unsigned int>> &elements,
+    std::shared_ptr<const ShortElements> &short_elements
+);
+
+// Reorder the triangles within each range to make good use of the
+// post-transform vertex cache (Forsyth's linear-speed algorithm). Ranges
+// stay where they are.
+void optimizeVertexCache(std::vector<unsigned int> &elements, const std::vector<PatchRange> &ranges);
+
+// Renumber vertices in the order the elements first use them, so vertex
+// fetches walk through memory. Returns the old index of each new vertex;
+// unused vertices go at the end.
+std::vector<unsigned int> optimizeVertexFetch(std::vector<unsigned int> &elements, unsigned int num_vertices);
+
+VertexCacheStats analyzeVertexCache(const std::vector<unsigned int> &elements, unsigned int cache_size = 16);
+
+// Split a mesh into meshlets, taking its triangles in order, so a mesh that
+// has been optimized for the vertex cache gives compact meshlets.
+Meshlets buildMeshlets(
+    const PositionsAndElements &pne,
+    unsigned int max_vertices = MESHLET_MAX_VERTICES,
+    unsigned int max_triangles = MESHLET_MAX_TRIANGLES
+);
+
+// Narrow an element list whose ranges are in order and cover it.
+ShortElements narrowElements(
+    const std::vector<unsigned int> &elements,
+    const std::vector<PatchRange> &ranges,
+    unsigned int max_vertices = SHORT_INDEX_MAX_VERTICES
+);
 
 std::vector<glm::vec3> computeNormals(const PositionsAndElements &pne);
 
+// Octahedral mapping of a unit vector onto [-1, 1]^2, so that normals and
+// directions fit in two 16-bit components. The shaders have the inverse.
+glm::vec2 octahedralEncode(const glm::vec3 &v);
+
+// Fixed point conversions, rounding to nearest and clamping to the range.
+uint16_t quantizeUnorm16(float x);
+int16_t quantizeSnorm16(float x);
+
 extern const double ICOSAHEDRON_VERTICES[12][3];
 extern const unsigned int ICOSAHEDRON_VERTEX_COUNT;
 extern const unsigned int ICOSAHEDRON_ELEMS[60];
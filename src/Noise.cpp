@@ -1,15 +1,20 @@
 // -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
 
+#include <algorithm>
 #include <cmath>
+#include <iterator>
 #include <random>
 
 #include "Noise.h"
 
 double reduceToRange(double x, double modulus);
 
-PermutationTable::PermutationTable() {
-    std::random_device seed;
-    std::default_random_engine engine{seed()};
+PermutationTable::PermutationTable()
+    : PermutationTable{std::random_device{}()}
+{}
+
+PermutationTable::PermutationTable(uint32_t seed) {
+    std::default_random_engine engine{seed};
 
     for (int i = 0; i < 256; ++i) {
         table[i] = i;
@@ -46,6 +51,13 @@ Perlin::Perlin(double x_scale, double y_scale, double z_scale)
       m_z_scale{z_scale}
 {}
 
+Perlin::Perlin(double x_scale, double y_scale, double z_scale, uint32_t seed)
+    : m_permutation{seed},
+      m_x_scale{x_scale},
+      m_y_scale{y_scale},
+      m_z_scale{z_scale}
+{}
+
 Perlin::~Perlin() {}
 
 void Perlin::setScales(double x, double y) {
@@ -59,6 +71,22 @@ void Perlin::setScales(double x, double y, double z) {
     m_z_scale = z;
 }
 
+const PermutationTable &Perlin::permutation() const {
+    return m_permutation;
+}
+
+double Perlin::xScale() const {
+    return m_x_scale;
+}
+
+double Perlin::yScale() const {
+    return m_y_scale;
+}
+
+double Perlin::zScale() const {
+    return m_z_scale;
+}
+
 double Perlin::operator()(double xx, double yy) const {
     const unsigned char *const p = m_permutation.table;
 
@@ -133,6 +161,10 @@ double Perlin::operator()(double xx, double yy, double zz) const {
     return rv;
 }
 
+void Perlin::fingerprint(Fingerprint &fp) const {
+    fp.add('P').add(m_x_scale).add(m_y_scale).add(m_z_scale).add(m_permutation.table);
+}
+
 double Perlin::fade(double t) {
     // 6t^5 - 15t^4 + 10t^3
     return t * t * t * (t * (t * 6 - 15) + 10);
@@ -182,6 +214,14 @@ Octave::Octave(const NoiseFunction &base, int octaves, double persistence)
 
 Octave::~Octave() {}
 
+int Octave::octaves() const {
+    return m_octaves;
+}
+
+double Octave::persistence() const {
+    return m_persistence;
+}
+
 double Octave::operator()(double x, double y) const {
     double total = 0;
     double frequency = 1;
@@ -216,6 +256,11 @@ double Octave::operator()(double x, double y, double z) const {
     return rv;
 }
 
+void Octave::fingerprint(Fingerprint &fp) const {
+    fp.add('O').add(m_octaves).add(m_persistence);
+    m_noise.fingerprint(fp);
+}
+
 Curve::Curve(const NoiseFunction &base, const CubicSpline &curve)
     : m_noise{base},
       m_curve{curve}
@@ -233,6 +278,62 @@ double Curve::operator()(double x, double y, double z) const {
     return rv;
 }
 
+void Curve::fingerprint(Fingerprint &fp) const {
+    fp.add('C');
+    m_curve.fingerprint(fp);
+    m_noise.fingerprint(fp);
+}
+
+TerrainNoise::TerrainNoise(uint32_t seed)
+    : m_base{2.0, 2.0, 2.0, seed},
+      m_octaves{m_base, 4, 0.3},
+      m_spline{},
+      m_curve{m_octaves, m_spline}
+{
+    m_spline
+        .addControlPoint(-1.0, -1.0)
+        .addControlPoint(-0.5, -0.5)
+        .addControlPoint(0.0, -0.1)
+        .addControlPoint(0.5, 0.8)
+        .addControlPoint(0.75, 1.2)
+        .addControlPoint(1.0, 1.2);
+}
+
+TerrainNoise::~TerrainNoise() {}
+
+const NoiseFunction &TerrainNoise::function() const {
+    return m_curve;
+}
+
+TerrainNoiseTables TerrainNoise::tables() const {
+    TerrainNoiseTables tables{
+        .permutation = std::vector<uint32_t>(std::begin(m_base.permutation().table), std::end(m_base.permutation().table)),
+        .scales = { m_base.xScale(), m_base.yScale(), m_base.zScale() },
+        .octaves = m_octaves.octaves(),
+        .persistence = m_octaves.persistence(),
+        .control_points = m_spline.controlPoints(),
+        .second_derivatives = m_spline.coefficients(),
+        .min_value = 0.0,
+        .max_value = 0.0,
+    };
+
+    // The spline holds its end values outside of its control points, so
+    // its range is the function's, whatever the octaves add up to. Between
+    // control points it can overshoot them; sampled finely enough, what it
+    // misses of that is far below anything that shows.
+    const auto &cps = tables.control_points;
+    tables.min_value = tables.max_value = cps.front().second;
+    const int samples = 256;
+    for (size_t i = 0; i + 1 < cps.size(); ++i) {
+        for (int j = 0; j <= samples; ++j) {
+            double y = m_spline(cps[i].first + (cps[i+1].first - cps[i].first) * j / samples);
+            tables.min_value = std::min(tables.min_value, y);
+            tables.max_value = std::max(tables.max_value, y);
+        }
+    }
+    return tables;
+}
+
 double reduceToRange(double x, double modulus) {
     while (x >= modulus) {
         x -= modulus;
@@ -3,11 +3,18 @@
 #ifndef _VPLANET_NOISE_H_
 #define _VPLANET_NOISE_H_
 
+#include <cstdint>
+#include <utility>
+#include <vector>
+
 #include "Curve.h"
+#include "Fingerprint.h"
 
 class PermutationTable {
 public:
+    // Shuffled from a random device, or reproducibly from a seed.
     PermutationTable();
+    explicit PermutationTable(uint32_t seed);
     ~PermutationTable();
 
     unsigned char table[512];
@@ -21,21 +28,33 @@ public:
     // virtual double operator()(double x) const = 0;
     virtual double operator()(double x, double y) const = 0;
     virtual double operator()(double x, double y, double z) const = 0;
+
+    // Adds everything the function's values depend on, including the
+    // functions it's built on.
+    virtual void fingerprint(Fingerprint &fp) const = 0;
 };
 
 class Perlin : public NoiseFunction {
 public:
     Perlin();
     Perlin(double x_scale, double y_scale, double z_scale);
+    Perlin(double x_scale, double y_scale, double z_scale, uint32_t seed);
     virtual ~Perlin();
 
     void setScales(double x, double y);
     void setScales(double x, double y, double z);
 
+    const PermutationTable &permutation() const;
+    double xScale() const;
+    double yScale() const;
+    double zScale() const;
+
     // virtual double operator()(double x) const;
     virtual double operator()(double x, double y) const;
     virtual double operator()(double x, double y, double z) const;
 
+    virtual void fingerprint(Fingerprint &fp) const;
+
 private:
     static double fade(double t);
     static double lerp(double t, double a, double b);
@@ -52,10 +71,15 @@ public:
     Octave(const NoiseFunction &base, int octaves, double persistence);
     virtual ~Octave();
 
+    int octaves() const;
+    double persistence() const;
+
     // virtual double operator()(double x) const;
     virtual double operator()(double x, double y) const;
     virtual double operator()(double x, double y, double z) const;
 
+    virtual void fingerprint(Fingerprint &fp) const;
+
 private:
     const NoiseFunction &m_noise;
     int m_octaves;
@@ -71,9 +95,46 @@ public:
     virtual double operator()(double x, double y) const;
     virtual double operator()(double x, double y, double z) const;
 
+    virtual void fingerprint(Fingerprint &fp) const;
+
 private:
     const NoiseFunction &m_noise;
     const CubicSpline &m_curve;
 };
 
+// TerrainNoise reduced to plain numbers, to evaluate it somewhere other
+// than through NoiseFunction, as terrain_generate.slang does: the base
+// noise's permutation table and scales, the octaves summed over it, and the
+// spline's control points with its second derivatives at them.
+struct TerrainNoiseTables {
+    std::vector<uint32_t> permutation;
+    double scales[3];
+    int octaves;
+    double persistence;
+    std::vector<std::pair<double, double>> control_points;
+    std::vector<double> second_derivatives;
+    // Bounds on the function's values, from the spline's range.
+    double min_value, max_value;
+};
+
+// The planet's terrain: octaves of seeded Perlin noise shaped by a spline.
+// The viewer and vplanet_bake both use this, so they make the same planet.
+class TerrainNoise {
+public:
+    explicit TerrainNoise(uint32_t seed);
+    TerrainNoise(const TerrainNoise &other) = delete;
+    ~TerrainNoise();
+
+    TerrainNoise &operator=(const TerrainNoise &other) = delete;
+
+    const NoiseFunction &function() const;
+    TerrainNoiseTables tables() const;
+
+private:
+    Perlin m_base;
+    Octave m_octaves;
+    CubicSpline m_spline;
+    Curve m_curve;
+};
+
 #endif
@@ -1,16 +1,37 @@
 // -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
 
 #include <array>
-#include <random>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
 #include <vector>
 
 #include "vulkan.h"
 
 #include "glm.h"
 
+#include "Fingerprint.h"
+#include "MeshCache.h"
 #include "Models.h"
 #include "Ocean.h"
 
+namespace {
+    enum OceanSection : uint32_t {
+        eInfo = MESH_CACHE_FIRST_USER_SECTION,
+        eVertices,
+    };
+
+    struct OceanInfo {
+        float radius;
+        int32_t refinements;
+        IndexWidth index_width;
+        uint32_t padding;
+    };
+
+    const glm::vec4 OCEAN_COLOR{0.2f, 0.3f, 0.6f, 1.0f};
+}
+
 vk::VertexInputBindingDescription OceanVertex::bindingDescription() {
     return vk::VertexInputBindingDescription{
         .binding = 0,
@@ -24,55 +45,122 @@ std::array<vk::VertexInputAttributeDescription, OceanVertex::NUM_ATTRIBUTES> Oce
         vk::VertexInputAttributeDescription{
             .location = 0,
             .binding = 0,
-            .format = vk::Format::eR32G32B32Sfloat,
-            .offset = offsetof(OceanVertex, position),
-        },
-        vk::VertexInputAttributeDescription{
-            .location = 1,
-            .binding = 0,
-            .format = vk::Format::eR32G32B32A32Sfloat,
-            .offset = offsetof(OceanVertex, color),
-        },
-        vk::VertexInputAttributeDescription{
-            .location = 2,
-            .binding = 0,
-            .format = vk::Format::eR32G32B32Sfloat,
-            .offset = offsetof(OceanVertex, normal),
+            .format = vk::Format::eR16G16Unorm,
+            .offset = offsetof(OceanVertex, direction),
         },
     };
 }
 
-Ocean::Ocean(float radius, int refinements)
-    : m_vertices{},
-      m_indices{}
+Ocean::Ocean(float radius, int refinements, IndexWidth index_width)
+    : m_radius{radius},
+      m_color{OCEAN_COLOR},
+      m_refinements{refinements},
+      m_vertices{},
+      m_mapping{},
+      m_vertex_data{},
+      m_indices{},
+      m_short_indices{}
 {
-    std::random_device seed;
-    std::default_random_engine eng{seed()};
-    std::uniform_real_distribution<float> dist{0.995f, 1.005f};
-    PositionsAndElements pne = icosphere(radius, refinements);
+    PositionsAndElements pne = icosphere(1.0f, refinements);
 
-    for (size_t i = 0; i < pne.positions.size(); ++i) {
-        float factor = dist(eng);
-        pne.positions[i] *= factor;
+    icosphereElements(refinements, index_width, m_indices, m_short_indices);
+    if (m_short_indices) {
+        std::vector<glm::vec3> positions;
+        positions.reserve(m_short_indices->vertex_order.size());
+        for (unsigned int v : m_short_indices->vertex_order) {
+            positions.push_back(pne.positions[v]);
+        }
+        pne.positions = std::move(positions);
     }
 
-    std::vector<glm::vec3> normals = computeNormals(pne);
-
-    m_indices = pne.elements;
     m_vertices.resize(pne.positions.size());
     for (size_t i = 0; i < pne.positions.size(); ++i) {
-        m_vertices[i].position = pne.positions[i];
-        m_vertices[i].color = { 0.2, 0.3, 0.6, 1.0 };
-        m_vertices[i].normal = normals[i];
+        glm::vec2 direction = octahedralEncode(pne.positions[i]) * 0.5f + 0.5f;
+        m_vertices[i].direction[0] = quantizeUnorm16(direction.x);
+        m_vertices[i].direction[1] = quantizeUnorm16(direction.y);
     }
+    m_vertex_data = m_vertices;
 }
 
+Ocean::Ocean()
+    : m_radius{0.0f},
+      m_color{OCEAN_COLOR},
+      m_refinements{0},
+      m_vertices{},
+      m_mapping{},
+      m_vertex_data{},
+      m_indices{},
+      m_short_indices{}
+{}
+
 Ocean::~Ocean() {}
 
-const std::vector<OceanVertex>& Ocean::vertices() const {
-    return m_vertices;
+uint64_t Ocean::cacheKey(float radius, int refinements, IndexWidth index_width) {
+    Fingerprint fp;
+    fp.add('W').add(radius).add(refinements).add(index_width).add(sizeof(OceanVertex));
+    return fp.value();
+}
+
+std::unique_ptr<Ocean> Ocean::load(const std::filesystem::path &path, uint64_t key) {
+    std::optional<MeshCacheReader> reader = MeshCacheReader::open(path, key);
+    if (!reader) {
+        return nullptr;
+    }
+
+    std::optional<std::span<const OceanInfo>> info = reader->section<OceanInfo>(eInfo);
+    std::optional<std::span<const OceanVertex>> vertices = reader->section<OceanVertex>(eVertices);
+    if (!info || info->size() != 1 || !vertices) {
+        return nullptr;
+    }
+
+    const OceanInfo &stored = info->front();
+    std::unique_ptr<Ocean> ocean{new Ocean()};
+    icosphereElements(stored.refinements, stored.index_width, ocean->m_indices, ocean->m_short_indices);
+    if (ocean->m_short_indices && ocean->m_short_indices->vertex_order.size() != vertices->size()) {
+        return nullptr;
+    }
+
+    ocean->m_radius = stored.radius;
+    ocean->m_refinements = stored.refinements;
+    ocean->m_mapping = reader->file();
+    ocean->m_vertex_data = *vertices;
+    return ocean;
+}
+
+void Ocean::save(const std::filesystem::path &path, uint64_t key) const {
+    OceanInfo info{
+        .radius = m_radius,
+        .refinements = m_refinements,
+        .index_width = m_short_indices ? IndexWidth::e16 : IndexWidth::e32,
+        .padding = 0,
+    };
+
+    MeshCacheWriter writer{key};
+    writer.addSection(eInfo, std::span<const OceanInfo>{&info, 1})
+        .addSection(eVertices, m_vertex_data);
+    writer.write(path);
+}
+
+float Ocean::radius() const {
+    return m_radius;
+}
+
+const glm::vec4& Ocean::color() const {
+    return m_color;
+}
+
+int Ocean::refinements() const {
+    return m_refinements;
+}
+
+std::span<const OceanVertex> Ocean::vertices() const {
+    return m_vertex_data;
 }
 
 const std::vector<uint32_t>& Ocean::indices() const {
-    return m_indices;
+    return *m_indices;
+}
+
+const ShortElements* Ocean::shortIndices() const {
+    return m_short_indices.get();
 }
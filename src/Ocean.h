@@ -4,16 +4,23 @@
 #define _VPLANET_OCEAN_H_
 
 #include <array>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
 #include <vector>
 
 #include "glm.h"
+#include "MeshCache.h"
+#include "Models.h"
 #include "vulkan.h"
 
+// A point on the unit sphere, as an octahedral direction in 16-bit unorm
+// components. The vertex shader scales it out to the ocean's radius and
+// displaces it by the waves.
 struct OceanVertex {
-    glm::vec3 position;
-    glm::vec4 color;
-    glm::vec3 normal;
-    static const int NUM_ATTRIBUTES = 3;
+    uint16_t direction[2];
+    static const int NUM_ATTRIBUTES = 1;
 
     static vk::VertexInputBindingDescription bindingDescription();
     static std::array<vk::VertexInputAttributeDescription, NUM_ATTRIBUTES> attributeDescription();
@@ -21,15 +28,37 @@ struct OceanVertex {
 
 class Ocean {
 public:
-    Ocean(float radius, int refinements);
+    Ocean(float radius, int refinements, IndexWidth index_width = IndexWidth::e32);
     ~Ocean();
 
-    const std::vector<OceanVertex>& vertices() const;
+    // As for Terrain.
+    static uint64_t cacheKey(float radius, int refinements, IndexWidth index_width);
+    static std::unique_ptr<Ocean> load(const std::filesystem::path &path, uint64_t key);
+    void save(const std::filesystem::path &path, uint64_t key) const;
+
+    float radius() const;
+    const glm::vec4& color() const;
+    int refinements() const;
+    std::span<const OceanVertex> vertices() const;
     const std::vector<uint32_t>& indices() const;
 
+    // As for Terrain, null unless the ocean has 16-bit indices.
+    const ShortElements* shortIndices() const;
+
 private:
+    Ocean();
+
+    float m_radius;
+    glm::vec4 m_color;
+    int m_refinements;
+
+    // As for Terrain, generated into m_vertices or mapped from a cache
+    // file.
     std::vector<OceanVertex> m_vertices;
-    std::vector<uint32_t> m_indices;
+    std::shared_ptr<const MappedFile> m_mapping;
+    std::span<const OceanVertex> m_vertex_data;
+    std::shared_ptr<const std::vector<uint32_t>> m_indices;
+    std::shared_ptr<const ShortElements> m_short_indices;
 };
 
 #endif
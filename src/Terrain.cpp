@@ -1,12 +1,21 @@
 // -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
 
+#include <algorithm>
 #include <array>
+#include <cmath>
+#include <filesystem>
+#include <limits>
 #include <map>
+#include <memory>
+#include <optional>
+#include <span>
 #include <vector>
 
 #include "glm.h"
 #include "vulkan.h"
 
+#include "Fingerprint.h"
+#include "MeshCache.h"
 #include "Models.h"
 #include "Noise.h"
 #include "Terrain.h"
@@ -33,14 +42,131 @@ std::array<vk::VertexInputAttributeDescription, TerrainVertex::NUM_ATTRIBUTES> T
             .format = vk::Format::eR32G32B32Sfloat,
             .offset = offsetof(TerrainVertex, normal),
         },
+        vk::VertexInputAttributeDescription{
+            .location = 2,
+            .binding = 0,
+            .format = vk::Format::eR32G32B32Sfloat,
+            .offset = offsetof(TerrainVertex, parent_position),
+        },
+        vk::VertexInputAttributeDescription{
+            .location = 3,
+            .binding = 0,
+            .format = vk::Format::eR32G32B32Sfloat,
+            .offset = offsetof(TerrainVertex, parent_normal),
+        },
+    };
+}
+
+CompactTerrainVertex CompactTerrainVertex::encode(const TerrainVertex &vertex, float min_radius, float max_radius) {
+    float radius_scale = max_radius > min_radius ? 1.0f / (max_radius - min_radius) : 0.0f;
+    float radius = glm::length(vertex.position);
+    float parent_radius = glm::length(vertex.parent_position);
+    glm::vec2 direction = octahedralEncode(vertex.position) * 0.5f + 0.5f;
+    glm::vec2 parent_direction = octahedralEncode(vertex.parent_position) * 0.5f + 0.5f;
+    glm::vec2 normal = octahedralEncode(vertex.normal);
+    glm::vec2 parent_normal = octahedralEncode(vertex.parent_normal);
+
+    return CompactTerrainVertex{
+        .position = {
+            quantizeUnorm16(direction.x),
+            quantizeUnorm16(direction.y),
+            quantizeUnorm16((radius - min_radius) * radius_scale),
+            quantizeUnorm16((parent_radius - min_radius) * radius_scale),
+        },
+        .parent_direction = { quantizeUnorm16(parent_direction.x), quantizeUnorm16(parent_direction.y) },
+        .normal = { quantizeSnorm16(normal.x), quantizeSnorm16(normal.y) },
+        .parent_normal = { quantizeSnorm16(parent_normal.x), quantizeSnorm16(parent_normal.y) },
+    };
+}
+
+vk::VertexInputBindingDescription CompactTerrainVertex::bindingDescription() {
+    return vk::VertexInputBindingDescription{
+        .binding = 0,
+        .stride = sizeof(CompactTerrainVertex),
+        .inputRate = vk::VertexInputRate::eVertex,
+    };
+}
+
+std::array<vk::VertexInputAttributeDescription, CompactTerrainVertex::NUM_ATTRIBUTES> CompactTerrainVertex::attributeDescription() {
+    return std::array<vk::VertexInputAttributeDescription, CompactTerrainVertex::NUM_ATTRIBUTES>{
+        vk::VertexInputAttributeDescription{
+            .location = 0,
+            .binding = 0,
+            .format = vk::Format::eR16G16B16A16Unorm,
+            .offset = offsetof(CompactTerrainVertex, position),
+        },
+        vk::VertexInputAttributeDescription{
+            .location = 1,
+            .binding = 0,
+            .format = vk::Format::eR16G16Unorm,
+            .offset = offsetof(CompactTerrainVertex, parent_direction),
+        },
+        vk::VertexInputAttributeDescription{
+            .location = 2,
+            .binding = 0,
+            .format = vk::Format::eR16G16Snorm,
+            .offset = offsetof(CompactTerrainVertex, normal),
+        },
+        vk::VertexInputAttributeDescription{
+            .location = 3,
+            .binding = 0,
+            .format = vk::Format::eR16G16Snorm,
+            .offset = offsetof(CompactTerrainVertex, parent_normal),
+        },
     };
 }
 
-Terrain::Terrain(float radius, int refinements, const NoiseFunction &noise)
-    : m_vertices{},
-      m_indices{}
+namespace {
+    enum TerrainSection : uint32_t {
+        eInfo = MESH_CACHE_FIRST_USER_SECTION,
+        eVertices,
+        ePatches,
+        eMeshlets,
+        eMeshletVertices,
+        eMeshletTriangles,
+    };
+
+    struct TerrainInfo {
+        int32_t refinements;
+        float min_radius;
+        float max_radius;
+        IndexWidth index_width;
+    };
+
+    // Each draw has one base vertex, so patches can't cross from one index
+    // batch into the next.
+    std::vector<PatchRange> splitAtBatches(const std::vector<PatchRange> &ranges, const std::vector<IndexBatch> &batches) {
+        std::vector<PatchRange> rv;
+        rv.reserve(ranges.size() + batches.size());
+        for (const PatchRange &range : ranges) {
+            unsigned int range_end = range.first_element + range.element_count;
+            for (const IndexBatch &batch : batches) {
+                unsigned int first = std::max(range.first_element, batch.first_element);
+                unsigned int last = std::min(range_end, batch.first_element + batch.element_count);
+                if (first < last) {
+                    rv.push_back({ first, last - first });
+                }
+            }
+        }
+        return rv;
+    }
+}
+
+Terrain::Terrain(float radius, int refinements, const NoiseFunction &noise, int patch_refinements, IndexWidth index_width)
+    : m_refinements{refinements},
+      m_vertices{},
+      m_mapping{},
+      m_vertex_data{},
+      m_indices{},
+      m_short_indices{},
+      m_batches{},
+      m_patches{},
+      m_meshlets{},
+      m_min_radius{radius},
+      m_max_radius{radius}
 {
-    PositionsAndElements pne = icosphere(radius, refinements);
+    std::vector<VertexParents> parents;
+    PositionsAndElements pne = icosphere(radius, refinements, parents);
 
     for (size_t i = 0; i < pne.positions.size(); ++i) {
         glm::vec3 &pos = pne.positions[i];
@@ -50,20 +176,255 @@ Terrain::Terrain(float radius, int refinements, const NoiseFunction &noise)
 
     std::vector<glm::vec3> normals = computeNormals(pne);
 
-    m_indices = pne.elements;
-    m_vertices.resize(pne.positions.size());
+    std::vector<TerrainVertex> vertices(pne.positions.size());
     for (size_t i = 0; i < pne.positions.size(); ++i) {
-        m_vertices[i].position = pne.positions[i];
-        m_vertices[i].normal = normals[i];
+        vertices[i].position = pne.positions[i];
+        vertices[i].normal = normals[i];
+
+        // A vertex that splits an edge sits on that edge of the coarser
+        // mesh.
+        const VertexParents &parent = parents[i];
+        if (parent.first == parent.second) {
+            vertices[i].parent_position = pne.positions[i];
+            vertices[i].parent_normal = normals[i];
+        } else {
+            vertices[i].parent_position = (pne.positions[parent.first] + pne.positions[parent.second]) * 0.5f;
+            vertices[i].parent_normal = glm::normalize(normals[parent.first] + normals[parent.second]);
+        }
+    }
+
+    // Narrowed indices come with their own vertex order, with the vertices
+    // shared by two batches duplicated.
+    std::vector<PatchRange> ranges = icospherePatches(refinements, patch_refinements);
+    icosphereElements(refinements, index_width, m_indices, m_short_indices);
+    if (m_short_indices) {
+        m_batches = m_short_indices->batches;
+
+        std::vector<TerrainVertex> narrowed_vertices;
+        std::vector<glm::vec3> narrowed_positions;
+        narrowed_vertices.reserve(m_short_indices->vertex_order.size());
+        narrowed_positions.reserve(m_short_indices->vertex_order.size());
+        for (unsigned int v : m_short_indices->vertex_order) {
+            narrowed_vertices.push_back(vertices[v]);
+            narrowed_positions.push_back(pne.positions[v]);
+        }
+        vertices = std::move(narrowed_vertices);
+        pne.positions = std::move(narrowed_positions);
+        pne.elements = m_short_indices->wide_elements;
+        ranges = splitAtBatches(ranges, m_batches);
+    } else {
+        m_batches.push_back({ 0, static_cast<unsigned int>(m_indices->size()), 0 });
+    }
+
+    // The parents are included so they can be quantized over the same
+    // range. They lie on chords, never above the surface, so the minimum
+    // stays a safe occluder.
+    m_min_radius = std::numeric_limits<float>::max();
+    m_max_radius = 0.0f;
+    for (const TerrainVertex &vertex : vertices) {
+        for (float r : { glm::length(vertex.position), glm::length(vertex.parent_position) }) {
+            m_min_radius = std::min(m_min_radius, r);
+            m_max_radius = std::max(m_max_radius, r);
+        }
     }
+
+    m_vertices.reserve(vertices.size());
+    for (const TerrainVertex &vertex : vertices) {
+        m_vertices.push_back(CompactTerrainVertex::encode(vertex, m_min_radius, m_max_radius));
+    }
+    m_vertex_data = m_vertices;
+
+    computePatchBounds(pne.positions, ranges);
+    m_meshlets = buildMeshlets(pne);
 }
 
+Terrain::Terrain()
+    : m_refinements{0},
+      m_vertices{},
+      m_mapping{},
+      m_vertex_data{},
+      m_indices{},
+      m_short_indices{},
+      m_batches{},
+      m_patches{},
+      m_meshlets{},
+      m_min_radius{0.0f},
+      m_max_radius{0.0f}
+{}
+
 Terrain::~Terrain() {}
 
-const std::vector<TerrainVertex>& Terrain::vertices() const {
-    return m_vertices;
+uint64_t Terrain::cacheKey(
+    float radius,
+    int refinements,
+    const NoiseFunction &noise,
+    int patch_refinements,
+    IndexWidth index_width
+) {
+    Fingerprint fp;
+    fp.add('T').add(radius).add(refinements).add(patch_refinements).add(index_width);
+    fp.add(sizeof(CompactTerrainVertex)).add(sizeof(TerrainPatch)).add(sizeof(Meshlet));
+    noise.fingerprint(fp);
+    return fp.value();
+}
+
+std::unique_ptr<Terrain> Terrain::load(const std::filesystem::path &path, uint64_t key) {
+    std::optional<MeshCacheReader> reader = MeshCacheReader::open(path, key);
+    if (!reader) {
+        return nullptr;
+    }
+
+    std::optional<std::span<const TerrainInfo>> info = reader->section<TerrainInfo>(eInfo);
+    std::optional<std::span<const CompactTerrainVertex>> vertices = reader->section<CompactTerrainVertex>(eVertices);
+    std::optional<std::vector<TerrainPatch>> patches = reader->copySection<TerrainPatch>(ePatches);
+    std::optional<std::vector<Meshlet>> meshlets = reader->copySection<Meshlet>(eMeshlets);
+    std::optional<std::vector<uint32_t>> meshlet_vertices = reader->copySection<uint32_t>(eMeshletVertices);
+    std::optional<std::vector<uint32_t>> meshlet_triangles = reader->copySection<uint32_t>(eMeshletTriangles);
+    if (!info || info->size() != 1 || !vertices || !patches || !meshlets || !meshlet_vertices || !meshlet_triangles) {
+        return nullptr;
+    }
+
+    // The vertices are in the order of the shared elements they were
+    // generated for.
+    std::unique_ptr<Terrain> terrain{new Terrain()};
+    icosphereElements(info->front().refinements, info->front().index_width, terrain->m_indices, terrain->m_short_indices);
+    if (terrain->m_short_indices && terrain->m_short_indices->vertex_order.size() != vertices->size()) {
+        return nullptr;
+    }
+
+    terrain->m_refinements = info->front().refinements;
+    terrain->m_min_radius = info->front().min_radius;
+    terrain->m_max_radius = info->front().max_radius;
+    terrain->m_mapping = reader->file();
+    terrain->m_vertex_data = *vertices;
+    if (terrain->m_short_indices) {
+        terrain->m_batches = terrain->m_short_indices->batches;
+    } else {
+        terrain->m_batches.push_back({ 0, static_cast<unsigned int>(terrain->m_indices->size()), 0 });
+    }
+    terrain->m_patches = std::move(*patches);
+    terrain->m_meshlets.meshlets = std::move(*meshlets);
+    terrain->m_meshlets.vertices = std::move(*meshlet_vertices);
+    terrain->m_meshlets.triangles = std::move(*meshlet_triangles);
+    return terrain;
+}
+
+void Terrain::save(const std::filesystem::path &path, uint64_t key) const {
+    TerrainInfo info{
+        .refinements = m_refinements,
+        .min_radius = m_min_radius,
+        .max_radius = m_max_radius,
+        .index_width = indexWidth(),
+    };
+
+    MeshCacheWriter writer{key};
+    writer.addSection(eInfo, std::span<const TerrainInfo>{&info, 1})
+        .addSection(eVertices, m_vertex_data)
+        .addSection(ePatches, m_patches)
+        .addSection(eMeshlets, m_meshlets.meshlets)
+        .addSection(eMeshletVertices, m_meshlets.vertices)
+        .addSection(eMeshletTriangles, m_meshlets.triangles);
+    writer.write(path);
+}
+
+int Terrain::refinements() const {
+    return m_refinements;
+}
+
+std::span<const CompactTerrainVertex> Terrain::vertices() const {
+    return m_vertex_data;
 }
 
 const std::vector<uint32_t>& Terrain::elements() const {
-    return m_indices;
+    return *m_indices;
+}
+
+IndexWidth Terrain::indexWidth() const {
+    return m_short_indices ? IndexWidth::e16 : IndexWidth::e32;
+}
+
+const ShortElements* Terrain::shortElements() const {
+    return m_short_indices.get();
+}
+
+const std::vector<IndexBatch>& Terrain::indexBatches() const {
+    return m_batches;
+}
+
+const std::vector<TerrainPatch>& Terrain::patches() const {
+    return m_patches;
+}
+
+const Meshlets& Terrain::meshlets() const {
+    return m_meshlets;
+}
+
+float Terrain::minRadius() const {
+    return m_min_radius;
+}
+
+float Terrain::maxRadius() const {
+    return m_max_radius;
+}
+
+void Terrain::computePatchBounds(const std::vector<glm::vec3> &positions, const std::vector<PatchRange> &ranges) {
+    const std::vector<uint32_t> &indices = *m_indices;
+    m_patches.clear();
+    m_patches.reserve(ranges.size());
+
+    for (const PatchRange &range : ranges) {
+        TerrainPatch patch{};
+        patch.first_index = range.first_element;
+        patch.index_count = range.element_count;
+        for (const IndexBatch &batch : m_batches) {
+            if (range.first_element >= batch.first_element && range.first_element < batch.first_element + batch.element_count) {
+                patch.vertex_offset = static_cast<int32_t>(batch.base_vertex);
+            }
+        }
+
+        // Bounding sphere around the center of the patch's bounding box.
+        glm::vec3 lo{std::numeric_limits<float>::max()};
+        glm::vec3 hi{-std::numeric_limits<float>::max()};
+        for (uint32_t i = range.first_element; i < range.first_element + range.element_count; ++i) {
+            const glm::vec3 &p = positions[indices[i]];
+            lo = glm::min(lo, p);
+            hi = glm::max(hi, p);
+        }
+        patch.center = (lo + hi) * 0.5f;
+        for (uint32_t i = range.first_element; i < range.first_element + range.element_count; ++i) {
+            const glm::vec3 &p = positions[indices[i]];
+            patch.radius = std::max(patch.radius, glm::length(p - patch.center));
+        }
+
+        // Normal cone around the average facet normal. The cutoff is the sine
+        // of the cone's half angle; a cone wider than a hemisphere can never
+        // be entirely back facing, so give it a cutoff the test can't pass.
+        std::vector<glm::vec3> facet_normals;
+        facet_normals.reserve(range.element_count / 3);
+        glm::vec3 axis{0.0f};
+        for (uint32_t i = range.first_element; i < range.first_element + range.element_count; i += 3) {
+            const glm::vec3 &v1 = positions[indices[i+0]];
+            const glm::vec3 &v2 = positions[indices[i+1]];
+            const glm::vec3 &v3 = positions[indices[i+2]];
+            glm::vec3 cross = glm::cross(v2 - v1, v3 - v1);
+            if (glm::length(cross) > 0.0f) {
+                facet_normals.push_back(glm::normalize(cross));
+                axis += facet_normals.back();
+            }
+        }
+
+        if (facet_normals.empty() || glm::length(axis) == 0.0f) {
+            patch.cone_axis = glm::vec3{0.0f, 0.0f, 1.0f};
+            patch.cone_cutoff = 2.0f;
+        } else {
+            patch.cone_axis = glm::normalize(axis);
+            float min_dot = 1.0f;
+            for (const glm::vec3 &n : facet_normals) {
+                min_dot = std::min(min_dot, glm::dot(n, patch.cone_axis));
+            }
+            patch.cone_cutoff = min_dot <= 0.0f ? 2.0f : std::sqrt(1.0f - min_dot * min_dot);
+        }
+
+        m_patches.push_back(patch);
+    }
 }
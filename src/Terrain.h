@@ -4,33 +4,127 @@
 #define _VPLANET_TERRAIN_H_
 
 #include <array>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
 #include <vector>
 
 #include "vulkan.h"
 #include "glm.h"
 
+#include "MeshCache.h"
+#include "Models.h"
 #include "Noise.h"
 
+// The parent position and normal are where the vertex sits on the next
+// coarser mesh, so the vertex shader can morph between the two levels.
 struct TerrainVertex {
     glm::vec3 position;
     glm::vec3 normal;
-    static const int NUM_ATTRIBUTES = 2;
+    glm::vec3 parent_position;
+    glm::vec3 parent_normal;
+    static const int NUM_ATTRIBUTES = 4;
 
     static vk::VertexInputBindingDescription bindingDescription();
     static std::array<vk::VertexInputAttributeDescription, NUM_ATTRIBUTES> attributeDescription();
 };
 
+// TerrainVertex packed into 20 bytes instead of 48. Positions are an
+// octahedral direction plus a radius quantized between the mesh's minimum
+// and maximum radius, which the vertex shader gets as draw parameters;
+// normals are octahedral.
+struct CompactTerrainVertex {
+    uint16_t position[4];          // direction (2), radius, parent radius; unorm
+    uint16_t parent_direction[2];  // unorm
+    int16_t normal[2];             // snorm
+    int16_t parent_normal[2];      // snorm
+    static const int NUM_ATTRIBUTES = 4;
+
+    static CompactTerrainVertex encode(const TerrainVertex &vertex, float min_radius, float max_radius);
+
+    static vk::VertexInputBindingDescription bindingDescription();
+    static std::array<vk::VertexInputAttributeDescription, NUM_ATTRIBUTES> attributeDescription();
+};
+
+// A contiguous range of the terrain's index buffer, along with the bounds
+// used to cull it, and the base vertex of the index batch it's in. The
+// layout matches PatchBounds in terrain_cull.slang.
+struct TerrainPatch {
+    glm::vec3 center;
+    float radius;
+    glm::vec3 cone_axis;
+    float cone_cutoff;
+    uint32_t first_index;
+    uint32_t index_count;
+    int32_t vertex_offset;
+    uint32_t padding;
+};
+
 class Terrain {
 public:
-    Terrain(float radius, int refinements, const NoiseFunction &noise);
+    Terrain(
+        float radius,
+        int refinements,
+        const NoiseFunction &noise,
+        int patch_refinements = 0,
+        IndexWidth index_width = IndexWidth::e32
+    );
+    Terrain(const Terrain &other) = delete;
     ~Terrain();
 
-    const std::vector<TerrainVertex>& vertices() const;
+    Terrain &operator=(const Terrain &other) = delete;
+
+    // Identifies the terrain the constructor would build from the same
+    // arguments, for the mesh cache.
+    static uint64_t cacheKey(
+        float radius,
+        int refinements,
+        const NoiseFunction &noise,
+        int patch_refinements,
+        IndexWidth index_width
+    );
+
+    // Null if there's no usable cache file. A loaded terrain's vertices stay
+    // in the file's mapping, ready to be copied straight to the GPU.
+    static std::unique_ptr<Terrain> load(const std::filesystem::path &path, uint64_t key);
+    void save(const std::filesystem::path &path, uint64_t key) const;
+
+    int refinements() const;
+    std::span<const CompactTerrainVertex> vertices() const;
+
+    // 32-bit indices into vertices(), whatever the index width.
     const std::vector<uint32_t>& elements() const;
 
+    // With 16-bit indices, elements() narrowed batch by batch; otherwise
+    // null. There's always at least one batch.
+    IndexWidth indexWidth() const;
+    const ShortElements* shortElements() const;
+    const std::vector<IndexBatch>& indexBatches() const;
+
+    const std::vector<TerrainPatch>& patches() const;
+    const Meshlets& meshlets() const;
+    float minRadius() const;
+    float maxRadius() const;
+
 private:
-    std::vector<TerrainVertex> m_vertices;
-    std::vector<uint32_t> m_indices;
+    Terrain();
+
+    void computePatchBounds(const std::vector<glm::vec3> &positions, const std::vector<PatchRange> &ranges);
+
+    int m_refinements;
+
+    // The vertices are either generated into m_vertices or mapped from a
+    // cache file.
+    std::vector<CompactTerrainVertex> m_vertices;
+    std::shared_ptr<const MappedFile> m_mapping;
+    std::span<const CompactTerrainVertex> m_vertex_data;
+    std::shared_ptr<const std::vector<uint32_t>> m_indices;
+    std::shared_ptr<const ShortElements> m_short_indices;
+    std::vector<IndexBatch> m_batches;
+    std::vector<TerrainPatch> m_patches;
+    Meshlets m_meshlets;
+    float m_min_radius, m_max_radius;
 };
 
 #endif
@@ -0,0 +1,250 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <vector>
+
+#include "vulkan.h"
+#include "glm.h"
+
+#include "Models.h"
+#include "TerrainChunks.h"
+
+vk::VertexInputBindingDescription TerrainChunkVertex::bindingDescription() {
+    return vk::VertexInputBindingDescription{
+        .binding = 0,
+        .stride = sizeof(TerrainChunkVertex),
+        .inputRate = vk::VertexInputRate::eVertex,
+    };
+}
+
+std::array<vk::VertexInputAttributeDescription, TerrainChunkVertex::NUM_ATTRIBUTES> TerrainChunkVertex::attributeDescription() {
+    return std::array<vk::VertexInputAttributeDescription, TerrainChunkVertex::NUM_ATTRIBUTES>{
+        vk::VertexInputAttributeDescription{
+            .location = 0,
+            .binding = 0,
+            .format = vk::Format::eR32G32B32Sfloat,
+            .offset = offsetof(TerrainChunkVertex, position),
+        },
+        vk::VertexInputAttributeDescription{
+            .location = 1,
+            .binding = 0,
+            .format = vk::Format::eR32G32B32Sfloat,
+            .offset = offsetof(TerrainChunkVertex, normal),
+        },
+    };
+}
+
+TerrainChunkKey TerrainChunkKey::child(uint32_t index) const {
+    return TerrainChunkKey{
+        .face = face,
+        .level = level + 1,
+        .path = (path << 2) | index,
+    };
+}
+
+size_t TerrainChunkKeyHash::operator()(const TerrainChunkKey &key) const {
+    size_t h = std::hash<uint64_t>{}(key.path);
+    h ^= std::hash<uint64_t>{}((static_cast<uint64_t>(key.face) << 32) | key.level) + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+    return h;
+}
+
+TerrainChunkGenerator::TerrainChunkGenerator(float radius, const NoiseFunction &noise, uint32_t resolution)
+    : m_radius{radius},
+      m_noise{noise},
+      m_resolution{resolution},
+      m_grid_vertices{(resolution + 1) * (resolution + 2) / 2},
+      m_vertices_per_chunk{m_grid_vertices + 3 * resolution},
+      m_indices{}
+{
+    buildIndices();
+}
+
+TerrainChunkGenerator::~TerrainChunkGenerator() {}
+
+float TerrainChunkGenerator::radius() const {
+    return m_radius;
+}
+
+uint32_t TerrainChunkGenerator::resolution() const {
+    return m_resolution;
+}
+
+uint32_t TerrainChunkGenerator::verticesPerChunk() const {
+    return m_vertices_per_chunk;
+}
+
+const std::vector<uint32_t>& TerrainChunkGenerator::indices() const {
+    return m_indices;
+}
+
+std::array<glm::vec3, 3> TerrainChunkGenerator::faceCorners(uint32_t face) const {
+    std::array<glm::vec3, 3> corners;
+    for (int i = 0; i < 3; ++i) {
+        const double *v = ICOSAHEDRON_VERTICES[ICOSAHEDRON_ELEMS[3*face + i]];
+        corners[i] = glm::normalize(glm::vec3{v[0], v[1], v[2]});
+    }
+    return corners;
+}
+
+std::array<glm::vec3, 3> TerrainChunkGenerator::childCorners(const std::array<glm::vec3, 3> &corners, uint32_t index) const {
+    // Same split as refine() in Models.cpp, with the midpoints pushed out
+    // onto the unit sphere.
+    const glm::vec3 &a = corners[0];
+    const glm::vec3 &b = corners[1];
+    const glm::vec3 &c = corners[2];
+    glm::vec3 ab = glm::normalize(a + b);
+    glm::vec3 bc = glm::normalize(b + c);
+    glm::vec3 ca = glm::normalize(c + a);
+
+    switch (index) {
+    case 0: return {a, ab, ca};
+    case 1: return {b, bc, ab};
+    case 2: return {c, ca, bc};
+    default: return {ab, bc, ca};
+    }
+}
+
+std::array<glm::vec3, 3> TerrainChunkGenerator::corners(const TerrainChunkKey &key) const {
+    // The path's first split is in its highest bits.
+    std::array<glm::vec3, 3> rv = faceCorners(key.face);
+    for (uint32_t level = key.level; level > 0; --level) {
+        rv = childCorners(rv, static_cast<uint32_t>((key.path >> (2 * (level - 1))) & 3));
+    }
+    return rv;
+}
+
+float TerrainChunkGenerator::geometricError(const std::array<glm::vec3, 3> &corners) const {
+    // Grid spacing along the longest edge.
+    float angle = 0.0f;
+    for (int i = 0; i < 3; ++i) {
+        float d = glm::dot(corners[i], corners[(i + 1) % 3]);
+        angle = std::max(angle, std::acos(std::clamp(d, -1.0f, 1.0f)));
+    }
+    return m_radius * angle / m_resolution;
+}
+
+TerrainChunkData TerrainChunkGenerator::generate(const TerrainChunkKey &key, const std::array<glm::vec3, 3> &corners) const {
+    TerrainChunkData chunk{};
+    chunk.key = key;
+    chunk.corners = corners;
+    chunk.error = geometricError(corners);
+    chunk.min_surface_radius = std::numeric_limits<float>::max();
+    chunk.max_surface_radius = 0.0f;
+    chunk.vertices.resize(m_vertices_per_chunk);
+
+    const glm::vec3 &a = corners[0];
+    const glm::vec3 &b = corners[1];
+    const glm::vec3 &c = corners[2];
+    const uint32_t n = m_resolution;
+    float epsilon = chunk.error / m_radius * 0.5f;
+    std::vector<TerrainChunkVertex> &vertices = chunk.vertices;
+
+    // Row i runs from the a-b edge (j = 0) to the c-a edge (j = i).
+    for (uint32_t i = 0; i <= n; ++i) {
+        for (uint32_t j = 0; j <= i; ++j) {
+            float u = static_cast<float>(i - j) / n;
+            float v = static_cast<float>(j) / n;
+            glm::vec3 direction = glm::normalize(a * (1.0f - u - v) + b * u + c * v);
+            TerrainChunkVertex &vertex = vertices[i * (i + 1) / 2 + j];
+            vertex.position = displace(direction);
+            vertex.normal = surfaceNormal(direction, epsilon);
+        }
+    }
+
+    glm::vec3 lo{std::numeric_limits<float>::max()};
+    glm::vec3 hi{-std::numeric_limits<float>::max()};
+    for (uint32_t i = 0; i < m_grid_vertices; ++i) {
+        const glm::vec3 &p = vertices[i].position;
+        lo = glm::min(lo, p);
+        hi = glm::max(hi, p);
+        float r = glm::length(p);
+        chunk.min_surface_radius = std::min(chunk.min_surface_radius, r);
+        chunk.max_surface_radius = std::max(chunk.max_surface_radius, r);
+    }
+
+    // The skirt hangs below the boundary far enough to cover the gap to a
+    // neighbour one level coarser.
+    float skirt_depth = 2.0f * chunk.error;
+    uint32_t k = m_grid_vertices;
+    auto addSkirt = [&](uint32_t i, uint32_t j) {
+        const TerrainChunkVertex &edge = vertices[i * (i + 1) / 2 + j];
+        vertices[k].position = edge.position - glm::normalize(edge.position) * skirt_depth;
+        vertices[k].normal = edge.normal;
+        lo = glm::min(lo, vertices[k].position);
+        hi = glm::max(hi, vertices[k].position);
+        ++k;
+    };
+    for (uint32_t i = 0; i < n; ++i) addSkirt(i, 0);
+    for (uint32_t j = 0; j < n; ++j) addSkirt(n, j);
+    for (uint32_t i = n; i > 0; --i) addSkirt(i, i);
+
+    chunk.center = (lo + hi) * 0.5f;
+    chunk.radius = 0.0f;
+    for (const TerrainChunkVertex &vertex : vertices) {
+        chunk.radius = std::max(chunk.radius, glm::length(vertex.position - chunk.center));
+    }
+
+    return chunk;
+}
+
+glm::vec3 TerrainChunkGenerator::displace(const glm::vec3 &direction) const {
+    // Same displacement as Terrain.
+    glm::vec3 pos = direction * m_radius;
+    double n = m_noise(pos.x, pos.y, pos.z);
+    return pos * static_cast<float>(n/8.0 + 1.0);
+}
+
+glm::vec3 TerrainChunkGenerator::surfaceNormal(const glm::vec3 &direction, float epsilon) const {
+    // Central differences of the displaced surface along two tangents.
+    glm::vec3 up = std::abs(direction.y) < 0.9f ? glm::vec3{0.0f, 1.0f, 0.0f} : glm::vec3{1.0f, 0.0f, 0.0f};
+    glm::vec3 t1 = glm::normalize(glm::cross(up, direction));
+    glm::vec3 t2 = glm::cross(direction, t1);
+
+    glm::vec3 du = displace(glm::normalize(direction + t1 * epsilon)) - displace(glm::normalize(direction - t1 * epsilon));
+    glm::vec3 dv = displace(glm::normalize(direction + t2 * epsilon)) - displace(glm::normalize(direction - t2 * epsilon));
+    glm::vec3 normal = glm::normalize(glm::cross(du, dv));
+    return glm::dot(normal, direction) < 0.0f ? -normal : normal;
+}
+
+void TerrainChunkGenerator::buildIndices() {
+    const uint32_t n = m_resolution;
+    auto index = [](uint32_t i, uint32_t j) { return i * (i + 1) / 2 + j; };
+
+    m_indices.clear();
+    m_indices.reserve(3 * (n * n + 6 * n));
+
+    // Grid triangles, wound the same way as the face.
+    for (uint32_t i = 0; i < n; ++i) {
+        for (uint32_t j = 0; j <= i; ++j) {
+            m_indices.insert(m_indices.end(), {index(i, j), index(i+1, j), index(i+1, j+1)});
+            if (j < i) {
+                m_indices.insert(m_indices.end(), {index(i, j), index(i+1, j+1), index(i, j+1)});
+            }
+        }
+    }
+
+    // Skirt quads around the boundary, which runs a -> b -> c, facing out.
+    std::vector<uint32_t> ring;
+    ring.reserve(3 * n);
+    for (uint32_t i = 0; i < n; ++i) ring.push_back(index(i, 0));
+    for (uint32_t j = 0; j < n; ++j) ring.push_back(index(n, j));
+    for (uint32_t i = n; i > 0; --i) ring.push_back(index(i, i));
+
+    uint32_t num_ring = static_cast<uint32_t>(ring.size());
+    for (uint32_t k = 0; k < num_ring; ++k) {
+        uint32_t next = (k + 1) % num_ring;
+        uint32_t v0 = ring[k], v1 = ring[next];
+        uint32_t s0 = m_grid_vertices + k, s1 = m_grid_vertices + next;
+        m_indices.insert(m_indices.end(), {v0, s0, v1});
+        m_indices.insert(m_indices.end(), {v1, s0, s1});
+    }
+
+    // The vertex layout is fixed by generate(), so only the triangle order
+    // is optimized.
+    optimizeVertexCache(m_indices, { PatchRange{0, static_cast<unsigned int>(m_indices.size())} });
+}
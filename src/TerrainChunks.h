@@ -0,0 +1,90 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#ifndef _VPLANET_TERRAIN_CHUNKS_H_
+#define _VPLANET_TERRAIN_CHUNKS_H_
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "vulkan.h"
+#include "glm.h"
+
+#include "Noise.h"
+#include "Terrain.h"
+
+// Chunks don't morph, so unlike TerrainVertex they have no parent position
+// or normal: 24 bytes a vertex.
+struct TerrainChunkVertex {
+    glm::vec3 position;
+    glm::vec3 normal;
+    static const int NUM_ATTRIBUTES = 2;
+
+    static vk::VertexInputBindingDescription bindingDescription();
+    static std::array<vk::VertexInputAttributeDescription, NUM_ATTRIBUTES> attributeDescription();
+};
+
+// Names a node of the chunk tree: one of the 20 icosahedron faces, split
+// `level` times, with two bits of `path` per level choosing the child.
+struct TerrainChunkKey {
+    uint32_t face;
+    uint32_t level;
+    uint64_t path;
+
+    TerrainChunkKey child(uint32_t index) const;
+    bool operator==(const TerrainChunkKey &other) const = default;
+};
+
+struct TerrainChunkKeyHash {
+    size_t operator()(const TerrainChunkKey &key) const;
+};
+
+// A generated chunk: its bounds, its geometric error (the grid spacing on
+// the sphere), the range of surface radii it covers, and its vertices.
+struct TerrainChunkData {
+    TerrainChunkKey key;
+    std::array<glm::vec3, 3> corners;
+    glm::vec3 center;
+    float radius;
+    float error;
+    float min_surface_radius, max_surface_radius;
+    std::vector<TerrainChunkVertex> vertices;
+};
+
+// Builds chunks of the chunk tree. Every chunk is the same triangular grid
+// of `resolution` triangles along an edge, plus a skirt to hide cracks
+// between levels, so they all share one index list. Only reads state fixed
+// at construction, so chunks can be generated from any thread.
+class TerrainChunkGenerator {
+public:
+    static const uint32_t NUM_FACES = 20;
+
+    TerrainChunkGenerator(float radius, const NoiseFunction &noise, uint32_t resolution);
+    ~TerrainChunkGenerator();
+
+    float radius() const;
+    uint32_t resolution() const;
+    uint32_t verticesPerChunk() const;
+    const std::vector<uint32_t>& indices() const;
+
+    std::array<glm::vec3, 3> faceCorners(uint32_t face) const;
+    std::array<glm::vec3, 3> childCorners(const std::array<glm::vec3, 3> &corners, uint32_t index) const;
+    std::array<glm::vec3, 3> corners(const TerrainChunkKey &key) const;
+    float geometricError(const std::array<glm::vec3, 3> &corners) const;
+
+    TerrainChunkData generate(const TerrainChunkKey &key, const std::array<glm::vec3, 3> &corners) const;
+
+private:
+    glm::vec3 displace(const glm::vec3 &direction) const;
+    glm::vec3 surfaceNormal(const glm::vec3 &direction, float epsilon) const;
+
+    void buildIndices();
+
+    float m_radius;
+    const NoiseFunction &m_noise;
+    uint32_t m_resolution;
+    uint32_t m_grid_vertices, m_vertices_per_chunk;
+    std::vector<uint32_t> m_indices;
+};
+
+#endif
@@ -0,0 +1,498 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+
+#include "glm.h"
+
+#include "Culling.h"
+#include "TerrainLod.h"
+
+static const uint32_t NO_SLOT = std::numeric_limits<uint32_t>::max();
+
+TerrainLod::TerrainLod(
+    float radius,
+    const NoiseFunction &noise,
+    ThreadPool &threads,
+    uint64_t budget_bytes,
+    uint32_t resolution,
+    const std::filesystem::path &tile_directory
+)
+    : m_radius{radius},
+      m_generator{radius, noise, resolution},
+      m_threads{threads},
+      m_budget_bytes{budget_bytes},
+      m_capacity{static_cast<uint32_t>(std::min<uint64_t>(budget_bytes / chunkBytes(), NO_SLOT))},
+      m_tiles{},
+      m_tile_max_level{0},
+      m_max_pixel_error{6.0f},
+      m_max_level{DEFAULT_MAX_LEVEL},
+      m_max_jobs_in_flight{DEFAULT_MAX_JOBS_IN_FLIGHT},
+      m_uploads_per_frame{DEFAULT_UPLOADS_PER_FRAME},
+      m_min_surface_radius{std::numeric_limits<float>::max()},
+      m_max_surface_radius{0.0f},
+      m_gpu_generation{false},
+      m_chunks{},
+      m_lru{},
+      m_free_slots{},
+      m_draw_slots{},
+      m_shadow_casters{},
+      m_residency_changed{false},
+      m_uploads{},
+      m_generations{},
+      m_pending{},
+      m_requests{},
+      m_generated_chunks{},
+      m_backlog{},
+      m_jobs_mutex{},
+      m_jobs_done{},
+      m_jobs_in_flight{0},
+      m_num_loaded{0},
+      m_num_generated{0},
+      m_num_evicted{0},
+      m_num_dropped{0},
+      m_frame{0},
+      m_generated{0},
+      m_eye{0.0f},
+      m_frustum{},
+      m_projection_scale{1.0f}
+{
+    if (m_capacity < TerrainChunkGenerator::NUM_FACES) {
+        throw std::runtime_error("Terrain chunk budget doesn't fit the face chunks");
+    }
+
+    // Tiles baked from other arguments would be a different planet.
+    if (!tile_directory.empty()) {
+        uint64_t key = TerrainTileSet::tileKey(radius, noise, resolution);
+        std::optional<TerrainTileSetInfo> info = TerrainTileSet::readManifest(tile_directory, key);
+        if (info) {
+            m_tiles.emplace(tile_directory, key);
+            m_tile_max_level = info->max_level;
+        }
+    }
+
+    // Hand out low slots first.
+    m_free_slots.reserve(m_capacity);
+    for (uint32_t i = m_capacity; i > 0; --i) {
+        m_free_slots.push_back(i - 1);
+    }
+
+    // The face chunks are never evicted once they arrive, so there is always
+    // something to draw, and they give the first estimate of the surface's
+    // height range.
+    for (uint32_t face = 0; face < TerrainChunkGenerator::NUM_FACES; ++face) {
+        request(TerrainChunkKey{face, 0, 0}, m_generator.faceCorners(face), std::numeric_limits<float>::max());
+    }
+    submitRequests();
+}
+
+TerrainLod::~TerrainLod() {
+    // Queued jobs refer to this object, so let them finish.
+    std::unique_lock<std::mutex> lock{m_jobs_mutex};
+    m_jobs_done.wait(lock, [this] { return m_jobs_in_flight == 0; });
+}
+
+uint32_t TerrainLod::capacity() const {
+    return m_capacity;
+}
+
+uint64_t TerrainLod::chunkBytes() const {
+    return uint64_t{m_generator.verticesPerChunk()} * sizeof(TerrainChunkVertex);
+}
+
+uint32_t TerrainLod::uploadsPerFrame() const {
+    return m_uploads_per_frame;
+}
+
+bool TerrainLod::hasTiles() const {
+    return m_tiles.has_value();
+}
+
+uint32_t TerrainLod::tileMaxLevel() const {
+    return m_tile_max_level;
+}
+
+uint32_t TerrainLod::verticesPerChunk() const {
+    return m_generator.verticesPerChunk();
+}
+
+const std::vector<uint32_t>& TerrainLod::chunkIndices() const {
+    return m_generator.indices();
+}
+
+const TerrainChunkGenerator &TerrainLod::generator() const {
+    return m_generator;
+}
+
+float TerrainLod::maxPixelError() const {
+    return m_max_pixel_error;
+}
+
+void TerrainLod::setMaxPixelError(float pixels) {
+    m_max_pixel_error = std::max(pixels, 0.5f);
+}
+
+uint32_t TerrainLod::maxLevel() const {
+    return m_max_level;
+}
+
+void TerrainLod::setMaxLevel(uint32_t level) {
+    // Two bits of path per level.
+    m_max_level = std::min(level, 31u);
+}
+
+bool TerrainLod::gpuGeneration() const {
+    return m_gpu_generation;
+}
+
+void TerrainLod::setGpuGeneration(bool enabled) {
+    m_gpu_generation = enabled;
+}
+
+void TerrainLod::boundSurface(float min_radius, float max_radius) {
+    m_min_surface_radius = std::min(m_min_surface_radius, min_radius);
+    m_max_surface_radius = std::max(m_max_surface_radius, max_radius);
+}
+
+void TerrainLod::update(const glm::vec3 &eye, const Frustum &frustum, float projection_scale) {
+    ++m_frame;
+    m_eye = eye;
+    m_frustum = frustum;
+    m_projection_scale = projection_scale;
+    m_generated = 0;
+    m_draw_slots.clear();
+
+    for (uint32_t face = 0; face < TerrainChunkGenerator::NUM_FACES; ++face) {
+        TerrainChunkKey key{face, 0, 0};
+        if (m_chunks.contains(key)) {
+            visit(key);
+        } else {
+            request(key, m_generator.faceCorners(face), std::numeric_limits<float>::max());
+        }
+    }
+    submitRequests();
+
+    // Chunks taken in now are drawn from the next update on.
+    takeGenerated();
+
+    if (m_residency_changed) {
+        m_shadow_casters.clear();
+        for (uint32_t face = 0; face < TerrainChunkGenerator::NUM_FACES; ++face) {
+            TerrainChunkKey key{face, 0, 0};
+            auto it = m_chunks.find(key);
+            if (it != m_chunks.end()) {
+                addShadowCasters(key, it->second);
+            }
+        }
+        m_residency_changed = false;
+    }
+}
+
+const std::vector<uint32_t>& TerrainLod::drawSlots() const {
+    return m_draw_slots;
+}
+
+const std::vector<TerrainShadowCaster>& TerrainLod::shadowCasters() const {
+    return m_shadow_casters;
+}
+
+std::vector<TerrainChunkUpload> TerrainLod::takeUploads() {
+    std::vector<TerrainChunkUpload> uploads;
+    std::swap(uploads, m_uploads);
+    return uploads;
+}
+
+std::vector<TerrainChunkGeneration> TerrainLod::takeGenerations() {
+    std::vector<TerrainChunkGeneration> generations;
+    std::swap(generations, m_generations);
+    return generations;
+}
+
+uint32_t TerrainLod::numResident() const {
+    return static_cast<uint32_t>(m_chunks.size());
+}
+
+uint32_t TerrainLod::numPending() const {
+    return static_cast<uint32_t>(m_pending.size());
+}
+
+uint32_t TerrainLod::numGenerated() const {
+    return m_generated;
+}
+
+TerrainLodStats TerrainLod::stats() const {
+    uint32_t resident = numResident();
+    return TerrainLodStats{
+        .resident = resident,
+        .capacity = m_capacity,
+        .resident_bytes = resident * chunkBytes(),
+        .budget_bytes = m_budget_bytes,
+        .pending = numPending(),
+        .loaded = m_num_loaded.load(std::memory_order_relaxed),
+        .generated = m_num_generated.load(std::memory_order_relaxed),
+        .evicted = m_num_evicted,
+        .dropped = m_num_dropped,
+    };
+}
+
+void TerrainLod::estimateBounds(const std::array<glm::vec3, 3> &corners, glm::vec3 &center, float &radius) const {
+    // The chunk lies between the lowest and highest surface seen so far, and
+    // on the sphere its middle bulges out past the plane of its corners.
+    float lo = m_min_surface_radius;
+    float hi = m_max_surface_radius;
+    if (lo > hi) {
+        lo = m_radius * 0.75f;
+        hi = m_radius * 1.25f;
+    }
+
+    glm::vec3 middle = glm::normalize(corners[0] + corners[1] + corners[2]);
+    center = middle * (lo + hi) * 0.5f;
+    radius = glm::length(middle * hi - center);
+    for (const glm::vec3 &corner : corners) {
+        radius = std::max(radius, glm::length(corner * lo - center));
+        radius = std::max(radius, glm::length(corner * hi - center));
+    }
+}
+
+bool TerrainLod::isVisible(const glm::vec3 &center, float radius) const {
+    // The lowest surface seen so far is only sampled, so keep a little
+    // margin under it for the occluder.
+    return sphereInFrustum(m_frustum, center, radius)
+        && !sphereBelowHorizon(m_eye, m_min_surface_radius * 0.98f, m_max_surface_radius, center, radius);
+}
+
+float TerrainLod::pixelError(const Chunk &chunk) const {
+    float distance = std::max(glm::length(chunk.center - m_eye) - chunk.radius, 1e-4f);
+    return chunk.error * m_projection_scale / distance;
+}
+
+void TerrainLod::touch(Chunk &chunk) {
+    chunk.last_used = m_frame;
+    m_lru.splice(m_lru.begin(), m_lru, chunk.lru);
+}
+
+void TerrainLod::visit(const TerrainChunkKey &key) {
+    Chunk &chunk = m_chunks.at(key);
+    touch(chunk);
+
+    if (!isVisible(chunk.center, chunk.radius)) {
+        return;
+    }
+
+    // Only descend once every visible child is resident; until then keep
+    // drawing this chunk so there are no holes.
+    float pixels = pixelError(chunk);
+    if (key.level < m_max_level && pixels > m_max_pixel_error) {
+        std::array<bool, 4> visible;
+        bool ready = true;
+        for (uint32_t i = 0; i < 4; ++i) {
+            std::array<glm::vec3, 3> corners = m_generator.childCorners(chunk.corners, i);
+            TerrainChunkKey child = key.child(i);
+            auto it = m_chunks.find(child);
+            if (it != m_chunks.end()) {
+                touch(it->second);
+                visible[i] = isVisible(it->second.center, it->second.radius);
+            } else {
+                glm::vec3 center;
+                float radius;
+                estimateBounds(corners, center, radius);
+                visible[i] = isVisible(center, radius);
+                if (visible[i] && !request(child, corners, pixels)) {
+                    ready = false;
+                }
+            }
+        }
+
+        if (ready) {
+            for (uint32_t i = 0; i < 4; ++i) {
+                if (visible[i]) {
+                    visit(key.child(i));
+                }
+            }
+            return;
+        }
+    }
+
+    m_draw_slots.push_back(chunk.slot);
+}
+
+void TerrainLod::addShadowCasters(const TerrainChunkKey &key, const Chunk &chunk) {
+    // Children only replace their parent all together, like in visit(),
+    // so the casters never leave a hole.
+    std::array<const Chunk*, 4> children{};
+    for (uint32_t i = 0; i < 4; ++i) {
+        auto it = m_chunks.find(key.child(i));
+        if (it == m_chunks.end()) {
+            m_shadow_casters.push_back(TerrainShadowCaster{chunk.slot, chunk.center, chunk.radius});
+            return;
+        }
+        children[i] = &it->second;
+    }
+    for (uint32_t i = 0; i < 4; ++i) {
+        addShadowCasters(key.child(i), *children[i]);
+    }
+}
+
+bool TerrainLod::request(const TerrainChunkKey &key, const std::array<glm::vec3, 3> &corners, float priority) {
+    if (m_chunks.contains(key)) {
+        return true;
+    }
+    if (!m_pending.contains(key)) {
+        m_requests.push_back(ChunkRequest{key, corners, priority});
+    }
+    return false;
+}
+
+void TerrainLod::submitRequests() {
+    if (m_gpu_generation) {
+        generateRequestsOnGpu();
+    }
+
+    // Start jobs for the chunks whose absence costs the most pixels, as
+    // many as there is room for; the rest are asked for again next update.
+    size_t room = m_max_jobs_in_flight - std::min<size_t>(m_pending.size(), m_max_jobs_in_flight);
+    size_t count = std::min(room, m_requests.size());
+    std::partial_sort(
+        m_requests.begin(), m_requests.begin() + count, m_requests.end(),
+        [](const ChunkRequest &a, const ChunkRequest &b) { return a.priority > b.priority; }
+    );
+
+    // Workers run their newest job first, so submit the most wanted last.
+    for (size_t i = count; i > 0; --i) {
+        const ChunkRequest &request = m_requests[i - 1];
+        m_pending.insert(request.key);
+        {
+            std::lock_guard<std::mutex> lock{m_jobs_mutex};
+            ++m_jobs_in_flight;
+        }
+        m_threads.submit([this, key = request.key, corners = request.corners] {
+            m_generated_chunks.push(loadChunk(key, corners));
+            // The last thing the job does with this object: once the lock
+            // is released, the destructor may run.
+            std::lock_guard<std::mutex> lock{m_jobs_mutex};
+            --m_jobs_in_flight;
+            m_jobs_done.notify_all();
+        });
+    }
+    m_requests.clear();
+}
+
+void TerrainLod::generateRequestsOnGpu() {
+    // Whatever would be read from the tiles still goes to the workers. The
+    // rest become resident now, most wanted first, as far as the frame's
+    // uploads and the free slots go; the others are asked for again.
+    auto tiled = [this](const ChunkRequest &request) {
+        return m_tiles && request.key.level <= m_tile_max_level;
+    };
+    auto gpu_begin = std::stable_partition(m_requests.begin(), m_requests.end(), tiled);
+    std::sort(gpu_begin, m_requests.end(), [](const ChunkRequest &a, const ChunkRequest &b) {
+        return a.priority > b.priority;
+    });
+
+    for (auto it = gpu_begin; it != m_requests.end() && m_generated < m_uploads_per_frame; ++it) {
+        uint32_t slot = acquireSlot();
+        if (slot == NO_SLOT) {
+            break;
+        }
+
+        Chunk &chunk = m_chunks[it->key];
+        chunk.corners = it->corners;
+        estimateBounds(it->corners, chunk.center, chunk.radius);
+        chunk.error = m_generator.geometricError(it->corners);
+        chunk.slot = slot;
+        chunk.last_used = m_frame;
+        m_lru.push_front(it->key);
+        chunk.lru = m_lru.begin();
+
+        m_generations.push_back(TerrainChunkGeneration{slot, it->corners, chunk.error});
+        m_residency_changed = true;
+        m_num_generated.fetch_add(1, std::memory_order_relaxed);
+        ++m_generated;
+    }
+    m_requests.erase(gpu_begin, m_requests.end());
+}
+
+TerrainChunkData TerrainLod::loadChunk(const TerrainChunkKey &key, const std::array<glm::vec3, 3> &corners) {
+    // Tiles missing from a partial bake are made here instead.
+    if (m_tiles && key.level <= m_tile_max_level) {
+        std::optional<TerrainChunkData> tile = m_tiles->readTile(key);
+        if (tile) {
+            m_num_loaded.fetch_add(1, std::memory_order_relaxed);
+            return std::move(*tile);
+        }
+    }
+    m_num_generated.fetch_add(1, std::memory_order_relaxed);
+    return m_generator.generate(key, corners);
+}
+
+void TerrainLod::takeGenerated() {
+    std::vector<TerrainChunkData> finished = m_generated_chunks.takeAll();
+    m_backlog.insert(m_backlog.end(), std::make_move_iterator(finished.begin()), std::make_move_iterator(finished.end()));
+
+    size_t taken = 0;
+    while (taken < m_backlog.size() && m_generated < m_uploads_per_frame) {
+        TerrainChunkData &generated = m_backlog[taken++];
+        m_pending.erase(generated.key);
+
+        // If every slot is in use this frame, drop it; it will be asked for
+        // again if it is still wanted.
+        uint32_t slot = acquireSlot();
+        if (slot == NO_SLOT) {
+            ++m_num_dropped;
+            continue;
+        }
+
+        m_min_surface_radius = std::min(m_min_surface_radius, generated.min_surface_radius);
+        m_max_surface_radius = std::max(m_max_surface_radius, generated.max_surface_radius);
+
+        Chunk &chunk = m_chunks[generated.key];
+        chunk.corners = generated.corners;
+        chunk.center = generated.center;
+        chunk.radius = generated.radius;
+        chunk.error = generated.error;
+        chunk.slot = slot;
+        chunk.last_used = m_frame;
+        m_lru.push_front(generated.key);
+        chunk.lru = m_lru.begin();
+
+        m_uploads.push_back(TerrainChunkUpload{slot, std::move(generated.vertices)});
+        m_residency_changed = true;
+        ++m_generated;
+    }
+    m_backlog.erase(m_backlog.begin(), m_backlog.begin() + taken);
+}
+
+uint32_t TerrainLod::acquireSlot() {
+    if (!m_free_slots.empty()) {
+        uint32_t slot = m_free_slots.back();
+        m_free_slots.pop_back();
+        return slot;
+    }
+
+    // Evict the least recently used chunk that isn't a face chunk and wasn't
+    // touched during this update. The face chunks are touched every update,
+    // so only the back of the list is ever looked at.
+    for (auto it = m_lru.rbegin(); it != m_lru.rend(); ++it) {
+        auto victim = m_chunks.find(*it);
+        if (victim->second.last_used == m_frame) {
+            break;
+        }
+        if (victim->first.level == 0) {
+            continue;
+        }
+
+        uint32_t slot = victim->second.slot;
+        m_lru.erase(victim->second.lru);
+        m_chunks.erase(victim);
+        ++m_num_evicted;
+        m_residency_changed = true;
+        return slot;
+    }
+    return NO_SLOT;
+}
+
@@ -0,0 +1,227 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#ifndef _VPLANET_TERRAIN_LOD_H_
+#define _VPLANET_TERRAIN_LOD_H_
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "glm.h"
+
+#include "CompletionQueue.h"
+#include "Culling.h"
+#include "Noise.h"
+#include "Terrain.h"
+#include "TerrainChunks.h"
+#include "TerrainTiles.h"
+#include "ThreadPool.h"
+
+// Vertex data for a chunk that has to be copied into its slot in the GPU
+// chunk pool.
+struct TerrainChunkUpload {
+    uint32_t slot;
+    std::vector<TerrainChunkVertex> vertices;
+};
+
+// A chunk to be generated on the GPU straight into its slot in the chunk
+// pool, from the corners and geometric error TerrainChunkGenerator would
+// generate it from.
+struct TerrainChunkGeneration {
+    uint32_t slot;
+    std::array<glm::vec3, 3> corners;
+    float error;
+};
+
+// A resident chunk to draw into the shadow maps, with its bounds in model
+// space for culling against each cascade.
+struct TerrainShadowCaster {
+    uint32_t slot;
+    glm::vec3 center;
+    float radius;
+
+    bool operator==(const TerrainShadowCaster &other) const = default;
+};
+
+// Counters for the streaming, cumulative since construction except where
+// noted.
+struct TerrainLodStats {
+    uint32_t resident;
+    uint32_t capacity;
+    uint64_t resident_bytes;
+    uint64_t budget_bytes;
+    uint32_t pending;
+    uint64_t loaded;
+    uint64_t generated;
+    uint64_t evicted;
+    uint64_t dropped;
+};
+
+// Chunked level of detail over the icosahedron faces. Every chunk is the
+// same triangular grid (see TerrainChunkGenerator), so all of them share one
+// index buffer and live in fixed size slots of one vertex buffer, as many
+// as fit the memory budget. Chunks are split when their grid spacing
+// projects to more than maxPixelError() pixels. They are read from a baked
+// tile set if there is one, or generated, by jobs on a thread pool, most
+// projected error first; update() never waits for a job. Once the slots
+// are full, the least recently used chunks are evicted to make room.
+//
+// With GPU generation on, chunks that aren't in the tiles are handed out
+// to be generated on the GPU instead (see takeGenerations()) and are
+// resident straight away. Their vertices never reach the CPU, so their
+// bounds are estimated from their corners and the range of surface radii
+// given to boundSurface().
+class TerrainLod {
+public:
+    static const uint32_t DEFAULT_RESOLUTION = 16;
+    static const uint32_t DEFAULT_MAX_LEVEL = 16;
+    static const uint32_t DEFAULT_MAX_JOBS_IN_FLIGHT = 64;
+    static const uint32_t DEFAULT_UPLOADS_PER_FRAME = 32;
+
+    // Chunks are read from the tiles in tile_directory, down to the level
+    // they were baked to, if it holds a tile set (see TerrainTiles.h) made
+    // with the same arguments; any tile missing from it is generated.
+    TerrainLod(
+        float radius,
+        const NoiseFunction &noise,
+        ThreadPool &threads,
+        uint64_t budget_bytes,
+        uint32_t resolution = DEFAULT_RESOLUTION,
+        const std::filesystem::path &tile_directory = {}
+    );
+    ~TerrainLod();
+
+    uint32_t capacity() const;
+    uint64_t chunkBytes() const;
+    uint32_t uploadsPerFrame() const;
+    bool hasTiles() const;
+    uint32_t tileMaxLevel() const;
+    uint32_t verticesPerChunk() const;
+    const std::vector<uint32_t>& chunkIndices() const;
+    const TerrainChunkGenerator &generator() const;
+
+    float maxPixelError() const;
+    void setMaxPixelError(float pixels);
+    uint32_t maxLevel() const;
+    void setMaxLevel(uint32_t level);
+
+    bool gpuGeneration() const;
+    void setGpuGeneration(bool enabled);
+    // Widens the range of surface radii every chunk lies within, which is
+    // otherwise learned from the chunks generated on the CPU as they come.
+    void boundSurface(float min_radius, float max_radius);
+
+    // Select the chunks to draw from the given eye position (in model space),
+    // queue jobs for missing chunks, and take in up to uploadsPerFrame()
+    // finished ones. projection_scale is the viewport height divided by
+    // 2 tan(fovy / 2).
+    void update(const glm::vec3 &eye, const Frustum &frustum, float projection_scale);
+
+    const std::vector<uint32_t>& drawSlots() const;
+    // The finest resident chunks that cover the whole planet, whatever the
+    // view, since what shadows it may well be out of it. Only changes when
+    // chunks become resident or are evicted, not as the view moves.
+    const std::vector<TerrainShadowCaster>& shadowCasters() const;
+    std::vector<TerrainChunkUpload> takeUploads();
+    // Chunks to generate on the GPU; they count against the same
+    // uploadsPerFrame() as the uploads.
+    std::vector<TerrainChunkGeneration> takeGenerations();
+
+    uint32_t numResident() const;
+    uint32_t numPending() const;
+    uint32_t numGenerated() const;
+    TerrainLodStats stats() const;
+
+private:
+    // Resident chunks, most recently used first.
+    using LruList = std::list<TerrainChunkKey>;
+
+    struct Chunk {
+        std::array<glm::vec3, 3> corners;
+        glm::vec3 center;
+        float radius;
+        float error;
+        uint32_t slot;
+        uint64_t last_used;
+        LruList::iterator lru;
+    };
+
+    // A missing chunk wanted during this update, with the error in pixels
+    // of what is drawn in its place.
+    struct ChunkRequest {
+        TerrainChunkKey key;
+        std::array<glm::vec3, 3> corners;
+        float priority;
+    };
+
+    void estimateBounds(const std::array<glm::vec3, 3> &corners, glm::vec3 &center, float &radius) const;
+    bool isVisible(const glm::vec3 &center, float radius) const;
+    float pixelError(const Chunk &chunk) const;
+
+    void touch(Chunk &chunk);
+    void visit(const TerrainChunkKey &key);
+    void addShadowCasters(const TerrainChunkKey &key, const Chunk &chunk);
+    bool request(const TerrainChunkKey &key, const std::array<glm::vec3, 3> &corners, float priority);
+    void submitRequests();
+    void generateRequestsOnGpu();
+    TerrainChunkData loadChunk(const TerrainChunkKey &key, const std::array<glm::vec3, 3> &corners);
+    void takeGenerated();
+    uint32_t acquireSlot();
+
+    float m_radius;
+    TerrainChunkGenerator m_generator;
+    ThreadPool &m_threads;
+    uint64_t m_budget_bytes;
+    uint32_t m_capacity;
+    std::optional<TerrainTileSet> m_tiles;
+    uint32_t m_tile_max_level;
+
+    float m_max_pixel_error;
+    uint32_t m_max_level;
+    uint32_t m_max_jobs_in_flight;
+    uint32_t m_uploads_per_frame;
+    float m_min_surface_radius, m_max_surface_radius;
+    bool m_gpu_generation;
+
+    std::unordered_map<TerrainChunkKey, Chunk, TerrainChunkKeyHash> m_chunks;
+    LruList m_lru;
+    std::vector<uint32_t> m_free_slots;
+    std::vector<uint32_t> m_draw_slots;
+    // Rebuilt at the end of an update that changed what's resident.
+    std::vector<TerrainShadowCaster> m_shadow_casters;
+    bool m_residency_changed;
+    std::vector<TerrainChunkUpload> m_uploads;
+    std::vector<TerrainChunkGeneration> m_generations;
+
+    // Chunks being generated. Finished ones come back through the queue and
+    // wait in the backlog until there is room to upload them.
+    std::unordered_set<TerrainChunkKey, TerrainChunkKeyHash> m_pending;
+    std::vector<ChunkRequest> m_requests;
+    CompletionQueue<TerrainChunkData> m_generated_chunks;
+    std::vector<TerrainChunkData> m_backlog;
+    // Counted under the mutex, so that the destructor can't see the last
+    // job finish until that job is done with this object.
+    std::mutex m_jobs_mutex;
+    std::condition_variable m_jobs_done;
+    uint32_t m_jobs_in_flight;
+
+    std::atomic<uint64_t> m_num_loaded, m_num_generated;
+    uint64_t m_num_evicted, m_num_dropped;
+
+    // Per-update state.
+    uint64_t m_frame;
+    uint32_t m_generated;
+    glm::vec3 m_eye;
+    Frustum m_frustum;
+    float m_projection_scale;
+};
+
+#endif
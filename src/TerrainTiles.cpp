@@ -0,0 +1,133 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#include <filesystem>
+#include <format>
+#include <optional>
+#include <span>
+#include <system_error>
+#include <vector>
+
+#include "Fingerprint.h"
+#include "MeshCache.h"
+#include "TerrainTiles.h"
+
+namespace {
+    enum TileSection : uint32_t {
+        eManifest = MESH_CACHE_FIRST_USER_SECTION,
+        eTileInfo,
+        eTileVertices,
+    };
+
+    // TerrainChunkData without its vertices.
+    struct TileInfo {
+        uint32_t face;
+        uint32_t level;
+        uint64_t path;
+        glm::vec3 corners[3];
+        glm::vec3 center;
+        float radius;
+        float error;
+        float min_surface_radius;
+        float max_surface_radius;
+    };
+
+    const char *MANIFEST_NAME = "manifest.mesh";
+}
+
+TerrainTileSet::TerrainTileSet(const std::filesystem::path &directory, uint64_t key)
+    : m_directory{directory},
+      m_key{key}
+{}
+
+uint64_t TerrainTileSet::tileKey(float radius, const NoiseFunction &noise, uint32_t resolution) {
+    Fingerprint fp;
+    fp.add('K').add(radius).add(resolution).add(sizeof(TerrainChunkVertex)).add(sizeof(TileInfo));
+    noise.fingerprint(fp);
+    return fp.value();
+}
+
+std::optional<TerrainTileSetInfo> TerrainTileSet::readManifest(const std::filesystem::path &directory, uint64_t key) {
+    std::optional<MeshCacheReader> reader = MeshCacheReader::open(manifestPath(directory), key);
+    if (!reader) {
+        return std::nullopt;
+    }
+
+    std::optional<std::span<const TerrainTileSetInfo>> info = reader->section<TerrainTileSetInfo>(eManifest);
+    if (!info || info->size() != 1) {
+        return std::nullopt;
+    }
+    return info->front();
+}
+
+void TerrainTileSet::writeManifest(const std::filesystem::path &directory, const TerrainTileSetInfo &info) {
+    MeshCacheWriter writer{info.key};
+    writer.addSection(eManifest, std::span<const TerrainTileSetInfo>{&info, 1});
+    writer.write(manifestPath(directory));
+}
+
+std::filesystem::path TerrainTileSet::manifestPath(const std::filesystem::path &directory) {
+    return directory / MANIFEST_NAME;
+}
+
+const std::filesystem::path &TerrainTileSet::directory() const {
+    return m_directory;
+}
+
+std::filesystem::path TerrainTileSet::tilePath(const TerrainChunkKey &key) const {
+    return m_directory / std::format("{}", key.level) / std::format("{:02}-{:x}.tile", key.face, key.path);
+}
+
+bool TerrainTileSet::hasTile(const TerrainChunkKey &key) const {
+    std::error_code ec;
+    return std::filesystem::is_regular_file(tilePath(key), ec);
+}
+
+std::optional<TerrainChunkData> TerrainTileSet::readTile(const TerrainChunkKey &key) const {
+    // Tiles are small and copied straight out, so read rather than map
+    // them.
+    std::optional<MeshCacheReader> reader = MeshCacheReader::open(tilePath(key), m_key, FileAccess::eRead);
+    if (!reader) {
+        return std::nullopt;
+    }
+
+    std::optional<std::span<const TileInfo>> info = reader->section<TileInfo>(eTileInfo);
+    std::optional<std::vector<TerrainChunkVertex>> vertices = reader->copySection<TerrainChunkVertex>(eTileVertices);
+    if (!info || info->size() != 1 || !vertices) {
+        return std::nullopt;
+    }
+
+    const TileInfo &stored = info->front();
+    if (stored.face != key.face || stored.level != key.level || stored.path != key.path) {
+        return std::nullopt;
+    }
+
+    return TerrainChunkData{
+        .key = key,
+        .corners = { stored.corners[0], stored.corners[1], stored.corners[2] },
+        .center = stored.center,
+        .radius = stored.radius,
+        .error = stored.error,
+        .min_surface_radius = stored.min_surface_radius,
+        .max_surface_radius = stored.max_surface_radius,
+        .vertices = std::move(*vertices),
+    };
+}
+
+void TerrainTileSet::writeTile(const TerrainChunkData &chunk) const {
+    TileInfo info{
+        .face = chunk.key.face,
+        .level = chunk.key.level,
+        .path = chunk.key.path,
+        .corners = { chunk.corners[0], chunk.corners[1], chunk.corners[2] },
+        .center = chunk.center,
+        .radius = chunk.radius,
+        .error = chunk.error,
+        .min_surface_radius = chunk.min_surface_radius,
+        .max_surface_radius = chunk.max_surface_radius,
+    };
+
+    MeshCacheWriter writer{m_key};
+    writer.addSection(eTileInfo, std::span<const TileInfo>{&info, 1})
+        .addSection(eTileVertices, chunk.vertices);
+    writer.write(tilePath(chunk.key));
+}
@@ -0,0 +1,62 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#ifndef _VPLANET_TERRAIN_TILES_H_
+#define _VPLANET_TERRAIN_TILES_H_
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+#include "Noise.h"
+#include "TerrainChunks.h"
+
+// Properties of a baked tile set, stored in its manifest.
+struct TerrainTileSetInfo {
+    uint64_t key;
+    float radius;
+    uint32_t resolution;
+    uint32_t max_level;
+    uint32_t padding;
+};
+
+// A baked chunk tree on disk, as written by vplanet_bake: a manifest, and a
+// mesh cache file (see MeshCache.h) per chunk, named by its level, face and
+// path:
+//
+//     <directory>/manifest.mesh
+//     <directory>/<level>/<face>-<path in hex>.tile
+//
+// Tiles are keyed by the same fingerprint as the manifest, so tiles left
+// over from different parameters are never read. Each tile is written
+// whole and renamed into place, so a tile that exists is complete, and
+// baking any tile again just rewrites the same file.
+class TerrainTileSet {
+public:
+    TerrainTileSet(const std::filesystem::path &directory, uint64_t key);
+
+    // Identifies the chunks a TerrainChunkGenerator makes from the same
+    // arguments, in the same vertex layout, so tiles written with another
+    // TerrainChunkVertex are regenerated rather than misread.
+    static uint64_t tileKey(float radius, const NoiseFunction &noise, uint32_t resolution);
+
+    // Nothing if there's no manifest, or it's for another key.
+    static std::optional<TerrainTileSetInfo> readManifest(const std::filesystem::path &directory, uint64_t key);
+    static void writeManifest(const std::filesystem::path &directory, const TerrainTileSetInfo &info);
+
+    static std::filesystem::path manifestPath(const std::filesystem::path &directory);
+
+    const std::filesystem::path &directory() const;
+    std::filesystem::path tilePath(const TerrainChunkKey &key) const;
+
+    bool hasTile(const TerrainChunkKey &key) const;
+    std::optional<TerrainChunkData> readTile(const TerrainChunkKey &key) const;
+
+    // Throws std::runtime_error if the tile can't be written.
+    void writeTile(const TerrainChunkData &chunk) const;
+
+private:
+    std::filesystem::path m_directory;
+    uint64_t m_key;
+};
+
+#endif
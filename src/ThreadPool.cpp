@@ -0,0 +1,118 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#include <algorithm>
+#include <iostream>
+
+#include "ThreadPool.h"
+
+// Index of the worker running on this thread, or -1 off the pool.
+static thread_local int s_worker_index = -1;
+static thread_local const ThreadPool *s_worker_pool = nullptr;
+
+ThreadPool::ThreadPool(unsigned int num_threads)
+    : m_workers{},
+      m_threads{},
+      m_next_worker{0},
+      m_queued{0},
+      m_stopping{false},
+      m_sleep_mutex{},
+      m_wake{}
+{
+    if (num_threads == 0) {
+        unsigned int hardware = std::thread::hardware_concurrency();
+        num_threads = std::max(hardware, 2u) - 1;
+    }
+
+    for (unsigned int i = 0; i < num_threads; ++i) {
+        m_workers.emplace_back(std::make_unique<Worker>());
+    }
+    for (unsigned int i = 0; i < num_threads; ++i) {
+        m_threads.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+    std::cerr << "Started thread pool with " << num_threads << " workers\n";
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock{m_sleep_mutex};
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+
+    for (std::thread &thread : m_threads) {
+        thread.join();
+    }
+}
+
+unsigned int ThreadPool::numThreads() const {
+    return static_cast<unsigned int>(m_workers.size());
+}
+
+void ThreadPool::submit(Job job) {
+    unsigned int index;
+    if (s_worker_pool == this) {
+        index = static_cast<unsigned int>(s_worker_index);
+    } else {
+        index = m_next_worker.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+    }
+
+    // Count the job before it can be taken, so the count never goes below
+    // zero, and under the sleep mutex so a worker can't check the count and
+    // then miss the notification.
+    {
+        std::lock_guard<std::mutex> lock{m_sleep_mutex};
+        m_queued.fetch_add(1);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{m_workers[index]->mutex};
+        m_workers[index]->jobs.push_back(std::move(job));
+    }
+    m_wake.notify_one();
+}
+
+void ThreadPool::workerLoop(unsigned int index) {
+    s_worker_index = static_cast<int>(index);
+    s_worker_pool = this;
+
+    Job job;
+    while (true) {
+        if (popLocal(index, job) || steal(index, job)) {
+            m_queued.fetch_sub(1);
+            job();
+            job = nullptr;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock{m_sleep_mutex};
+        m_wake.wait(lock, [this] { return m_stopping || m_queued > 0; });
+        if (m_stopping && m_queued == 0) {
+            return;
+        }
+    }
+}
+
+bool ThreadPool::popLocal(unsigned int index, Job &job) {
+    Worker &worker = *m_workers[index];
+    std::lock_guard<std::mutex> lock{worker.mutex};
+    if (worker.jobs.empty()) {
+        return false;
+    }
+    job = std::move(worker.jobs.back());
+    worker.jobs.pop_back();
+    return true;
+}
+
+bool ThreadPool::steal(unsigned int index, Job &job) {
+    unsigned int num_workers = static_cast<unsigned int>(m_workers.size());
+    for (unsigned int i = 1; i < num_workers; ++i) {
+        Worker &victim = *m_workers[(index + i) % num_workers];
+        std::lock_guard<std::mutex> lock{victim.mutex};
+        if (!victim.jobs.empty()) {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,52 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#ifndef _VPLANET_THREAD_POOL_H_
+#define _VPLANET_THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, each with its own job deque. A worker runs
+// its newest job first and, when it runs dry, steals the oldest job from
+// another worker. Jobs submitted from a worker go to that worker's deque;
+// jobs from other threads are dealt round robin.
+class ThreadPool {
+public:
+    using Job = std::function<void()>;
+
+    // Zero threads means one per hardware thread, less one for rendering.
+    explicit ThreadPool(unsigned int num_threads = 0);
+    ThreadPool(const ThreadPool &other) = delete;
+    ~ThreadPool();
+
+    ThreadPool &operator=(const ThreadPool &other) = delete;
+
+    unsigned int numThreads() const;
+    void submit(Job job);
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    void workerLoop(unsigned int index);
+    bool popLocal(unsigned int index, Job &job);
+    bool steal(unsigned int index, Job &job);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<std::thread> m_threads;
+    std::atomic<unsigned int> m_next_worker;
+    std::atomic<unsigned int> m_queued;
+    std::atomic<bool> m_stopping;
+    std::mutex m_sleep_mutex;
+    std::condition_variable m_wake;
+};
+
+#endif
@@ -0,0 +1,64 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#ifndef _VPLANET_TOOL_OPTIONS_H_
+#define _VPLANET_TOOL_OPTIONS_H_
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <format>
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+// Command line parsing shared by the offline tools, whose options all take
+// a value: `--name value`. Bad values throw std::runtime_error, for the
+// tool to print with its usage.
+namespace tool_options {
+    inline uint32_t parseCount(const std::string &value, const char *name) {
+        try {
+            size_t used = 0;
+            unsigned long n = std::stoul(value, &used);
+            if (used == value.size()) {
+                return static_cast<uint32_t>(n);
+            }
+        } catch (std::exception&) {}
+        throw std::runtime_error(std::format("Bad value for {}: {}", name, value));
+    }
+
+    // Finite and positive.
+    inline float parseLength(const std::string &value, const char *name) {
+        try {
+            size_t used = 0;
+            float x = std::stof(value, &used);
+            if (used == value.size() && std::isfinite(x) && x > 0.0f) {
+                return x;
+            }
+        } catch (std::exception&) {}
+        throw std::runtime_error(std::format("Bad value for {}: {}", name, value));
+    }
+
+    // Calls option(name, value) for each pair in argv, which throws for
+    // names it doesn't know. --help or -h prints the usage and exits.
+    inline void parseOptions(
+        int argc,
+        char **argv,
+        const std::function<void(const char *argv0)> &usage,
+        const std::function<void(const std::string &name, const std::string &value)> &option
+    ) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--help" || arg == "-h") {
+                usage(argv[0]);
+                std::exit(0);
+            }
+            if (i + 1 >= argc) {
+                throw std::runtime_error(std::format("Missing value for {}", arg));
+            }
+            option(arg, argv[++i]);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,633 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#include <array>
+#include <format>
+#include <iostream>
+#include <optional>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../glm.h"
+#include "../vulkan.h"
+
+#include "Atmosphere.h"
+#include "Renderer.h"
+#include "ShaderLibrary.h"
+#include "System.h"
+#include "Uniforms.h"
+
+const char *ATMOSPHERE_TRANSMITTANCE_SHADER = "atmosphere_transmittance.slang.spv";
+const char *ATMOSPHERE_MULTISCATTERING_SHADER = "atmosphere_multiscattering.slang.spv";
+const char *ATMOSPHERE_APPLY_SHADER = "atmosphere_apply.slang.spv";
+
+// Must match numthreads in atmosphere_transmittance.slang and
+// atmosphere_multiscattering.slang.
+const uint32_t ATMOSPHERE_WORKGROUP_SIZE = 8;
+
+const vk::Format ATMOSPHERE_TABLE_FORMAT = vk::Format::eR16G16B16A16Sfloat;
+
+gfx::AtmosphereParameters gfx::AtmosphereParameters::earthLike(float bottom_radius, float top_radius) {
+    // Earth's coefficients per km (Hillaire 2020), scaled by the ratio of
+    // its scale heights to these, so the air is as thick looking through
+    // it as on Earth. Its 100 km shell is about a fifth of the height here.
+    float thickness = top_radius - bottom_radius;
+    float rayleigh_scale_height = 0.2f * thickness;
+    float mie_scale_height = 0.03f * thickness;
+    float ozone_width = 0.3f * thickness;
+    float rayleigh_scale = 8.0f / rayleigh_scale_height;
+    float mie_scale = 1.2f / mie_scale_height;
+    float ozone_scale = 30.0f / ozone_width;
+
+    return AtmosphereParameters{
+        .rayleigh_scattering = glm::vec3{5.802e-3f, 13.558e-3f, 33.1e-3f} * rayleigh_scale,
+        .rayleigh_scale_height = rayleigh_scale_height,
+        .mie_scattering = glm::vec3{3.996e-3f} * mie_scale,
+        .mie_scale_height = mie_scale_height,
+        .mie_extinction = glm::vec3{4.44e-3f} * mie_scale,
+        .mie_phase_g = 0.8f,
+        .ozone_absorption = glm::vec3{0.65e-3f, 1.881e-3f, 0.085e-3f} * ozone_scale,
+        .ozone_center_height = 0.25f * thickness,
+        .ground_albedo = glm::vec3{0.3f},
+        .ozone_width = ozone_width,
+        .bottom_radius = bottom_radius,
+        .top_radius = top_radius,
+        .padding = {0.0f, 0.0f},
+    };
+}
+
+gfx::Atmosphere::Atmosphere()
+: m_renderer{nullptr},
+  m_enabled{true},
+  m_parameters{AtmosphereParameters::earthLike(1.97f, 2.4f)},
+  m_sun_illuminance{4.0f},
+  m_tables_dirty{true},
+  m_tables_computed_with{},
+  m_frame_has_sun{},
+  m_transmittance_image{nullptr},
+  m_transmittance_allocation{VK_NULL_HANDLE},
+  m_transmittance_view{nullptr},
+  m_multiscattering_image{nullptr},
+  m_multiscattering_allocation{VK_NULL_HANDLE},
+  m_multiscattering_view{nullptr},
+  m_table_sampler{nullptr},
+  m_depth_sampler{nullptr},
+  m_uniform_buffers{},
+  m_uniform_buffer_allocations{},
+  m_descriptor_set_layout{nullptr},
+  m_descriptor_sets{},
+  m_pipeline_layout{nullptr},
+  m_transmittance_pipeline{nullptr},
+  m_multiscattering_pipeline{nullptr},
+  m_apply_pipeline{nullptr}
+{}
+
+gfx::Atmosphere::Atmosphere(Renderer *renderer) : Atmosphere() {
+    m_renderer = renderer;
+    initLookupTables();
+    initUniformBuffers();
+    initPipelines();
+    initDescriptorSets();
+}
+
+gfx::Atmosphere::~Atmosphere() {
+    if (m_renderer != nullptr) {
+        VmaAllocator allocator = m_renderer->system()->allocator();
+        for (auto &alloc : m_uniform_buffer_allocations) {
+            vmaFreeMemory(allocator, alloc);
+        }
+        for (VmaAllocation alloc : {m_transmittance_allocation, m_multiscattering_allocation}) {
+            if (alloc != VK_NULL_HANDLE) {
+                vmaFreeMemory(allocator, alloc);
+            }
+        }
+    }
+}
+
+// Swaps, so that the temporary moved from frees nothing in use.
+gfx::Atmosphere &gfx::Atmosphere::operator=(Atmosphere &&other) {
+    std::swap(m_renderer, other.m_renderer);
+    m_enabled = other.m_enabled;
+    m_parameters = other.m_parameters;
+    m_sun_illuminance = other.m_sun_illuminance;
+    m_tables_dirty = other.m_tables_dirty;
+    m_tables_computed_with = other.m_tables_computed_with;
+    std::swap(m_frame_has_sun, other.m_frame_has_sun);
+    std::swap(m_transmittance_image, other.m_transmittance_image);
+    std::swap(m_transmittance_allocation, other.m_transmittance_allocation);
+    std::swap(m_transmittance_view, other.m_transmittance_view);
+    std::swap(m_multiscattering_image, other.m_multiscattering_image);
+    std::swap(m_multiscattering_allocation, other.m_multiscattering_allocation);
+    std::swap(m_multiscattering_view, other.m_multiscattering_view);
+    std::swap(m_table_sampler, other.m_table_sampler);
+    std::swap(m_depth_sampler, other.m_depth_sampler);
+    std::swap(m_uniform_buffers, other.m_uniform_buffers);
+    std::swap(m_uniform_buffer_allocations, other.m_uniform_buffer_allocations);
+    std::swap(m_descriptor_set_layout, other.m_descriptor_set_layout);
+    std::swap(m_descriptor_sets, other.m_descriptor_sets);
+    std::swap(m_pipeline_layout, other.m_pipeline_layout);
+    std::swap(m_transmittance_pipeline, other.m_transmittance_pipeline);
+    std::swap(m_multiscattering_pipeline, other.m_multiscattering_pipeline);
+    std::swap(m_apply_pipeline, other.m_apply_pipeline);
+    return *this;
+}
+
+bool gfx::Atmosphere::enabled() const {
+    return m_enabled;
+}
+
+void gfx::Atmosphere::setEnabled(bool enabled) {
+    m_enabled = enabled;
+}
+
+const gfx::AtmosphereParameters &gfx::Atmosphere::parameters() const {
+    return m_parameters;
+}
+
+void gfx::Atmosphere::setParameters(const AtmosphereParameters &parameters) {
+    m_parameters = parameters;
+    m_tables_dirty = true;
+}
+
+void gfx::Atmosphere::setSunIlluminance(const glm::vec3 &illuminance) {
+    m_sun_illuminance = illuminance;
+}
+
+void gfx::Atmosphere::recordLookupTables(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index) {
+    m_frame_has_sun[frame_index] = m_enabled && updateUniformBuffer(frame_index);
+    std::array<vk::Pipeline, 2> table_pipelines{*m_transmittance_pipeline, *m_multiscattering_pipeline};
+    if (!m_frame_has_sun[frame_index] || (!m_tables_dirty && table_pipelines == m_tables_computed_with)) {
+        return;
+    }
+
+    vk::ImageSubresourceRange color_range{
+        .aspectMask = vk::ImageAspectFlagBits::eColor,
+        .baseMipLevel = 0,
+        .levelCount = 1,
+        .baseArrayLayer = 0,
+        .layerCount = 1,
+    };
+
+    // The tables are written over whole, so what was in them goes, but
+    // frames still in flight may be drawing with them; those were
+    // submitted before, so waiting for their fragment shaders covers them.
+    std::array<vk::ImageMemoryBarrier2, 2> write_barriers{
+        vk::ImageMemoryBarrier2{
+            .srcStageMask = vk::PipelineStageFlagBits2::eFragmentShader,
+            .srcAccessMask = vk::AccessFlagBits2::eNone,
+            .dstStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+            .dstAccessMask = vk::AccessFlagBits2::eShaderStorageWrite,
+            .oldLayout = vk::ImageLayout::eUndefined,
+            .newLayout = vk::ImageLayout::eGeneral,
+            .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+            .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+            .image = *m_transmittance_image,
+            .subresourceRange = color_range,
+        },
+        vk::ImageMemoryBarrier2{
+            .srcStageMask = vk::PipelineStageFlagBits2::eFragmentShader,
+            .srcAccessMask = vk::AccessFlagBits2::eNone,
+            .dstStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+            .dstAccessMask = vk::AccessFlagBits2::eShaderStorageWrite,
+            .oldLayout = vk::ImageLayout::eUndefined,
+            .newLayout = vk::ImageLayout::eGeneral,
+            .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+            .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+            .image = *m_multiscattering_image,
+            .subresourceRange = color_range,
+        },
+    };
+    cmd_buf.pipelineBarrier2(vk::DependencyInfo{}.setImageMemoryBarriers(write_barriers));
+
+    cmd_buf.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *m_pipeline_layout, 0, *m_descriptor_sets[frame_index], nullptr);
+    cmd_buf.bindPipeline(vk::PipelineBindPoint::eCompute, *m_transmittance_pipeline);
+    cmd_buf.dispatch(
+        (TRANSMITTANCE_WIDTH + ATMOSPHERE_WORKGROUP_SIZE - 1) / ATMOSPHERE_WORKGROUP_SIZE,
+        (TRANSMITTANCE_HEIGHT + ATMOSPHERE_WORKGROUP_SIZE - 1) / ATMOSPHERE_WORKGROUP_SIZE,
+        1
+    );
+
+    // Multiple scattering is gathered through the transmittance table.
+    vk::ImageMemoryBarrier2 transmittance_barrier{
+        .srcStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+        .srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite,
+        .dstStageMask = vk::PipelineStageFlagBits2::eComputeShader | vk::PipelineStageFlagBits2::eFragmentShader,
+        .dstAccessMask = vk::AccessFlagBits2::eShaderSampledRead,
+        .oldLayout = vk::ImageLayout::eGeneral,
+        .newLayout = vk::ImageLayout::eShaderReadOnlyOptimal,
+        .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .image = *m_transmittance_image,
+        .subresourceRange = color_range,
+    };
+    cmd_buf.pipelineBarrier2(vk::DependencyInfo{}.setImageMemoryBarriers(transmittance_barrier));
+
+    cmd_buf.bindPipeline(vk::PipelineBindPoint::eCompute, *m_multiscattering_pipeline);
+    cmd_buf.dispatch(
+        (MULTISCATTERING_SIZE + ATMOSPHERE_WORKGROUP_SIZE - 1) / ATMOSPHERE_WORKGROUP_SIZE,
+        (MULTISCATTERING_SIZE + ATMOSPHERE_WORKGROUP_SIZE - 1) / ATMOSPHERE_WORKGROUP_SIZE,
+        1
+    );
+
+    vk::ImageMemoryBarrier2 multiscattering_barrier{
+        .srcStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+        .srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite,
+        .dstStageMask = vk::PipelineStageFlagBits2::eFragmentShader,
+        .dstAccessMask = vk::AccessFlagBits2::eShaderSampledRead,
+        .oldLayout = vk::ImageLayout::eGeneral,
+        .newLayout = vk::ImageLayout::eShaderReadOnlyOptimal,
+        .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .image = *m_multiscattering_image,
+        .subresourceRange = color_range,
+    };
+    cmd_buf.pipelineBarrier2(vk::DependencyInfo{}.setImageMemoryBarriers(multiscattering_barrier));
+
+    m_tables_dirty = false;
+    m_tables_computed_with = table_pipelines;
+}
+
+void gfx::Atmosphere::recordCommands(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index) {
+    // The tables are left undefined until there's a sun to compute them
+    // with.
+    if (!m_frame_has_sun[frame_index] || m_tables_dirty) {
+        return;
+    }
+
+    cmd_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, *m_apply_pipeline);
+    cmd_buf.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *m_pipeline_layout, 0, *m_descriptor_sets[frame_index], nullptr);
+    cmd_buf.draw(3, 1, 0, 0);
+}
+
+void gfx::Atmosphere::addReloadJobs(const std::set<std::string> &shaders, std::vector<ReloadJob> &jobs) {
+    if (shaders.contains(ATMOSPHERE_TRANSMITTANCE_SHADER)) {
+        jobs.push_back([this](PipelineReload &reload) {
+            reload.add(&m_transmittance_pipeline, createComputePipeline(ATMOSPHERE_TRANSMITTANCE_SHADER));
+        });
+    }
+    if (shaders.contains(ATMOSPHERE_MULTISCATTERING_SHADER)) {
+        jobs.push_back([this](PipelineReload &reload) {
+            reload.add(&m_multiscattering_pipeline, createComputePipeline(ATMOSPHERE_MULTISCATTERING_SHADER));
+        });
+    }
+    if (shaders.contains(ATMOSPHERE_APPLY_SHADER)) {
+        jobs.push_back([this](PipelineReload &reload) {
+            reload.add(&m_apply_pipeline, createApplyPipeline());
+        });
+    }
+}
+
+void gfx::Atmosphere::initLookupTables() {
+    System *system = m_renderer->system();
+    const vk::raii::Device &device = system->device();
+
+    auto create_table = [&](uint32_t width, uint32_t height, VmaAllocation &allocation, const char *name) {
+        vk::ImageCreateInfo img_ci{
+            .imageType = vk::ImageType::e2D,
+            .format = ATMOSPHERE_TABLE_FORMAT,
+            .extent = {width, height, 1},
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = vk::SampleCountFlagBits::e1,
+            .tiling = vk::ImageTiling::eOptimal,
+            .usage = vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled,
+            .sharingMode = vk::SharingMode::eExclusive,
+            .initialLayout = vk::ImageLayout::eUndefined,
+        };
+
+        VkImage image;
+        VmaAllocationCreateInfo alloc_ci{.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE};
+        VkResult rslt = vmaCreateImage(
+            system->allocator(),
+            static_cast<VkImageCreateInfo *>(img_ci),
+            &alloc_ci,
+            &image,
+            &allocation,
+            nullptr
+        );
+        if (rslt != VK_SUCCESS) {
+            throw std::runtime_error(
+                std::format(
+                    "Unable to create {} table. Error code: {}",
+                    name, vk::to_string(vk::Result(rslt))
+                )
+            );
+        }
+        vk::raii::Image table(device, image);
+        std::cerr << "Created " << name << " table image " << *table << "\n";
+        return table;
+    };
+
+    auto create_view = [&](const vk::raii::Image &image) {
+        vk::ImageViewCreateInfo iv_ci{
+            .image = *image,
+            .viewType = vk::ImageViewType::e2D,
+            .format = ATMOSPHERE_TABLE_FORMAT,
+            .subresourceRange = {
+                .aspectMask = vk::ImageAspectFlagBits::eColor,
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+        };
+        return device.createImageView(iv_ci);
+    };
+
+    m_transmittance_image = create_table(TRANSMITTANCE_WIDTH, TRANSMITTANCE_HEIGHT, m_transmittance_allocation, "transmittance");
+    m_transmittance_view = create_view(m_transmittance_image);
+    m_multiscattering_image = create_table(MULTISCATTERING_SIZE, MULTISCATTERING_SIZE, m_multiscattering_allocation, "multiple scattering");
+    m_multiscattering_view = create_view(m_multiscattering_image);
+
+    vk::SamplerCreateInfo table_sampler_ci{
+        .magFilter = vk::Filter::eLinear,
+        .minFilter = vk::Filter::eLinear,
+        .mipmapMode = vk::SamplerMipmapMode::eNearest,
+        .addressModeU = vk::SamplerAddressMode::eClampToEdge,
+        .addressModeV = vk::SamplerAddressMode::eClampToEdge,
+        .addressModeW = vk::SamplerAddressMode::eClampToEdge,
+        .maxLod = 0.0f,
+    };
+    m_table_sampler = device.createSampler(table_sampler_ci);
+
+    // Depth is read texel for texel; blending depths across an edge would
+    // put the surface somewhere between.
+    vk::SamplerCreateInfo depth_sampler_ci{
+        .magFilter = vk::Filter::eNearest,
+        .minFilter = vk::Filter::eNearest,
+        .mipmapMode = vk::SamplerMipmapMode::eNearest,
+        .addressModeU = vk::SamplerAddressMode::eClampToEdge,
+        .addressModeV = vk::SamplerAddressMode::eClampToEdge,
+        .addressModeW = vk::SamplerAddressMode::eClampToEdge,
+        .maxLod = 0.0f,
+    };
+    m_depth_sampler = device.createSampler(depth_sampler_ci);
+}
+
+void gfx::Atmosphere::initUniformBuffers() {
+    System *system = m_renderer->system();
+    uint32_t num_frames = system->numFrames();
+
+    for (uint32_t i = 0; i < num_frames; ++i) {
+        auto [buffer, allocation] = system->createBuffer(
+            sizeof(AtmosphereUniforms),
+            vk::BufferUsageFlagBits::eUniformBuffer,
+            VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+            "atmosphere uniform"
+        );
+        m_uniform_buffers.emplace_back(std::move(buffer));
+        m_uniform_buffer_allocations.push_back(allocation);
+    }
+    m_frame_has_sun.assign(num_frames, false);
+}
+
+void gfx::Atmosphere::initDescriptorSets() {
+    System *system = m_renderer->system();
+    const vk::raii::Device &device = system->device();
+    uint32_t num_sets = system->numFrames();
+
+    std::vector<vk::DescriptorSetLayout> layouts{num_sets, *m_descriptor_set_layout};
+    vk::DescriptorSetAllocateInfo ds_ai = vk::DescriptorSetAllocateInfo{
+        .descriptorPool = *system->uniforms().descriptorPool(),
+    }.setSetLayouts(layouts);
+    m_descriptor_sets = device.allocateDescriptorSets(ds_ai);
+
+    // The storage images are written in the general layout; everything is
+    // sampled read only, the depth buffer between the colour pass and this.
+    std::array<vk::DescriptorImageInfo, 5> image_infos{
+        vk::DescriptorImageInfo{
+            .imageView = *m_transmittance_view,
+            .imageLayout = vk::ImageLayout::eGeneral,
+        },
+        vk::DescriptorImageInfo{
+            .imageView = *m_multiscattering_view,
+            .imageLayout = vk::ImageLayout::eGeneral,
+        },
+        vk::DescriptorImageInfo{
+            .sampler = *m_table_sampler,
+            .imageView = *m_transmittance_view,
+            .imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal,
+        },
+        vk::DescriptorImageInfo{
+            .sampler = *m_table_sampler,
+            .imageView = *m_multiscattering_view,
+            .imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal,
+        },
+        vk::DescriptorImageInfo{
+            .sampler = *m_depth_sampler,
+            .imageView = *system->depthBuffer().imageView(),
+            .imageLayout = vk::ImageLayout::eDepthReadOnlyOptimal,
+        },
+    };
+
+    std::vector<vk::DescriptorBufferInfo> buffer_infos;
+    buffer_infos.reserve(num_sets);
+    std::vector<vk::WriteDescriptorSet> writes;
+    for (uint32_t i = 0; i < num_sets; ++i) {
+        buffer_infos.push_back(vk::DescriptorBufferInfo{
+            .buffer = *m_uniform_buffers[i],
+            .offset = 0,
+            .range = sizeof(AtmosphereUniforms),
+        });
+        writes.push_back(vk::WriteDescriptorSet{
+            .dstSet = *m_descriptor_sets[i],
+            .dstBinding = 0,
+            .dstArrayElement = 0,
+            .descriptorType = vk::DescriptorType::eUniformBuffer,
+        }.setBufferInfo(buffer_infos.back()));
+
+        for (uint32_t b = 0; b < image_infos.size(); ++b) {
+            writes.push_back(vk::WriteDescriptorSet{
+                .dstSet = *m_descriptor_sets[i],
+                .dstBinding = 1 + b,
+                .dstArrayElement = 0,
+                .descriptorType = b < 2 ? vk::DescriptorType::eStorageImage : vk::DescriptorType::eCombinedImageSampler,
+            }.setImageInfo(image_infos[b]));
+        }
+    }
+    device.updateDescriptorSets(writes, nullptr);
+    std::cerr << "Allocated " << num_sets << " descriptor sets for the atmosphere\n";
+}
+
+void gfx::Atmosphere::initPipelines() {
+    const vk::raii::Device &device = m_renderer->system()->device();
+
+    // Uniforms, the two tables to write, the two tables to sample and the
+    // depth buffer.
+    std::array<vk::DescriptorSetLayoutBinding, 6> bindings{};
+    for (uint32_t b = 0; b < bindings.size(); ++b) {
+        bindings[b] = vk::DescriptorSetLayoutBinding{
+            .binding = b,
+            .descriptorType = b == 0 ? vk::DescriptorType::eUniformBuffer :
+                b < 3 ? vk::DescriptorType::eStorageImage : vk::DescriptorType::eCombinedImageSampler,
+            .descriptorCount = 1,
+            .stageFlags = b == 1 || b == 2 ? vk::ShaderStageFlagBits::eCompute :
+                vk::ShaderStageFlagBits::eCompute | vk::ShaderStageFlagBits::eFragment,
+        };
+    }
+    vk::DescriptorSetLayoutCreateInfo dsl_ci = vk::DescriptorSetLayoutCreateInfo{}
+        .setBindings(bindings);
+    m_descriptor_set_layout = device.createDescriptorSetLayout(dsl_ci);
+
+    vk::PipelineLayoutCreateInfo pl_ci = vk::PipelineLayoutCreateInfo{}
+        .setSetLayouts(*m_descriptor_set_layout);
+    m_pipeline_layout = device.createPipelineLayout(pl_ci);
+    std::cerr << "Created atmosphere pipeline layout " << *m_pipeline_layout << "\n";
+
+    m_transmittance_pipeline = createComputePipeline(ATMOSPHERE_TRANSMITTANCE_SHADER);
+    m_multiscattering_pipeline = createComputePipeline(ATMOSPHERE_MULTISCATTERING_SHADER);
+    m_apply_pipeline = createApplyPipeline();
+}
+
+vk::raii::Pipeline gfx::Atmosphere::createComputePipeline(const char *shader_name) {
+    System *system = m_renderer->system();
+    const vk::raii::Device &device = system->device();
+    vk::raii::ShaderModule shader = system->shaders().createModule(device, shader_name);
+
+    vk::ComputePipelineCreateInfo cp_ci{
+        .stage = vk::PipelineShaderStageCreateInfo{
+            .stage = vk::ShaderStageFlagBits::eCompute,
+            .module = *shader,
+            .pName = "cs_main",
+        },
+        .layout = *m_pipeline_layout,
+    };
+    vk::raii::Pipeline pipeline = device.createComputePipeline(nullptr, cp_ci);
+    std::cerr << "Created atmosphere compute pipeline " << *pipeline << " for " << shader_name << "\n";
+    return pipeline;
+}
+
+vk::raii::Pipeline gfx::Atmosphere::createApplyPipeline() {
+    System *system = m_renderer->system();
+    const vk::raii::Device &device = system->device();
+    vk::SurfaceFormatKHR swapchain_format = system->swapchain().format();
+
+    vk::raii::ShaderModule shader = system->shaders().createModule(device, ATMOSPHERE_APPLY_SHADER);
+    std::array<vk::PipelineShaderStageCreateInfo, 2> shader_stages{
+        vk::PipelineShaderStageCreateInfo{
+            .stage = vk::ShaderStageFlagBits::eVertex,
+            .module = *shader,
+            .pName = "vs_main",
+        },
+        vk::PipelineShaderStageCreateInfo{
+            .stage = vk::ShaderStageFlagBits::eFragment,
+            .module = *shader,
+            .pName = "fs_main",
+        },
+    };
+
+    // One triangle over the screen, made from the vertex index.
+    vk::PipelineVertexInputStateCreateInfo vertex_input_ci{};
+
+    vk::PipelineInputAssemblyStateCreateInfo input_assembly_ci{
+        .topology = vk::PrimitiveTopology::eTriangleList,
+    };
+
+    vk::PipelineViewportStateCreateInfo viewport_ci{
+        .viewportCount = 1,
+        .scissorCount = 1,
+    };
+
+    vk::PipelineRasterizationStateCreateInfo raster_ci{
+        .depthClampEnable = vk::False,
+        .rasterizerDiscardEnable = vk::False,
+        .polygonMode = vk::PolygonMode::eFill,
+        .cullMode = vk::CullModeFlagBits::eNone,
+        .frontFace = vk::FrontFace::eCounterClockwise,
+        .depthBiasEnable = vk::False,
+        .lineWidth = 1.0f,
+    };
+
+    vk::PipelineMultisampleStateCreateInfo multisample_state_ci{
+        .rasterizationSamples = vk::SampleCountFlagBits::e1,
+        .sampleShadingEnable = vk::False,
+    };
+
+    // In-scattered light plus the scene through the air: the shader's
+    // alpha is the transmittance, and the scene's alpha is kept.
+    vk::PipelineColorBlendAttachmentState blend_attachment{
+        .blendEnable = vk::True,
+        .srcColorBlendFactor = vk::BlendFactor::eOne,
+        .dstColorBlendFactor = vk::BlendFactor::eSrcAlpha,
+        .colorBlendOp = vk::BlendOp::eAdd,
+        .srcAlphaBlendFactor = vk::BlendFactor::eZero,
+        .dstAlphaBlendFactor = vk::BlendFactor::eOne,
+        .alphaBlendOp = vk::BlendOp::eAdd,
+        .colorWriteMask = vk::ColorComponentFlagBits::eR |
+            vk::ColorComponentFlagBits::eG |
+            vk::ColorComponentFlagBits::eB |
+            vk::ColorComponentFlagBits::eA,
+    };
+
+    vk::PipelineColorBlendStateCreateInfo color_blend_ci = vk::PipelineColorBlendStateCreateInfo{
+        .logicOpEnable = vk::False,
+        .logicOp = vk::LogicOp::eCopy,
+    }.setAttachments(blend_attachment);
+
+    std::array<vk::DynamicState, 2> dynamic_states{
+        vk::DynamicState::eViewport,
+        vk::DynamicState::eScissor,
+    };
+    vk::PipelineDynamicStateCreateInfo dynamic_state_ci = vk::PipelineDynamicStateCreateInfo{}
+        .setDynamicStates(dynamic_states);
+
+    vk::StructureChain<vk::GraphicsPipelineCreateInfo, vk::PipelineRenderingCreateInfo> pipeline_ci{
+        vk::GraphicsPipelineCreateInfo{
+            .pVertexInputState = &vertex_input_ci,
+            .pInputAssemblyState = &input_assembly_ci,
+            .pViewportState = &viewport_ci,
+            .pRasterizationState = &raster_ci,
+            .pMultisampleState = &multisample_state_ci,
+            .pColorBlendState = &color_blend_ci,
+            .pDynamicState = &dynamic_state_ci,
+            .layout = *m_pipeline_layout,
+            .renderPass = nullptr,
+        },
+        vk::PipelineRenderingCreateInfo{},
+    };
+    pipeline_ci.get<vk::GraphicsPipelineCreateInfo>().setStages(shader_stages);
+    pipeline_ci.get<vk::PipelineRenderingCreateInfo>()
+        .setColorAttachmentFormats(swapchain_format.format);
+
+    vk::raii::Pipeline pipeline = device.createGraphicsPipeline(nullptr, pipeline_ci.get<vk::GraphicsPipelineCreateInfo>());
+    std::cerr << "Created atmosphere graphics pipeline " << *pipeline << "\n";
+    return pipeline;
+}
+
+bool gfx::Atmosphere::updateUniformBuffer(uint32_t frame_index) {
+    const SceneUniformSet &scene_uniforms = m_renderer->sceneUniforms();
+    std::optional<glm::vec3> sun_direction = scene_uniforms.sunDirection();
+    if (!sun_direction) {
+        return false;
+    }
+
+    // The planet is centered on the terrain's origin.
+    const ViewProjectionTransform &xform = scene_uniforms.transforms();
+    glm::vec3 planet_center{m_renderer->terrainPipeline().transform()[3]};
+    AtmosphereUniforms uniforms{
+        .atmosphere = m_parameters,
+        .clip_to_world = glm::inverse(xform.projection * xform.view),
+        .planet_center = glm::vec4{planet_center, m_renderer->reverseDepth() ? 1.0f : 0.0f},
+        .eye = glm::vec4{glm::vec3{xform.view_inv[3]}, 1.0f},
+        .sun_direction = glm::vec4{-glm::normalize(*sun_direction), 0.0f},
+        .sun_illuminance = glm::vec4{m_sun_illuminance, 0.0f},
+    };
+
+    VkResult rslt = vmaCopyMemoryToAllocation(
+        m_renderer->system()->allocator(),
+        &uniforms,
+        m_uniform_buffer_allocations[frame_index],
+        0, sizeof(uniforms)
+    );
+    if (rslt != VK_SUCCESS) {
+        throw std::runtime_error(
+            std::format(
+                "Unable to update atmosphere uniform buffer. Error code: {}",
+                vk::to_string(vk::Result(rslt))
+            )
+        );
+    }
+    return true;
+}
@@ -0,0 +1,140 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#ifndef _VPLANET_GFX_ATMOSPHERE_H_
+#define _VPLANET_GFX_ATMOSPHERE_H_
+
+#include <array>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../glm.h"
+#include "../vulkan.h"
+#include "../VmaUsage.h"
+
+#include "Pipeline.h"
+
+namespace gfx {
+    class Renderer;
+
+    // Scattering and absorption per unit of distance, and the heights they
+    // fall off over, above a planet of `bottom_radius` with air up to
+    // `top_radius`. The layout matches AtmosphereParameters in
+    // atmosphere.slang.
+    struct AtmosphereParameters {
+        glm::vec3 rayleigh_scattering;
+        float rayleigh_scale_height;
+        glm::vec3 mie_scattering;
+        float mie_scale_height;
+        glm::vec3 mie_extinction;
+        float mie_phase_g;
+        glm::vec3 ozone_absorption;
+        float ozone_center_height;
+        glm::vec3 ground_albedo;
+        float ozone_width;
+        float bottom_radius;
+        float top_radius;
+        float padding[2];
+
+        // Earth's air, in its optical depths rather than to scale, over a
+        // shell thick enough to show at the planet's size.
+        static AtmosphereParameters earthLike(float bottom_radius, float top_radius);
+    };
+
+    // Written each frame. The layout matches AtmosphereUniforms in
+    // atmosphere.slang.
+    struct AtmosphereUniforms {
+        AtmosphereParameters atmosphere;
+        glm::mat4x4 clip_to_world;
+        glm::vec4 planet_center; // xyz; w: 1 if depth is reversed
+        glm::vec4 eye;
+        glm::vec4 sun_direction; // xyz: towards the sun
+        glm::vec4 sun_illuminance;
+    };
+
+    // Sky and aerial perspective from the sun, after Hillaire (2020). Light
+    // through the air is kept in two lookup tables computed in compute
+    // passes: transmittance to the top of the atmosphere by height and
+    // zenith, and light scattered more than once by height and the sun's
+    // zenith. Neither depends on where the sun is, only on the air, so
+    // they're only computed again when the parameters change. A full-screen
+    // pass then marches each view ray a few steps through the tables, over
+    // the terrain and ocean, up to the depth they left.
+    //
+    // The sun is the first enabled light of the scene uniform set. With
+    // none, nothing is drawn.
+    class Atmosphere {
+    public:
+        static const uint32_t TRANSMITTANCE_WIDTH = 256;
+        static const uint32_t TRANSMITTANCE_HEIGHT = 64;
+        static const uint32_t MULTISCATTERING_SIZE = 32;
+
+        Atmosphere();
+        Atmosphere(Renderer *renderer);
+        Atmosphere(const Atmosphere &other) = delete;
+        Atmosphere(Atmosphere &&other) = delete;
+
+        ~Atmosphere();
+
+        Atmosphere &operator=(const Atmosphere &other) = delete;
+        Atmosphere &operator=(Atmosphere &&other);
+
+        bool enabled() const;
+        void setEnabled(bool enabled);
+
+        const AtmosphereParameters &parameters() const;
+        void setParameters(const AtmosphereParameters &parameters);
+        void setSunIlluminance(const glm::vec3 &illuminance);
+
+        // Recorded outside of the rendering pass. Writes the frame's
+        // uniforms, and computes the tables if the parameters changed.
+        void recordLookupTables(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index);
+        // Recorded in a rendering pass over the colour attachment alone,
+        // with the depth buffer readable by fragment shaders.
+        void recordCommands(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index);
+        // As Pipeline::addReloadJobs().
+        void addReloadJobs(const std::set<std::string> &shaders, std::vector<ReloadJob> &jobs);
+
+    private:
+        void initLookupTables();
+        void initUniformBuffers();
+        void initDescriptorSets();
+        void initPipelines();
+        vk::raii::Pipeline createComputePipeline(const char *shader_name);
+        vk::raii::Pipeline createApplyPipeline();
+        bool updateUniformBuffer(uint32_t frame_index);
+
+        Renderer *m_renderer;
+        bool m_enabled;
+        AtmosphereParameters m_parameters;
+        glm::vec3 m_sun_illuminance;
+        bool m_tables_dirty;
+        // The pipelines the tables were last computed with, so that ones
+        // rebuilt from reloaded shaders compute them again.
+        std::array<vk::Pipeline, 2> m_tables_computed_with;
+        // Whether the frame's uniforms have a sun to draw with.
+        std::vector<bool> m_frame_has_sun;
+
+        vk::raii::Image m_transmittance_image;
+        VmaAllocation m_transmittance_allocation;
+        vk::raii::ImageView m_transmittance_view;
+        vk::raii::Image m_multiscattering_image;
+        VmaAllocation m_multiscattering_allocation;
+        vk::raii::ImageView m_multiscattering_view;
+        vk::raii::Sampler m_table_sampler;
+        vk::raii::Sampler m_depth_sampler;
+
+        std::vector<vk::raii::Buffer> m_uniform_buffers;
+        std::vector<VmaAllocation> m_uniform_buffer_allocations;
+
+        vk::raii::DescriptorSetLayout m_descriptor_set_layout;
+        std::vector<vk::raii::DescriptorSet> m_descriptor_sets;
+        vk::raii::PipelineLayout m_pipeline_layout;
+        vk::raii::Pipeline m_transmittance_pipeline;
+        vk::raii::Pipeline m_multiscattering_pipeline;
+        vk::raii::Pipeline m_apply_pipeline;
+    };
+}
+
+#endif
@@ -0,0 +1,153 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#include <format>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../vulkan.h"
+#include "../VmaUsage.h"
+
+#include "ComputeContext.h"
+
+gfx::ComputeContext::~ComputeContext() {}
+
+std::pair<vk::raii::Buffer, VmaAllocation> gfx::ComputeContext::createBuffer(
+    vk::DeviceSize size, 
+    vk::BufferUsageFlags usage,
+    VmaAllocationCreateFlags allocation_flags,
+    const std::optional<std::string> &name
+) {
+
+    std::string buffer_name;
+    if (name.has_value()) {
+        buffer_name = std::string{name.value()} + " buffer";
+    } else {
+        buffer_name = "buffer";
+    }
+
+    vk::BufferCreateInfo buf_ci{
+        .size = size,
+        .usage = usage,
+        .sharingMode = vk::SharingMode::eExclusive,
+    };
+
+    VmaAllocationCreateInfo alloc_ci{};
+    alloc_ci.usage = VMA_MEMORY_USAGE_AUTO;
+    alloc_ci.flags = allocation_flags;
+
+    VkBuffer buffer;
+    VmaAllocation allocation;
+    VkResult rslt = vmaCreateBuffer(
+        allocator(),
+        static_cast<VkBufferCreateInfo *>(buf_ci),
+        &alloc_ci,
+        &buffer,
+        &allocation,
+        nullptr
+    );
+
+    if (rslt != VK_SUCCESS) {
+        throw std::runtime_error(
+            std::format(
+                "Failed to create {}. Error code: {}",
+                buffer_name,
+                vk::to_string(vk::Result(rslt))
+            )
+        );
+    }
+
+    std::cerr << "Created " << buffer_name << ": " << buffer << "\n";
+    std::cerr << "Created " << buffer_name << " allocation: " << allocation << "\n";
+    return {vk::raii::Buffer(device(), buffer), allocation};
+}
+
+std::pair<vk::raii::Buffer, VmaAllocation> gfx::ComputeContext::createBufferWithData(
+    const void *data, 
+    size_t size, 
+    vk::BufferUsageFlags usage,
+    VmaAllocationCreateFlags allocation_flags,
+    const std::optional<std::string> &name
+) {
+    auto [staging_buffer, staging_allocation] = createStagingBuffer(data, size);
+
+    // Create the real buffer.
+    auto [buffer, allocation] = createBuffer(
+        size,
+        usage | vk::BufferUsageFlagBits::eTransferDst,
+        allocation_flags,
+        name
+    );
+
+    // Copy the staging buffer to the real buffer.
+    copyBuffer(buffer, staging_buffer, size);
+
+    // Free the staging buffer allocation. (The staging buffer will be freed by
+    // RAII)
+    std::cerr << "Freeing staging buffer allocation " << staging_allocation << "\n";
+    vmaFreeMemory(allocator(), staging_allocation);
+
+    return {std::move(buffer), allocation};
+}
+
+std::pair<vk::raii::Buffer, VmaAllocation> gfx::ComputeContext::createBufferWithStagedData(
+    const void *data,
+    size_t size,
+    vk::BufferUsageFlags usage,
+    VmaAllocationCreateFlags allocation_flags,
+    const std::optional<std::string> &name,
+    std::vector<StagedCopy> &copies
+) {
+    auto [staging_buffer, staging_allocation] = createStagingBuffer(data, size);
+    auto [buffer, allocation] = createBuffer(
+        size,
+        usage | vk::BufferUsageFlagBits::eTransferDst,
+        allocation_flags,
+        name
+    );
+
+    copies.push_back(StagedCopy{
+        .staging_buffer = std::move(staging_buffer),
+        .staging_allocation = staging_allocation,
+        .dst = *buffer,
+        .size = size,
+    });
+    return {std::move(buffer), allocation};
+}
+
+void gfx::ComputeContext::copyBuffer(const vk::raii::Buffer &dst, const vk::raii::Buffer &src, VkDeviceSize size) {
+    vk::BufferCopy region{
+        .srcOffset = 0,
+        .dstOffset = 0,
+        .size = size,
+    };
+
+    vk::raii::CommandBuffer cb = beginOneShot();
+    cb.copyBuffer(*src, *dst, region);
+    endOneShot(std::move(cb));
+}
+
+std::pair<vk::raii::Buffer, VmaAllocation> gfx::ComputeContext::createStagingBuffer(const void *data, size_t size) {
+    auto [staging_buffer, staging_allocation] = createBuffer(
+        size,
+        vk::BufferUsageFlagBits::eTransferSrc,
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+        "staging"
+    );
+
+    // Copy data to the staging buffer.
+    VkResult rslt = vmaCopyMemoryToAllocation(allocator(), data, staging_allocation, 0, size);
+
+    if (rslt != VK_SUCCESS) {
+        throw std::runtime_error(
+            std::format(
+                "Failed to copy data to the staging buffer. Error code: {}",
+                vk::to_string(vk::Result(rslt))
+            )
+        );
+    }
+    return {std::move(staging_buffer), staging_allocation};
+}
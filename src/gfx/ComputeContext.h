@@ -0,0 +1,79 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#ifndef _VPLANET_GFX_COMPUTE_CONTEXT_H_
+#define _VPLANET_GFX_COMPUTE_CONTEXT_H_
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../vulkan.h"
+#include "../VmaUsage.h"
+
+namespace gfx {
+    class ShaderLibrary;
+
+    // A copy out of a staging buffer, left for its owner to record with a
+    // frame's other commands. The staging buffer has to be kept until
+    // that frame is done with it.
+    struct StagedCopy {
+        vk::raii::Buffer staging_buffer;
+        VmaAllocation staging_allocation;
+        vk::Buffer dst;
+        vk::DeviceSize size;
+    };
+
+    // What compute work needs from a device, so it can run without the
+    // renderer: on the viewer's System, or on a HeadlessDevice that has no
+    // window or swapchain at all.
+    class ComputeContext {
+    public:
+        virtual ~ComputeContext();
+
+        virtual const vk::raii::Device &device() const = 0;
+        virtual VmaAllocator allocator() const = 0;
+        // Frames in flight, each of which needs its own copy of whatever is
+        // rewritten per frame.
+        virtual uint32_t numFrames() const = 0;
+        virtual ShaderLibrary &shaders() = 0;
+        virtual const vk::raii::DescriptorPool &descriptorPool() const = 0;
+
+        // Commands submitted on their own, waited for by endOneShot().
+        virtual vk::raii::CommandBuffer beginOneShot() const = 0;
+        virtual void endOneShot(vk::raii::CommandBuffer &&buffer) const = 0;
+        virtual void waitIdle() = 0;
+
+        std::pair<vk::raii::Buffer, VmaAllocation> createBuffer(
+            vk::DeviceSize size,
+            vk::BufferUsageFlags usage,
+            VmaAllocationCreateFlags allocation_flags,
+            const std::optional<std::string> &name
+        );
+        // Goes through a staging buffer, copied from in a one shot command.
+        std::pair<vk::raii::Buffer, VmaAllocation> createBufferWithData(
+            const void *data,
+            size_t size,
+            vk::BufferUsageFlags usage,
+            VmaAllocationCreateFlags allocation_flags,
+            const std::optional<std::string> &name
+        );
+        // As createBufferWithData(), but the copy is added to copies instead
+        // of being submitted and waited for.
+        std::pair<vk::raii::Buffer, VmaAllocation> createBufferWithStagedData(
+            const void *data,
+            size_t size,
+            vk::BufferUsageFlags usage,
+            VmaAllocationCreateFlags allocation_flags,
+            const std::optional<std::string> &name,
+            std::vector<StagedCopy> &copies
+        );
+        void copyBuffer(const vk::raii::Buffer &dst, const vk::raii::Buffer &src, vk::DeviceSize size);
+
+    private:
+        std::pair<vk::raii::Buffer, VmaAllocation> createStagingBuffer(const void *data, size_t size);
+    };
+}
+
+#endif
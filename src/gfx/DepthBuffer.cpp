@@ -51,6 +51,54 @@ bool gfx::DepthBuffer::hasStencilComponent() const {
         m_format == vk::Format::eD32SfloatS8Uint;
 }
 
+bool gfx::DepthBuffer::isFloat() const {
+    return m_format == vk::Format::eD32Sfloat || m_format == vk::Format::eD32SfloatS8Uint;
+}
+
+void gfx::DepthBuffer::transitionToShaderRead(const vk::raii::CommandBuffer &cmd_buf) const {
+    vk::ImageMemoryBarrier2 imb{
+        .srcStageMask = vk::PipelineStageFlagBits2::eEarlyFragmentTests | vk::PipelineStageFlagBits2::eLateFragmentTests,
+        .srcAccessMask = vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+        .dstStageMask = vk::PipelineStageFlagBits2::eFragmentShader,
+        .dstAccessMask = vk::AccessFlagBits2::eShaderSampledRead,
+        .oldLayout = vk::ImageLayout::eDepthAttachmentOptimal,
+        .newLayout = vk::ImageLayout::eDepthReadOnlyOptimal,
+        .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .image = *m_image,
+        .subresourceRange = {
+            .aspectMask = vk::ImageAspectFlagBits::eDepth,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+    };
+    cmd_buf.pipelineBarrier2(vk::DependencyInfo{}.setImageMemoryBarriers(imb));
+}
+
+void gfx::DepthBuffer::transitionToAttachment(const vk::raii::CommandBuffer &cmd_buf) const {
+    vk::ImageMemoryBarrier2 imb{
+        .srcStageMask = vk::PipelineStageFlagBits2::eFragmentShader,
+        .srcAccessMask = vk::AccessFlagBits2::eNone,
+        .dstStageMask = vk::PipelineStageFlagBits2::eEarlyFragmentTests | vk::PipelineStageFlagBits2::eLateFragmentTests,
+        .dstAccessMask = vk::AccessFlagBits2::eDepthStencilAttachmentRead | vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+        .oldLayout = vk::ImageLayout::eDepthReadOnlyOptimal,
+        .newLayout = vk::ImageLayout::eDepthAttachmentOptimal,
+        .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .image = *m_image,
+        .subresourceRange = {
+            .aspectMask = vk::ImageAspectFlagBits::eDepth,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+    };
+    cmd_buf.pipelineBarrier2(vk::DependencyInfo{}.setImageMemoryBarriers(imb));
+}
+
 void gfx::DepthBuffer::initDepthResources() {
     const vk::raii::Device &device = m_system->device();
     const vk::raii::PhysicalDevice physical_device = m_system->physicalDevice();
@@ -65,7 +113,7 @@ void gfx::DepthBuffer::initDepthResources() {
         .arrayLayers = 1,
         .samples = vk::SampleCountFlagBits::e1,
         .tiling = vk::ImageTiling::eOptimal,
-        .usage = vk::ImageUsageFlagBits::eDepthStencilAttachment,
+        .usage = vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eSampled,
         .sharingMode = vk::SharingMode::eExclusive,
         .initialLayout = vk::ImageLayout::eUndefined,
     };
@@ -135,6 +183,9 @@ void gfx::DepthBuffer::transitionImageLayout() {
 }
 
 vk::Format chooseDepthFormat(const vk::raii::PhysicalDevice &device) {
+    // Float first: with reversed depth its exponent puts the precision in
+    // the distance, where the perspective divide takes it away. The
+    // atmosphere samples it, so it has to be sampleable too.
     std::array<vk::Format, 3> candidates{
         vk::Format::eD32Sfloat,
         vk::Format::eD32SfloatS8Uint,
@@ -145,7 +196,8 @@ vk::Format chooseDepthFormat(const vk::raii::PhysicalDevice &device) {
         candidates,
         [&device](vk::Format format) {
             vk::FormatProperties props = device.getFormatProperties(format);
-            return static_cast<bool>(props.optimalTilingFeatures & vk::FormatFeatureFlagBits::eDepthStencilAttachment);
+            vk::FormatFeatureFlags needed = vk::FormatFeatureFlagBits::eDepthStencilAttachment | vk::FormatFeatureFlagBits::eSampledImage;
+            return (props.optimalTilingFeatures & needed) == needed;
         }
     );
 
@@ -24,6 +24,13 @@ namespace gfx {
         vk::Format format() const;
         const vk::raii::ImageView &imageView() const;
         bool hasStencilComponent() const;
+        bool isFloat() const;
+
+        // Between the draws that write it and passes that sample it, such
+        // as the atmosphere's, and back. The buffer is otherwise left as a
+        // depth attachment.
+        void transitionToShaderRead(const vk::raii::CommandBuffer &cmd_buf) const;
+        void transitionToAttachment(const vk::raii::CommandBuffer &cmd_buf) const;
 
     private:
         void initDepthResources();
@@ -0,0 +1,248 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#include <cstdint>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../vulkan.h"
+#include "../VmaUsage.h"
+
+#include "HeadlessDevice.h"
+#include "ShaderLibrary.h"
+
+gfx::HeadlessDevice::HeadlessDevice(const std::string &device_name)
+: m_context{},
+  m_instance{nullptr},
+  m_physical_device{nullptr},
+  m_device{nullptr},
+  m_compute_queue_family{UINT32_MAX},
+  m_compute_queue{nullptr},
+  m_allocator{VK_NULL_HANDLE},
+  m_command_pool{nullptr},
+  m_descriptor_pool{nullptr},
+  m_shaders{nullptr}
+{
+    initInstance();
+    initDevice(device_name);
+    initAllocator();
+    initCommands();
+    initDescriptorPool();
+#ifdef VPLANET_SHADER_DIRECTORY
+    m_shaders = std::make_unique<ShaderLibrary>(VPLANET_SHADER_DIRECTORY);
+#else
+    m_shaders = std::make_unique<ShaderLibrary>();
+#endif
+}
+
+gfx::HeadlessDevice::~HeadlessDevice() {
+    waitIdle();
+    if (m_allocator != VK_NULL_HANDLE) {
+        vmaDestroyAllocator(m_allocator);
+    }
+}
+
+const vk::raii::PhysicalDevice &gfx::HeadlessDevice::physicalDevice() const {
+    return m_physical_device;
+}
+
+const vk::raii::Device &gfx::HeadlessDevice::device() const {
+    return m_device;
+}
+
+VmaAllocator gfx::HeadlessDevice::allocator() const {
+    return m_allocator;
+}
+
+uint32_t gfx::HeadlessDevice::numFrames() const {
+    return 1;
+}
+
+gfx::ShaderLibrary &gfx::HeadlessDevice::shaders() {
+    return *m_shaders;
+}
+
+const vk::raii::DescriptorPool &gfx::HeadlessDevice::descriptorPool() const {
+    return m_descriptor_pool;
+}
+
+vk::raii::CommandBuffer gfx::HeadlessDevice::beginOneShot() const {
+    vk::CommandBufferAllocateInfo cb_ai{
+        .commandPool = *m_command_pool,
+        .level = vk::CommandBufferLevel::ePrimary,
+        .commandBufferCount = 1,
+    };
+    vk::raii::CommandBuffer commands = std::move(m_device.allocateCommandBuffers(cb_ai).front());
+
+    vk::CommandBufferBeginInfo cb_bi{.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit};
+    commands.begin(cb_bi);
+    return std::move(commands);
+}
+
+void gfx::HeadlessDevice::endOneShot(vk::raii::CommandBuffer &&commands) const {
+    commands.end();
+    vk::SubmitInfo si = vk::SubmitInfo{}.setCommandBuffers(*commands);
+    m_compute_queue.submit(si);
+    m_compute_queue.waitIdle();
+}
+
+void gfx::HeadlessDevice::waitIdle() {
+    if (m_compute_queue != nullptr) {
+        m_compute_queue.waitIdle();
+    }
+}
+
+void gfx::HeadlessDevice::initInstance() {
+    vk::ApplicationInfo app_info{
+        .pApplicationName = "vplanet",
+        .applicationVersion = VK_MAKE_VERSION(0, 1, 0),
+        .pEngineName = "vplanet-engine",
+        .engineVersion = VK_MAKE_VERSION(0, 1, 0),
+        .apiVersion = vk::ApiVersion13,
+    };
+
+    // Without a surface, only the portability enumeration is needed, so
+    // that MoltenVK's devices are listed.
+    vk::InstanceCreateFlags flags;
+    std::vector<const char*> extensions;
+    #ifdef __APPLE__
+    flags |= vk::InstanceCreateFlagBits::eEnumeratePortabilityKHR;
+    extensions.push_back(vk::KHRPortabilityEnumerationExtensionName);
+    #endif
+
+    vk::InstanceCreateInfo inst_ci = vk::InstanceCreateInfo{
+        .flags = flags,
+        .pApplicationInfo = &app_info,
+    }
+        .setPEnabledExtensionNames(extensions);
+
+    m_instance = m_context.createInstance(inst_ci);
+    std::cerr << "Created instance: " << *m_instance << "\n";
+}
+
+void gfx::HeadlessDevice::initDevice(const std::string &device_name) {
+    std::vector<vk::raii::PhysicalDevice> devices = m_instance.enumeratePhysicalDevices();
+    for (auto &device : devices) {
+        vk::PhysicalDeviceProperties props = device.getProperties();
+        if (props.apiVersion < vk::ApiVersion13) {
+            continue;
+        }
+        std::string name = props.deviceName;
+        if (!device_name.empty() && name.find(device_name) == std::string::npos) {
+            continue;
+        }
+
+        const auto features = device.getFeatures2<
+            vk::PhysicalDeviceFeatures2,
+            vk::PhysicalDeviceVulkan13Features
+        >();
+        if (!features.get<vk::PhysicalDeviceVulkan13Features>().synchronization2) {
+            continue;
+        }
+
+        std::vector<vk::QueueFamilyProperties> families = device.getQueueFamilyProperties();
+        std::optional<uint32_t> family;
+        for (uint32_t i = 0; i < families.size(); ++i) {
+            if (families[i].queueFlags & vk::QueueFlagBits::eCompute) {
+                family = i;
+                break;
+            }
+        }
+        if (!family) {
+            continue;
+        }
+
+        m_physical_device = device;
+        m_compute_queue_family = *family;
+        std::cerr << "Chose device: " << name << "\n";
+        break;
+    }
+    if (m_physical_device == nullptr) {
+        throw std::runtime_error(
+            device_name.empty()
+                ? "Unable to find a device with a compute queue"
+                : std::format("Unable to find a device named like {} with a compute queue", device_name)
+        );
+    }
+
+    float queue_priority = 1.0;
+    vk::DeviceQueueCreateInfo queue_ci{
+        .queueFamilyIndex = m_compute_queue_family,
+        .queueCount = 1,
+        .pQueuePriorities = &queue_priority,
+    };
+
+    vk::StructureChain<
+        vk::PhysicalDeviceFeatures2,
+        vk::PhysicalDeviceVulkan13Features
+    > feature_chain = {
+        vk::PhysicalDeviceFeatures2{},
+        vk::PhysicalDeviceVulkan13Features{
+            .synchronization2 = true, // Support new synchronization commands
+        },
+    };
+
+    // Portability devices have to have their subset enabled.
+    std::vector<const char*> extensions;
+    #ifdef __APPLE__
+    std::vector<vk::ExtensionProperties> available_extensions = m_physical_device.enumerateDeviceExtensionProperties();
+    for (const auto &ext : available_extensions) {
+        if (std::string{ext.extensionName} == vk::KHRPortabilitySubsetExtensionName) {
+            extensions.push_back(vk::KHRPortabilitySubsetExtensionName);
+        }
+    }
+    #endif
+
+    vk::DeviceCreateInfo dev_ci = vk::DeviceCreateInfo{.pNext = &feature_chain.get<vk::PhysicalDeviceFeatures2>()}
+        .setPEnabledExtensionNames(extensions)
+        .setQueueCreateInfos(queue_ci);
+
+    m_device = m_physical_device.createDevice(dev_ci);
+    std::cerr << "Created device: " << *m_device << "\n";
+    m_compute_queue = m_device.getQueue(m_compute_queue_family, 0);
+}
+
+void gfx::HeadlessDevice::initAllocator() {
+    VmaAllocatorCreateInfo alloc_ci{};
+    alloc_ci.physicalDevice = *m_physical_device;
+    alloc_ci.device = *m_device;
+    alloc_ci.instance = *m_instance;
+    alloc_ci.vulkanApiVersion = vk::ApiVersion13;
+
+    VkResult rslt = vmaCreateAllocator(&alloc_ci, &m_allocator);
+    if (rslt != VK_SUCCESS) {
+        throw std::runtime_error(
+            std::format(
+                "Unable to create memory allocator. Error code: {}",
+                vk::to_string(vk::Result(rslt))
+            )
+        );
+    }
+}
+
+void gfx::HeadlessDevice::initCommands() {
+    m_command_pool = m_device.createCommandPool(vk::CommandPoolCreateInfo{
+        .flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+        .queueFamilyIndex = m_compute_queue_family,
+    });
+}
+
+void gfx::HeadlessDevice::initDescriptorPool() {
+    // TerrainGenerator's one set: the noise's two tables, the jobs and the
+    // vertices.
+    vk::DescriptorPoolSize pool_size{
+        .type = vk::DescriptorType::eStorageBuffer,
+        .descriptorCount = 4,
+    };
+    vk::DescriptorPoolCreateInfo dp_ci = vk::DescriptorPoolCreateInfo{
+        .flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
+        .maxSets = 1,
+    }.setPoolSizes(pool_size);
+
+    m_descriptor_pool = m_device.createDescriptorPool(dp_ci);
+}
@@ -0,0 +1,64 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#ifndef _VPLANET_GFX_HEADLESS_DEVICE_H_
+#define _VPLANET_GFX_HEADLESS_DEVICE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "../vulkan.h"
+#include "../VmaUsage.h"
+
+#include "ComputeContext.h"
+#include "ShaderLibrary.h"
+
+namespace gfx {
+    // A device with nothing but a compute queue: no window, surface or
+    // swapchain, so compute passes can be run by tools and tests on
+    // machines without a display. It has a single frame in flight, and
+    // room in its descriptor pool for one TerrainGenerator.
+    class HeadlessDevice : public ComputeContext {
+    public:
+        // The first device with a compute queue and synchronization2 whose
+        // name contains device_name, which matches any if it's empty.
+        explicit HeadlessDevice(const std::string &device_name);
+        HeadlessDevice(const HeadlessDevice &other) = delete;
+        ~HeadlessDevice();
+
+        HeadlessDevice &operator=(const HeadlessDevice &other) = delete;
+
+        const vk::raii::PhysicalDevice &physicalDevice() const;
+        virtual const vk::raii::Device &device() const;
+        virtual VmaAllocator allocator() const;
+        virtual uint32_t numFrames() const;
+        virtual ShaderLibrary &shaders();
+        virtual const vk::raii::DescriptorPool &descriptorPool() const;
+        // On the compute queue.
+        virtual vk::raii::CommandBuffer beginOneShot() const;
+        virtual void endOneShot(vk::raii::CommandBuffer &&buffer) const;
+        virtual void waitIdle();
+
+    private:
+        void initInstance();
+        void initDevice(const std::string &device_name);
+        void initAllocator();
+        void initCommands();
+        void initDescriptorPool();
+
+        vk::raii::Context m_context;
+        vk::raii::Instance m_instance;
+        vk::raii::PhysicalDevice m_physical_device;
+        vk::raii::Device m_device;
+        uint32_t m_compute_queue_family;
+        vk::raii::Queue m_compute_queue;
+
+        VmaAllocator m_allocator;
+
+        vk::raii::CommandPool m_command_pool;
+        vk::raii::DescriptorPool m_descriptor_pool;
+        std::unique_ptr<ShaderLibrary> m_shaders;
+    };
+}
+
+#endif
@@ -0,0 +1,86 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../vulkan.h"
+
+#include "LightClusters.h"
+#include "Renderer.h"
+#include "ShaderLibrary.h"
+#include "System.h"
+#include "Uniforms.h"
+
+const char *LIGHT_BINNING_SHADER = "light_binning.slang.spv";
+
+// Must match GROUP_SIZE in light_binning.slang.
+const uint32_t LIGHT_BINNING_WORKGROUP_SIZE = 64;
+
+gfx::LightClusters::LightClusters()
+: m_renderer{nullptr},
+  m_pipeline_layout{nullptr},
+  m_pipeline{nullptr}
+{}
+
+gfx::LightClusters::LightClusters(Renderer *renderer) : LightClusters() {
+    m_renderer = renderer;
+    initPipeline();
+}
+
+void gfx::LightClusters::recordBinning(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index) {
+    const SceneUniformSet &scene_uniforms = m_renderer->sceneUniforms();
+    if (scene_uniforms.pointLightCount(frame_index) == 0) {
+        return;
+    }
+
+    cmd_buf.bindPipeline(vk::PipelineBindPoint::eCompute, *m_pipeline);
+    cmd_buf.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *m_pipeline_layout, 0, *scene_uniforms.descriptorSets()[frame_index], nullptr);
+    cmd_buf.dispatch((LIGHT_CLUSTER_COUNT + LIGHT_BINNING_WORKGROUP_SIZE - 1) / LIGHT_BINNING_WORKGROUP_SIZE, 1, 1);
+
+    vk::MemoryBarrier2 lights_barrier{
+        .srcStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+        .srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite,
+        .dstStageMask = vk::PipelineStageFlagBits2::eFragmentShader,
+        .dstAccessMask = vk::AccessFlagBits2::eShaderStorageRead,
+    };
+    cmd_buf.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(lights_barrier));
+}
+
+void gfx::LightClusters::addReloadJobs(const std::set<std::string> &shaders, std::vector<ReloadJob> &jobs) {
+    if (shaders.contains(LIGHT_BINNING_SHADER)) {
+        jobs.push_back([this](PipelineReload &reload) {
+            reload.add(&m_pipeline, createPipeline());
+        });
+    }
+}
+
+void gfx::LightClusters::initPipeline() {
+    System *system = m_renderer->system();
+    const vk::raii::Device &device = system->device();
+
+    vk::PipelineLayoutCreateInfo pl_ci = vk::PipelineLayoutCreateInfo{}
+        .setSetLayouts(*system->uniforms().sceneDescriptorSetLayout());
+    m_pipeline_layout = device.createPipelineLayout(pl_ci);
+
+    m_pipeline = createPipeline();
+}
+
+vk::raii::Pipeline gfx::LightClusters::createPipeline() {
+    System *system = m_renderer->system();
+    const vk::raii::Device &device = system->device();
+    vk::raii::ShaderModule shader = system->shaders().createModule(device, LIGHT_BINNING_SHADER);
+
+    vk::ComputePipelineCreateInfo cp_ci{
+        .stage = vk::PipelineShaderStageCreateInfo{
+            .stage = vk::ShaderStageFlagBits::eCompute,
+            .module = *shader,
+            .pName = "cs_main",
+        },
+        .layout = *m_pipeline_layout,
+    };
+    vk::raii::Pipeline pipeline = device.createComputePipeline(nullptr, cp_ci);
+    std::cerr << "Created light binning compute pipeline " << *pipeline << "\n";
+    return pipeline;
+}
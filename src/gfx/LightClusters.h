@@ -0,0 +1,46 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#ifndef _VPLANET_GFX_LIGHT_CLUSTERS_H_
+#define _VPLANET_GFX_LIGHT_CLUSTERS_H_
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../vulkan.h"
+
+#include "Pipeline.h"
+
+namespace gfx {
+    class Renderer;
+
+    // The compute pass that bins the scene's point lights into clusters of
+    // the view, so that the colour pass only shades each fragment with the
+    // lights that reach it, and its cost follows the lights per cluster
+    // rather than the lights in the scene. It reads and writes the buffers
+    // of the scene uniform set (see SceneUniformSet), so it's bound with
+    // the same descriptor set as the draws.
+    class LightClusters {
+    public:
+        LightClusters();
+        LightClusters(Renderer *renderer);
+
+        // Recorded outside of the rendering pass, after the frame's light
+        // cluster parameters are written. Does nothing without point
+        // lights; the fragment shaders skip the lists then.
+        void recordBinning(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index);
+        // As Pipeline::addReloadJobs().
+        void addReloadJobs(const std::set<std::string> &shaders, std::vector<ReloadJob> &jobs);
+
+    private:
+        void initPipeline();
+        vk::raii::Pipeline createPipeline();
+
+        Renderer *m_renderer;
+        vk::raii::PipelineLayout m_pipeline_layout;
+        vk::raii::Pipeline m_pipeline;
+    };
+}
+
+#endif
@@ -1,6 +1,10 @@
 // -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
 
+#include <cstddef>
 #include <iostream>
+#include <set>
+#include <span>
+#include <string>
 #include <vector>
 
 #include "../vulkan.h"
@@ -11,20 +15,25 @@
 #include "Pipeline.h"
 #include "Renderer.h"
 #include "Resource.h"
+#include "ShaderLibrary.h"
 #include "System.h"
 
-const std::vector<unsigned char> &OCEAN_SLANG_SHADER_BYTECODE = LOAD_RESOURCE(ocean_slang_spv);
-const std::vector<unsigned char> &OCEAN_GLSL_VERTEX_SHADER_BYTECODE = LOAD_RESOURCE(ocean_vert_spv);
-const std::vector<unsigned char> &OCEAN_GLSL_FRAGMENT_SHADER_BYTECODE = LOAD_RESOURCE(ocean_frag_spv);
+const char *OCEAN_SHADER = "ocean.slang.spv";
+const std::span<const std::byte> OCEAN_GLSL_VERTEX_SHADER_BYTECODE = LOAD_RESOURCE(ocean_vert_spv);
+const std::span<const std::byte> OCEAN_GLSL_FRAGMENT_SHADER_BYTECODE = LOAD_RESOURCE(ocean_frag_spv);
 
 gfx::OceanPipeline::OceanPipeline()
 : Pipeline(nullptr),
   m_uniform_set{},
-  m_num_indices{0},
+  m_draw_parameters{
+      .color = glm::vec4{0.0f, 0.0f, 0.0f, 1.0f},
+      .radius = 1.0f,
+      .time = 0.0f,
+      .padding = {0.0f, 0.0f},
+  },
   m_vertex_buffer{nullptr},
-  m_index_buffer{nullptr},
   m_vertex_buffer_allocation{nullptr},
-  m_index_buffer_allocation{nullptr}
+  m_index_buffer{}
 {}
 
 gfx::OceanPipeline::OceanPipeline(Renderer *renderer) : OceanPipeline() {
@@ -40,50 +49,66 @@ gfx::OceanPipeline::~OceanPipeline() {
             vmaFreeMemory(m_renderer->system()->allocator(), m_vertex_buffer_allocation);
             m_vertex_buffer_allocation = nullptr;
         }
-        
-        if (m_index_buffer_allocation != nullptr) {
-            std::cerr << "Freeing ocean index buffer allocation " << m_index_buffer_allocation << "\n";
-            vmaFreeMemory(m_renderer->system()->allocator(), m_index_buffer_allocation);
-            m_index_buffer_allocation = nullptr;
-        }
     }
 }
 
-void gfx::OceanPipeline::recordCommands(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index) {
+void gfx::OceanPipeline::recordCommands(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index, DrawPass pass) {
     const vk::raii::PipelineLayout &layout = m_renderer->pipelineLayout();
     const std::vector<vk::raii::DescriptorSet> &model_uniforms = m_uniform_set.descriptorSets();
 
-    cmd_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, *m_pipeline);
+    if (!m_index_buffer) {
+        return;
+    }
+
+    const vk::raii::Pipeline &pipeline = m_pipelines.get(lightCount(frame_index), [this](uint32_t light_count) {
+        return createPipeline(light_count);
+    });
+    cmd_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, *pipeline);
     cmd_buf.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *layout, 1, *model_uniforms[frame_index], nullptr);
+    cmd_buf.pushConstants<OceanDrawParameters>(*layout, vk::ShaderStageFlagBits::eVertex, 0, m_draw_parameters);
     cmd_buf.bindVertexBuffers(0, *m_vertex_buffer, {0});
-    cmd_buf.bindIndexBuffer(*m_index_buffer, 0, vk::IndexType::eUint32);
-    cmd_buf.drawIndexed(m_num_indices, 1, 0, 0, 0);
+    cmd_buf.bindIndexBuffer(*m_index_buffer->buffer(), 0, m_index_buffer->indexType());
+    for (const IndexBatch &batch : m_index_buffer->batches()) {
+        cmd_buf.drawIndexed(batch.element_count, 1, batch.first_element, static_cast<int32_t>(batch.base_vertex), 0);
+    }
 }
 
-void gfx::OceanPipeline::setGeometry(const std::vector<OceanVertex> &verts, const std::vector<uint32_t> &indices) {
+void gfx::OceanPipeline::setGeometry(
+    uint32_t refinements,
+    std::span<const OceanVertex> verts,
+    const std::vector<uint32_t> &indices,
+    const ShortElements *short_indices
+) {
     System *gfx = m_renderer->system();
 
     if (m_vertex_buffer_allocation != nullptr) {
         vmaFreeMemory(gfx->allocator(), m_vertex_buffer_allocation);
     }
 
-    if (m_index_buffer_allocation != nullptr) {
-        vmaFreeMemory(gfx->allocator(), m_index_buffer_allocation);
-    }
-
     std::tie(m_vertex_buffer, m_vertex_buffer_allocation) = gfx->createBufferWithData(
         verts.data(), verts.size() * sizeof(OceanVertex),
         vk::BufferUsageFlagBits::eVertexBuffer, 0,
         "ocean vertex"
     );
 
-    std::tie(m_index_buffer, m_index_buffer_allocation) = gfx->createBufferWithData(
-        indices.data(), indices.size() * sizeof(uint32_t),
-        vk::BufferUsageFlagBits::eIndexBuffer, 0,
-        "ocean index"
-    );
+    if (short_indices != nullptr) {
+        m_index_buffer = gfx->topologies().icosphereIndices(refinements, *short_indices);
+    } else {
+        m_index_buffer = gfx->topologies().icosphereIndices(refinements, indices);
+    }
+}
 
-    m_num_indices = static_cast<uint32_t>(indices.size());
+void gfx::OceanPipeline::setSurface(float radius, const glm::vec4 &color) {
+    m_draw_parameters.radius = radius;
+    m_draw_parameters.color = color;
+}
+
+glm::vec4 gfx::OceanPipeline::boundingSphere() const {
+    return glm::vec4{glm::vec3{m_uniform_set.transform()[3]}, m_draw_parameters.radius};
+}
+
+void gfx::OceanPipeline::setTime(float seconds) {
+    m_draw_parameters.time = seconds;
 }
 
 void gfx::OceanPipeline::setTransform(const glm::mat4x4 &xform) {
@@ -94,7 +119,25 @@ void gfx::OceanPipeline::writeTransform(uint32_t buffer_index) {
     m_uniform_set.updateModelBuffer(buffer_index);
 }
 
+// Other light counts than the usual one get their pipelines when first
+// drawn with.
 void gfx::OceanPipeline::initPipeline() {
+    m_pipelines.get(1, [this](uint32_t light_count) {
+        return createPipeline(light_count);
+    });
+}
+
+void gfx::OceanPipeline::addReloadJobs(const std::set<std::string> &shaders, std::vector<ReloadJob> &jobs) {
+    if (shaders.contains(OCEAN_SHADER)) {
+        jobs.push_back([this, light_counts = m_pipelines.lightCounts()](PipelineReload &reload) {
+            reload.add(&m_pipelines, PipelineVariants::create(light_counts, [this](uint32_t light_count) {
+                return createPipeline(light_count);
+            }));
+        });
+    }
+}
+
+vk::raii::Pipeline gfx::OceanPipeline::createPipeline(uint32_t light_count) {
     System *system = m_renderer->system();
     const vk::raii::Device &device = system->device();
     vk::Extent2D extent = system->swapchain().extent();
@@ -102,12 +145,9 @@ void gfx::OceanPipeline::initPipeline() {
     vk::SurfaceFormatKHR swapchain_format = system->swapchain().format();
     vk::Format depth_format = system->depthBuffer().format();
 
-    vk::ShaderModuleCreateInfo sm_ci{
-        .codeSize = OCEAN_SLANG_SHADER_BYTECODE.size() * sizeof(std::remove_reference<decltype(OCEAN_SLANG_SHADER_BYTECODE)>::type::value_type),
-        .pCode = reinterpret_cast<const uint32_t *>(OCEAN_SLANG_SHADER_BYTECODE.data()),
-    };
-    vk::raii::ShaderModule shader = device.createShaderModule(sm_ci);
+    vk::raii::ShaderModule shader = system->shaders().createModule(device, OCEAN_SHADER);
 
+    ShaderSpecialization specialization{light_count};
     std::array<vk::PipelineShaderStageCreateInfo, 2> shader_stages{
         vk::PipelineShaderStageCreateInfo{
             .stage = vk::ShaderStageFlagBits::eVertex,
@@ -118,6 +158,7 @@ void gfx::OceanPipeline::initPipeline() {
             .stage = vk::ShaderStageFlagBits::eFragment,
             .module = *shader,
             .pName = "fs_main",
+            .pSpecializationInfo = specialization.info(),
         },
     };
 
@@ -179,7 +220,7 @@ void gfx::OceanPipeline::initPipeline() {
     vk::PipelineDepthStencilStateCreateInfo depth_ci{
         .depthTestEnable = vk::True,
         .depthWriteEnable = vk::True,
-        .depthCompareOp = vk::CompareOp::eLess,
+        .depthCompareOp = vk::CompareOp::eLess, // Dynamic, for reversed depth
         .depthBoundsTestEnable = vk::False,
         .stencilTestEnable = vk::False,
     };
@@ -197,9 +238,11 @@ void gfx::OceanPipeline::initPipeline() {
         .logicOp = vk::LogicOp::eCopy,
     }.setAttachments(blend_attachment);
 
-    std::array<vk::DynamicState, 2> dynamic_states{
+    std::array<vk::DynamicState, 4> dynamic_states{
         vk::DynamicState::eViewport,
         vk::DynamicState::eScissor,
+        vk::DynamicState::eDepthCompareOp,
+        vk::DynamicState::eDepthWriteEnable,
     };
     vk::PipelineDynamicStateCreateInfo dynamic_state_ci = vk::PipelineDynamicStateCreateInfo{}
         .setDynamicStates(dynamic_states);
@@ -225,6 +268,7 @@ void gfx::OceanPipeline::initPipeline() {
     pipeline_ci.get<vk::PipelineRenderingCreateInfo>()
         .setColorAttachmentFormats(swapchain_format.format);
     
-    m_pipeline = device.createGraphicsPipeline(nullptr, pipeline_ci.get<vk::GraphicsPipelineCreateInfo>());
-    std::cerr << "Created ocean graphics pipeline " << *m_pipeline << "\n";
+    vk::raii::Pipeline pipeline = device.createGraphicsPipeline(nullptr, pipeline_ci.get<vk::GraphicsPipelineCreateInfo>());
+    std::cerr << "Created ocean graphics pipeline " << *pipeline << " for " << light_count << " lights\n";
+    return pipeline;
 }
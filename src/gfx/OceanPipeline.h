@@ -3,11 +3,18 @@
 #ifndef _VPLANET_GFX_OCEAN_PIPELINE_H_
 #define _VPLANET_GFX_OCEAN_PIPELINE_H_
 
+#include <memory>
+#include <set>
+#include <span>
+#include <string>
+#include <vector>
+
 #include "../vulkan.h"
 #include "../VmaUsage.h"
 
 #include "../Ocean.h"
 #include "Pipeline.h"
+#include "TopologyCache.h"
 #include "Uniforms.h"
 
 namespace gfx {
@@ -25,19 +32,31 @@ namespace gfx {
         OceanPipeline &operator=(const OceanPipeline &other) = delete;
         OceanPipeline &operator=(OceanPipeline &&other) = default;
 
-        void setGeometry(const std::vector<OceanVertex> &verts, const std::vector<uint32_t> &elems);
+        void setGeometry(
+            uint32_t refinements,
+            std::span<const OceanVertex> verts,
+            const std::vector<uint32_t> &elems,
+            const ShortElements *short_elems = nullptr
+        );
+        void setSurface(float radius, const glm::vec4 &color);
+        void setTime(float seconds);
         void setTransform(const glm::mat4x4 &xform);
         void writeTransform(uint32_t buffer_index);
 
-        void recordCommands(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index);
+        virtual void recordCommands(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index, DrawPass pass);
+        virtual void addReloadJobs(const std::set<std::string> &shaders, std::vector<ReloadJob> &jobs);
+        // World space bounds, as center and radius.
+        glm::vec4 boundingSphere() const;
 
     private:
         virtual void initPipeline();
+        vk::raii::Pipeline createPipeline(uint32_t light_count);
 
         ModelUniformSet m_uniform_set;
-        uint32_t m_num_indices;
-        vk::raii::Buffer m_vertex_buffer, m_index_buffer;
-        VmaAllocation m_vertex_buffer_allocation, m_index_buffer_allocation;
+        OceanDrawParameters m_draw_parameters;
+        vk::raii::Buffer m_vertex_buffer;
+        VmaAllocation m_vertex_buffer_allocation;
+        std::shared_ptr<const SharedIndexBuffer> m_index_buffer;
     };
 }
 
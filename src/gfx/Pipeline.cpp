@@ -1,14 +1,46 @@
 // -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
 
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "../vulkan.h"
 
 #include "Pipeline.h"
 #include "Renderer.h"
 #include "System.h"
 
+gfx::ShaderSpecialization::ShaderSpecialization(uint32_t light_count)
+: m_light_count{light_count},
+  m_entry{
+      .constantID = eLightCountConstant,
+      .offset = 0,
+      .size = sizeof(m_light_count),
+  },
+  m_info{
+      .mapEntryCount = 1,
+      .pMapEntries = &m_entry,
+      .dataSize = sizeof(m_light_count),
+      .pData = &m_light_count,
+  }
+{}
+
+const vk::SpecializationInfo *gfx::ShaderSpecialization::info() const {
+    return &m_info;
+}
+
+std::vector<uint32_t> gfx::PipelineVariants::lightCounts() const {
+    std::vector<uint32_t> counts;
+    for (const auto &[light_count, pipeline] : m_pipelines) {
+        counts.push_back(light_count);
+    }
+    return counts;
+}
+
 gfx::Pipeline::Pipeline()
 : m_renderer{nullptr},
-  m_pipeline{nullptr}
+  m_pipelines{}
 {}
 
 gfx::Pipeline::Pipeline(Renderer *renderer) : Pipeline() {
@@ -16,3 +48,17 @@ gfx::Pipeline::Pipeline(Renderer *renderer) : Pipeline() {
 }
 
 gfx::Pipeline::~Pipeline() {}
+
+bool gfx::Pipeline::depthPrepassSupported() const {
+    return false;
+}
+
+bool gfx::Pipeline::drawsMeshTasks(DrawPass pass) const {
+    return false;
+}
+
+void gfx::Pipeline::addReloadJobs(const std::set<std::string> &shaders, std::vector<ReloadJob> &jobs) {}
+
+uint32_t gfx::Pipeline::lightCount(uint32_t frame_index) const {
+    return m_renderer->sceneUniforms().lightCount(frame_index);
+}
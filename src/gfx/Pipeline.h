@@ -3,6 +3,14 @@
 #ifndef _VPLANET_GFX_PIPELINE_H_
 #define _VPLANET_GFX_PIPELINE_H_
 
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "../vulkan.h"
 
 #include "Resource.h"
@@ -10,6 +18,101 @@
 namespace gfx {
     class Renderer;
 
+    // What a draw is recorded for. The depth prepass only writes depth, so
+    // that the colour pass shades nothing that ends up hidden. Shadow
+    // passes write the depth from the sun into the shadow map.
+    enum class DrawPass {
+        eDepthPrepass,
+        eColor,
+        eShadow,
+    };
+
+    // The scene shaders' specialization constants, by constant_id.
+    enum SpecializationConstant : uint32_t {
+        // How many lights are packed at the front of the light list.
+        eLightCountConstant = 0,
+    };
+
+    // Specializes a scene fragment shader for a light count. Points into
+    // itself, so it stays put.
+    class ShaderSpecialization {
+    public:
+        ShaderSpecialization(uint32_t light_count);
+        ShaderSpecialization(const ShaderSpecialization &other) = delete;
+
+        ShaderSpecialization &operator=(const ShaderSpecialization &other) = delete;
+
+        const vk::SpecializationInfo *info() const;
+
+    private:
+        uint32_t m_light_count;
+        vk::SpecializationMapEntry m_entry;
+        vk::SpecializationInfo m_info;
+    };
+
+    // A pipeline for each light count, created the first time it's drawn
+    // with and kept, so switching between counts seen before is free.
+    class PipelineVariants {
+    public:
+        template <typename Create>
+        const vk::raii::Pipeline &get(uint32_t light_count, Create create) {
+            auto it = m_pipelines.find(light_count);
+            if (it == m_pipelines.end()) {
+                it = m_pipelines.emplace(light_count, create(light_count)).first;
+            }
+            return it->second;
+        }
+
+        std::vector<uint32_t> lightCounts() const;
+
+        // Variants for the given light counts, made again, as for a reload.
+        template <typename Create>
+        static PipelineVariants create(const std::vector<uint32_t> &light_counts, Create create) {
+            PipelineVariants variants;
+            for (uint32_t light_count : light_counts) {
+                variants.get(light_count, create);
+            }
+            return variants;
+        }
+
+    private:
+        std::map<uint32_t, vk::raii::Pipeline> m_pipelines;
+    };
+
+    // Pipelines rebuilt after their shaders changed on disk, each with the
+    // member it replaces. Swapping them in leaves the old pipelines in
+    // their place, to be kept until the frames in flight are done with
+    // them. Defined here, so that whatever builds its own pipelines can
+    // reload them without linking the rest of the renderer.
+    class PipelineReload {
+    public:
+        void add(PipelineVariants *target, PipelineVariants rebuilt) {
+            m_variants.emplace_back(target, std::move(rebuilt));
+        }
+
+        void add(vk::raii::Pipeline *target, vk::raii::Pipeline rebuilt) {
+            m_pipelines.emplace_back(target, std::move(rebuilt));
+        }
+
+        void swap() {
+            for (auto &[target, rebuilt] : m_variants) {
+                std::swap(*target, rebuilt);
+            }
+            for (auto &[target, rebuilt] : m_pipelines) {
+                std::swap(*target, rebuilt);
+            }
+        }
+
+    private:
+        std::vector<std::pair<PipelineVariants *, PipelineVariants>> m_variants;
+        std::vector<std::pair<vk::raii::Pipeline *, vk::raii::Pipeline>> m_pipelines;
+    };
+
+    // Rebuilds some pipelines into a reload. Runs on a background thread
+    // while the old pipelines are still drawn with, so it may only read
+    // the pipeline it belongs to.
+    using ReloadJob = std::function<void(PipelineReload &)>;
+
     class Pipeline {
     public:
         Pipeline();
@@ -22,11 +125,29 @@ namespace gfx {
         Pipeline &operator=(const Pipeline &other) = delete;
         Pipeline &operator=(Pipeline &&other) = default;
 
+        // Records the draws for a pass inside the frame's dynamic rendering
+        // pass. Only pipelines with depthPrepassSupported() are asked for
+        // the prepass.
+        virtual void recordCommands(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index, DrawPass pass) = 0;
+        virtual bool depthPrepassSupported() const;
+        // Whether the pass's draws are mesh shading ones, which can't be
+        // counted by input assembly or vertex shader statistics.
+        virtual bool drawsMeshTasks(DrawPass pass) const;
+
+        // Adds jobs rebuilding whichever of the pipelines are made from the
+        // named shaders. Called between frames.
+        virtual void addReloadJobs(const std::set<std::string> &shaders, std::vector<ReloadJob> &jobs);
+
     protected:
         virtual void initPipeline() = 0;
 
+        // The length of the light list the frame's scene uniforms were last
+        // written with.
+        uint32_t lightCount(uint32_t frame_index) const;
+
         Renderer *m_renderer;
-        vk::raii::Pipeline m_pipeline;
+        // The colour pass pipeline, by light count.
+        PipelineVariants m_pipelines;
     };
 }
 
@@ -0,0 +1,171 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#include <algorithm>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+#include "../vulkan.h"
+
+#include "PipelineStatistics.h"
+#include "System.h"
+
+gfx::PipelineCounters &gfx::PipelineCounters::operator+=(const PipelineCounters &other) {
+    input_vertices += other.input_vertices;
+    input_primitives += other.input_primitives;
+    vertex_shader_invocations += other.vertex_shader_invocations;
+    clipping_invocations += other.clipping_invocations;
+    clipping_primitives += other.clipping_primitives;
+    fragment_shader_invocations += other.fragment_shader_invocations;
+    return *this;
+}
+
+gfx::PipelineStatistics::PipelineStatistics()
+: m_queries{nullptr},
+  m_mesh_queries{nullptr},
+  m_enabled{false},
+  m_active{false},
+  m_frame_passes{},
+  m_totals{}
+{}
+
+gfx::PipelineStatistics::PipelineStatistics(System *system) : PipelineStatistics() {
+    if (!system->capabilities().pipeline_statistics) {
+        return;
+    }
+
+    uint32_t num_frames = system->numFrames();
+    m_queries = system->device().createQueryPool(vk::QueryPoolCreateInfo{
+        .queryType = vk::QueryType::ePipelineStatistics,
+        .queryCount = num_frames * MAX_PASSES,
+        .pipelineStatistics = COUNTERS,
+    });
+    std::cerr << "Created pipeline statistics query pool " << *m_queries << "\n";
+    if (system->capabilities().mesh_shader) {
+        m_mesh_queries = system->device().createQueryPool(vk::QueryPoolCreateInfo{
+            .queryType = vk::QueryType::ePipelineStatistics,
+            .queryCount = num_frames * MAX_PASSES,
+            .pipelineStatistics = MESH_COUNTERS,
+        });
+        std::cerr << "Created mesh shading pipeline statistics query pool " << *m_mesh_queries << "\n";
+    }
+    m_frame_passes.resize(num_frames);
+}
+
+bool gfx::PipelineStatistics::supported() const {
+    return m_queries != nullptr;
+}
+
+bool gfx::PipelineStatistics::enabled() const {
+    return m_enabled;
+}
+
+void gfx::PipelineStatistics::setEnabled(bool enabled) {
+    m_enabled = enabled && supported();
+}
+
+void gfx::PipelineStatistics::beginFrame(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index) {
+    if (!supported()) {
+        return;
+    }
+
+    // Queries recorded before being turned off are still read, so the
+    // totals cover whole frames.
+    readResults(frame_index);
+    if (m_enabled) {
+        cmd_buf.resetQueryPool(*m_queries, frame_index * MAX_PASSES, MAX_PASSES);
+        if (m_mesh_queries != nullptr) {
+            cmd_buf.resetQueryPool(*m_mesh_queries, frame_index * MAX_PASSES, MAX_PASSES);
+        }
+    }
+}
+
+void gfx::PipelineStatistics::beginPass(
+    const vk::raii::CommandBuffer &cmd_buf,
+    uint32_t frame_index,
+    const char *name,
+    DrawPass pass,
+    bool mesh_tasks
+) {
+    if (!m_enabled || m_frame_passes[frame_index].size() == MAX_PASSES) {
+        return;
+    }
+    // Without mesh shading there are no such passes to count.
+    if (mesh_tasks && m_mesh_queries == nullptr) {
+        return;
+    }
+
+    uint32_t query = frame_index * MAX_PASSES + static_cast<uint32_t>(m_frame_passes[frame_index].size());
+    cmd_buf.beginQuery(*queryPool(mesh_tasks), query, {});
+    m_frame_passes[frame_index].push_back(PassQuery{name, pass, mesh_tasks});
+    m_active = true;
+}
+
+void gfx::PipelineStatistics::endPass(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index) {
+    if (!m_active) {
+        return;
+    }
+
+    uint32_t query = frame_index * MAX_PASSES + static_cast<uint32_t>(m_frame_passes[frame_index].size()) - 1;
+    cmd_buf.endQuery(*queryPool(m_frame_passes[frame_index].back().mesh_tasks), query);
+    m_active = false;
+}
+
+std::vector<gfx::PassStatistics> gfx::PipelineStatistics::takeTotals() {
+    std::vector<PassStatistics> totals;
+    std::swap(totals, m_totals);
+    return totals;
+}
+
+const vk::raii::QueryPool &gfx::PipelineStatistics::queryPool(bool mesh_tasks) const {
+    return mesh_tasks ? m_mesh_queries : m_queries;
+}
+
+void gfx::PipelineStatistics::readResults(uint32_t frame_index) {
+    std::vector<PassQuery> &passes = m_frame_passes[frame_index];
+    if (passes.empty()) {
+        return;
+    }
+
+    // The passes alternate between the pools, and a query that was reset
+    // but never begun is never available, so each is read on its own.
+    std::vector<PipelineCounters> results(passes.size());
+    bool complete = true;
+    for (size_t i = 0; i < passes.size() && complete; ++i) {
+        uint32_t query = frame_index * MAX_PASSES + static_cast<uint32_t>(i);
+        if (passes[i].mesh_tasks) {
+            auto [rslt, counters] = m_mesh_queries.getResult<MeshPipelineCounters>(
+                query, 1, sizeof(MeshPipelineCounters), vk::QueryResultFlagBits::e64
+            );
+            complete = rslt == vk::Result::eSuccess;
+            results[i] = PipelineCounters{
+                .input_vertices = 0,
+                .input_primitives = 0,
+                .vertex_shader_invocations = 0,
+                .clipping_invocations = counters.clipping_invocations,
+                .clipping_primitives = counters.clipping_primitives,
+                .fragment_shader_invocations = counters.fragment_shader_invocations,
+            };
+        } else {
+            auto [rslt, counters] = m_queries.getResult<PipelineCounters>(
+                query, 1, sizeof(PipelineCounters), vk::QueryResultFlagBits::e64
+            );
+            complete = rslt == vk::Result::eSuccess;
+            results[i] = counters;
+        }
+    }
+    if (complete) {
+        for (size_t i = 0; i < passes.size(); ++i) {
+            auto total = std::ranges::find_if(m_totals, [&pass = passes[i]](const PassStatistics &t) {
+                return std::string_view{t.name} == pass.name && t.pass == pass.pass;
+            });
+            if (total == m_totals.end()) {
+                m_totals.push_back(PassStatistics{passes[i].name, passes[i].pass, 0, PipelineCounters{}});
+                total = m_totals.end() - 1;
+            }
+            ++total->frames;
+            total->totals += results[i];
+        }
+    }
+    passes.clear();
+}
@@ -0,0 +1,118 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#ifndef _VPLANET_GFX_PIPELINE_STATISTICS_H_
+#define _VPLANET_GFX_PIPELINE_STATISTICS_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "../vulkan.h"
+
+#include "Pipeline.h"
+
+namespace gfx {
+    class System;
+
+    // The counts of one pipeline statistics query, in the order Vulkan
+    // writes them for PipelineStatistics::COUNTERS. Mesh shading passes
+    // have no input assembly or vertex shading to count, and leave those
+    // at zero.
+    struct PipelineCounters {
+        uint64_t input_vertices;
+        uint64_t input_primitives;
+        uint64_t vertex_shader_invocations;
+        uint64_t clipping_invocations;
+        uint64_t clipping_primitives;
+        uint64_t fragment_shader_invocations;
+
+        PipelineCounters &operator+=(const PipelineCounters &other);
+    };
+
+    // One pass of one draw, summed over the frames read back since the
+    // totals were last taken.
+    struct PassStatistics {
+        const char *name;
+        DrawPass pass;
+        uint32_t frames;
+        PipelineCounters totals;
+    };
+
+    // Pipeline statistics queries around each pass of each draw, to tell
+    // whether a frame is bound by vertices, primitives or fragments. Each
+    // frame in flight has its own queries, read without waiting when the
+    // frame comes round again, by which time its fence has been passed.
+    // Off by default; when off, nothing is recorded.
+    class PipelineStatistics {
+    public:
+        static const uint32_t MAX_PASSES = 8;
+        static constexpr vk::QueryPipelineStatisticFlags COUNTERS =
+            vk::QueryPipelineStatisticFlagBits::eInputAssemblyVertices |
+            vk::QueryPipelineStatisticFlagBits::eInputAssemblyPrimitives |
+            vk::QueryPipelineStatisticFlagBits::eVertexShaderInvocations |
+            vk::QueryPipelineStatisticFlagBits::eClippingInvocations |
+            vk::QueryPipelineStatisticFlagBits::eClippingPrimitives |
+            vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations;
+        // The counters that may be active around mesh shading draws, which
+        // go in a pool of their own.
+        static constexpr vk::QueryPipelineStatisticFlags MESH_COUNTERS =
+            vk::QueryPipelineStatisticFlagBits::eClippingInvocations |
+            vk::QueryPipelineStatisticFlagBits::eClippingPrimitives |
+            vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations;
+
+        PipelineStatistics();
+        PipelineStatistics(System *system);
+
+        bool supported() const;
+        bool enabled() const;
+        void setEnabled(bool enabled);
+
+        // Adds the results of the frame's last queries to the totals and,
+        // if enabled, resets its queries. Has to be recorded outside of the
+        // rendering pass, before any beginPass() for the frame.
+        void beginFrame(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index);
+
+        // Queries can't nest, so passes are begun and ended in turn. Passes
+        // past MAX_PASSES in a frame go uncounted. `mesh_tasks` says the
+        // pass draws with mesh shaders, so it's counted with MESH_COUNTERS.
+        void beginPass(
+            const vk::raii::CommandBuffer &cmd_buf,
+            uint32_t frame_index,
+            const char *name,
+            DrawPass pass,
+            bool mesh_tasks
+        );
+        void endPass(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index);
+
+        // The totals of each pass in the order first seen, which are then
+        // cleared.
+        std::vector<PassStatistics> takeTotals();
+
+    private:
+        struct PassQuery {
+            const char *name;
+            DrawPass pass;
+            bool mesh_tasks;
+        };
+
+        // The counts MESH_COUNTERS writes.
+        struct MeshPipelineCounters {
+            uint64_t clipping_invocations;
+            uint64_t clipping_primitives;
+            uint64_t fragment_shader_invocations;
+        };
+
+        const vk::raii::QueryPool &queryPool(bool mesh_tasks) const;
+        void readResults(uint32_t frame_index);
+
+        // Each pass's query is in one pool or the other, at the same index.
+        vk::raii::QueryPool m_queries, m_mesh_queries;
+        bool m_enabled;
+        bool m_active;
+        // The passes queried in each frame in flight since its results
+        // were last read.
+        std::vector<std::vector<PassQuery>> m_frame_passes;
+        std::vector<PassStatistics> m_totals;
+    };
+}
+
+#endif
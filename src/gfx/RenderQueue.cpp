@@ -0,0 +1,66 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#include <algorithm>
+#include <ranges>
+#include <tuple>
+#include <vector>
+
+#include "../glm.h"
+#include "../vulkan.h"
+
+#include "RenderQueue.h"
+
+void gfx::RenderQueue::clear() {
+    m_items.clear();
+}
+
+void gfx::RenderQueue::add(const Item &item) {
+    m_items.push_back(item);
+}
+
+void gfx::RenderQueue::record(
+    const vk::raii::CommandBuffer &cmd_buf,
+    uint32_t frame_index,
+    const glm::vec3 &eye,
+    bool reverse_depth,
+    PipelineStatistics &statistics
+) {
+    auto distance = [&eye](const Item &item) {
+        return std::max(glm::length(item.center - eye) - item.radius, 0.0f);
+    };
+    std::ranges::stable_sort(m_items, [&distance](const Item &a, const Item &b) {
+        return std::make_tuple(a.occluder_rank, distance(a)) < std::make_tuple(b.occluder_rank, distance(b));
+    });
+
+    vk::CompareOp nearer = reverse_depth ? vk::CompareOp::eGreater : vk::CompareOp::eLess;
+    vk::CompareOp nearer_or_equal = reverse_depth ? vk::CompareOp::eGreaterOrEqual : vk::CompareOp::eLessOrEqual;
+
+    bool any_prepass = std::ranges::any_of(m_items, &Item::depth_prepass);
+    if (any_prepass) {
+        cmd_buf.setDepthCompareOp(nearer);
+        cmd_buf.setDepthWriteEnable(vk::True);
+        for (const Item &item : m_items) {
+            if (item.depth_prepass) {
+                statistics.beginPass(cmd_buf, frame_index, item.name, DrawPass::eDepthPrepass, item.pipeline->drawsMeshTasks(DrawPass::eDepthPrepass));
+                item.pipeline->recordCommands(cmd_buf, frame_index, DrawPass::eDepthPrepass);
+                statistics.endPass(cmd_buf, frame_index);
+            }
+        }
+    }
+
+    // What went into the prepass passes the test again only where it was
+    // nearest, so it is shaded once per pixel. Or-equal rather than equal
+    // forgives its colour pass landing a hair in front of its prepass.
+    for (const Item &item : m_items) {
+        if (item.depth_prepass) {
+            cmd_buf.setDepthCompareOp(nearer_or_equal);
+            cmd_buf.setDepthWriteEnable(vk::False);
+        } else {
+            cmd_buf.setDepthCompareOp(nearer);
+            cmd_buf.setDepthWriteEnable(vk::True);
+        }
+        statistics.beginPass(cmd_buf, frame_index, item.name, DrawPass::eColor, item.pipeline->drawsMeshTasks(DrawPass::eColor));
+        item.pipeline->recordCommands(cmd_buf, frame_index, DrawPass::eColor);
+        statistics.endPass(cmd_buf, frame_index);
+    }
+}
@@ -0,0 +1,54 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#ifndef _VPLANET_GFX_RENDER_QUEUE_H_
+#define _VPLANET_GFX_RENDER_QUEUE_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "../glm.h"
+#include "../vulkan.h"
+
+#include "Pipeline.h"
+#include "PipelineStatistics.h"
+
+namespace gfx {
+    // The opaque draws of a frame, recorded in the order that lets early
+    // depth testing reject the most fragments: the likeliest occluders
+    // first, then front to back by bounding sphere. Draws that ask for it
+    // are drawn into a depth prepass first, and their colour pass then only
+    // shades the fragments that made it into the depth buffer.
+    class RenderQueue {
+    public:
+        // Draws with a lower rank go first, whatever their distance. The
+        // terrain is ranked ahead of the ocean it stands in, for one.
+        struct Item {
+            const char *name;
+            Pipeline *pipeline;
+            uint32_t occluder_rank;
+            glm::vec3 center;
+            float radius;
+            bool depth_prepass;
+        };
+
+        void clear();
+        void add(const Item &item);
+
+        // Records the depth prepass, if anything wants one, then the colour
+        // pass. Sets the depth compare op and depth write enable, which
+        // every pipeline drawn has as dynamic state. Each item's passes are
+        // counted by `statistics`, under its name, if that's enabled.
+        void record(
+            const vk::raii::CommandBuffer &cmd_buf,
+            uint32_t frame_index,
+            const glm::vec3 &eye,
+            bool reverse_depth,
+            PipelineStatistics &statistics
+        );
+
+    private:
+        std::vector<Item> m_items;
+    };
+}
+
+#endif
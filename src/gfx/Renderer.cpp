@@ -1,27 +1,51 @@
 // -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
 
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <future>
 #include <iostream>
+#include <set>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "../vulkan.h"
 
 #include "Renderer.h"
+#include "ShaderLibrary.h"
 #include "System.h"
 
 gfx::Renderer::Renderer()
 : m_system{nullptr},
   m_pipeline_layout{nullptr},
+  m_stats{},
+  m_reverse_depth{false},
+  m_depth_prepass{false},
+  m_render_queue{},
+  m_pipeline_statistics{},
   m_uniform_set{},
+  m_light_clusters{},
+  m_shadow_maps{},
   m_ocean_pipeline{},
-  m_terrain_pipeline{}
+  m_terrain_pipeline{},
+  m_atmosphere{},
+  m_shader_reload{},
+  m_retired_pipelines{}
 {}
 
 gfx::Renderer::Renderer(System *system) : Renderer() {
     m_system = system;
+    m_reverse_depth = system->depthBuffer().isFloat();
     m_uniform_set = SceneUniformSet(&system->uniforms());
     initPipelineLayout();
+    m_pipeline_statistics = PipelineStatistics(system);
+    m_light_clusters = LightClusters(this);
+    m_shadow_maps = ShadowMaps(this);
+    m_uniform_set.setShadowMap(m_shadow_maps.imageView(), m_shadow_maps.sampler());
     m_ocean_pipeline = OceanPipeline(this);
     m_terrain_pipeline = TerrainPipeline(this);
+    m_atmosphere = Atmosphere(this);
 }
 
 // gfx::Renderer::~Renderer() {}
@@ -34,6 +58,10 @@ const vk::raii::PipelineLayout &gfx::Renderer::pipelineLayout() const {
     return m_pipeline_layout;
 }
 
+const gfx::SceneUniformSet &gfx::Renderer::sceneUniforms() const {
+    return m_uniform_set;
+}
+
 gfx::TerrainPipeline& gfx::Renderer::terrainPipeline() {
     return m_terrain_pipeline;
 }
@@ -42,10 +70,46 @@ gfx::OceanPipeline& gfx::Renderer::oceanPipeline() {
     return m_ocean_pipeline;
 }
 
+gfx::Atmosphere& gfx::Renderer::atmosphere() {
+    return m_atmosphere;
+}
+
+gfx::ShadowMaps& gfx::Renderer::shadowMaps() {
+    return m_shadow_maps;
+}
+
+const gfx::RenderStats &gfx::Renderer::stats() const {
+    return m_stats;
+}
+
+gfx::PipelineStatistics &gfx::Renderer::pipelineStatistics() {
+    return m_pipeline_statistics;
+}
+
+bool gfx::Renderer::reverseDepth() const {
+    return m_reverse_depth;
+}
+
+void gfx::Renderer::setReverseDepth(bool reverse) {
+    m_reverse_depth = reverse;
+}
+
+bool gfx::Renderer::depthPrepass() const {
+    return m_depth_prepass;
+}
+
+void gfx::Renderer::setDepthPrepass(bool enabled) {
+    m_depth_prepass = enabled;
+}
+
 void gfx::Renderer::setViewProjectionTransform(const ViewProjectionTransform &xform) {
     m_uniform_set.setTransforms(xform);
 }
 
+const gfx::ViewProjectionTransform &gfx::Renderer::viewProjectionTransform() const {
+    return m_uniform_set.transforms();
+}
+
 void gfx::Renderer::writeViewProjectionTransform(uint32_t buffer_index) {
     m_uniform_set.updateViewProjectionBuffer(buffer_index);
 }
@@ -62,12 +126,44 @@ void gfx::Renderer::writeLightList(uint32_t buffer_index) {
     m_uniform_set.updateLightListBuffer(buffer_index);
 }
 
+void gfx::Renderer::setPointLights(std::span<const PointLight> lights) {
+    m_uniform_set.setPointLights(lights);
+}
+
+void gfx::Renderer::writePointLights(uint32_t buffer_index) {
+    m_uniform_set.updatePointLightBuffer(buffer_index);
+}
+
+void gfx::Renderer::setLightClusterRange(float z_near, float z_far) {
+    m_uniform_set.setLightClusterRange(z_near, z_far);
+}
+
 void gfx::Renderer::recordCommands(const vk::raii::CommandBuffer &cmd_buf, uint32_t image_index, uint32_t frame_index) {
     const DepthBuffer &depth_buffer = m_system->depthBuffer();
     const Swapchain &swapchain = m_system->swapchain();
     vk::Extent2D swapchain_extent = swapchain.extent();
     const std::vector<vk::raii::DescriptorSet> &scene_uniforms = m_uniform_set.descriptorSets();
 
+    reloadShaders();
+
+    // Transfers, compute work and query resets have to be recorded outside
+    // of the dynamic rendering pass. The fence for this frame has been
+    // waited on, so its last queries are done.
+    m_pipeline_statistics.beginFrame(cmd_buf, frame_index);
+    m_terrain_pipeline.recordUploads(cmd_buf, frame_index);
+    m_terrain_pipeline.recordCulling(cmd_buf, frame_index);
+    m_stats.terrain_patches = m_terrain_pipeline.numPatches();
+    m_stats.terrain_patches_drawn = m_terrain_pipeline.numPatchesDrawn();
+    m_stats.terrain_patches_culled = m_stats.terrain_patches - m_stats.terrain_patches_drawn;
+    m_stats.terrain_chunks_drawn = m_terrain_pipeline.numChunksDrawn();
+
+    m_uniform_set.updateLightClusterBuffer(frame_index, m_terrain_pipeline.transform(), swapchain_extent);
+    m_light_clusters.recordBinning(cmd_buf, frame_index);
+    m_shadow_maps.recordCommands(cmd_buf, frame_index);
+    m_uniform_set.updateShadowBuffer(frame_index, m_shadow_maps.parameters());
+    m_stats.shadow_cascades_drawn = m_shadow_maps.cascadesDrawn();
+    m_atmosphere.recordLookupTables(cmd_buf, frame_index);
+
     swapchain.transitionImageToColorAttachment(cmd_buf, image_index);
 
     vk::RenderingAttachmentInfo color_ai{
@@ -77,12 +173,13 @@ void gfx::Renderer::recordCommands(const vk::raii::CommandBuffer &cmd_buf, uint3
         .storeOp = vk::AttachmentStoreOp::eStore,
         .clearValue = vk::ClearColorValue{0.0f, 0.0f, 0.0f, 1.0f},
     };
+    // Depth is kept for the atmosphere to march up to.
     vk::RenderingAttachmentInfo depth_ai{
         .imageView = *depth_buffer.imageView(),
         .imageLayout = vk::ImageLayout::eDepthAttachmentOptimal,
         .loadOp = vk::AttachmentLoadOp::eClear,
-        .storeOp = vk::AttachmentStoreOp::eDontCare,
-        .clearValue = vk::ClearDepthStencilValue{1.0f, 0},
+        .storeOp = m_atmosphere.enabled() ? vk::AttachmentStoreOp::eStore : vk::AttachmentStoreOp::eDontCare,
+        .clearValue = vk::ClearDepthStencilValue{m_reverse_depth ? 0.0f : 1.0f, 0},
     };
     vk::RenderingInfo ri = vk::RenderingInfo{
         .renderArea = {.offset = {0, 0}, .extent = swapchain_extent},
@@ -94,14 +191,115 @@ void gfx::Renderer::recordCommands(const vk::raii::CommandBuffer &cmd_buf, uint3
     cmd_buf.setViewport(0, vk::Viewport{0.0f, 0.0f, static_cast<float>(swapchain_extent.width), static_cast<float>(swapchain_extent.height), 0.0f, 1.0f});
     cmd_buf.setScissor(0, vk::Rect2D{vk::Offset2D{0, 0}, swapchain_extent});
     cmd_buf.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *m_pipeline_layout, 0, *scene_uniforms[frame_index], nullptr);
-    m_ocean_pipeline.recordCommands(cmd_buf, frame_index);
-    m_terrain_pipeline.recordCommands(cmd_buf, frame_index);
+
+    // The terrain stands in the ocean, so it goes first whatever the
+    // distances, and covers most of what it would otherwise shade.
+    glm::vec4 terrain_bounds = m_terrain_pipeline.boundingSphere();
+    glm::vec4 ocean_bounds = m_ocean_pipeline.boundingSphere();
+    m_render_queue.clear();
+    m_render_queue.add(RenderQueue::Item{
+        .name = "terrain",
+        .pipeline = &m_terrain_pipeline,
+        .occluder_rank = 0,
+        .center = glm::vec3{terrain_bounds},
+        .radius = terrain_bounds.w,
+        .depth_prepass = m_depth_prepass && m_terrain_pipeline.depthPrepassSupported(),
+    });
+    m_render_queue.add(RenderQueue::Item{
+        .name = "ocean",
+        .pipeline = &m_ocean_pipeline,
+        .occluder_rank = 1,
+        .center = glm::vec3{ocean_bounds},
+        .radius = ocean_bounds.w,
+        .depth_prepass = false,
+    });
+
+    glm::vec3 eye{m_uniform_set.transforms().view_inv[3]};
+    m_render_queue.record(cmd_buf, frame_index, eye, m_reverse_depth, m_pipeline_statistics);
 
     cmd_buf.endRendering();
 
+    // The atmosphere goes over everything, reading the depth the terrain
+    // and ocean left, so it's drawn in a pass of its own.
+    if (m_atmosphere.enabled()) {
+        depth_buffer.transitionToShaderRead(cmd_buf);
+        vk::MemoryBarrier2 color_barrier{
+            .srcStageMask = vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+            .srcAccessMask = vk::AccessFlagBits2::eColorAttachmentWrite,
+            .dstStageMask = vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+            .dstAccessMask = vk::AccessFlagBits2::eColorAttachmentRead | vk::AccessFlagBits2::eColorAttachmentWrite,
+        };
+        cmd_buf.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(color_barrier));
+
+        vk::RenderingAttachmentInfo atmosphere_color_ai{
+            .imageView = *swapchain.imageViews()[image_index],
+            .imageLayout = vk::ImageLayout::eColorAttachmentOptimal,
+            .loadOp = vk::AttachmentLoadOp::eLoad,
+            .storeOp = vk::AttachmentStoreOp::eStore,
+        };
+        vk::RenderingInfo atmosphere_ri = vk::RenderingInfo{
+            .renderArea = {.offset = {0, 0}, .extent = swapchain_extent},
+            .layerCount = 1,
+        }.setColorAttachments(atmosphere_color_ai);
+        cmd_buf.beginRendering(atmosphere_ri);
+        m_atmosphere.recordCommands(cmd_buf, frame_index);
+        cmd_buf.endRendering();
+
+        depth_buffer.transitionToAttachment(cmd_buf);
+    }
+
+    m_terrain_pipeline.recordReadback(cmd_buf, frame_index);
+
     swapchain.transitionImageToPresentable(cmd_buf, image_index);
 }
 
+void gfx::Renderer::reloadShaders() {
+    // A frame's fence has been waited on by the time it's recorded again,
+    // so once every frame has been, the old pipelines are out of use.
+    for (auto &retired : m_retired_pipelines) {
+        --retired.first;
+    }
+    std::erase_if(m_retired_pipelines, [](const auto &retired) {
+        return retired.first == 0;
+    });
+
+    if (m_shader_reload.valid()) {
+        if (m_shader_reload.wait_for(std::chrono::seconds{0}) != std::future_status::ready) {
+            return;
+        }
+        // A shader that won't build is only a mistake to fix and save
+        // again, so the old pipelines are kept.
+        try {
+            PipelineReload reload = m_shader_reload.get();
+            reload.swap();
+            m_retired_pipelines.emplace_back(m_system->numFrames(), std::move(reload));
+            std::cerr << "Swapped in reloaded shaders\n";
+        } catch (const std::exception &ex) {
+            std::cerr << "Unable to reload shaders, keeping the old ones: " << ex.what() << "\n";
+        }
+    }
+
+    std::set<std::string> changed = m_system->shaders().takeChanged();
+    if (changed.empty()) {
+        return;
+    }
+    std::vector<ReloadJob> jobs;
+    m_light_clusters.addReloadJobs(changed, jobs);
+    m_ocean_pipeline.addReloadJobs(changed, jobs);
+    m_terrain_pipeline.addReloadJobs(changed, jobs);
+    m_atmosphere.addReloadJobs(changed, jobs);
+    if (jobs.empty()) {
+        return;
+    }
+    m_shader_reload = std::async(std::launch::async, [jobs = std::move(jobs)] {
+        PipelineReload reload;
+        for (const ReloadJob &job : jobs) {
+            job(reload);
+        }
+        return reload;
+    });
+}
+
 void gfx::Renderer::initPipelineLayout() {
     const vk::raii::Device &device = m_system->device();
     const Uniforms *uniforms = m_uniform_set.uniforms();
@@ -111,8 +309,15 @@ void gfx::Renderer::initPipelineLayout() {
         *uniforms->modelDescriptorSetLayout(),
     };
 
+    vk::PushConstantRange push_range{
+        .stageFlags = vk::ShaderStageFlagBits::eVertex,
+        .offset = 0,
+        .size = static_cast<uint32_t>(std::max(sizeof(DrawParameters), sizeof(OceanDrawParameters))),
+    };
+
     vk::PipelineLayoutCreateInfo pl_ci = vk::PipelineLayoutCreateInfo{}
-        .setSetLayouts(layouts);
+        .setSetLayouts(layouts)
+        .setPushConstantRanges(push_range);
     
     m_pipeline_layout = device.createPipelineLayout(pl_ci);
     std::cerr << "Created planet rendering pipeline layout " << *m_pipeline_layout << "\n";
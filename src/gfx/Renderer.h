@@ -3,17 +3,36 @@
 #ifndef _VPLANET_GFX_RENDERER_H_
 #define _VPLANET_GFX_RENDERER_H_
 
+#include <cstdint>
+#include <future>
+#include <span>
+#include <utility>
 #include <vector>
 
 #include "../vulkan.h"
 
+#include "Atmosphere.h"
+#include "LightClusters.h"
 #include "OceanPipeline.h"
+#include "Pipeline.h"
+#include "PipelineStatistics.h"
+#include "RenderQueue.h"
+#include "ShadowMaps.h"
 #include "TerrainPipeline.h"
 #include "Uniforms.h"
 
 namespace gfx {
     class System;
 
+    // Per-frame counters, updated as the frame's commands are recorded.
+    struct RenderStats {
+        uint32_t terrain_patches;
+        uint32_t terrain_patches_drawn;
+        uint32_t terrain_patches_culled;
+        uint32_t terrain_chunks_drawn;
+        uint32_t shadow_cascades_drawn;
+    };
+
     class Renderer {
     public:
         Renderer();
@@ -28,27 +47,67 @@ namespace gfx {
 
         System* system();
         const vk::raii::PipelineLayout &pipelineLayout() const;
+        const SceneUniformSet &sceneUniforms() const;
         TerrainPipeline& terrainPipeline();
         OceanPipeline& oceanPipeline();
+        Atmosphere& atmosphere();
+        ShadowMaps& shadowMaps();
+        const RenderStats &stats() const;
+        PipelineStatistics &pipelineStatistics();
+
+        // Reversed depth clears to 0 and keeps the greater depth, for
+        // projections that map the near plane to 1 and infinity to 0.
+        bool reverseDepth() const;
+        void setReverseDepth(bool reverse);
+
+        // Draws the terrain's depth first, so that it and the ocean under it
+        // are shaded only where they show.
+        bool depthPrepass() const;
+        void setDepthPrepass(bool enabled);
 
         void setViewProjectionTransform(const ViewProjectionTransform &xform);
+        const ViewProjectionTransform &viewProjectionTransform() const;
         void writeViewProjectionTransform(uint32_t buffer_index);
 
         void enableLight(uint32_t index, const glm::vec3 &direction);
         void disableLight(uint32_t index);
         void writeLightList(uint32_t buffer_index);
 
+        // Point lights move with the terrain.
+        void setPointLights(std::span<const PointLight> lights);
+        void writePointLights(uint32_t buffer_index);
+        void setLightClusterRange(float z_near, float z_far);
+
         void recordCommands(const vk::raii::CommandBuffer &cmd_buf, uint32_t image_index, uint32_t frame_index);
 
     private:
         void initPipelineLayout();
+        // Swaps in the pipelines rebuilt for changed shaders once they're
+        // ready, and starts rebuilding for any shaders changed since.
+        void reloadShaders();
 
         System *m_system;
         vk::raii::PipelineLayout m_pipeline_layout;
 
+        RenderStats m_stats;
+        bool m_reverse_depth;
+        bool m_depth_prepass;
+        RenderQueue m_render_queue;
+        PipelineStatistics m_pipeline_statistics;
         SceneUniformSet m_uniform_set;
+        LightClusters m_light_clusters;
+        // Before the terrain, whose shadow pipelines draw into it.
+        ShadowMaps m_shadow_maps;
         OceanPipeline m_ocean_pipeline;
         TerrainPipeline m_terrain_pipeline;
+        Atmosphere m_atmosphere;
+
+        // Shader hot reload: the rebuild running in the background, and
+        // the pipelines swapped out, each with the frames left to record
+        // before none in flight can be using them. Declared after the
+        // pipelines, so that a rebuild is finished before they go.
+        std::future<PipelineReload> m_shader_reload;
+        std::vector<std::pair<uint32_t, PipelineReload>> m_retired_pipelines;
     };
 }
 
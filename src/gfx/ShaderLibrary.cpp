@@ -0,0 +1,175 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "../vulkan.h"
+
+#include "Resource.h"
+#include "ShaderLibrary.h"
+
+namespace {
+    struct EmbeddedShader {
+        const char *name;
+        std::span<const std::byte> code;
+    };
+
+    const std::array<EmbeddedShader, 10> EMBEDDED_SHADERS{{
+        {"atmosphere_apply.slang.spv", LOAD_RESOURCE(atmosphere_apply_slang_spv)},
+        {"atmosphere_multiscattering.slang.spv", LOAD_RESOURCE(atmosphere_multiscattering_slang_spv)},
+        {"atmosphere_transmittance.slang.spv", LOAD_RESOURCE(atmosphere_transmittance_slang_spv)},
+        {"light_binning.slang.spv", LOAD_RESOURCE(light_binning_slang_spv)},
+        {"ocean.slang.spv", LOAD_RESOURCE(ocean_slang_spv)},
+        {"terrain.slang.spv", LOAD_RESOURCE(terrain_slang_spv)},
+        {"terrain_cull.slang.spv", LOAD_RESOURCE(terrain_cull_slang_spv)},
+        {"terrain_generate.slang.spv", LOAD_RESOURCE(terrain_generate_slang_spv)},
+        {"terrain_mesh.slang.spv", LOAD_RESOURCE(terrain_mesh_slang_spv)},
+        {"terrain_shadow.slang.spv", LOAD_RESOURCE(terrain_shadow_slang_spv)},
+    }};
+
+    const uint32_t SPIRV_MAGIC = 0x07230203;
+    // The magic number and four more words of header.
+    const size_t SPIRV_HEADER_SIZE = 5 * sizeof(uint32_t);
+
+    bool isSpirv(std::span<const std::byte> code) {
+        if (code.size() < SPIRV_HEADER_SIZE || code.size() % sizeof(uint32_t) != 0) {
+            return false;
+        }
+        uint32_t magic;
+        std::memcpy(&magic, code.data(), sizeof(magic));
+        return magic == SPIRV_MAGIC;
+    }
+}
+
+gfx::ShaderLibrary::ShaderLibrary()
+: m_directory{},
+  m_loaded{},
+  m_inotify_fd{-1}
+{}
+
+gfx::ShaderLibrary::ShaderLibrary(const std::filesystem::path &directory) : ShaderLibrary() {
+    m_directory = directory;
+    for (const EmbeddedShader &shader : EMBEDDED_SHADERS) {
+        if (std::filesystem::exists(m_directory / shader.name)) {
+            load(shader.name);
+        }
+    }
+
+#ifdef __linux__
+    // Compilers either rewrite the file or move a new one over it.
+    m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotify_fd >= 0 && inotify_add_watch(m_inotify_fd, m_directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        close(m_inotify_fd);
+        m_inotify_fd = -1;
+    }
+#endif
+    if (watching()) {
+        std::cerr << "Watching " << m_directory.string() << " for shaders to reload\n";
+    } else {
+        std::cerr << "Unable to watch " << m_directory.string() << " for shaders; they won't be reloaded\n";
+    }
+}
+
+gfx::ShaderLibrary::~ShaderLibrary() {
+#ifdef __linux__
+    if (m_inotify_fd >= 0) {
+        close(m_inotify_fd);
+    }
+#endif
+}
+
+bool gfx::ShaderLibrary::watching() const {
+    return m_inotify_fd >= 0;
+}
+
+std::span<const std::byte> gfx::ShaderLibrary::code(std::string_view name) const {
+    auto loaded = m_loaded.find(name);
+    if (loaded != m_loaded.end()) {
+        return loaded->second;
+    }
+    for (const EmbeddedShader &shader : EMBEDDED_SHADERS) {
+        if (name == shader.name) {
+            return shader.code;
+        }
+    }
+    throw std::runtime_error(std::format("No shader named {}", name));
+}
+
+vk::raii::ShaderModule gfx::ShaderLibrary::createModule(const vk::raii::Device &device, std::string_view name) const {
+    std::span<const std::byte> bytecode = code(name);
+    vk::ShaderModuleCreateInfo sm_ci{
+        .codeSize = bytecode.size(),
+        .pCode = reinterpret_cast<const uint32_t *>(bytecode.data()),
+    };
+    return device.createShaderModule(sm_ci);
+}
+
+std::set<std::string> gfx::ShaderLibrary::takeChanged() {
+    std::set<std::string> changed;
+#ifdef __linux__
+    if (m_inotify_fd < 0) {
+        return changed;
+    }
+
+    // A file written more than once since the last call is only reloaded
+    // once.
+    std::set<std::string> written;
+    alignas(inotify_event) char buffer[4096];
+    while (true) {
+        ssize_t length = read(m_inotify_fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            break;
+        }
+        for (ssize_t offset = 0; offset < length;) {
+            const inotify_event *event = reinterpret_cast<const inotify_event *>(buffer + offset);
+            if (event->len > 0) {
+                std::string name{event->name};
+                if (name.ends_with(".spv")) {
+                    written.insert(name);
+                }
+            }
+            offset += sizeof(inotify_event) + event->len;
+        }
+    }
+
+    for (const std::string &name : written) {
+        if (load(name)) {
+            changed.insert(name);
+        }
+    }
+#endif
+    return changed;
+}
+
+bool gfx::ShaderLibrary::load(const std::string &name) {
+    std::filesystem::path path = m_directory / name;
+    std::error_code error;
+    uintmax_t size = std::filesystem::file_size(path, error);
+    std::vector<std::byte> bytecode(error ? 0 : size);
+    std::ifstream in{path, std::ios::binary};
+    in.read(reinterpret_cast<char *>(bytecode.data()), static_cast<std::streamsize>(bytecode.size()));
+    if (!in || !isSpirv(bytecode)) {
+        std::cerr << "Skipping " << path.string() << ", which isn't SPIR-V\n";
+        return false;
+    }
+
+    std::cerr << "Loaded shader " << path.string() << " (" << bytecode.size() << " bytes)\n";
+    m_loaded[name] = std::move(bytecode);
+    return true;
+}
@@ -0,0 +1,55 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#ifndef _VPLANET_GFX_SHADER_LIBRARY_H_
+#define _VPLANET_GFX_SHADER_LIBRARY_H_
+
+#include <cstddef>
+#include <filesystem>
+#include <map>
+#include <set>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../vulkan.h"
+
+namespace gfx {
+    // SPIR-V by the name of the file it's compiled to, such as
+    // "terrain.slang.spv". Normally that's the code embedded in the
+    // executable. Given a shader directory (development builds configured
+    // with VPLANET_SHADER_RELOAD), the files in it are used instead, and
+    // the directory is watched, so that shaders rebuilt while running can
+    // be swapped in (see Renderer::reloadShaders()).
+    //
+    // Creating modules may happen on any thread, but not at the same time
+    // as takeChanged(), which replaces the code.
+    class ShaderLibrary {
+    public:
+        ShaderLibrary();
+        ShaderLibrary(const std::filesystem::path &directory);
+        ShaderLibrary(const ShaderLibrary &other) = delete;
+        ~ShaderLibrary();
+
+        ShaderLibrary &operator=(const ShaderLibrary &other) = delete;
+
+        bool watching() const;
+
+        std::span<const std::byte> code(std::string_view name) const;
+        vk::raii::ShaderModule createModule(const vk::raii::Device &device, std::string_view name) const;
+
+        // Reloads the files written since the last call, without waiting
+        // for any, and returns their names. Files that aren't SPIR-V, such
+        // as one caught half written, are skipped, keeping the code before.
+        std::set<std::string> takeChanged();
+
+    private:
+        bool load(const std::string &name);
+
+        std::filesystem::path m_directory;
+        std::map<std::string, std::vector<std::byte>, std::less<>> m_loaded;
+        int m_inotify_fd;
+    };
+}
+
+#endif
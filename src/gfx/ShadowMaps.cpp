@@ -0,0 +1,433 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <format>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "../glm.h"
+#include "../vulkan.h"
+
+#include "Renderer.h"
+#include "ShadowMaps.h"
+#include "System.h"
+#include "Uniforms.h"
+
+// How far the split between cascades leans from even towards logarithmic
+// spacing (Zhang et al., "Parallel-Split Shadow Maps").
+const float SHADOW_SPLIT_LAMBDA = 0.8f;
+
+// Kept cascades are fit this much larger than their slice, so that the
+// view can move a while before they have to be drawn again.
+const float SHADOW_CACHE_MARGIN = 1.3f;
+
+// A kept cascade is drawn again once the sun has turned a degree against
+// the terrain.
+const float SHADOW_CACHE_LIGHT_COS = 0.99985f;
+
+// Lookups are pushed off the surface by this many texels of their cascade.
+const float SHADOW_NORMAL_OFFSET_TEXELS = 1.5f;
+
+vk::Format chooseShadowFormat(const vk::raii::PhysicalDevice &device);
+
+gfx::ShadowMaps::ShadowMaps()
+: m_renderer{nullptr},
+  m_enabled{true},
+  m_format{vk::Format::eUndefined},
+  m_image{nullptr},
+  m_image_allocation{VK_NULL_HANDLE},
+  m_image_view{nullptr},
+  m_layer_views{},
+  m_sampler{nullptr},
+  m_cascades{},
+  m_parameters{},
+  m_cascades_drawn{0}
+{}
+
+gfx::ShadowMaps::ShadowMaps(Renderer *renderer) : ShadowMaps() {
+    m_renderer = renderer;
+    initImage();
+    transitionImageLayout();
+}
+
+gfx::ShadowMaps::~ShadowMaps() {
+    if (m_renderer != nullptr && m_image_allocation != VK_NULL_HANDLE) {
+        vmaFreeMemory(m_renderer->system()->allocator(), m_image_allocation);
+    }
+}
+
+// Swaps, so that the temporary moved from frees nothing in use.
+gfx::ShadowMaps &gfx::ShadowMaps::operator=(ShadowMaps &&other) {
+    std::swap(m_renderer, other.m_renderer);
+    m_enabled = other.m_enabled;
+    m_format = other.m_format;
+    std::swap(m_image, other.m_image);
+    std::swap(m_image_allocation, other.m_image_allocation);
+    std::swap(m_image_view, other.m_image_view);
+    std::swap(m_layer_views, other.m_layer_views);
+    std::swap(m_sampler, other.m_sampler);
+    m_cascades = other.m_cascades;
+    m_parameters = other.m_parameters;
+    m_cascades_drawn = other.m_cascades_drawn;
+    return *this;
+}
+
+bool gfx::ShadowMaps::enabled() const {
+    return m_enabled;
+}
+
+void gfx::ShadowMaps::setEnabled(bool enabled) {
+    m_enabled = enabled;
+}
+
+vk::Format gfx::ShadowMaps::format() const {
+    return m_format;
+}
+
+const vk::raii::ImageView &gfx::ShadowMaps::imageView() const {
+    return m_image_view;
+}
+
+const vk::raii::Sampler &gfx::ShadowMaps::sampler() const {
+    return m_sampler;
+}
+
+const gfx::ShadowParameters &gfx::ShadowMaps::parameters() const {
+    return m_parameters;
+}
+
+uint32_t gfx::ShadowMaps::cascadesDrawn() const {
+    return m_cascades_drawn;
+}
+
+void gfx::ShadowMaps::recordCommands(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index) {
+    m_cascades_drawn = 0;
+    m_parameters = ShadowParameters{};
+    m_parameters.texel_size = 1.0f / SIZE;
+
+    const SceneUniformSet &scene_uniforms = m_renderer->sceneUniforms();
+    TerrainPipeline &terrain = m_renderer->terrainPipeline();
+    std::optional<glm::vec3> sun_direction = scene_uniforms.sunDirection();
+    float planet_radius = terrain.boundingSphere().w;
+    if (!m_enabled || !sun_direction || planet_radius <= 0.0f) {
+        for (Cascade &cascade : m_cascades) {
+            cascade.valid = false;
+        }
+        return;
+    }
+
+    // The cascades are fit in the terrain's model space, where the kept
+    // ones stay put as it turns.
+    const ViewProjectionTransform &xform = scene_uniforms.transforms();
+    glm::mat4x4 model_inv = glm::inverse(terrain.transform());
+    glm::mat4x4 view_to_model = model_inv * xform.view_inv;
+    glm::vec3 light_direction = glm::normalize(glm::mat3x3{model_inv} * *sun_direction);
+    glm::vec3 eye{view_to_model[3]};
+
+    // Nothing is further than the horizon over the occluder, and then on
+    // to the highest peak behind it.
+    float occluder_radius = std::min(terrain.occluderRadius(), planet_radius);
+    float eye_distance = glm::length(eye);
+    float z_near = std::max(eye_distance - planet_radius, 0.01f);
+    float z_far = std::sqrt(std::max(eye_distance * eye_distance - occluder_radius * occluder_radius, 0.0f)) +
+        std::sqrt(planet_radius * planet_radius - occluder_radius * occluder_radius);
+    z_far = std::max(z_far, 2.0f * z_near);
+
+    std::array<float, SHADOW_CASCADES + 1> splits{};
+    for (uint32_t i = 0; i <= SHADOW_CASCADES; ++i) {
+        float t = static_cast<float>(i) / SHADOW_CASCADES;
+        float logarithmic = z_near * std::pow(z_far / z_near, t);
+        float uniform = z_near + (z_far - z_near) * t;
+        splits[i] = SHADOW_SPLIT_LAMBDA * logarithmic + (1.0f - SHADOW_SPLIT_LAMBDA) * uniform;
+    }
+
+    float tan_x = 1.0f / xform.projection[0][0];
+    float tan_y = 1.0f / std::abs(xform.projection[1][1]);
+    uint64_t generation = terrain.geometryGeneration();
+    bool may_refresh = true;
+
+    for (uint32_t c = 0; c < SHADOW_CASCADES; ++c) {
+        // The slice's bounding sphere, which keeps its size however the
+        // view turns. One bigger than the planet is no use.
+        std::array<glm::vec3, 8> corners{};
+        glm::vec3 center{0.0f};
+        for (uint32_t i = 0; i < corners.size(); ++i) {
+            float z = i < 4 ? splits[c] : splits[c + 1];
+            glm::vec4 corner = view_to_model * glm::vec4{
+                (i & 1 ? 1.0f : -1.0f) * z * tan_x,
+                (i & 2 ? 1.0f : -1.0f) * z * tan_y,
+                -z,
+                1.0f,
+            };
+            corners[i] = glm::vec3{corner} / corner.w;
+            center += corners[i] / static_cast<float>(corners.size());
+        }
+        float radius = 0.0f;
+        for (const glm::vec3 &corner : corners) {
+            radius = std::max(radius, glm::distance(corner, center));
+        }
+        if (radius >= planet_radius) {
+            center = glm::vec3{0.0f};
+            radius = planet_radius;
+        }
+
+        Cascade &cascade = m_cascades[c];
+        if (c < FIRST_CACHED_CASCADE) {
+            cascade = fitCascade(light_direction, center, radius, planet_radius);
+            cascade.generation = generation;
+            recordCascade(cmd_buf, frame_index, c);
+        } else if (may_refresh && (
+            !cascade.valid || cascade.generation != generation ||
+            glm::dot(cascade.light_direction, light_direction) < SHADOW_CACHE_LIGHT_COS ||
+            glm::distance(cascade.center, center) + radius > cascade.radius))
+        {
+            cascade = fitCascade(light_direction, center, std::min(SHADOW_CACHE_MARGIN * radius, planet_radius), planet_radius);
+            cascade.generation = generation;
+            recordCascade(cmd_buf, frame_index, c);
+            may_refresh = false;
+        }
+
+        m_parameters.world_to_shadow[c] = cascade.light_view_projection * model_inv;
+        m_parameters.split_depths[c] = splits[c + 1];
+        m_parameters.normal_offsets[c] = SHADOW_NORMAL_OFFSET_TEXELS * cascade.texel_size;
+        if (cascade.valid) {
+            m_parameters.valid_mask |= 1u << c;
+        }
+    }
+    m_parameters.cascade_count = SHADOW_CASCADES;
+}
+
+// Looking along the light from the planet's center, with the depth range
+// across the whole planet, so that whatever casts a shadow into the
+// cascade is in it, however little of the planet the cascade covers.
+gfx::ShadowMaps::Cascade gfx::ShadowMaps::fitCascade(
+    const glm::vec3 &light_direction,
+    const glm::vec3 &center,
+    float radius,
+    float planet_radius
+) const {
+    glm::vec3 up = std::abs(light_direction.y) < 0.99f ? glm::vec3{0.0f, 1.0f, 0.0f} : glm::vec3{1.0f, 0.0f, 0.0f};
+    glm::mat4x4 light_view = glm::lookAt(glm::vec3{0.0f}, light_direction, up);
+
+    // Moving the cascade a whole texel at a time keeps the shadows' edges
+    // from crawling as the view moves.
+    float texel_size = 2.0f * radius / SIZE;
+    glm::vec3 light_center{light_view * glm::vec4{center, 1.0f}};
+    light_center.x = std::floor(light_center.x / texel_size) * texel_size;
+    light_center.y = std::floor(light_center.y / texel_size) * texel_size;
+    glm::mat4x4 projection = glm::ortho(
+        light_center.x - radius, light_center.x + radius,
+        light_center.y - radius, light_center.y + radius,
+        -planet_radius, planet_radius
+    );
+
+    return Cascade{
+        .light_view_projection = projection * light_view,
+        .light_direction = light_direction,
+        .center = center,
+        .radius = radius,
+        .texel_size = texel_size,
+        .generation = 0,
+        .valid = true,
+    };
+}
+
+void gfx::ShadowMaps::recordCascade(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index, uint32_t cascade) {
+    vk::ImageSubresourceRange layer_range{
+        .aspectMask = vk::ImageAspectFlagBits::eDepth,
+        .baseMipLevel = 0,
+        .levelCount = 1,
+        .baseArrayLayer = cascade,
+        .layerCount = 1,
+    };
+
+    // The layer is drawn over whole, but frames in flight may still be
+    // sampling it; those were submitted before, so waiting for their
+    // fragment shaders covers them.
+    vk::ImageMemoryBarrier2 to_attachment{
+        .srcStageMask = vk::PipelineStageFlagBits2::eFragmentShader,
+        .srcAccessMask = vk::AccessFlagBits2::eNone,
+        .dstStageMask = vk::PipelineStageFlagBits2::eEarlyFragmentTests | vk::PipelineStageFlagBits2::eLateFragmentTests,
+        .dstAccessMask = vk::AccessFlagBits2::eDepthStencilAttachmentRead | vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+        .oldLayout = vk::ImageLayout::eUndefined,
+        .newLayout = vk::ImageLayout::eDepthAttachmentOptimal,
+        .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .image = *m_image,
+        .subresourceRange = layer_range,
+    };
+    cmd_buf.pipelineBarrier2(vk::DependencyInfo{}.setImageMemoryBarriers(to_attachment));
+
+    vk::RenderingAttachmentInfo depth_ai{
+        .imageView = *m_layer_views[cascade],
+        .imageLayout = vk::ImageLayout::eDepthAttachmentOptimal,
+        .loadOp = vk::AttachmentLoadOp::eClear,
+        .storeOp = vk::AttachmentStoreOp::eStore,
+        .clearValue = vk::ClearDepthStencilValue{1.0f, 0},
+    };
+    vk::Extent2D extent{SIZE, SIZE};
+    vk::RenderingInfo ri{
+        .renderArea = {.offset = {0, 0}, .extent = extent},
+        .layerCount = 1,
+        .pDepthAttachment = &depth_ai,
+    };
+    cmd_buf.beginRendering(ri);
+
+    cmd_buf.setViewport(0, vk::Viewport{0.0f, 0.0f, static_cast<float>(SIZE), static_cast<float>(SIZE), 0.0f, 1.0f});
+    cmd_buf.setScissor(0, vk::Rect2D{vk::Offset2D{0, 0}, extent});
+    cmd_buf.setDepthCompareOp(vk::CompareOp::eLess);
+    cmd_buf.setDepthWriteEnable(vk::True);
+
+    PipelineStatistics &statistics = m_renderer->pipelineStatistics();
+    statistics.beginPass(cmd_buf, frame_index, "terrain", DrawPass::eShadow, false);
+    m_renderer->terrainPipeline().recordShadowCommands(cmd_buf, m_cascades[cascade].light_view_projection);
+    statistics.endPass(cmd_buf, frame_index);
+
+    cmd_buf.endRendering();
+
+    vk::ImageMemoryBarrier2 to_shader_read{
+        .srcStageMask = vk::PipelineStageFlagBits2::eEarlyFragmentTests | vk::PipelineStageFlagBits2::eLateFragmentTests,
+        .srcAccessMask = vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+        .dstStageMask = vk::PipelineStageFlagBits2::eFragmentShader,
+        .dstAccessMask = vk::AccessFlagBits2::eShaderSampledRead,
+        .oldLayout = vk::ImageLayout::eDepthAttachmentOptimal,
+        .newLayout = vk::ImageLayout::eDepthReadOnlyOptimal,
+        .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .image = *m_image,
+        .subresourceRange = layer_range,
+    };
+    cmd_buf.pipelineBarrier2(vk::DependencyInfo{}.setImageMemoryBarriers(to_shader_read));
+
+    ++m_cascades_drawn;
+}
+
+void gfx::ShadowMaps::initImage() {
+    System *system = m_renderer->system();
+    const vk::raii::Device &device = system->device();
+    m_format = chooseShadowFormat(system->physicalDevice());
+
+    vk::ImageCreateInfo img_ci{
+        .imageType = vk::ImageType::e2D,
+        .format = m_format,
+        .extent = {SIZE, SIZE, 1},
+        .mipLevels = 1,
+        .arrayLayers = SHADOW_CASCADES,
+        .samples = vk::SampleCountFlagBits::e1,
+        .tiling = vk::ImageTiling::eOptimal,
+        .usage = vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eSampled,
+        .sharingMode = vk::SharingMode::eExclusive,
+        .initialLayout = vk::ImageLayout::eUndefined,
+    };
+
+    VkImage image;
+    VmaAllocationCreateInfo alloc_ci{.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE};
+    VkResult rslt = vmaCreateImage(
+        system->allocator(),
+        static_cast<VkImageCreateInfo *>(img_ci),
+        &alloc_ci,
+        &image,
+        &m_image_allocation,
+        nullptr
+    );
+    if (rslt != VK_SUCCESS) {
+        throw std::runtime_error(
+            std::format(
+                "Unable to create shadow map. Error code: {}",
+                vk::to_string(vk::Result(rslt))
+            )
+        );
+    }
+    m_image = vk::raii::Image(device, image);
+    std::cerr << "Created shadow map image " << *m_image << "\n";
+
+    // One view per cascade to draw into, and one of them all to sample.
+    for (uint32_t layer = 0; layer <= SHADOW_CASCADES; ++layer) {
+        bool all = layer == SHADOW_CASCADES;
+        vk::ImageViewCreateInfo iv_ci{
+            .image = *m_image,
+            .viewType = all ? vk::ImageViewType::e2DArray : vk::ImageViewType::e2D,
+            .format = m_format,
+            .subresourceRange = {
+                .aspectMask = vk::ImageAspectFlagBits::eDepth,
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = all ? 0 : layer,
+                .layerCount = all ? SHADOW_CASCADES : 1,
+            },
+        };
+        if (all) {
+            m_image_view = device.createImageView(iv_ci);
+        } else {
+            m_layer_views.push_back(device.createImageView(iv_ci));
+        }
+    }
+
+    // Lookups compare against the map, and the comparisons are filtered
+    // between texels.
+    vk::SamplerCreateInfo sampler_ci{
+        .magFilter = vk::Filter::eLinear,
+        .minFilter = vk::Filter::eLinear,
+        .mipmapMode = vk::SamplerMipmapMode::eNearest,
+        .addressModeU = vk::SamplerAddressMode::eClampToEdge,
+        .addressModeV = vk::SamplerAddressMode::eClampToEdge,
+        .addressModeW = vk::SamplerAddressMode::eClampToEdge,
+        .compareEnable = vk::True,
+        .compareOp = vk::CompareOp::eLessOrEqual,
+        .maxLod = 0.0f,
+    };
+    m_sampler = device.createSampler(sampler_ci);
+}
+
+// Every layer is readable from the start, since the scene's fragment
+// shaders are bound to all of them before any is drawn.
+void gfx::ShadowMaps::transitionImageLayout() {
+    const Commands &commands = m_renderer->system()->commands();
+    vk::raii::CommandBuffer cb = commands.beginOneShot();
+
+    vk::ImageMemoryBarrier2 imb{
+        .srcStageMask = vk::PipelineStageFlagBits2::eNone,
+        .srcAccessMask = vk::AccessFlagBits2::eNone,
+        .dstStageMask = vk::PipelineStageFlagBits2::eFragmentShader,
+        .dstAccessMask = vk::AccessFlagBits2::eShaderSampledRead,
+        .oldLayout = vk::ImageLayout::eUndefined,
+        .newLayout = vk::ImageLayout::eDepthReadOnlyOptimal,
+        .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .image = *m_image,
+        .subresourceRange = {
+            .aspectMask = vk::ImageAspectFlagBits::eDepth,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = SHADOW_CASCADES,
+        },
+    };
+    cb.pipelineBarrier2(vk::DependencyInfo{}.setImageMemoryBarriers(imb));
+    commands.endOneShot(std::move(cb));
+}
+
+vk::Format chooseShadowFormat(const vk::raii::PhysicalDevice &device) {
+    // Every device can draw into and filter the second.
+    std::array<vk::Format, 2> candidates{
+        vk::Format::eD32Sfloat,
+        vk::Format::eD16Unorm,
+    };
+
+    auto chosen = std::ranges::find_if(
+        candidates,
+        [&device](vk::Format format) {
+            vk::FormatProperties props = device.getFormatProperties(format);
+            vk::FormatFeatureFlags needed = vk::FormatFeatureFlagBits::eDepthStencilAttachment |
+                vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+            return (props.optimalTilingFeatures & needed) == needed;
+        }
+    );
+
+    return chosen == candidates.end() ? vk::Format::eD16Unorm : *chosen;
+}
@@ -0,0 +1,98 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#ifndef _VPLANET_GFX_SHADOW_MAPS_H_
+#define _VPLANET_GFX_SHADOW_MAPS_H_
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "../glm.h"
+#include "../vulkan.h"
+#include "../VmaUsage.h"
+
+#include "Uniforms.h"
+
+namespace gfx {
+    class Renderer;
+
+    // The terrain's shadows from the sun, the first enabled light of the
+    // scene uniform set. The view is cut in depth into SHADOW_CASCADES
+    // slices, from the eye out to the planet's horizon, and each gets a
+    // layer of the shadow map: an orthographic view from the sun, fit
+    // around the slice.
+    //
+    // The near cascades move with the eye, so they're drawn again every
+    // frame. The far ones are fit with room to spare and kept in the
+    // terrain's model space, and only drawn again once the sun has turned
+    // against the terrain, the terrain has changed or the view has left
+    // them, and no more than one of them a frame, so that the shadows cost
+    // at most FIRST_CACHED_CASCADE + 1 cascades a frame. Until a far
+    // cascade catches up, what it no longer covers falls through to the
+    // next one out.
+    class ShadowMaps {
+    public:
+        static const uint32_t SIZE = 2048;
+        // The cascades from this one out are kept between frames.
+        static const uint32_t FIRST_CACHED_CASCADE = 2;
+
+        ShadowMaps();
+        ShadowMaps(Renderer *renderer);
+        ShadowMaps(const ShadowMaps &other) = delete;
+        ShadowMaps(ShadowMaps &&other) = delete;
+
+        ~ShadowMaps();
+
+        ShadowMaps &operator=(const ShadowMaps &other) = delete;
+        ShadowMaps &operator=(ShadowMaps &&other);
+
+        bool enabled() const;
+        void setEnabled(bool enabled);
+
+        vk::Format format() const;
+        // All of the cascades, for the scene's fragment shaders.
+        const vk::raii::ImageView &imageView() const;
+        const vk::raii::Sampler &sampler() const;
+        // For the frame last recorded.
+        const ShadowParameters &parameters() const;
+        uint32_t cascadesDrawn() const;
+
+        // Recorded outside of the rendering pass, after the terrain's
+        // uploads and before anything samples the shadow map. Fills in
+        // parameters() for the frame.
+        void recordCommands(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index);
+
+    private:
+        // A cascade, with what it was fit to, to tell when a kept one is
+        // out of date. Everything is in the terrain's model space.
+        struct Cascade {
+            glm::mat4x4 light_view_projection;
+            glm::vec3 light_direction;
+            glm::vec3 center;
+            float radius;
+            float texel_size;
+            uint64_t generation;
+            bool valid;
+        };
+
+        void initImage();
+        void transitionImageLayout();
+        Cascade fitCascade(const glm::vec3 &light_direction, const glm::vec3 &center, float radius, float planet_radius) const;
+        void recordCascade(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index, uint32_t cascade);
+
+        Renderer *m_renderer;
+        bool m_enabled;
+        vk::Format m_format;
+        vk::raii::Image m_image;
+        VmaAllocation m_image_allocation;
+        vk::raii::ImageView m_image_view;
+        std::vector<vk::raii::ImageView> m_layer_views;
+        vk::raii::Sampler m_sampler;
+
+        std::array<Cascade, SHADOW_CASCADES> m_cascades;
+        ShadowParameters m_parameters;
+        uint32_t m_cascades_drawn;
+    };
+}
+
+#endif
@@ -6,6 +6,7 @@
 #include <iostream>
 #include <optional>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "../vulkan.h"
@@ -14,8 +15,10 @@
 #include "Commands.h"
 #include "DepthBuffer.h"
 #include "Renderer.h"
+#include "ShaderLibrary.h"
 #include "Swapchain.h"
 #include "System.h"
+#include "TopologyCache.h"
 #include "Uniforms.h"
 
 struct ChosenDeviceInfo {
@@ -39,6 +42,7 @@ gfx::System::System(GLFWwindow *window, bool debug)
 : m_window{window},
   m_debug{debug},
   m_frame_index{0},
+  m_frame_count{0},
   m_context{},
   m_instance{nullptr},
   m_debug_messenger{nullptr},
@@ -47,6 +51,7 @@ gfx::System::System(GLFWwindow *window, bool debug)
   m_device{nullptr},
   m_graphics_queue_family{UINT32_MAX},
   m_present_queue_family{UINT32_MAX},
+  m_capabilities{},
   m_render_finished_semaphores{},
   m_present_complete_semaphores{},
   m_draw_fences{},
@@ -54,6 +59,8 @@ gfx::System::System(GLFWwindow *window, bool debug)
   m_commands{nullptr},
   m_swapchain{nullptr},
   m_depth_buffer{nullptr},
+  m_topologies{nullptr},
+  m_shaders{nullptr},
   m_renderer{nullptr},
   m_uniforms{nullptr}
 {
@@ -71,6 +78,12 @@ gfx::System::System(GLFWwindow *window, bool debug)
     m_commands = std::make_unique<Commands>(this, m_swapchain->imageCount());
     m_uniforms = std::make_unique<Uniforms>(this, MAX_FRAMES_IN_FLIGHT);
     m_depth_buffer = std::make_unique<DepthBuffer>(this);
+    m_topologies = std::make_unique<TopologyCache>(this);
+#ifdef VPLANET_SHADER_DIRECTORY
+    m_shaders = std::make_unique<ShaderLibrary>(VPLANET_SHADER_DIRECTORY);
+#else
+    m_shaders = std::make_unique<ShaderLibrary>();
+#endif
     m_renderer = std::make_unique<Renderer>(this);
 }
 
@@ -79,6 +92,7 @@ gfx::System::~System() {
     m_commands->waitPresentIdle();
     m_depth_buffer.reset();
     m_renderer.reset();
+    m_topologies.reset();
     cleanupAllocator();
 }
 
@@ -114,10 +128,82 @@ uint32_t gfx::System::numFrames() const {
     return MAX_FRAMES_IN_FLIGHT;
 }
 
+const gfx::DeviceCapabilities &gfx::System::capabilities() const {
+    return m_capabilities;
+}
+
 VmaAllocator gfx::System::allocator() const {
     return m_allocator;
 }
 
+gfx::MemoryStats gfx::System::memoryStats() const {
+    const VkPhysicalDeviceMemoryProperties *mem_props = nullptr;
+    vmaGetMemoryProperties(m_allocator, &mem_props);
+
+    std::vector<VmaBudget> budgets(mem_props->memoryHeapCount);
+    vmaGetHeapBudgets(m_allocator, budgets.data());
+
+    // Walks every block, so this is for reports, not every frame.
+    VmaTotalStatistics total{};
+    vmaCalculateStatistics(m_allocator, &total);
+
+    MemoryStats stats{
+        .driver_budget = m_capabilities.memory_budget,
+        .heaps = {},
+        .block_count = total.total.statistics.blockCount,
+        .allocation_count = total.total.statistics.allocationCount,
+        .unused_range_count = total.total.unusedRangeCount,
+        .block_bytes = total.total.statistics.blockBytes,
+        .allocation_bytes = total.total.statistics.allocationBytes,
+        .allocation_size_min = total.total.statistics.allocationCount > 0 ? total.total.allocationSizeMin : 0,
+        .allocation_size_max = total.total.allocationSizeMax,
+        .unused_range_size_min = total.total.unusedRangeCount > 0 ? total.total.unusedRangeSizeMin : 0,
+        .unused_range_size_max = total.total.unusedRangeSizeMax,
+    };
+    for (uint32_t i = 0; i < mem_props->memoryHeapCount; ++i) {
+        stats.heaps.push_back(MemoryHeapStats{
+            .flags = vk::MemoryHeapFlags{mem_props->memoryHeaps[i].flags},
+            .size = mem_props->memoryHeaps[i].size,
+            .usage = budgets[i].usage,
+            .budget = budgets[i].budget,
+            .block_count = budgets[i].statistics.blockCount,
+            .allocation_count = budgets[i].statistics.allocationCount,
+            .block_bytes = budgets[i].statistics.blockBytes,
+            .allocation_bytes = budgets[i].statistics.allocationBytes,
+        });
+    }
+    return stats;
+}
+
+vk::DeviceSize gfx::System::deviceLocalHeadroom() const {
+    const VkPhysicalDeviceMemoryProperties *mem_props = nullptr;
+    vmaGetMemoryProperties(m_allocator, &mem_props);
+
+    std::vector<VmaBudget> budgets(mem_props->memoryHeapCount);
+    vmaGetHeapBudgets(m_allocator, budgets.data());
+
+    uint32_t largest = UINT32_MAX;
+    for (uint32_t i = 0; i < mem_props->memoryHeapCount; ++i) {
+        if ((mem_props->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) &&
+            (largest == UINT32_MAX || mem_props->memoryHeaps[i].size > mem_props->memoryHeaps[largest].size))
+        {
+            largest = i;
+        }
+    }
+    if (largest == UINT32_MAX) {
+        return 0;
+    }
+    return budgets[largest].budget > budgets[largest].usage ? budgets[largest].budget - budgets[largest].usage : 0;
+}
+
+std::string gfx::System::memoryStatsJson(bool detailed) const {
+    char *json = nullptr;
+    vmaBuildStatsString(m_allocator, &json, detailed ? VK_TRUE : VK_FALSE);
+    std::string result{json};
+    vmaFreeStatsString(m_allocator, json);
+    return result;
+}
+
 const gfx::Commands& gfx::System::commands() const {
     return *m_commands;
 }
@@ -134,12 +220,61 @@ const gfx::Renderer& gfx::System::renderer() const {
     return *m_renderer;
 }
 
+const gfx::RenderStats& gfx::System::stats() const {
+    return m_renderer->stats();
+}
+
 gfx::Uniforms& gfx::System::uniforms() {
     return *m_uniforms;
 }
 
-void gfx::System::setTerrainGeometry(const std::vector<TerrainVertex> &verts, const std::vector<uint32_t> &elems) {
-    m_renderer->terrainPipeline().setGeometry(verts, elems);
+gfx::TopologyCache& gfx::System::topologies() {
+    return *m_topologies;
+}
+
+gfx::ShaderLibrary& gfx::System::shaders() {
+    return *m_shaders;
+}
+
+const vk::raii::DescriptorPool &gfx::System::descriptorPool() const {
+    return m_uniforms->descriptorPool();
+}
+
+vk::raii::CommandBuffer gfx::System::beginOneShot() const {
+    return m_commands->beginOneShot();
+}
+
+void gfx::System::endOneShot(vk::raii::CommandBuffer &&buffer) const {
+    m_commands->endOneShot(std::move(buffer));
+}
+
+void gfx::System::setTerrainGeometry(
+    uint32_t level,
+    std::span<const CompactTerrainVertex> verts,
+    const std::vector<uint32_t> &elems,
+    const ShortElements *short_elems,
+    const std::vector<TerrainPatch> &patches,
+    const Meshlets &meshlets,
+    float min_radius,
+    float max_radius
+) {
+    m_renderer->terrainPipeline().setGeometry(level, verts, elems, short_elems, patches, meshlets, min_radius, max_radius, m_frame_index);
+}
+
+bool gfx::System::hasTerrainLevel(uint32_t level) const {
+    return m_renderer->terrainPipeline().hasLevel(level);
+}
+
+uint32_t gfx::System::terrainLevel() const {
+    return m_renderer->terrainPipeline().level();
+}
+
+void gfx::System::setTerrainLevel(uint32_t level) {
+    m_renderer->terrainPipeline().setLevel(level);
+}
+
+void gfx::System::setTerrainMorphRange(float start, float end) {
+    m_renderer->terrainPipeline().setMorphRange(start, end);
 }
 
 void gfx::System::setTerrainTransform(const glm::mat4x4 &xform) {
@@ -154,8 +289,78 @@ void gfx::System::writeTerrainTransform(uint32_t frame_index) {
     m_renderer->terrainPipeline().writeTransform(frame_index);
 }
 
-void gfx::System::setOceanGeometry(const std::vector<OceanVertex> &verts, const std::vector<uint32_t> &indices) {
-    m_renderer->oceanPipeline().setGeometry(verts, indices);
+gfx::CullMode gfx::System::terrainCullMode() const {
+    return m_renderer->terrainPipeline().cullMode();
+}
+
+void gfx::System::setTerrainCullMode(CullMode mode) {
+    m_renderer->terrainPipeline().setCullMode(mode);
+}
+
+bool gfx::System::terrainCullModeSupported(CullMode mode) const {
+    return m_renderer->terrainPipeline().cullModeSupported(mode);
+}
+
+void gfx::System::setTerrainChunkTopology(
+    const std::vector<uint32_t> &indices,
+    uint32_t vertices_per_chunk,
+    uint32_t capacity,
+    uint32_t uploads_per_frame
+) {
+    m_renderer->terrainPipeline().setChunkTopology(indices, vertices_per_chunk, capacity, uploads_per_frame);
+}
+
+void gfx::System::uploadTerrainChunks(const std::vector<TerrainChunkUpload> &uploads) {
+    m_renderer->terrainPipeline().uploadChunks(uploads, m_frame_index);
+}
+
+void gfx::System::setTerrainChunkNoise(const TerrainNoiseTables &noise, float radius, uint32_t resolution) {
+    m_renderer->terrainPipeline().setChunkNoise(noise, radius, resolution);
+}
+
+bool gfx::System::terrainChunkGenerationSupported() const {
+    return m_renderer->terrainPipeline().chunkGenerationSupported();
+}
+
+void gfx::System::generateTerrainChunks(const std::vector<TerrainChunkGeneration> &chunks) {
+    m_renderer->terrainPipeline().generateChunks(chunks, m_frame_index);
+}
+
+std::vector<TerrainChunkVertex> gfx::System::generateTerrainChunksNow(const std::vector<TerrainChunkGeneration> &chunks) {
+    return m_renderer->terrainPipeline().generateChunksNow(chunks);
+}
+
+void gfx::System::setTerrainChunkDraws(const std::vector<uint32_t> &slots) {
+    m_renderer->terrainPipeline().setChunkDraws(slots);
+}
+
+void gfx::System::setTerrainChunkShadowCasters(const std::vector<TerrainShadowCaster> &casters) {
+    m_renderer->terrainPipeline().setChunkShadowCasters(casters);
+}
+
+bool gfx::System::terrainChunksEnabled() const {
+    return m_renderer->terrainPipeline().chunksEnabled();
+}
+
+void gfx::System::setTerrainChunksEnabled(bool enabled) {
+    m_renderer->terrainPipeline().setChunksEnabled(enabled);
+}
+
+void gfx::System::setOceanGeometry(
+    uint32_t refinements,
+    std::span<const OceanVertex> verts,
+    const std::vector<uint32_t> &indices,
+    const ShortElements *short_indices
+) {
+    m_renderer->oceanPipeline().setGeometry(refinements, verts, indices, short_indices);
+}
+
+void gfx::System::setOceanSurface(float radius, const glm::vec4 &color) {
+    m_renderer->oceanPipeline().setSurface(radius, color);
+}
+
+void gfx::System::setOceanTime(float seconds) {
+    m_renderer->oceanPipeline().setTime(seconds);
 }
 
 void gfx::System::setOceanTransform(const glm::mat4x4 &xform) {
@@ -170,6 +375,54 @@ void gfx::System::writeOceanTransform(uint32_t frame_index) {
     m_renderer->oceanPipeline().writeTransform(frame_index);
 }
 
+bool gfx::System::reverseDepth() const {
+    return m_renderer->reverseDepth();
+}
+
+void gfx::System::setReverseDepth(bool reverse) {
+    m_renderer->setReverseDepth(reverse);
+}
+
+bool gfx::System::depthPrepass() const {
+    return m_renderer->depthPrepass();
+}
+
+void gfx::System::setDepthPrepass(bool enabled) {
+    m_renderer->setDepthPrepass(enabled);
+}
+
+bool gfx::System::pipelineStatisticsEnabled() const {
+    return m_renderer->pipelineStatistics().enabled();
+}
+
+void gfx::System::setPipelineStatisticsEnabled(bool enabled) {
+    m_renderer->pipelineStatistics().setEnabled(enabled);
+}
+
+std::vector<gfx::PassStatistics> gfx::System::takePipelineStatistics() {
+    return m_renderer->pipelineStatistics().takeTotals();
+}
+
+bool gfx::System::atmosphereEnabled() const {
+    return m_renderer->atmosphere().enabled();
+}
+
+void gfx::System::setAtmosphereEnabled(bool enabled) {
+    m_renderer->atmosphere().setEnabled(enabled);
+}
+
+void gfx::System::setAtmosphereParameters(const AtmosphereParameters &parameters) {
+    m_renderer->atmosphere().setParameters(parameters);
+}
+
+bool gfx::System::shadowsEnabled() const {
+    return m_renderer->shadowMaps().enabled();
+}
+
+void gfx::System::setShadowsEnabled(bool enabled) {
+    m_renderer->shadowMaps().setEnabled(enabled);
+}
+
 void gfx::System::setViewProjectionTransform(const ViewProjectionTransform &xform) {
     m_renderer->setViewProjectionTransform(xform);
 }
@@ -198,6 +451,22 @@ void gfx::System::writeLightList(uint32_t frame_index) {
     m_renderer->writeLightList(frame_index);
 }
 
+void gfx::System::setPointLights(std::span<const PointLight> lights) {
+    m_renderer->setPointLights(lights);
+}
+
+void gfx::System::writePointLights() {
+    writePointLights(m_frame_index);
+}
+
+void gfx::System::writePointLights(uint32_t frame_index) {
+    m_renderer->writePointLights(frame_index);
+}
+
+void gfx::System::setLightClusterRange(float z_near, float z_far) {
+    m_renderer->setLightClusterRange(z_near, z_far);
+}
+
 // void gfx::System::recordCommandBuffers() {
 //     const std::vector<vk::raii::CommandBuffer> &draw_commands = m_commands.drawCommands();
 
@@ -234,6 +503,9 @@ uint32_t gfx::System::startFrame() {
     }
 
     m_device.resetFences(*draw_fence);
+
+    // Lets VMA refresh its heap budgets from the driver now and then.
+    vmaSetCurrentFrameIndex(m_allocator, m_frame_count);
     return image_index;
 }
 
@@ -273,6 +545,7 @@ void gfx::System::presentFrame(uint32_t image_index) {
     }
     
     m_frame_index = (m_frame_index + 1) % MAX_FRAMES_IN_FLIGHT;
+    ++m_frame_count;
 }
 
 void gfx::System::waitIdle() {
@@ -295,114 +568,6 @@ uint32_t gfx::System::chooseMemoryType(uint32_t type_filter, VkMemoryPropertyFla
     return UINT32_MAX;
 }
 
-std::pair<vk::raii::Buffer, VmaAllocation> gfx::System::createBuffer(
-    vk::DeviceSize size, 
-    vk::BufferUsageFlags usage,
-    VmaAllocationCreateFlags allocation_flags,
-    const std::optional<std::string> &name
-) {
-
-    std::string buffer_name;
-    if (name.has_value()) {
-        buffer_name = std::string{name.value()} + " buffer";
-    } else {
-        buffer_name = "buffer";
-    }
-
-    vk::BufferCreateInfo buf_ci{
-        .size = size,
-        .usage = usage,
-        .sharingMode = vk::SharingMode::eExclusive,
-    };
-
-    VmaAllocationCreateInfo alloc_ci{};
-    alloc_ci.usage = VMA_MEMORY_USAGE_AUTO;
-    alloc_ci.flags = allocation_flags;
-
-    VkBuffer buffer;
-    VmaAllocation allocation;
-    VkResult rslt = vmaCreateBuffer(
-        m_allocator,
-        static_cast<VkBufferCreateInfo *>(buf_ci),
-        &alloc_ci,
-        &buffer,
-        &allocation,
-        nullptr
-    );
-
-    if (rslt != VK_SUCCESS) {
-        throw std::runtime_error(
-            std::format(
-                "Failed to create {}. Error code: {}",
-                buffer_name,
-                vk::to_string(vk::Result(rslt))
-            )
-        );
-    }
-
-    std::cerr << "Created " << buffer_name << ": " << buffer << "\n";
-    std::cerr << "Created " << buffer_name << " allocation: " << allocation << "\n";
-    return {vk::raii::Buffer(m_device, buffer), allocation};
-}
-
-std::pair<vk::raii::Buffer, VmaAllocation> gfx::System::createBufferWithData(
-    const void *data, 
-    size_t size, 
-    vk::BufferUsageFlags usage,
-    VmaAllocationCreateFlags allocation_flags,
-    const std::optional<std::string> &name
-) {
-    // Create the staging buffer.
-    auto [staging_buffer, staging_allocation] = createBuffer(
-        size,
-        vk::BufferUsageFlagBits::eTransferSrc,
-        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
-        "staging"
-    );
-
-    // Copy data to the staging buffer.
-    VkResult rslt = vmaCopyMemoryToAllocation(m_allocator, data, staging_allocation, 0, size);
-
-    if (rslt != VK_SUCCESS) {
-        throw std::runtime_error(
-            std::format(
-                "Failed to copy data to the staging buffer. Error code: {}",
-                vk::to_string(vk::Result(rslt))
-            )
-        );
-    }
-
-    // Create the real buffer.
-    auto [buffer, allocation] = createBuffer(
-        size,
-        usage | vk::BufferUsageFlagBits::eTransferDst,
-        allocation_flags,
-        name
-    );
-
-    // Copy the staging buffer to the real buffer.
-    copyBuffer(buffer, staging_buffer, size);
-
-    // Free the staging buffer allocation. (The staging buffer will be freed by
-    // RAII)
-    std::cerr << "Freeing staging buffer allocation " << staging_allocation << "\n";
-    vmaFreeMemory(m_allocator, staging_allocation);
-
-    return {std::move(buffer), allocation};
-}
-
-void gfx::System::copyBuffer(const vk::raii::Buffer &dst, const vk::raii::Buffer &src, VkDeviceSize size) {
-    vk::BufferCopy region{
-        .srcOffset = 0,
-        .dstOffset = 0,
-        .size = size,
-    };
-
-    vk::raii::CommandBuffer cb = m_commands->beginOneShot();
-    cb.copyBuffer(*src, *dst, region);
-    m_commands->endOneShot(std::move(cb));
-}
-
 void gfx::System::initInstance() {
     std::vector<const char*> required_extensions = requiredInstanceExtensions(m_debug);
     std::vector<vk::ExtensionProperties> extensions = m_context.enumerateInstanceExtensionProperties();
@@ -621,20 +786,60 @@ void gfx::System::initDevice() {
         });
     }
 
+    // Optional features. These are enabled if the device has them, and the
+    // renderer checks capabilities() to decide which paths to use.
+    const auto supported_features = m_physical_device.getFeatures2<
+        vk::PhysicalDeviceFeatures2,
+        vk::PhysicalDeviceVulkan12Features
+    >();
+    m_capabilities.multi_draw_indirect = supported_features.get<vk::PhysicalDeviceFeatures2>().features.multiDrawIndirect;
+    m_capabilities.draw_indirect_count = supported_features.get<vk::PhysicalDeviceVulkan12Features>().drawIndirectCount;
+    m_capabilities.pipeline_statistics = supported_features.get<vk::PhysicalDeviceFeatures2>().features.pipelineStatisticsQuery;
+
+    // The mesh shader features can only be queried if the extension is
+    // there.
+    std::vector<const char*> extensions = requiredDeviceExtensions(m_debug);
+    std::vector<vk::ExtensionProperties> available_extensions = m_physical_device.enumerateDeviceExtensionProperties();
+    if (hasExtension(vk::EXTMeshShaderExtensionName, available_extensions)) {
+        const auto mesh_features = m_physical_device.getFeatures2<
+            vk::PhysicalDeviceFeatures2,
+            vk::PhysicalDeviceMeshShaderFeaturesEXT
+        >();
+        const vk::PhysicalDeviceMeshShaderFeaturesEXT &mesh_shader = mesh_features.get<vk::PhysicalDeviceMeshShaderFeaturesEXT>();
+        m_capabilities.mesh_shader = mesh_shader.taskShader && mesh_shader.meshShader;
+    }
+    if (m_capabilities.mesh_shader) {
+        extensions.push_back(vk::EXTMeshShaderExtensionName);
+    }
+
+    // Real heap usage and budgets from the driver, for VMA to report.
+    m_capabilities.memory_budget = hasExtension(vk::EXTMemoryBudgetExtensionName, available_extensions);
+    if (m_capabilities.memory_budget) {
+        extensions.push_back(vk::EXTMemoryBudgetExtensionName);
+    }
+
     vk::StructureChain<
         vk::PhysicalDeviceFeatures2,
         vk::PhysicalDeviceVulkan11Features,
+        vk::PhysicalDeviceVulkan12Features,
         vk::PhysicalDeviceVulkan13Features,
-        vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT
+        vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT,
+        vk::PhysicalDeviceMeshShaderFeaturesEXT
     > feature_chain = {
         vk::PhysicalDeviceFeatures2{
             .features = vk::PhysicalDeviceFeatures{
+                .multiDrawIndirect = m_capabilities.multi_draw_indirect, // More than one draw per indirect command
                 .samplerAnisotropy = true, // Enable ansiotropic filtering in samplers
+                .pipelineStatisticsQuery = m_capabilities.pipeline_statistics, // Count shader invocations
             },
         },
         vk::PhysicalDeviceVulkan11Features{
             // .shaderDrawParameters = true, // Enable shader draw parameters (we need this for SV_VertexID in the shader)
         },
+        vk::PhysicalDeviceVulkan12Features{
+            .drawIndirectCount = m_capabilities.draw_indirect_count, // GPU-generated draw counts
+            .separateDepthStencilLayouts = true, // Depth-only attachment and read-only layouts
+        },
         vk::PhysicalDeviceVulkan13Features{
             .synchronization2 = true, // Support new synchronization commands
             .dynamicRendering = true, // Enable dynamic rendering from Vulkan 1.3
@@ -642,9 +847,15 @@ void gfx::System::initDevice() {
         vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT{
             .extendedDynamicState = true // Enable extended dynamic state from the extension
         },
+        vk::PhysicalDeviceMeshShaderFeaturesEXT{
+            .taskShader = true, // Per-meshlet culling for the terrain
+            .meshShader = true,
+        },
     };
+    if (!m_capabilities.mesh_shader) {
+        feature_chain.unlink<vk::PhysicalDeviceMeshShaderFeaturesEXT>();
+    }
 
-    std::vector<const char*> extensions = requiredDeviceExtensions(m_debug);
     std::vector<const char*> layers = requiredDeviceLayers(m_debug);
 
     vk::DeviceCreateInfo dev_ci = vk::DeviceCreateInfo{.pNext = &feature_chain.get<vk::PhysicalDeviceFeatures2>()}
@@ -653,6 +864,11 @@ void gfx::System::initDevice() {
 
     m_device = m_physical_device.createDevice(dev_ci);
     std::cerr << "Created device: " << *m_device << "\n";
+    std::cerr << "Device capabilities: multiDrawIndirect = " << m_capabilities.multi_draw_indirect
+              << ", drawIndirectCount = " << m_capabilities.draw_indirect_count
+              << ", meshShader = " << m_capabilities.mesh_shader
+              << ", memoryBudget = " << m_capabilities.memory_budget
+              << ", pipelineStatisticsQuery = " << m_capabilities.pipeline_statistics << "\n";
 }
 
 void gfx::System::initSynchronizationObjects() {
@@ -679,6 +895,9 @@ void gfx::System::initAllocator() {
         alloc_ci.device = *m_device;
         alloc_ci.instance = *m_instance;
         alloc_ci.vulkanApiVersion = vk::ApiVersion14;
+        if (m_capabilities.memory_budget) {
+            alloc_ci.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+        }
 
         if (m_debug) {
             callbacks.pfnAllocate = gfx::System::memoryAllocationCallback;
@@ -4,6 +4,7 @@
 #define _VPLANET_GFX_SYSTEM_H_
 
 #include <optional>
+#include <span>
 #include <string>
 #include <vector>
 
@@ -11,15 +12,57 @@
 #include "../VmaUsage.h"
 
 #include "../Terrain.h"
+#include "../TerrainLod.h"
 #include "Commands.h"
+#include "ComputeContext.h"
 #include "DepthBuffer.h"
 #include "Renderer.h"
 #include "Resource.h"
+#include "ShaderLibrary.h"
 #include "Swapchain.h"
+#include "TopologyCache.h"
 #include "Uniforms.h"
 
 namespace gfx {
-    class System {
+    // Optional device features, detected when the device is created.
+    struct DeviceCapabilities {
+        bool multi_draw_indirect;
+        bool draw_indirect_count;
+        bool mesh_shader; // VK_EXT_mesh_shader with task shaders
+        bool memory_budget; // VK_EXT_memory_budget
+        bool pipeline_statistics; // pipelineStatisticsQuery
+    };
+
+    // Use of one memory heap. With VK_EXT_memory_budget, usage and budget
+    // come from the driver and cover everything in the process; without it
+    // usage is only what VMA allocated and budget is an estimate.
+    struct MemoryHeapStats {
+        vk::MemoryHeapFlags flags;
+        vk::DeviceSize size;
+        vk::DeviceSize usage;
+        vk::DeviceSize budget;
+        uint32_t block_count;
+        uint32_t allocation_count;
+        vk::DeviceSize block_bytes;
+        vk::DeviceSize allocation_bytes;
+    };
+
+    // Per-heap use, and VMA's statistics over every heap. Blocks are
+    // VkDeviceMemory objects; allocations are suballocated from them, and
+    // the unused ranges are the holes left between.
+    struct MemoryStats {
+        bool driver_budget;
+        std::vector<MemoryHeapStats> heaps;
+        uint32_t block_count;
+        uint32_t allocation_count;
+        uint32_t unused_range_count;
+        vk::DeviceSize block_bytes;
+        vk::DeviceSize allocation_bytes;
+        vk::DeviceSize allocation_size_min, allocation_size_max;
+        vk::DeviceSize unused_range_size_min, unused_range_size_max;
+    };
+
+    class System : public ComputeContext {
     public:
         static constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 2;
         
@@ -28,31 +71,99 @@ namespace gfx {
 
         GLFWwindow* window() const;
         const vk::raii::Instance &instance() const;
-        const vk::raii::Device &device() const;
+        virtual const vk::raii::Device &device() const;
         const vk::raii::PhysicalDevice &physicalDevice() const;
         const vk::raii::SurfaceKHR &surface() const;
         uint32_t graphicsQueueFamily() const;
         uint32_t presentQueueFamily() const;
-        uint32_t numFrames() const;
+        virtual uint32_t numFrames() const;
+        const DeviceCapabilities &capabilities() const;
 
-        VmaAllocator allocator() const;
+        virtual VmaAllocator allocator() const;
+        MemoryStats memoryStats() const;
+        // Room left under the budget of the largest device local heap, for
+        // sizing caches that shouldn't push the device into over-commit.
+        vk::DeviceSize deviceLocalHeadroom() const;
+        // VMA's full JSON dump, with every allocation if detailed.
+        std::string memoryStatsJson(bool detailed) const;
 
         const Commands& commands() const;
         const DepthBuffer& depthBuffer() const;
         const Swapchain& swapchain() const;
         const Renderer& renderer() const;
+        const RenderStats& stats() const;
         Uniforms& uniforms();
+        TopologyCache& topologies();
+        virtual ShaderLibrary& shaders();
+        // The uniforms' pool, which has room for the compute passes' sets.
+        virtual const vk::raii::DescriptorPool &descriptorPool() const;
+        // On the graphics queue; see Commands.
+        virtual vk::raii::CommandBuffer beginOneShot() const;
+        virtual void endOneShot(vk::raii::CommandBuffer &&buffer) const;
 
-        void setTerrainGeometry(const std::vector<TerrainVertex> &vertices, const std::vector<uint32_t> &indices);
+        void setTerrainGeometry(
+            uint32_t level,
+            std::span<const CompactTerrainVertex> vertices,
+            const std::vector<uint32_t> &indices,
+            const ShortElements *short_indices,
+            const std::vector<TerrainPatch> &patches,
+            const Meshlets &meshlets,
+            float min_radius,
+            float max_radius
+        );
+        bool hasTerrainLevel(uint32_t level) const;
+        uint32_t terrainLevel() const;
+        void setTerrainLevel(uint32_t level);
+        void setTerrainMorphRange(float start, float end);
         void setTerrainTransform(const glm::mat4x4 &xform);
         void writeTerrainTransform();
         void writeTerrainTransform(uint32_t frame_index);
+        CullMode terrainCullMode() const;
+        void setTerrainCullMode(CullMode mode);
+        bool terrainCullModeSupported(CullMode mode) const;
+        void setTerrainChunkTopology(
+            const std::vector<uint32_t> &indices,
+            uint32_t vertices_per_chunk,
+            uint32_t capacity,
+            uint32_t uploads_per_frame
+        );
+        void uploadTerrainChunks(const std::vector<TerrainChunkUpload> &uploads);
+        void setTerrainChunkNoise(const TerrainNoiseTables &noise, float radius, uint32_t resolution);
+        bool terrainChunkGenerationSupported() const;
+        void generateTerrainChunks(const std::vector<TerrainChunkGeneration> &chunks);
+        std::vector<TerrainChunkVertex> generateTerrainChunksNow(const std::vector<TerrainChunkGeneration> &chunks);
+        void setTerrainChunkDraws(const std::vector<uint32_t> &slots);
+        void setTerrainChunkShadowCasters(const std::vector<TerrainShadowCaster> &casters);
+        bool terrainChunksEnabled() const;
+        void setTerrainChunksEnabled(bool enabled);
 
-        void setOceanGeometry(const std::vector<OceanVertex> &vertices, const std::vector<uint32_t> &indices);
+        void setOceanGeometry(
+            uint32_t refinements,
+            std::span<const OceanVertex> vertices,
+            const std::vector<uint32_t> &indices,
+            const ShortElements *short_indices = nullptr
+        );
+        void setOceanSurface(float radius, const glm::vec4 &color);
+        void setOceanTime(float seconds);
         void setOceanTransform(const glm::mat4x4 &xform);
         void writeOceanTransform();
         void writeOceanTransform(uint32_t frame_index);
 
+        bool reverseDepth() const;
+        void setReverseDepth(bool reverse);
+        bool depthPrepass() const;
+        void setDepthPrepass(bool enabled);
+        bool pipelineStatisticsEnabled() const;
+        void setPipelineStatisticsEnabled(bool enabled);
+        std::vector<PassStatistics> takePipelineStatistics();
+
+        // The atmosphere is lit by the first enabled light.
+        bool atmosphereEnabled() const;
+        void setAtmosphereEnabled(bool enabled);
+        void setAtmosphereParameters(const AtmosphereParameters &parameters);
+        // The terrain is shadowed from the first enabled light too.
+        bool shadowsEnabled() const;
+        void setShadowsEnabled(bool enabled);
         void setViewProjectionTransform(const ViewProjectionTransform &xform);
         void writeViewProjectionTransform();
         void writeViewProjectionTransform(uint32_t frame_index);
@@ -62,29 +173,21 @@ namespace gfx {
         void writeLightList();
         void writeLightList(uint32_t frame_index);
 
+        // Point lights are in the terrain's model space, and binned into
+        // view space clusters between the given depths each frame.
+        void setPointLights(std::span<const PointLight> lights);
+        void writePointLights();
+        void writePointLights(uint32_t frame_index);
+        void setLightClusterRange(float z_near, float z_far);
+
         // void recordCommandBuffers();
         uint32_t startFrame();
         void drawFrame(uint32_t image_index);
         void presentFrame(uint32_t image_index);
-        void waitIdle();
+        virtual void waitIdle();
 
         uint32_t chooseMemoryType(uint32_t type_filter, VkMemoryPropertyFlags properties) const;
 
-        std::pair<vk::raii::Buffer, VmaAllocation> createBuffer(
-            vk::DeviceSize size, 
-            vk::BufferUsageFlags usage,
-            VmaAllocationCreateFlags allocation_flags,
-            const std::optional<std::string> &name
-        );
-        std::pair<vk::raii::Buffer, VmaAllocation> createBufferWithData(
-            const void *data, 
-            size_t size, 
-            vk::BufferUsageFlags usage,
-            VmaAllocationCreateFlags allocation_flags,
-            const std::optional<std::string> &name
-        );
-        void copyBuffer(const vk::raii::Buffer &dst, const vk::raii::Buffer &src, vk::DeviceSize size);
-
     private:
         void initInstance();
         void initDebugCallback();
@@ -133,6 +236,7 @@ namespace gfx {
         GLFWwindow *m_window;
         bool m_debug;
         uint32_t m_frame_index;
+        uint32_t m_frame_count;
 
         vk::raii::Context m_context;
         vk::raii::Instance m_instance;
@@ -141,6 +245,7 @@ namespace gfx {
         vk::raii::PhysicalDevice m_physical_device;
         vk::raii::Device m_device;
         uint32_t m_graphics_queue_family, m_present_queue_family;
+        DeviceCapabilities m_capabilities;
         std::vector<vk::raii::Semaphore> m_present_complete_semaphores;
         std::vector<vk::raii::Semaphore> m_render_finished_semaphores;
         std::vector<vk::raii::Fence> m_draw_fences;
@@ -151,6 +256,8 @@ namespace gfx {
         std::unique_ptr<Swapchain> m_swapchain;
         std::unique_ptr<Uniforms> m_uniforms;
         std::unique_ptr<DepthBuffer> m_depth_buffer;
+        std::unique_ptr<TopologyCache> m_topologies;
+        std::unique_ptr<ShaderLibrary> m_shaders;
         std::unique_ptr<Renderer> m_renderer;
     };
 };
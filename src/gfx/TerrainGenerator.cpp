@@ -0,0 +1,418 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <format>
+#include <iostream>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "../glm.h"
+#include "../vulkan.h"
+
+#include "ComputeContext.h"
+#include "ShaderLibrary.h"
+#include "TerrainGenerator.h"
+
+const char *TERRAIN_GENERATE_SHADER = "terrain_generate.slang.spv";
+
+// Must match GROUP_SIZE in terrain_generate.slang.
+const uint32_t TERRAIN_GENERATE_WORKGROUP_SIZE = 64;
+
+gfx::TerrainGenerator::TerrainGenerator(
+    ComputeContext *context,
+    const TerrainNoiseTables &noise,
+    float radius,
+    uint32_t resolution,
+    uint32_t chunks_per_frame
+)
+: m_context{context},
+  m_parameters{},
+  m_chunks_per_frame{chunks_per_frame},
+  m_permutation_buffer{nullptr},
+  m_spline_buffer{nullptr},
+  m_permutation_buffer_allocation{VK_NULL_HANDLE},
+  m_spline_buffer_allocation{VK_NULL_HANDLE},
+  m_job_buffers{},
+  m_job_buffer_allocations{},
+  m_job_counts{},
+  m_descriptor_set_layout{nullptr},
+  m_pipeline_layout{nullptr},
+  m_pipeline{nullptr},
+  m_descriptor_sets{},
+  m_descriptor_vertex_buffers{}
+{
+    // The same grid and skirt as TerrainChunkGenerator.
+    uint32_t grid_vertices = (resolution + 1) * (resolution + 2) / 2;
+    m_parameters = TerrainGenerateParameters{
+        .scales = glm::vec4{noise.scales[0], noise.scales[1], noise.scales[2], radius},
+        .octaves = static_cast<uint32_t>(noise.octaves),
+        .persistence = static_cast<float>(noise.persistence),
+        .control_points = static_cast<uint32_t>(noise.control_points.size()),
+        .resolution = resolution,
+        .grid_vertices = grid_vertices,
+        .vertices_per_chunk = grid_vertices + 3 * resolution,
+        .chunk_count = 0,
+        .padding = 0.0f,
+    };
+
+    initNoiseBuffers(noise);
+    initJobBuffers();
+    initPipeline();
+    initDescriptorSets();
+}
+
+gfx::TerrainGenerator::~TerrainGenerator() {
+    VmaAllocator allocator = m_context->allocator();
+
+    // The descriptor sets refer to the buffers, so they go first.
+    m_descriptor_sets.clear();
+
+    for (auto &alloc : m_job_buffer_allocations) {
+        vmaFreeMemory(allocator, alloc);
+    }
+    if (m_spline_buffer_allocation != VK_NULL_HANDLE) {
+        vmaFreeMemory(allocator, m_spline_buffer_allocation);
+    }
+    if (m_permutation_buffer_allocation != VK_NULL_HANDLE) {
+        vmaFreeMemory(allocator, m_permutation_buffer_allocation);
+    }
+}
+
+uint32_t gfx::TerrainGenerator::verticesPerChunk() const {
+    return m_parameters.vertices_per_chunk;
+}
+
+uint32_t gfx::TerrainGenerator::chunksPerFrame() const {
+    return m_chunks_per_frame;
+}
+
+void gfx::TerrainGenerator::queueChunks(const std::vector<TerrainChunkGeneration> &chunks, uint32_t frame_index) {
+    writeJobs(frame_index, chunks);
+}
+
+bool gfx::TerrainGenerator::hasQueuedChunks(uint32_t frame_index) const {
+    return m_job_counts[frame_index] > 0;
+}
+
+void gfx::TerrainGenerator::recordCommands(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index, const vk::raii::Buffer &vertex_buffer) {
+    if (m_job_counts[frame_index] == 0) {
+        return;
+    }
+    recordDispatch(cmd_buf, frame_index, vertex_buffer);
+    m_job_counts[frame_index] = 0;
+}
+
+std::vector<TerrainChunkVertex> gfx::TerrainGenerator::generateNow(const std::vector<TerrainChunkGeneration> &chunks) {
+    ComputeContext *gfx = m_context;
+    gfx->waitIdle();
+
+    // One after the other, in the order given.
+    std::vector<TerrainChunkGeneration> packed{chunks.begin(), chunks.begin() + std::min<size_t>(chunks.size(), m_chunks_per_frame)};
+    for (uint32_t i = 0; i < packed.size(); ++i) {
+        packed[i].slot = i;
+    }
+
+    vk::DeviceSize size = packed.size() * m_parameters.vertices_per_chunk * sizeof(TerrainChunkVertex);
+    std::vector<TerrainChunkVertex> vertices(packed.size() * m_parameters.vertices_per_chunk);
+    if (packed.empty()) {
+        return vertices;
+    }
+
+    auto [readback_buffer, readback_allocation] = gfx->createBuffer(
+        size,
+        vk::BufferUsageFlagBits::eStorageBuffer,
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+        "terrain generation readback"
+    );
+
+    const uint32_t frame_index = 0;
+    uint32_t queued = m_job_counts[frame_index];
+    m_job_counts[frame_index] = 0;
+    writeJobs(frame_index, packed);
+
+    vk::raii::CommandBuffer cb = gfx->beginOneShot();
+    recordDispatch(cb, frame_index, readback_buffer);
+    vk::MemoryBarrier2 to_host{
+        .srcStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+        .srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite,
+        .dstStageMask = vk::PipelineStageFlagBits2::eHost,
+        .dstAccessMask = vk::AccessFlagBits2::eHostRead,
+    };
+    cb.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(to_host));
+    gfx->endOneShot(std::move(cb));
+
+    VkResult rslt = vmaCopyAllocationToMemory(gfx->allocator(), readback_allocation, 0, vertices.data(), size);
+
+    // Whatever the frame had queued is gone with its jobs, and its set
+    // points at a buffer that's about to go.
+    m_job_counts[frame_index] = 0;
+    m_descriptor_vertex_buffers[frame_index] = nullptr;
+    vmaFreeMemory(gfx->allocator(), readback_allocation);
+    if (queued > 0) {
+        std::cerr << "Dropped " << queued << " queued terrain chunks to check generation\n";
+    }
+
+    if (rslt != VK_SUCCESS) {
+        throw std::runtime_error(
+            std::format(
+                "Failed to read back generated terrain chunks. Error code: {}",
+                vk::to_string(vk::Result(rslt))
+            )
+        );
+    }
+    return vertices;
+}
+
+void gfx::TerrainGenerator::addReloadJobs(const std::set<std::string> &shaders, std::vector<ReloadJob> &jobs) {
+    if (shaders.contains(TERRAIN_GENERATE_SHADER)) {
+        jobs.push_back([this](PipelineReload &reload) {
+            reload.add(&m_pipeline, createPipeline());
+        });
+    }
+}
+
+void gfx::TerrainGenerator::initNoiseBuffers(const TerrainNoiseTables &noise) {
+    ComputeContext *gfx = m_context;
+
+    if (noise.permutation.size() != 512 || noise.control_points.size() < 2 ||
+        noise.second_derivatives.size() != noise.control_points.size())
+    {
+        throw std::runtime_error("Terrain noise tables don't fit the generation shader");
+    }
+
+    std::tie(m_permutation_buffer, m_permutation_buffer_allocation) = gfx->createBufferWithData(
+        noise.permutation.data(), noise.permutation.size() * sizeof(uint32_t),
+        vk::BufferUsageFlagBits::eStorageBuffer, 0,
+        "terrain noise permutation"
+    );
+
+    std::vector<glm::vec4> spline;
+    spline.reserve(noise.control_points.size());
+    for (size_t i = 0; i < noise.control_points.size(); ++i) {
+        spline.emplace_back(noise.control_points[i].first, noise.control_points[i].second, noise.second_derivatives[i], 0.0);
+    }
+    std::tie(m_spline_buffer, m_spline_buffer_allocation) = gfx->createBufferWithData(
+        spline.data(), spline.size() * sizeof(glm::vec4),
+        vk::BufferUsageFlagBits::eStorageBuffer, 0,
+        "terrain noise spline"
+    );
+}
+
+void gfx::TerrainGenerator::initJobBuffers() {
+    ComputeContext *gfx = m_context;
+
+    // Rewritten every frame, so each frame in flight gets its own.
+    for (uint32_t i = 0; i < gfx->numFrames(); ++i) {
+        auto [job_buffer, job_allocation] = gfx->createBuffer(
+            std::max(m_chunks_per_frame, 1u) * sizeof(TerrainGenerateJob),
+            vk::BufferUsageFlagBits::eStorageBuffer,
+            VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+            "terrain generation job"
+        );
+        m_job_buffers.emplace_back(std::move(job_buffer));
+        m_job_buffer_allocations.push_back(job_allocation);
+    }
+    m_job_counts.assign(gfx->numFrames(), 0);
+}
+
+void gfx::TerrainGenerator::initPipeline() {
+    const vk::raii::Device &device = m_context->device();
+
+    // Permutation table, spline, jobs and vertices.
+    std::array<vk::DescriptorSetLayoutBinding, 4> bindings{};
+    for (uint32_t b = 0; b < bindings.size(); ++b) {
+        bindings[b] = vk::DescriptorSetLayoutBinding{
+            .binding = b,
+            .descriptorType = vk::DescriptorType::eStorageBuffer,
+            .descriptorCount = 1,
+            .stageFlags = vk::ShaderStageFlagBits::eCompute,
+        };
+    }
+    m_descriptor_set_layout = device.createDescriptorSetLayout(
+        vk::DescriptorSetLayoutCreateInfo{}.setBindings(bindings)
+    );
+
+    vk::PushConstantRange push_range{
+        .stageFlags = vk::ShaderStageFlagBits::eCompute,
+        .offset = 0,
+        .size = sizeof(TerrainGenerateParameters),
+    };
+    vk::PipelineLayoutCreateInfo pl_ci = vk::PipelineLayoutCreateInfo{}
+        .setSetLayouts(*m_descriptor_set_layout)
+        .setPushConstantRanges(push_range);
+    m_pipeline_layout = device.createPipelineLayout(pl_ci);
+
+    m_pipeline = createPipeline();
+}
+
+vk::raii::Pipeline gfx::TerrainGenerator::createPipeline() {
+    vk::raii::ShaderModule shader = m_context->shaders().createModule(m_context->device(), TERRAIN_GENERATE_SHADER);
+
+    vk::ComputePipelineCreateInfo cp_ci{
+        .stage = vk::PipelineShaderStageCreateInfo{
+            .stage = vk::ShaderStageFlagBits::eCompute,
+            .module = *shader,
+            .pName = "cs_main",
+        },
+        .layout = *m_pipeline_layout,
+    };
+    vk::raii::Pipeline pipeline = m_context->device().createComputePipeline(nullptr, cp_ci);
+    std::cerr << "Created terrain generation compute pipeline " << *pipeline << "\n";
+    return pipeline;
+}
+
+void gfx::TerrainGenerator::initDescriptorSets() {
+    ComputeContext *gfx = m_context;
+    const vk::raii::Device &device = gfx->device();
+    uint32_t num_sets = gfx->numFrames();
+
+    std::vector<vk::DescriptorSetLayout> layouts{num_sets, *m_descriptor_set_layout};
+    vk::DescriptorSetAllocateInfo ds_ai = vk::DescriptorSetAllocateInfo{
+        .descriptorPool = *gfx->descriptorPool(),
+    }.setSetLayouts(layouts);
+    m_descriptor_sets = device.allocateDescriptorSets(ds_ai);
+
+    // The vertex binding is filled in by recordDispatch().
+    m_descriptor_vertex_buffers.assign(num_sets, nullptr);
+
+    for (uint32_t i = 0; i < num_sets; ++i) {
+        std::array<vk::DescriptorBufferInfo, 3> buffer_infos{
+            vk::DescriptorBufferInfo{ .buffer = *m_permutation_buffer, .offset = 0, .range = vk::WholeSize },
+            vk::DescriptorBufferInfo{ .buffer = *m_spline_buffer, .offset = 0, .range = vk::WholeSize },
+            vk::DescriptorBufferInfo{ .buffer = *m_job_buffers[i], .offset = 0, .range = vk::WholeSize },
+        };
+
+        std::array<vk::WriteDescriptorSet, 3> writes{};
+        for (uint32_t b = 0; b < writes.size(); ++b) {
+            writes[b] = vk::WriteDescriptorSet{
+                .dstSet = *m_descriptor_sets[i],
+                .dstBinding = b,
+                .dstArrayElement = 0,
+                .descriptorType = vk::DescriptorType::eStorageBuffer,
+            }.setBufferInfo(buffer_infos[b]);
+        }
+
+        device.updateDescriptorSets(writes, {});
+    }
+}
+
+void gfx::TerrainGenerator::writeJobs(uint32_t frame_index, const std::vector<TerrainChunkGeneration> &chunks) {
+    ComputeContext *gfx = m_context;
+
+    // The frame's fence has been waited on, so its job memory is free.
+    uint32_t first = m_job_counts[frame_index];
+    uint32_t count = static_cast<uint32_t>(std::min<size_t>(chunks.size(), m_chunks_per_frame - first));
+    assert(count == chunks.size());
+    if (count == 0) {
+        return;
+    }
+
+    std::vector<TerrainGenerateJob> jobs(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        const TerrainChunkGeneration &chunk = chunks[i];
+        jobs[i] = TerrainGenerateJob{
+            .corners = {
+                glm::vec4{chunk.corners[0], 0.0f},
+                glm::vec4{chunk.corners[1], 0.0f},
+                glm::vec4{chunk.corners[2], 0.0f},
+            },
+            .slot = chunk.slot,
+            .error = chunk.error,
+            .padding = {0.0f, 0.0f},
+        };
+    }
+
+    VkResult rslt = vmaCopyMemoryToAllocation(
+        gfx->allocator(), jobs.data(), m_job_buffer_allocations[frame_index],
+        first * sizeof(TerrainGenerateJob), count * sizeof(TerrainGenerateJob)
+    );
+    if (rslt != VK_SUCCESS) {
+        throw std::runtime_error(
+            std::format(
+                "Failed to copy terrain generation jobs to their buffer. Error code: {}",
+                vk::to_string(vk::Result(rslt))
+            )
+        );
+    }
+    m_job_counts[frame_index] = first + count;
+}
+
+void gfx::TerrainGenerator::recordDispatch(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index, const vk::raii::Buffer &vertex_buffer) {
+    // This frame's set was last used by a frame whose fence has been waited
+    // on, so it can be rewritten.
+    if (m_descriptor_vertex_buffers[frame_index] != *vertex_buffer) {
+        vk::DescriptorBufferInfo vertex_info{
+            .buffer = *vertex_buffer,
+            .offset = 0,
+            .range = vk::WholeSize,
+        };
+        vk::WriteDescriptorSet write = vk::WriteDescriptorSet{
+            .dstSet = *m_descriptor_sets[frame_index],
+            .dstBinding = 3,
+            .dstArrayElement = 0,
+            .descriptorType = vk::DescriptorType::eStorageBuffer,
+        }.setBufferInfo(vertex_info);
+        m_context->device().updateDescriptorSets(write, {});
+        m_descriptor_vertex_buffers[frame_index] = *vertex_buffer;
+    }
+
+    TerrainGenerateParameters params = m_parameters;
+    params.chunk_count = m_job_counts[frame_index];
+
+    cmd_buf.bindPipeline(vk::PipelineBindPoint::eCompute, *m_pipeline);
+    cmd_buf.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *m_pipeline_layout, 0, *m_descriptor_sets[frame_index], nullptr);
+    cmd_buf.pushConstants<TerrainGenerateParameters>(*m_pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, params);
+    cmd_buf.dispatch(
+        (params.vertices_per_chunk + TERRAIN_GENERATE_WORKGROUP_SIZE - 1) / TERRAIN_GENERATE_WORKGROUP_SIZE,
+        params.chunk_count,
+        1
+    );
+}
+
+bool gfx::TerrainGenerationError::withinTolerance() const {
+    return position <= POSITION_TOLERANCE && normal <= NORMAL_TOLERANCE;
+}
+
+std::optional<gfx::TerrainGenerationError> gfx::compareTerrainGeneration(
+    const TerrainChunkGenerator &generator,
+    const TerrainGenerateNow &generate_now
+) {
+    std::vector<TerrainChunkKey> keys;
+    std::vector<TerrainChunkGeneration> chunks;
+    for (uint32_t face = 0; face < TerrainChunkGenerator::NUM_FACES; face += 6) {
+        TerrainChunkKey key{face, 0, 0};
+        for (uint32_t level = 0; level <= TerrainGenerationError::CHECK_LEVEL; ++level) {
+            if (level % 4 == 0) {
+                std::array<glm::vec3, 3> corners = generator.corners(key);
+                keys.push_back(key);
+                chunks.push_back(TerrainChunkGeneration{0, corners, generator.geometricError(corners)});
+            }
+            key = key.child((face + level) % 4);
+        }
+    }
+
+    std::vector<TerrainChunkVertex> gpu_vertices = generate_now(chunks);
+    uint32_t per_chunk = generator.verticesPerChunk();
+    if (gpu_vertices.size() != chunks.size() * per_chunk) {
+        return std::nullopt;
+    }
+
+    TerrainGenerationError error{0.0f, 0.0f, chunks.size()};
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        TerrainChunkData chunk = generator.generate(keys[i], chunks[i].corners);
+        for (uint32_t v = 0; v < per_chunk; ++v) {
+            const TerrainChunkVertex &cpu = chunk.vertices[v];
+            const TerrainChunkVertex &gpu = gpu_vertices[i * per_chunk + v];
+            error.position = std::max(error.position, glm::length(cpu.position - gpu.position));
+            float cos_angle = std::clamp(glm::dot(cpu.normal, gpu.normal), -1.0f, 1.0f);
+            error.normal = std::max(error.normal, glm::degrees(std::acos(cos_angle)));
+        }
+    }
+    return error;
+}
@@ -0,0 +1,154 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#ifndef _VPLANET_GFX_TERRAIN_GENERATOR_H_
+#define _VPLANET_GFX_TERRAIN_GENERATOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../glm.h"
+#include "../vulkan.h"
+#include "../VmaUsage.h"
+
+#include "../Noise.h"
+#include "../Terrain.h"
+#include "../TerrainChunks.h"
+#include "../TerrainLod.h"
+#include "Pipeline.h"
+
+namespace gfx {
+    class ComputeContext;
+
+    // Push constants for the chunk generation compute shader. The layout
+    // matches GenerateParameters in terrain_generate.slang.
+    struct TerrainGenerateParameters {
+        glm::vec4 scales; // xyz: the base noise's scales, w: planet radius
+        uint32_t octaves;
+        float persistence;
+        uint32_t control_points;
+        uint32_t resolution;
+        uint32_t grid_vertices;
+        uint32_t vertices_per_chunk;
+        uint32_t chunk_count;
+        float padding;
+    };
+
+    // A chunk to generate. The layout matches ChunkJob in
+    // terrain_generate.slang.
+    struct TerrainGenerateJob {
+        glm::vec4 corners[3];
+        uint32_t slot;
+        float error;
+        float padding[2];
+    };
+
+    // Generates LOD terrain chunks in a compute pass, as
+    // TerrainChunkGenerator does on the CPU, writing their vertices straight
+    // into the chunk pool's vertex buffer, so nothing but the chunks'
+    // corners crosses from the host. The noise's tables are uploaded once,
+    // at construction. Its single precision puts the vertices within
+    // rounding of the CPU's, and generateNow() is there to check that.
+    class TerrainGenerator {
+    public:
+        TerrainGenerator(
+            ComputeContext *context,
+            const TerrainNoiseTables &noise,
+            float radius,
+            uint32_t resolution,
+            uint32_t chunks_per_frame
+        );
+        TerrainGenerator(const TerrainGenerator &other) = delete;
+        TerrainGenerator(TerrainGenerator &&other) = delete;
+
+        ~TerrainGenerator();
+
+        TerrainGenerator &operator=(const TerrainGenerator &other) = delete;
+        TerrainGenerator &operator=(TerrainGenerator &&other) = delete;
+
+        uint32_t verticesPerChunk() const;
+        uint32_t chunksPerFrame() const;
+
+        // Queues chunks for the frame's recordCommands(), up to
+        // chunksPerFrame() of them.
+        void queueChunks(const std::vector<TerrainChunkGeneration> &chunks, uint32_t frame_index);
+        bool hasQueuedChunks(uint32_t frame_index) const;
+        // Generates the frame's queued chunks into their slots of the
+        // vertex buffer, which has to allow storage use. Barriers around
+        // it are left to the caller, which owns the buffer.
+        void recordCommands(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index, const vk::raii::Buffer &vertex_buffer);
+
+        // Generates chunks into a buffer the host can read, one after the
+        // other whatever their slots, and waits for their vertices. Waits
+        // for the device to go idle first, since it borrows the first
+        // frame's buffers, so it's only for checking against the CPU.
+        std::vector<TerrainChunkVertex> generateNow(const std::vector<TerrainChunkGeneration> &chunks);
+
+        // As Pipeline::addReloadJobs().
+        void addReloadJobs(const std::set<std::string> &shaders, std::vector<ReloadJob> &jobs);
+
+    private:
+        void initNoiseBuffers(const TerrainNoiseTables &noise);
+        void initJobBuffers();
+        void initPipeline();
+        vk::raii::Pipeline createPipeline();
+        void initDescriptorSets();
+        void writeJobs(uint32_t frame_index, const std::vector<TerrainChunkGeneration> &chunks);
+        void recordDispatch(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index, const vk::raii::Buffer &vertex_buffer);
+
+        ComputeContext *m_context;
+        TerrainGenerateParameters m_parameters;
+        uint32_t m_chunks_per_frame;
+
+        vk::raii::Buffer m_permutation_buffer, m_spline_buffer;
+        VmaAllocation m_permutation_buffer_allocation, m_spline_buffer_allocation;
+
+        // Per frame in flight: mapped job memory and how many it holds.
+        std::vector<vk::raii::Buffer> m_job_buffers;
+        std::vector<VmaAllocation> m_job_buffer_allocations;
+        std::vector<uint32_t> m_job_counts;
+
+        // Each frame's set is pointed at the vertex buffer when it's next
+        // used with another one.
+        vk::raii::DescriptorSetLayout m_descriptor_set_layout;
+        vk::raii::PipelineLayout m_pipeline_layout;
+        vk::raii::Pipeline m_pipeline;
+        std::vector<vk::raii::DescriptorSet> m_descriptor_sets;
+        std::vector<vk::Buffer> m_descriptor_vertex_buffers;
+    };
+
+    // How far chunks generated on the GPU are from the CPU's: the largest
+    // distance between positions in model space and angle between normals
+    // in degrees.
+    struct TerrainGenerationError {
+        // Checked on a few chunks down to this level. Further down, the
+        // normals' central differences are lost in the CPU's own rounding
+        // of the directions.
+        static constexpr uint32_t CHECK_LEVEL = 8;
+        static constexpr float POSITION_TOLERANCE = 1e-4f;
+        static constexpr float NORMAL_TOLERANCE = 0.5f;
+
+        float position;
+        float normal;
+        size_t chunks;
+
+        bool withinTolerance() const;
+    };
+
+    // Generates chunks one after the other, as TerrainGenerator::generateNow().
+    using TerrainGenerateNow = std::function<std::vector<TerrainChunkVertex>(const std::vector<TerrainChunkGeneration> &)>;
+
+    // Generates a chunk every few levels down a path from some of the faces
+    // both with the CPU's generator and generate_now, and compares them.
+    // Empty if generate_now didn't return every chunk's vertices.
+    std::optional<TerrainGenerationError> compareTerrainGeneration(
+        const TerrainChunkGenerator &generator,
+        const TerrainGenerateNow &generate_now
+    );
+}
+
+#endif
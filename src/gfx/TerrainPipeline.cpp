@@ -1,126 +1,1054 @@
 // -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
 
+#include <algorithm>
 #include <array>
+#include <cassert>
+#include <cstddef>
 #include <cstring>
+#include <format>
+#include <iostream>
+#include <limits>
+#include <set>
+#include <span>
 #include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
 #include <vector>
 
+#include "../glm.h"
 #include "../vulkan.h"
 #include "../VmaUsage.h"
 
+#include "../Culling.h"
 #include "Pipeline.h"
 #include "Renderer.h"
 #include "Resource.h"
+#include "ShaderLibrary.h"
 #include "System.h"
 #include "Uniforms.h"
 
-const std::vector<unsigned char> &TERRAIN_SLANG_SHADER_BYTECODE = LOAD_RESOURCE(terrain_slang_spv);
-const std::vector<unsigned char> &TERRAIN_GLSL_VERTEX_SHADER_BYTECODE = LOAD_RESOURCE(terrain_vert_spv);
-const std::vector<unsigned char> &TERRAIN_GLSL_FRAGMENT_SHADER_BYTECODE = LOAD_RESOURCE(terrain_frag_spv);
+const char *TERRAIN_SHADER = "terrain.slang.spv";
+const char *TERRAIN_CULL_SHADER = "terrain_cull.slang.spv";
+const char *TERRAIN_MESH_SHADER = "terrain_mesh.slang.spv";
+const char *TERRAIN_SHADOW_SHADER = "terrain_shadow.slang.spv";
+const std::span<const std::byte> TERRAIN_GLSL_VERTEX_SHADER_BYTECODE = LOAD_RESOURCE(terrain_vert_spv);
+const std::span<const std::byte> TERRAIN_GLSL_FRAGMENT_SHADER_BYTECODE = LOAD_RESOURCE(terrain_frag_spv);
+
+// Must match numthreads in terrain_cull.slang.
+const uint32_t TERRAIN_CULL_WORKGROUP_SIZE = 64;
+
+// Must match TASK_GROUP_SIZE in terrain_mesh.slang.
+const uint32_t TERRAIN_MESH_TASK_GROUP_SIZE = 32;
+
+// The mesh shader reads vertices as five words each.
+static_assert(sizeof(CompactTerrainVertex) == 5 * sizeof(uint32_t));
 
 gfx::TerrainPipeline::TerrainPipeline()
 : Pipeline{},
+  m_depth_pipeline{nullptr},
+  m_chunk_depth_pipeline{nullptr},
+  m_shadow_pipeline_layout{nullptr},
+  m_shadow_pipeline{nullptr},
+  m_chunk_shadow_pipeline{nullptr},
+  m_geometry_generation{0},
   m_uniform_set{},
-  m_num_indices{0},
-  m_vertex_buffer{nullptr},
-  m_index_buffer{nullptr},
-  m_vertex_buffer_allocation{nullptr},
-  m_index_buffer_allocation{nullptr}
+  m_meshes{},
+  m_level_copies{},
+  m_retired_buffers{},
+  m_level{0},
+  m_draw_parameters{std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), 0.0f, 0.0f},
+  m_cull_mode{CullMode::eGpu},
+  m_num_patches_drawn{0},
+  m_visible_ranges{},
+  m_cull_descriptor_set_layout{nullptr},
+  m_cull_pipeline_layout{nullptr},
+  m_cull_pipeline{nullptr},
+  m_cull_descriptor_sets{},
+  m_cull_descriptor_levels{},
+  m_draw_capacity{0},
+  m_draw_buffers{},
+  m_draw_count_buffers{},
+  m_draw_buffer_allocations{},
+  m_draw_count_buffer_allocations{},
+  m_mesh_descriptor_set_layout{nullptr},
+  m_mesh_pipeline_layout{nullptr},
+  m_mesh_pipelines{},
+  m_mesh_descriptor_sets{},
+  m_mesh_descriptor_levels{},
+  m_meshlet_count_buffers{},
+  m_meshlet_count_buffer_allocations{},
+  m_chunk_pipelines{},
+  m_chunks_enabled{false},
+  m_chunk_vertices{0},
+  m_chunk_indices{0},
+  m_chunk_capacity{0},
+  m_chunk_uploads_per_frame{0},
+  m_chunk_vertex_buffer{nullptr},
+  m_chunk_index_type{vk::IndexType::eUint32},
+  m_chunk_index_buffer{nullptr},
+  m_chunk_vertex_buffer_allocation{nullptr},
+  m_chunk_index_buffer_allocation{nullptr},
+  m_chunk_draws{},
+  m_chunk_shadow_casters{},
+  m_chunk_staging_buffers{},
+  m_chunk_staging_allocations{},
+  m_chunk_copies{},
+  m_chunk_generator{}
 {}  
 
 gfx::TerrainPipeline::TerrainPipeline(Renderer *renderer) : TerrainPipeline() {
     m_renderer = renderer;
     m_uniform_set = ModelUniformSet(&m_renderer->system()->uniforms());
+    m_level_copies.resize(m_renderer->system()->numFrames());
     initPipeline();
+    initShadowPipeline();
+    initCullPipeline();
+    if (meshShadingSupported()) {
+        initMeshPipeline();
+        initMeshBuffers();
+    }
+    if (!gpuCullingSupported()) {
+        m_cull_mode = CullMode::eCpu;
+    }
 }
 
 gfx::TerrainPipeline::~TerrainPipeline() {
     if (m_renderer != nullptr) {
-        if (m_vertex_buffer_allocation != nullptr) {
-            vmaFreeMemory(m_renderer->system()->allocator(), m_vertex_buffer_allocation);
-            m_vertex_buffer_allocation = nullptr;
+        for (auto &[level, mesh] : m_meshes) {
+            freeMesh(mesh);
         }
-
-        if (m_index_buffer_allocation != nullptr) {
-            vmaFreeMemory(m_renderer->system()->allocator(), m_index_buffer_allocation);
-            m_index_buffer_allocation = nullptr;
+        VmaAllocator allocator = m_renderer->system()->allocator();
+        for (auto &copies : m_level_copies) {
+            for (StagedCopy &copy : copies) {
+                vmaFreeMemory(allocator, copy.staging_allocation);
+            }
         }
+        for (auto &[frames, retired] : m_retired_buffers) {
+            freeRetired(retired);
+        }
+
+        freeCullBuffers();
+        freeMeshBuffers();
+        freeChunkBuffers();
     }
 }
 
-void gfx::TerrainPipeline::setGeometry(const std::vector<TerrainVertex> &verts, const std::vector<uint32_t> &indices) {
+void gfx::TerrainPipeline::setGeometry(
+    uint32_t level,
+    std::span<const CompactTerrainVertex> verts,
+    const std::vector<uint32_t> &indices,
+    const ShortElements *short_indices,
+    const std::vector<TerrainPatch> &patches,
+    const Meshlets &meshlets,
+    float min_radius,
+    float max_radius,
+    uint32_t frame_index
+) {
     System *gfx = m_renderer->system();
+    std::vector<StagedCopy> &copies = m_level_copies[frame_index];
 
-    if (m_vertex_buffer_allocation != nullptr) {
-        vmaFreeMemory(m_renderer->system()->allocator(), m_vertex_buffer_allocation);
-        m_vertex_buffer_allocation = nullptr;
+    // Frames in flight may still be drawing a level being replaced, or
+    // from the draw buffers being outgrown, so those are retired rather
+    // than freed. The replaced level's index buffer is held on to with
+    // them, so the new one shares it rather than uploading it again.
+    bool replacing = m_meshes.contains(level);
+    bool grow_draws = gpuCullingSupported() && patches.size() > m_draw_capacity;
+    if (replacing) {
+        retireMesh(m_meshes.at(level));
+        m_meshes.erase(level);
     }
-
-    if (m_index_buffer_allocation != nullptr) {
-        vmaFreeMemory(m_renderer->system()->allocator(), m_index_buffer_allocation);
-        m_index_buffer_allocation = nullptr;
+    if (grow_draws) {
+        retireCullBuffers();
+        initCullBuffers(static_cast<uint32_t>(patches.size()));
     }
 
-    std::tie(m_vertex_buffer, m_vertex_buffer_allocation) = gfx->createBufferWithData(
-        verts.data(), verts.size() * sizeof(TerrainVertex),
-        vk::BufferUsageFlagBits::eVertexBuffer, 0,
-        "terrain vertex"
-    );
+    Mesh mesh{
+        .vertex_buffer = nullptr,
+        .patch_buffer = nullptr,
+        .vertex_buffer_allocation = nullptr,
+        .patch_buffer_allocation = nullptr,
+        .index_buffer = short_indices != nullptr
+            ? gfx->topologies().icosphereIndices(level, *short_indices, &copies)
+            : gfx->topologies().icosphereIndices(level, indices, &copies),
+        .patches = patches,
+        .meshlet_buffer = nullptr,
+        .meshlet_vertex_buffer = nullptr,
+        .meshlet_triangle_buffer = nullptr,
+        .meshlet_buffer_allocation = nullptr,
+        .meshlet_vertex_buffer_allocation = nullptr,
+        .meshlet_triangle_buffer_allocation = nullptr,
+        .num_meshlets = 0,
+        .occluder_radius = min_radius,
+        .max_radius = 0.0f,
+        .min_vertex_radius = min_radius,
+        .vertex_radius_range = max_radius - min_radius,
+    };
 
-    std::tie(m_index_buffer, m_index_buffer_allocation) = gfx->createBufferWithData(
-        indices.data(), indices.size() * sizeof(uint32_t),
-        vk::BufferUsageFlagBits::eIndexBuffer, 0,
-        "terrain index"
+    // The mesh shaders fetch the vertices themselves.
+    vk::BufferUsageFlags vertex_usage = vk::BufferUsageFlagBits::eVertexBuffer;
+    if (meshShadingSupported()) {
+        vertex_usage |= vk::BufferUsageFlagBits::eStorageBuffer;
+    }
+    std::tie(mesh.vertex_buffer, mesh.vertex_buffer_allocation) = gfx->createBufferWithStagedData(
+        verts.data(), verts.size() * sizeof(CompactTerrainVertex),
+        vertex_usage, 0,
+        "terrain vertex", copies
     );
 
-    m_num_indices = static_cast<uint32_t>(indices.size());
+    for (const TerrainPatch &patch : patches) {
+        mesh.max_radius = std::max(mesh.max_radius, glm::length(patch.center) + patch.radius);
+    }
+
+    if (gpuCullingSupported() && !patches.empty()) {
+        std::tie(mesh.patch_buffer, mesh.patch_buffer_allocation) = gfx->createBufferWithStagedData(
+            patches.data(), patches.size() * sizeof(TerrainPatch),
+            vk::BufferUsageFlagBits::eStorageBuffer, 0,
+            "terrain patch", copies
+        );
+    }
+
+    if (meshShadingSupported() && !meshlets.meshlets.empty()) {
+        std::tie(mesh.meshlet_buffer, mesh.meshlet_buffer_allocation) = gfx->createBufferWithStagedData(
+            meshlets.meshlets.data(), meshlets.meshlets.size() * sizeof(Meshlet),
+            vk::BufferUsageFlagBits::eStorageBuffer, 0,
+            "terrain meshlet", copies
+        );
+        std::tie(mesh.meshlet_vertex_buffer, mesh.meshlet_vertex_buffer_allocation) = gfx->createBufferWithStagedData(
+            meshlets.vertices.data(), meshlets.vertices.size() * sizeof(uint32_t),
+            vk::BufferUsageFlagBits::eStorageBuffer, 0,
+            "terrain meshlet vertex", copies
+        );
+        std::tie(mesh.meshlet_triangle_buffer, mesh.meshlet_triangle_buffer_allocation) = gfx->createBufferWithStagedData(
+            meshlets.triangles.data(), meshlets.triangles.size() * sizeof(uint32_t),
+            vk::BufferUsageFlagBits::eStorageBuffer, 0,
+            "terrain meshlet triangle", copies
+        );
+        mesh.num_meshlets = static_cast<uint32_t>(meshlets.meshlets.size());
+    }
+
+    if (m_meshes.empty() || level == m_level) {
+        ++m_geometry_generation;
+    }
+    if (m_meshes.empty()) {
+        m_level = level;
+    }
+    m_meshes.emplace(level, std::move(mesh));
+
+    // Anything bound to the replaced mesh's buffers is stale.
+    if (replacing) {
+        std::ranges::fill(m_cull_descriptor_levels, UINT32_MAX);
+        std::ranges::fill(m_mesh_descriptor_levels, UINT32_MAX);
+    }
+}
+
+bool gfx::TerrainPipeline::hasLevel(uint32_t level) const {
+    return m_meshes.contains(level);
+}
+
+uint32_t gfx::TerrainPipeline::level() const {
+    return m_level;
+}
+
+void gfx::TerrainPipeline::setLevel(uint32_t level) {
+    if (m_meshes.contains(level) && level != m_level) {
+        m_level = level;
+        ++m_geometry_generation;
+    }
+}
+
+void gfx::TerrainPipeline::setMorphRange(float start, float end) {
+    m_draw_parameters.morph_start = start;
+    m_draw_parameters.morph_end = end;
 }
 
 void gfx::TerrainPipeline::setTransform(const glm::mat4x4 &xform) {
     m_uniform_set.setTransform(xform);
 }
 
+const glm::mat4x4 &gfx::TerrainPipeline::transform() const {
+    return m_uniform_set.transform();
+}
+
 void gfx::TerrainPipeline::writeTransform(uint32_t buffer_index) {
     m_uniform_set.updateModelBuffer(buffer_index);
 }
 
-void gfx::TerrainPipeline::recordCommands(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index) {
+gfx::CullMode gfx::TerrainPipeline::cullMode() const {
+    return m_cull_mode;
+}
+
+void gfx::TerrainPipeline::setCullMode(CullMode mode) {
+    if (mode == CullMode::eMesh && !meshShadingSupported()) {
+        mode = CullMode::eGpu;
+    }
+    if (mode == CullMode::eGpu && !gpuCullingSupported()) {
+        mode = CullMode::eCpu;
+    }
+    m_cull_mode = mode;
+}
+
+bool gfx::TerrainPipeline::cullModeSupported(CullMode mode) const {
+    switch (mode) {
+    case CullMode::eGpu:
+        return gpuCullingSupported();
+    case CullMode::eMesh:
+        return meshShadingSupported();
+    default:
+        return true;
+    }
+}
+
+bool gfx::TerrainPipeline::gpuCullingSupported() const {
+    const DeviceCapabilities &caps = m_renderer->system()->capabilities();
+    return caps.draw_indirect_count && caps.multi_draw_indirect;
+}
+
+bool gfx::TerrainPipeline::meshShadingSupported() const {
+    return m_renderer->system()->capabilities().mesh_shader;
+}
+
+uint32_t gfx::TerrainPipeline::numPatches() const {
+    const Mesh *mesh = currentMesh();
+    if (mesh == nullptr) {
+        return 0;
+    }
+    return m_cull_mode == CullMode::eMesh ? mesh->num_meshlets : static_cast<uint32_t>(mesh->patches.size());
+}
+
+uint32_t gfx::TerrainPipeline::numPatchesDrawn() const {
+    return m_num_patches_drawn;
+}
+
+void gfx::TerrainPipeline::setChunkTopology(
+    const std::vector<uint32_t> &indices,
+    uint32_t vertices_per_chunk,
+    uint32_t capacity,
+    uint32_t uploads_per_frame
+) {
+    System *gfx = m_renderer->system();
+
+    // The generator's descriptor sets may point at the old vertex buffer,
+    // and its chunks may not be the new size, so the noise is given again.
+    m_chunk_generator.reset();
+    freeChunkBuffers();
+
+    // Every chunk is drawn with its slot as the base vertex, so the indices
+    // only have to reach across one chunk.
+    if (vertices_per_chunk <= std::numeric_limits<uint16_t>::max() + 1) {
+        std::vector<uint16_t> short_indices(indices.begin(), indices.end());
+        m_chunk_index_type = vk::IndexType::eUint16;
+        std::tie(m_chunk_index_buffer, m_chunk_index_buffer_allocation) = gfx->createBufferWithData(
+            short_indices.data(), short_indices.size() * sizeof(uint16_t),
+            vk::BufferUsageFlagBits::eIndexBuffer, 0,
+            "terrain chunk index"
+        );
+    } else {
+        m_chunk_index_type = vk::IndexType::eUint32;
+        std::tie(m_chunk_index_buffer, m_chunk_index_buffer_allocation) = gfx->createBufferWithData(
+            indices.data(), indices.size() * sizeof(uint32_t),
+            vk::BufferUsageFlagBits::eIndexBuffer, 0,
+            "terrain chunk index"
+        );
+    }
+
+    std::tie(m_chunk_vertex_buffer, m_chunk_vertex_buffer_allocation) = gfx->createBuffer(
+        static_cast<vk::DeviceSize>(capacity) * vertices_per_chunk * sizeof(TerrainChunkVertex),
+        vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+        0,
+        "terrain chunk vertex"
+    );
+
+    m_chunk_vertices = vertices_per_chunk;
+    m_chunk_indices = static_cast<uint32_t>(indices.size());
+    m_chunk_capacity = capacity;
+    m_chunk_uploads_per_frame = uploads_per_frame;
+    m_chunk_draws.clear();
+    m_chunk_shadow_casters.clear();
+
+    for (uint32_t i = 0; i < gfx->numFrames(); ++i) {
+        auto [staging_buffer, staging_allocation] = gfx->createBuffer(
+            static_cast<vk::DeviceSize>(uploads_per_frame) * vertices_per_chunk * sizeof(TerrainChunkVertex),
+            vk::BufferUsageFlagBits::eTransferSrc,
+            VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+            "terrain chunk staging"
+        );
+        m_chunk_staging_buffers.emplace_back(std::move(staging_buffer));
+        m_chunk_staging_allocations.push_back(staging_allocation);
+    }
+    m_chunk_copies.resize(gfx->numFrames());
+}
+
+void gfx::TerrainPipeline::uploadChunks(const std::vector<TerrainChunkUpload> &uploads, uint32_t frame_index) {
+    System *gfx = m_renderer->system();
+    vk::DeviceSize chunk_size = m_chunk_vertices * sizeof(TerrainChunkVertex);
+    std::vector<vk::BufferCopy> &copies = m_chunk_copies[frame_index];
+
+    // The frame's fence has been waited on, so its staging memory is free.
+    assert(copies.size() + uploads.size() <= m_chunk_uploads_per_frame);
+    for (const TerrainChunkUpload &upload : uploads) {
+        assert(upload.slot < m_chunk_capacity && upload.vertices.size() == m_chunk_vertices);
+        if (copies.size() >= m_chunk_uploads_per_frame) {
+            break;
+        }
+
+        vk::DeviceSize offset = copies.size() * chunk_size;
+        VkResult rslt = vmaCopyMemoryToAllocation(
+            gfx->allocator(), upload.vertices.data(), m_chunk_staging_allocations[frame_index], offset, chunk_size
+        );
+        if (rslt != VK_SUCCESS) {
+            throw std::runtime_error(
+                std::format(
+                    "Failed to copy terrain chunk to the staging buffer. Error code: {}",
+                    vk::to_string(vk::Result(rslt))
+                )
+            );
+        }
+
+        copies.push_back(vk::BufferCopy{
+            .srcOffset = offset,
+            .dstOffset = upload.slot * chunk_size,
+            .size = chunk_size,
+        });
+    }
+    if (!uploads.empty()) {
+        ++m_geometry_generation;
+    }
+}
+
+void gfx::TerrainPipeline::setChunkNoise(const TerrainNoiseTables &noise, float radius, uint32_t resolution) {
+    m_chunk_generator = std::make_unique<TerrainGenerator>(m_renderer->system(), noise, radius, resolution, m_chunk_uploads_per_frame);
+    if (m_chunk_generator->verticesPerChunk() != m_chunk_vertices) {
+        m_chunk_generator.reset();
+        throw std::runtime_error(std::format("Terrain chunks of resolution {} don't fit the chunk topology", resolution));
+    }
+}
+
+bool gfx::TerrainPipeline::chunkGenerationSupported() const {
+    return m_chunk_generator != nullptr;
+}
+
+void gfx::TerrainPipeline::generateChunks(const std::vector<TerrainChunkGeneration> &chunks, uint32_t frame_index) {
+    if (chunks.empty()) {
+        return;
+    }
+    assert(m_chunk_generator != nullptr);
+    assert(m_chunk_copies[frame_index].size() + chunks.size() <= m_chunk_uploads_per_frame);
+    m_chunk_generator->queueChunks(chunks, frame_index);
+    ++m_geometry_generation;
+}
+
+std::vector<TerrainChunkVertex> gfx::TerrainPipeline::generateChunksNow(const std::vector<TerrainChunkGeneration> &chunks) {
+    assert(m_chunk_generator != nullptr);
+    return m_chunk_generator->generateNow(chunks);
+}
+
+void gfx::TerrainPipeline::setChunkDraws(const std::vector<uint32_t> &slots) {
+    m_chunk_draws = slots;
+}
+
+void gfx::TerrainPipeline::setChunkShadowCasters(const std::vector<TerrainShadowCaster> &casters) {
+    if (casters != m_chunk_shadow_casters) {
+        m_chunk_shadow_casters = casters;
+        ++m_geometry_generation;
+    }
+}
+
+bool gfx::TerrainPipeline::chunksEnabled() const {
+    return m_chunks_enabled;
+}
+
+void gfx::TerrainPipeline::setChunksEnabled(bool enabled) {
+    enabled = enabled && m_chunk_capacity > 0;
+    if (enabled != m_chunks_enabled) {
+        m_chunks_enabled = enabled;
+        ++m_geometry_generation;
+    }
+}
+
+uint32_t gfx::TerrainPipeline::numChunksDrawn() const {
+    return m_chunks_enabled ? static_cast<uint32_t>(m_chunk_draws.size()) : 0;
+}
+
+void gfx::TerrainPipeline::recordUploads(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index) {
+    // As in Renderer::reloadShaders(), once every frame has been recorded
+    // again, the retired buffers are out of use.
+    for (auto &[frames, retired] : m_retired_buffers) {
+        if (--frames == 0) {
+            freeRetired(retired);
+        }
+    }
+    std::erase_if(m_retired_buffers, [](const auto &retired) {
+        return retired.first == 0;
+    });
+
+    bool level_copies = !m_level_copies.empty() && !m_level_copies[frame_index].empty();
+    bool copies = !m_chunk_copies.empty() && !m_chunk_copies[frame_index].empty();
+    bool generated = m_chunk_generator != nullptr && m_chunk_generator->hasQueuedChunks(frame_index);
+    if (!level_copies && !copies && !generated) {
+        return;
+    }
+
+    // A slot being refilled may still be drawn by the previous frame. The
+    // copies and the generated chunks go to different slots, so they don't
+    // wait on each other, and the levels' buffers are new.
+    vk::MemoryBarrier2 before_copy{
+        .srcStageMask = vk::PipelineStageFlagBits2::eVertexAttributeInput,
+        .srcAccessMask = vk::AccessFlagBits2::eVertexAttributeRead,
+        .dstStageMask = vk::PipelineStageFlagBits2::eTransfer | vk::PipelineStageFlagBits2::eComputeShader,
+        .dstAccessMask = vk::AccessFlagBits2::eTransferWrite | vk::AccessFlagBits2::eShaderStorageWrite,
+    };
+    cmd_buf.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(before_copy));
+
+    if (level_copies) {
+        // The staging buffers are kept until this frame is done with them.
+        RetiredBuffers staging{};
+        for (StagedCopy &copy : m_level_copies[frame_index]) {
+            cmd_buf.copyBuffer(*copy.staging_buffer, copy.dst, vk::BufferCopy{
+                .srcOffset = 0,
+                .dstOffset = 0,
+                .size = copy.size,
+            });
+            staging.buffers.push_back(std::move(copy.staging_buffer));
+            staging.allocations.push_back(copy.staging_allocation);
+        }
+        m_level_copies[frame_index].clear();
+        retire(std::move(staging));
+    }
+    if (copies) {
+        cmd_buf.copyBuffer(*m_chunk_staging_buffers[frame_index], *m_chunk_vertex_buffer, m_chunk_copies[frame_index]);
+        m_chunk_copies[frame_index].clear();
+    }
+    if (generated) {
+        m_chunk_generator->recordCommands(cmd_buf, frame_index, m_chunk_vertex_buffer);
+    }
+
+    vk::MemoryBarrier2 after_copy{
+        .srcStageMask = vk::PipelineStageFlagBits2::eTransfer | vk::PipelineStageFlagBits2::eComputeShader,
+        .srcAccessMask = vk::AccessFlagBits2::eTransferWrite | vk::AccessFlagBits2::eShaderStorageWrite,
+        .dstStageMask = vk::PipelineStageFlagBits2::eVertexAttributeInput,
+        .dstAccessMask = vk::AccessFlagBits2::eVertexAttributeRead,
+    };
+    if (level_copies) {
+        // A new level's indices, and the patches and meshlets the culling
+        // reads, besides its vertices.
+        after_copy.dstStageMask |= vk::PipelineStageFlagBits2::eIndexInput | vk::PipelineStageFlagBits2::eComputeShader;
+        after_copy.dstAccessMask |= vk::AccessFlagBits2::eIndexRead | vk::AccessFlagBits2::eShaderStorageRead;
+        if (meshShadingSupported()) {
+            after_copy.dstStageMask |= vk::PipelineStageFlagBits2::eTaskShaderEXT | vk::PipelineStageFlagBits2::eMeshShaderEXT;
+        }
+    }
+    cmd_buf.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(after_copy));
+}
+
+void gfx::TerrainPipeline::recordCulling(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index) {
+    // Chunks are culled as they are selected.
+    if (m_chunks_enabled) {
+        m_num_patches_drawn = 0;
+        return;
+    }
+
+    const Mesh *mesh = currentMesh();
+    if (mesh != nullptr && m_cull_mode == CullMode::eMesh && mesh->num_meshlets > 0) {
+        prepareMeshlets(cmd_buf, frame_index, *mesh);
+        return;
+    }
+    if (mesh == nullptr || m_cull_mode == CullMode::eNone || mesh->patches.empty()) {
+        m_num_patches_drawn = numPatches();
+        return;
+    }
+
+    // Cull in model space, so that the patch bounds can stay static.
+    const ViewProjectionTransform &vp = m_renderer->viewProjectionTransform();
+    Frustum frustum = extractFrustum(vp.projection * vp.view * m_uniform_set.transform());
+    glm::vec3 eye = modelSpaceEye();
+
+    if (m_cull_mode == CullMode::eGpu) {
+        cullOnGpu(cmd_buf, frame_index, *mesh, eye, frustum);
+    } else {
+        cullOnCpu(*mesh, eye, frustum);
+    }
+}
+
+void gfx::TerrainPipeline::recordReadback(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index) {
+    if (m_chunks_enabled || m_cull_mode != CullMode::eMesh || m_meshlet_count_buffers.empty()) {
+        return;
+    }
+
+    // The compute culling path does this after its dispatch, but the task
+    // shaders run inside the rendering pass.
+    vk::MemoryBarrier2 count_barrier{
+        .srcStageMask = vk::PipelineStageFlagBits2::eTaskShaderEXT,
+        .srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite,
+        .dstStageMask = vk::PipelineStageFlagBits2::eHost,
+        .dstAccessMask = vk::AccessFlagBits2::eHostRead,
+    };
+    cmd_buf.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(count_barrier));
+}
+
+const gfx::TerrainPipeline::Mesh *gfx::TerrainPipeline::currentMesh() const {
+    auto it = m_meshes.find(m_level);
+    return it == m_meshes.end() ? nullptr : &it->second;
+}
+
+glm::vec3 gfx::TerrainPipeline::modelSpaceEye() const {
+    const ViewProjectionTransform &vp = m_renderer->viewProjectionTransform();
+    glm::vec4 eye4 = glm::inverse(m_uniform_set.transform()) * vp.view_inv * glm::vec4{0.0f, 0.0f, 0.0f, 1.0f};
+    return glm::vec3{eye4} / eye4.w;
+}
+
+void gfx::TerrainPipeline::freeMesh(Mesh &mesh) {
+    VmaAllocator allocator = m_renderer->system()->allocator();
+
+    for (VmaAllocation *alloc : {
+        &mesh.vertex_buffer_allocation, &mesh.patch_buffer_allocation,
+        &mesh.meshlet_buffer_allocation, &mesh.meshlet_vertex_buffer_allocation, &mesh.meshlet_triangle_buffer_allocation,
+    }) {
+        if (*alloc != nullptr) {
+            vmaFreeMemory(allocator, *alloc);
+            *alloc = nullptr;
+        }
+    }
+    mesh.vertex_buffer = nullptr;
+    mesh.patch_buffer = nullptr;
+    mesh.meshlet_buffer = nullptr;
+    mesh.meshlet_vertex_buffer = nullptr;
+    mesh.meshlet_triangle_buffer = nullptr;
+    mesh.index_buffer.reset();
+}
+
+void gfx::TerrainPipeline::retireMesh(Mesh &mesh) {
+    RetiredBuffers retired{};
+    for (auto [buffer, alloc] : {
+        std::pair{&mesh.vertex_buffer, &mesh.vertex_buffer_allocation},
+        std::pair{&mesh.patch_buffer, &mesh.patch_buffer_allocation},
+        std::pair{&mesh.meshlet_buffer, &mesh.meshlet_buffer_allocation},
+        std::pair{&mesh.meshlet_vertex_buffer, &mesh.meshlet_vertex_buffer_allocation},
+        std::pair{&mesh.meshlet_triangle_buffer, &mesh.meshlet_triangle_buffer_allocation},
+    }) {
+        if (*alloc != nullptr) {
+            retired.buffers.push_back(std::move(*buffer));
+            retired.allocations.push_back(*alloc);
+            *alloc = nullptr;
+        }
+        *buffer = nullptr;
+    }
+    retired.index_buffer = std::move(mesh.index_buffer);
+    retire(std::move(retired));
+}
+
+void gfx::TerrainPipeline::retire(RetiredBuffers &&retired) {
+    m_retired_buffers.emplace_back(m_renderer->system()->numFrames(), std::move(retired));
+}
+
+void gfx::TerrainPipeline::freeRetired(RetiredBuffers &retired) {
+    VmaAllocator allocator = m_renderer->system()->allocator();
+    for (VmaAllocation alloc : retired.allocations) {
+        vmaFreeMemory(allocator, alloc);
+    }
+    retired.allocations.clear();
+    retired.buffers.clear();
+    retired.index_buffer.reset();
+}
+
+void gfx::TerrainPipeline::cullOnCpu(const Mesh &mesh, const glm::vec3 &eye, const Frustum &frustum) {
+    m_visible_ranges.clear();
+    m_num_patches_drawn = 0;
+
+    for (const TerrainPatch &patch : mesh.patches) {
+        if (!sphereInFrustum(frustum, patch.center, patch.radius) ||
+            sphereBelowHorizon(eye, mesh.occluder_radius, mesh.max_radius, patch.center, patch.radius) ||
+            coneBackFacing(eye, patch.center, patch.radius, patch.cone_axis, patch.cone_cutoff))
+        {
+            continue;
+        }
+
+        ++m_num_patches_drawn;
+        uint32_t base_vertex = static_cast<uint32_t>(patch.vertex_offset);
+        if (!m_visible_ranges.empty() &&
+            m_visible_ranges.back().first_element + m_visible_ranges.back().element_count == patch.first_index &&
+            m_visible_ranges.back().base_vertex == base_vertex)
+        {
+            m_visible_ranges.back().element_count += patch.index_count;
+        } else {
+            m_visible_ranges.push_back({ patch.first_index, patch.index_count, base_vertex });
+        }
+    }
+}
+
+void gfx::TerrainPipeline::cullOnGpu(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index, const Mesh &mesh, const glm::vec3 &eye, const Frustum &frustum) {
+    System *gfx = m_renderer->system();
+    uint32_t num_patches = static_cast<uint32_t>(mesh.patches.size());
+
+    // The fence for this frame has been waited on, so the count from the
+    // last time this frame's buffers were used is ready.
+    VkResult rslt = vmaCopyAllocationToMemory(
+        gfx->allocator(),
+        m_draw_count_buffer_allocations[frame_index],
+        0, &m_num_patches_drawn, sizeof(uint32_t)
+    );
+    if (rslt != VK_SUCCESS) {
+        m_num_patches_drawn = num_patches;
+    }
+
+    // This frame's set was last used by a frame whose fence has been waited
+    // on, so it can be rewritten.
+    if (m_cull_descriptor_levels[frame_index] != m_level) {
+        std::array<vk::DescriptorBufferInfo, 3> buffer_infos{
+            vk::DescriptorBufferInfo{ .buffer = *mesh.patch_buffer, .offset = 0, .range = vk::WholeSize },
+            vk::DescriptorBufferInfo{ .buffer = *m_draw_buffers[frame_index], .offset = 0, .range = vk::WholeSize },
+            vk::DescriptorBufferInfo{ .buffer = *m_draw_count_buffers[frame_index], .offset = 0, .range = vk::WholeSize },
+        };
+
+        std::array<vk::WriteDescriptorSet, 3> writes{};
+        for (uint32_t b = 0; b < writes.size(); ++b) {
+            writes[b] = vk::WriteDescriptorSet{
+                .dstSet = *m_cull_descriptor_sets[frame_index],
+                .dstBinding = b,
+                .dstArrayElement = 0,
+                .descriptorType = vk::DescriptorType::eStorageBuffer,
+            }.setBufferInfo(buffer_infos[b]);
+        }
+        gfx->device().updateDescriptorSets(writes, {});
+        m_cull_descriptor_levels[frame_index] = m_level;
+    }
+
+    TerrainCullParameters params{};
+    for (size_t i = 0; i < frustum.planes.size(); ++i) {
+        params.frustum_planes[i] = frustum.planes[i];
+    }
+    params.eye = glm::vec4{eye, mesh.occluder_radius};
+    params.max_radius = mesh.max_radius;
+    params.patch_count = num_patches;
+
+    const vk::raii::Buffer &count_buffer = m_draw_count_buffers[frame_index];
+
+    cmd_buf.fillBuffer(*count_buffer, 0, sizeof(uint32_t), 0);
+
+    vk::MemoryBarrier2 clear_barrier{
+        .srcStageMask = vk::PipelineStageFlagBits2::eTransfer,
+        .srcAccessMask = vk::AccessFlagBits2::eTransferWrite,
+        .dstStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+        .dstAccessMask = vk::AccessFlagBits2::eShaderStorageRead | vk::AccessFlagBits2::eShaderStorageWrite,
+    };
+    cmd_buf.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(clear_barrier));
+
+    cmd_buf.bindPipeline(vk::PipelineBindPoint::eCompute, *m_cull_pipeline);
+    cmd_buf.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *m_cull_pipeline_layout, 0, *m_cull_descriptor_sets[frame_index], nullptr);
+    cmd_buf.pushConstants<TerrainCullParameters>(*m_cull_pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, params);
+    cmd_buf.dispatch((num_patches + TERRAIN_CULL_WORKGROUP_SIZE - 1) / TERRAIN_CULL_WORKGROUP_SIZE, 1, 1);
+
+    vk::MemoryBarrier2 draw_barrier{
+        .srcStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+        .srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite,
+        .dstStageMask = vk::PipelineStageFlagBits2::eDrawIndirect | vk::PipelineStageFlagBits2::eHost,
+        .dstAccessMask = vk::AccessFlagBits2::eIndirectCommandRead | vk::AccessFlagBits2::eHostRead,
+    };
+    cmd_buf.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(draw_barrier));
+}
+
+void gfx::TerrainPipeline::prepareMeshlets(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index, const Mesh &mesh) {
+    System *gfx = m_renderer->system();
+
+    // As for the compute culling, the count was made visible to the host by
+    // recordReadback() when this frame's buffers were last used.
+    VkResult rslt = vmaCopyAllocationToMemory(
+        gfx->allocator(),
+        m_meshlet_count_buffer_allocations[frame_index],
+        0, &m_num_patches_drawn, sizeof(uint32_t)
+    );
+    if (rslt != VK_SUCCESS) {
+        m_num_patches_drawn = mesh.num_meshlets;
+    }
+    m_num_patches_drawn = std::min(m_num_patches_drawn, mesh.num_meshlets);
+
+    if (m_mesh_descriptor_levels[frame_index] != m_level) {
+        std::array<vk::DescriptorBufferInfo, 4> buffer_infos{
+            vk::DescriptorBufferInfo{ .buffer = *mesh.meshlet_buffer, .offset = 0, .range = vk::WholeSize },
+            vk::DescriptorBufferInfo{ .buffer = *mesh.meshlet_vertex_buffer, .offset = 0, .range = vk::WholeSize },
+            vk::DescriptorBufferInfo{ .buffer = *mesh.meshlet_triangle_buffer, .offset = 0, .range = vk::WholeSize },
+            vk::DescriptorBufferInfo{ .buffer = *mesh.vertex_buffer, .offset = 0, .range = vk::WholeSize },
+        };
+
+        std::array<vk::WriteDescriptorSet, 4> writes{};
+        for (uint32_t b = 0; b < writes.size(); ++b) {
+            writes[b] = vk::WriteDescriptorSet{
+                .dstSet = *m_mesh_descriptor_sets[frame_index],
+                .dstBinding = b,
+                .dstArrayElement = 0,
+                .descriptorType = vk::DescriptorType::eStorageBuffer,
+            }.setBufferInfo(buffer_infos[b]);
+        }
+        gfx->device().updateDescriptorSets(writes, {});
+        m_mesh_descriptor_levels[frame_index] = m_level;
+    }
+
+    const vk::raii::Buffer &count_buffer = m_meshlet_count_buffers[frame_index];
+    cmd_buf.fillBuffer(*count_buffer, 0, sizeof(uint32_t), 0);
+
+    vk::MemoryBarrier2 clear_barrier{
+        .srcStageMask = vk::PipelineStageFlagBits2::eTransfer,
+        .srcAccessMask = vk::AccessFlagBits2::eTransferWrite,
+        .dstStageMask = vk::PipelineStageFlagBits2::eTaskShaderEXT,
+        .dstAccessMask = vk::AccessFlagBits2::eShaderStorageRead | vk::AccessFlagBits2::eShaderStorageWrite,
+    };
+    cmd_buf.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(clear_barrier));
+}
+
+void gfx::TerrainPipeline::drawMeshlets(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index, const Mesh &mesh) {
+    const vk::raii::PipelineLayout &layout = m_renderer->pipelineLayout();
+    const std::vector<vk::raii::DescriptorSet> &scene_uniforms = m_renderer->sceneUniforms().descriptorSets();
+    const std::vector<vk::raii::DescriptorSet> &model_uniforms = m_uniform_set.descriptorSets();
+
+    TerrainMeshParameters params{
+        .draw = m_draw_parameters,
+        .eye = glm::vec4{modelSpaceEye(), mesh.occluder_radius},
+        .max_radius = mesh.max_radius,
+        .meshlet_count = mesh.num_meshlets,
+        .padding = {0.0f, 0.0f},
+    };
+    params.draw.min_radius = mesh.min_vertex_radius;
+    params.draw.radius_range = mesh.vertex_radius_range;
+
+    // The push constants differ from the shared layout's, so the scene set
+    // has to be bound again.
+    std::array<vk::DescriptorSet, 3> sets{
+        *scene_uniforms[frame_index],
+        *model_uniforms[frame_index],
+        *m_mesh_descriptor_sets[frame_index],
+    };
+    const vk::raii::Pipeline &pipeline = m_mesh_pipelines.get(lightCount(frame_index), [this](uint32_t light_count) {
+        return createMeshPipeline(light_count);
+    });
+    cmd_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, *pipeline);
+    cmd_buf.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *m_mesh_pipeline_layout, 0, sets, nullptr);
+    cmd_buf.pushConstants<TerrainMeshParameters>(
+        *m_mesh_pipeline_layout, vk::ShaderStageFlagBits::eTaskEXT | vk::ShaderStageFlagBits::eMeshEXT, 0, params
+    );
+    cmd_buf.drawMeshTasksEXT((mesh.num_meshlets + TERRAIN_MESH_TASK_GROUP_SIZE - 1) / TERRAIN_MESH_TASK_GROUP_SIZE, 1, 1);
+
+    // Leave the scene set bound for anything drawn with the shared layout
+    // afterwards.
+    cmd_buf.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *layout, 0, *scene_uniforms[frame_index], nullptr);
+}
+
+bool gfx::TerrainPipeline::depthPrepassSupported() const {
+    return m_chunks_enabled || m_cull_mode != CullMode::eMesh;
+}
+
+bool gfx::TerrainPipeline::drawsMeshTasks(DrawPass pass) const {
+    // As recordCommands() decides.
+    if (pass != DrawPass::eColor || m_chunks_enabled || m_cull_mode != CullMode::eMesh) {
+        return false;
+    }
+    const Mesh *mesh = currentMesh();
+    return mesh != nullptr && mesh->num_meshlets > 0;
+}
+
+glm::vec4 gfx::TerrainPipeline::boundingSphere() const {
+    float radius = 0.0f;
+    for (const auto &[level, mesh] : m_meshes) {
+        radius = std::max(radius, mesh.max_radius);
+    }
+    return glm::vec4{glm::vec3{m_uniform_set.transform()[3]}, radius};
+}
+
+float gfx::TerrainPipeline::occluderRadius() const {
+    const Mesh *mesh = currentMesh();
+    return mesh == nullptr ? 0.0f : mesh->occluder_radius;
+}
+
+void gfx::TerrainPipeline::recordShadowCommands(const vk::raii::CommandBuffer &cmd_buf, const glm::mat4x4 &light_view_projection) {
+    TerrainShadowParameters params{
+        .light_view_projection = light_view_projection,
+        .eye = glm::vec4{modelSpaceEye(), 1.0f},
+        .draw = m_draw_parameters,
+    };
+
+    if (m_chunks_enabled) {
+        cmd_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, *m_chunk_shadow_pipeline);
+        cmd_buf.pushConstants<TerrainShadowParameters>(*m_shadow_pipeline_layout, vk::ShaderStageFlagBits::eVertex, 0, params);
+        cmd_buf.bindVertexBuffers(0, *m_chunk_vertex_buffer, {0});
+        cmd_buf.bindIndexBuffer(*m_chunk_index_buffer, 0, m_chunk_index_type);
+        // The cascade's depth range spans the planet, so whatever is
+        // outside its frustum casts nothing into it.
+        Frustum frustum = extractFrustum(light_view_projection);
+        for (const TerrainShadowCaster &caster : m_chunk_shadow_casters) {
+            if (sphereInFrustum(frustum, caster.center, caster.radius)) {
+                cmd_buf.drawIndexed(m_chunk_indices, 1, 0, static_cast<int32_t>(caster.slot * m_chunk_vertices), 0);
+            }
+        }
+        return;
+    }
+
+    const Mesh *mesh = currentMesh();
+    if (mesh == nullptr) {
+        return;
+    }
+
+    params.draw.min_radius = mesh->min_vertex_radius;
+    params.draw.radius_range = mesh->vertex_radius_range;
+    cmd_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, *m_shadow_pipeline);
+    cmd_buf.pushConstants<TerrainShadowParameters>(*m_shadow_pipeline_layout, vk::ShaderStageFlagBits::eVertex, 0, params);
+    cmd_buf.bindVertexBuffers(0, *mesh->vertex_buffer, {0});
+    cmd_buf.bindIndexBuffer(*mesh->index_buffer->buffer(), 0, mesh->index_buffer->indexType());
+    for (const IndexBatch &batch : mesh->index_buffer->batches()) {
+        cmd_buf.drawIndexed(batch.element_count, 1, batch.first_element, static_cast<int32_t>(batch.base_vertex), 0);
+    }
+}
+
+uint64_t gfx::TerrainPipeline::geometryGeneration() const {
+    return m_geometry_generation;
+}
+
+void gfx::TerrainPipeline::recordCommands(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index, DrawPass pass) {
     const vk::raii::PipelineLayout &layout = m_renderer->pipelineLayout();
     const std::vector<vk::raii::DescriptorSet> &model_uniforms = m_uniform_set.descriptorSets();
+    bool depth_only = pass == DrawPass::eDepthPrepass;
+
+    if (m_chunks_enabled) {
+        if (depth_only) {
+            cmd_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, *m_chunk_depth_pipeline);
+        } else {
+            cmd_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, *m_chunk_pipelines.get(lightCount(frame_index), [this](uint32_t light_count) {
+                return createGraphicsPipeline<TerrainChunkVertex>("vs_chunk", DrawPass::eColor, light_count);
+            }));
+        }
+        cmd_buf.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *layout, 1, *model_uniforms[frame_index], nullptr);
+        cmd_buf.pushConstants<DrawParameters>(*layout, vk::ShaderStageFlagBits::eVertex, 0, m_draw_parameters);
+        cmd_buf.bindVertexBuffers(0, *m_chunk_vertex_buffer, {0});
+        cmd_buf.bindIndexBuffer(*m_chunk_index_buffer, 0, m_chunk_index_type);
+        for (uint32_t slot : m_chunk_draws) {
+            cmd_buf.drawIndexed(m_chunk_indices, 1, 0, static_cast<int32_t>(slot * m_chunk_vertices), 0);
+        }
+        return;
+    }
 
-    cmd_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, *m_pipeline);
+    // The meshes are built in the background and may not be here yet.
+    const Mesh *mesh = currentMesh();
+    if (mesh == nullptr) {
+        return;
+    }
+
+    if (m_cull_mode == CullMode::eMesh && mesh->num_meshlets > 0) {
+        if (!depth_only) {
+            drawMeshlets(cmd_buf, frame_index, *mesh);
+        }
+        return;
+    }
+
+    DrawParameters draw_parameters = m_draw_parameters;
+    draw_parameters.min_radius = mesh->min_vertex_radius;
+    draw_parameters.radius_range = mesh->vertex_radius_range;
+
+    if (depth_only) {
+        cmd_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, *m_depth_pipeline);
+    } else {
+        cmd_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, *m_pipelines.get(lightCount(frame_index), [this](uint32_t light_count) {
+            return createGraphicsPipeline<CompactTerrainVertex>("vs_main", DrawPass::eColor, light_count);
+        }));
+    }
     cmd_buf.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *layout, 1, *model_uniforms[frame_index], nullptr);
-    cmd_buf.bindVertexBuffers(0, *m_vertex_buffer, {0});
-    cmd_buf.bindIndexBuffer(*m_index_buffer, 0, vk::IndexType::eUint32);
-    cmd_buf.drawIndexed(m_num_indices, 1, 0, 0, 0);
+    cmd_buf.pushConstants<DrawParameters>(*layout, vk::ShaderStageFlagBits::eVertex, 0, draw_parameters);
+    cmd_buf.bindVertexBuffers(0, *mesh->vertex_buffer, {0});
+    cmd_buf.bindIndexBuffer(*mesh->index_buffer->buffer(), 0, mesh->index_buffer->indexType());
+
+    if (m_cull_mode == CullMode::eGpu && !mesh->patches.empty()) {
+        cmd_buf.drawIndexedIndirectCount(
+            *m_draw_buffers[frame_index], 0,
+            *m_draw_count_buffers[frame_index], 0,
+            static_cast<uint32_t>(mesh->patches.size()), sizeof(vk::DrawIndexedIndirectCommand)
+        );
+    } else if (m_cull_mode == CullMode::eCpu && !mesh->patches.empty()) {
+        for (const IndexBatch &range : m_visible_ranges) {
+            cmd_buf.drawIndexed(range.element_count, 1, range.first_element, static_cast<int32_t>(range.base_vertex), 0);
+        }
+    } else {
+        for (const IndexBatch &batch : mesh->index_buffer->batches()) {
+            cmd_buf.drawIndexed(batch.element_count, 1, batch.first_element, static_cast<int32_t>(batch.base_vertex), 0);
+        }
+    }
 }
 
+// The colour pipelines for other light counts than the usual one are made
+// when first drawn with.
 void gfx::TerrainPipeline::initPipeline() {
-    System *system = m_renderer->system();
-    const vk::raii::Device &device = system->device();
-    vk::Extent2D extent = system->swapchain().extent();
-    const vk::raii::PipelineLayout &layout = m_renderer->pipelineLayout();
-    vk::SurfaceFormatKHR swapchain_format = system->swapchain().format();
-    vk::Format depth_format = system->depthBuffer().format();
+    m_pipelines.get(1, [this](uint32_t light_count) {
+        return createGraphicsPipeline<CompactTerrainVertex>("vs_main", DrawPass::eColor, light_count);
+    });
+    m_chunk_pipelines.get(1, [this](uint32_t light_count) {
+        return createGraphicsPipeline<TerrainChunkVertex>("vs_chunk", DrawPass::eColor, light_count);
+    });
+    m_depth_pipeline = createGraphicsPipeline<CompactTerrainVertex>("vs_main", DrawPass::eDepthPrepass, 0);
+    m_chunk_depth_pipeline = createGraphicsPipeline<TerrainChunkVertex>("vs_chunk", DrawPass::eDepthPrepass, 0);
+}
 
-    vk::ShaderModuleCreateInfo sm_ci{
-        .codeSize = TERRAIN_SLANG_SHADER_BYTECODE.size() * sizeof(std::remove_reference<decltype(TERRAIN_SLANG_SHADER_BYTECODE)>::type::value_type),
-        .pCode = reinterpret_cast<const uint32_t *>(TERRAIN_SLANG_SHADER_BYTECODE.data()),
-    };
-    vk::raii::ShaderModule shader = device.createShaderModule(sm_ci);
+// The variants made so far are made again, and the rest are left to be
+// made from the new code when first drawn with.
+void gfx::TerrainPipeline::addReloadJobs(const std::set<std::string> &shaders, std::vector<ReloadJob> &jobs) {
+    if (shaders.contains(TERRAIN_SHADER)) {
+        jobs.push_back([this, light_counts = m_pipelines.lightCounts(), chunk_light_counts = m_chunk_pipelines.lightCounts()](PipelineReload &reload) {
+            reload.add(&m_pipelines, PipelineVariants::create(light_counts, [this](uint32_t light_count) {
+                return createGraphicsPipeline<CompactTerrainVertex>("vs_main", DrawPass::eColor, light_count);
+            }));
+            reload.add(&m_chunk_pipelines, PipelineVariants::create(chunk_light_counts, [this](uint32_t light_count) {
+                return createGraphicsPipeline<TerrainChunkVertex>("vs_chunk", DrawPass::eColor, light_count);
+            }));
+            reload.add(&m_depth_pipeline, createGraphicsPipeline<CompactTerrainVertex>("vs_main", DrawPass::eDepthPrepass, 0));
+            reload.add(&m_chunk_depth_pipeline, createGraphicsPipeline<TerrainChunkVertex>("vs_chunk", DrawPass::eDepthPrepass, 0));
+        });
+    }
+
+    if (shaders.contains(TERRAIN_SHADOW_SHADER)) {
+        jobs.push_back([this](PipelineReload &reload) {
+            reload.add(&m_shadow_pipeline, createGraphicsPipeline<CompactTerrainVertex>("vs_main", DrawPass::eShadow, 0));
+            reload.add(&m_chunk_shadow_pipeline, createGraphicsPipeline<TerrainChunkVertex>("vs_chunk", DrawPass::eShadow, 0));
+        });
+    }
+
+    if (m_chunk_generator != nullptr) {
+        m_chunk_generator->addReloadJobs(shaders, jobs);
+    }
 
-    std::array<vk::PipelineShaderStageCreateInfo, 2> shader_stages{
+    // The mesh shading pipelines share the fragment shader.
+    if (meshShadingSupported() && (shaders.contains(TERRAIN_MESH_SHADER) || shaders.contains(TERRAIN_SHADER))) {
+        jobs.push_back([this, light_counts = m_mesh_pipelines.lightCounts()](PipelineReload &reload) {
+            reload.add(&m_mesh_pipelines, PipelineVariants::create(light_counts, [this](uint32_t light_count) {
+                return createMeshPipeline(light_count);
+            }));
+        });
+    }
+
+    if (shaders.contains(TERRAIN_CULL_SHADER)) {
+        jobs.push_back([this](PipelineReload &reload) {
+            reload.add(&m_cull_pipeline, createCullPipeline());
+        });
+    }
+}
+
+template <typename Vertex>
+vk::raii::Pipeline gfx::TerrainPipeline::createGraphicsPipeline(const char *vertex_entry_point, DrawPass pass, uint32_t light_count) {
+    System *system = m_renderer->system();
+    bool shadow = pass == DrawPass::eShadow;
+    vk::raii::ShaderModule shader = system->shaders().createModule(system->device(), shadow ? TERRAIN_SHADOW_SHADER : TERRAIN_SHADER);
+
+    ShaderSpecialization specialization{light_count};
+    std::vector<vk::PipelineShaderStageCreateInfo> shader_stages{
         vk::PipelineShaderStageCreateInfo{
             .stage = vk::ShaderStageFlagBits::eVertex,
             .module = *shader,
-            .pName = "vs_main",
+            .pName = vertex_entry_point,
         },
         vk::PipelineShaderStageCreateInfo{
             .stage = vk::ShaderStageFlagBits::eFragment,
             .module = *shader,
             .pName = "fs_main",
+            .pSpecializationInfo = specialization.info(),
         },
     };
+    if (pass != DrawPass::eColor) {
+        shader_stages.pop_back();
+    }
 
     // vk::ShaderModuleCreateInfo vsm_ci{
     //     .codeSize = TERRAIN_GLSL_VERTEX_SHADER_BYTECODE.size() * sizeof(std::remove_reference<decltype(TERRAIN_GLSL_VERTEX_SHADER_BYTECODE)>::type::value_type),
@@ -147,8 +1075,8 @@ void gfx::TerrainPipeline::initPipeline() {
     //     },
     // };
 
-    vk::VertexInputBindingDescription bind_desc = TerrainVertex::bindingDescription();
-    std::array<vk::VertexInputAttributeDescription, TerrainVertex::NUM_ATTRIBUTES> attr_desc = TerrainVertex::attributeDescription();
+    vk::VertexInputBindingDescription bind_desc = Vertex::bindingDescription();
+    std::array<vk::VertexInputAttributeDescription, Vertex::NUM_ATTRIBUTES> attr_desc = Vertex::attributeDescription();
     vk::PipelineVertexInputStateCreateInfo vertex_input_ci = vk::PipelineVertexInputStateCreateInfo{}
         .setVertexBindingDescriptions(bind_desc)
         .setVertexAttributeDescriptions(attr_desc);
@@ -156,7 +1084,34 @@ void gfx::TerrainPipeline::initPipeline() {
     vk::PipelineInputAssemblyStateCreateInfo input_assembly_ci{
         .topology = vk::PrimitiveTopology::eTriangleList,
     };
-    
+
+    return createPipeline(
+        shader_stages, &vertex_input_ci, &input_assembly_ci,
+        shadow ? m_shadow_pipeline_layout : m_renderer->pipelineLayout(), pass
+    );
+}
+
+// Everything but the shaders and vertex input is shared by the terrain's
+// pipelines. Mesh shading pipelines have no vertex input. Depth prepass
+// pipelines leave the colour attachment alone; the position has to come
+// out of the same vertex shader as the colour pass's, so the depths match.
+// Shadow pipelines draw into the shadow map alone, with both faces, since
+// the cascades don't flip y like the view does, and with their depth
+// biased away from the light by the slope, to keep lit surfaces from
+// shadowing themselves.
+vk::raii::Pipeline gfx::TerrainPipeline::createPipeline(
+    const std::vector<vk::PipelineShaderStageCreateInfo> &shader_stages,
+    const vk::PipelineVertexInputStateCreateInfo *vertex_input_ci,
+    const vk::PipelineInputAssemblyStateCreateInfo *input_assembly_ci,
+    const vk::raii::PipelineLayout &layout,
+    DrawPass pass
+) {
+    System *system = m_renderer->system();
+    const vk::raii::Device &device = system->device();
+    vk::SurfaceFormatKHR swapchain_format = system->swapchain().format();
+    bool shadow = pass == DrawPass::eShadow;
+    vk::Format depth_format = shadow ? m_renderer->shadowMaps().format() : system->depthBuffer().format();
+
     vk::PipelineViewportStateCreateInfo viewport_ci{
         .viewportCount = 1,
         .scissorCount = 1,
@@ -166,9 +1121,12 @@ void gfx::TerrainPipeline::initPipeline() {
         .depthClampEnable = vk::False,
         .rasterizerDiscardEnable = vk::False,
         .polygonMode = vk::PolygonMode::eFill,
-        .cullMode = vk::CullModeFlagBits::eBack,
+        .cullMode = shadow ? vk::CullModeFlagBits::eNone : vk::CullModeFlagBits::eBack,
         .frontFace = vk::FrontFace::eCounterClockwise,
-        .depthBiasEnable = vk::False,
+        .depthBiasEnable = shadow ? vk::True : vk::False,
+        .depthBiasConstantFactor = shadow ? 1.25f : 0.0f,
+        .depthBiasClamp = 0.0f,
+        .depthBiasSlopeFactor = shadow ? 1.75f : 0.0f,
         .lineWidth = 1.0f,
     };
 
@@ -180,14 +1138,15 @@ void gfx::TerrainPipeline::initPipeline() {
     vk::PipelineDepthStencilStateCreateInfo depth_ci{
         .depthTestEnable = vk::True,
         .depthWriteEnable = vk::True,
-        .depthCompareOp = vk::CompareOp::eLess,
+        .depthCompareOp = vk::CompareOp::eLess, // Dynamic, for reversed depth
         .depthBoundsTestEnable = vk::False,
         .stencilTestEnable = vk::False,
     };
 
     vk::PipelineColorBlendAttachmentState blend_attachment{
         .blendEnable = vk::False,
-        .colorWriteMask = vk::ColorComponentFlagBits::eR | 
+        .colorWriteMask = pass != DrawPass::eColor ? vk::ColorComponentFlags{} :
+            vk::ColorComponentFlagBits::eR | 
             vk::ColorComponentFlagBits::eG | 
             vk::ColorComponentFlagBits::eB | 
             vk::ColorComponentFlagBits::eA,
@@ -198,17 +1157,19 @@ void gfx::TerrainPipeline::initPipeline() {
         .logicOp = vk::LogicOp::eCopy,
     }.setAttachments(blend_attachment);
 
-    std::array<vk::DynamicState, 2> dynamic_states{
+    std::array<vk::DynamicState, 4> dynamic_states{
         vk::DynamicState::eViewport,
         vk::DynamicState::eScissor,
+        vk::DynamicState::eDepthCompareOp,
+        vk::DynamicState::eDepthWriteEnable,
     };
     vk::PipelineDynamicStateCreateInfo dynamic_state_ci = vk::PipelineDynamicStateCreateInfo{}
         .setDynamicStates(dynamic_states);
 
     vk::StructureChain<vk::GraphicsPipelineCreateInfo, vk::PipelineRenderingCreateInfo> pipeline_ci{
         vk::GraphicsPipelineCreateInfo{
-            .pVertexInputState = &vertex_input_ci,
-            .pInputAssemblyState = &input_assembly_ci,
+            .pVertexInputState = vertex_input_ci,
+            .pInputAssemblyState = input_assembly_ci,
             .pViewportState = &viewport_ci,
             .pRasterizationState = &raster_ci,
             .pMultisampleState = &multisample_state_ci,
@@ -223,8 +1184,320 @@ void gfx::TerrainPipeline::initPipeline() {
         },
     };
     pipeline_ci.get<vk::GraphicsPipelineCreateInfo>().setStages(shader_stages);
-    pipeline_ci.get<vk::PipelineRenderingCreateInfo>()
-        .setColorAttachmentFormats(swapchain_format.format);
+    if (shadow) {
+        pipeline_ci.get<vk::GraphicsPipelineCreateInfo>().pColorBlendState = nullptr;
+    } else {
+        pipeline_ci.get<vk::PipelineRenderingCreateInfo>()
+            .setColorAttachmentFormats(swapchain_format.format);
+    }
     
-    m_pipeline = device.createGraphicsPipeline(nullptr, pipeline_ci.get<vk::GraphicsPipelineCreateInfo>());
+    return device.createGraphicsPipeline(nullptr, pipeline_ci.get<vk::GraphicsPipelineCreateInfo>());
+}
+
+void gfx::TerrainPipeline::initShadowPipeline() {
+    const vk::raii::Device &device = m_renderer->system()->device();
+
+    vk::PushConstantRange push_range{
+        .stageFlags = vk::ShaderStageFlagBits::eVertex,
+        .offset = 0,
+        .size = sizeof(TerrainShadowParameters),
+    };
+    vk::PipelineLayoutCreateInfo pl_ci = vk::PipelineLayoutCreateInfo{}
+        .setPushConstantRanges(push_range);
+    m_shadow_pipeline_layout = device.createPipelineLayout(pl_ci);
+
+    m_shadow_pipeline = createGraphicsPipeline<CompactTerrainVertex>("vs_main", DrawPass::eShadow, 0);
+    m_chunk_shadow_pipeline = createGraphicsPipeline<TerrainChunkVertex>("vs_chunk", DrawPass::eShadow, 0);
+    std::cerr << "Created terrain shadow pipelines " << *m_shadow_pipeline << ", " << *m_chunk_shadow_pipeline << "\n";
+}
+
+void gfx::TerrainPipeline::initCullPipeline() {
+    const vk::raii::Device &device = m_renderer->system()->device();
+
+    std::array<vk::DescriptorSetLayoutBinding, 3> bindings{
+        vk::DescriptorSetLayoutBinding{
+            .binding = 0,
+            .descriptorType = vk::DescriptorType::eStorageBuffer,
+            .descriptorCount = 1,
+            .stageFlags = vk::ShaderStageFlagBits::eCompute,
+        },
+        vk::DescriptorSetLayoutBinding{
+            .binding = 1,
+            .descriptorType = vk::DescriptorType::eStorageBuffer,
+            .descriptorCount = 1,
+            .stageFlags = vk::ShaderStageFlagBits::eCompute,
+        },
+        vk::DescriptorSetLayoutBinding{
+            .binding = 2,
+            .descriptorType = vk::DescriptorType::eStorageBuffer,
+            .descriptorCount = 1,
+            .stageFlags = vk::ShaderStageFlagBits::eCompute,
+        },
+    };
+    m_cull_descriptor_set_layout = device.createDescriptorSetLayout(
+        vk::DescriptorSetLayoutCreateInfo{}.setBindings(bindings)
+    );
+
+    vk::PushConstantRange push_range{
+        .stageFlags = vk::ShaderStageFlagBits::eCompute,
+        .offset = 0,
+        .size = sizeof(TerrainCullParameters),
+    };
+    vk::PipelineLayoutCreateInfo pl_ci = vk::PipelineLayoutCreateInfo{}
+        .setSetLayouts(*m_cull_descriptor_set_layout)
+        .setPushConstantRanges(push_range);
+    m_cull_pipeline_layout = device.createPipelineLayout(pl_ci);
+
+    m_cull_pipeline = createCullPipeline();
+}
+
+vk::raii::Pipeline gfx::TerrainPipeline::createCullPipeline() {
+    System *system = m_renderer->system();
+    vk::raii::ShaderModule shader = system->shaders().createModule(system->device(), TERRAIN_CULL_SHADER);
+
+    vk::ComputePipelineCreateInfo cp_ci{
+        .stage = vk::PipelineShaderStageCreateInfo{
+            .stage = vk::ShaderStageFlagBits::eCompute,
+            .module = *shader,
+            .pName = "cs_main",
+        },
+        .layout = *m_cull_pipeline_layout,
+    };
+    vk::raii::Pipeline pipeline = system->device().createComputePipeline(nullptr, cp_ci);
+    std::cerr << "Created terrain culling compute pipeline " << *pipeline << "\n";
+    return pipeline;
+}
+
+void gfx::TerrainPipeline::initCullBuffers(uint32_t num_patches) {
+    System *gfx = m_renderer->system();
+
+    // The draw commands are rewritten every frame, so each frame in flight
+    // gets its own copy. They are sized for the largest mesh so far.
+    for (uint32_t i = 0; i < gfx->numFrames(); ++i) {
+        auto [draw_buffer, draw_allocation] = gfx->createBuffer(
+            num_patches * sizeof(vk::DrawIndexedIndirectCommand),
+            vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer,
+            0,
+            "terrain draw command"
+        );
+        m_draw_buffers.emplace_back(std::move(draw_buffer));
+        m_draw_buffer_allocations.push_back(draw_allocation);
+
+        // The count is read back (a frame late) for the stats, so keep it
+        // host visible.
+        auto [count_buffer, count_allocation] = gfx->createBuffer(
+            sizeof(uint32_t),
+            vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferDst,
+            VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+            "terrain draw count"
+        );
+        m_draw_count_buffers.emplace_back(std::move(count_buffer));
+        m_draw_count_buffer_allocations.push_back(count_allocation);
+    }
+    m_draw_capacity = num_patches;
+
+    // The sets outlive the buffers they're pointed at, which cullOnGpu()
+    // does when each is next used.
+    if (m_cull_descriptor_sets.empty()) {
+        initCullDescriptorSets();
+    }
+    m_cull_descriptor_levels.assign(gfx->numFrames(), UINT32_MAX);
+}
+
+void gfx::TerrainPipeline::initCullDescriptorSets() {
+    System *gfx = m_renderer->system();
+    uint32_t num_sets = gfx->numFrames();
+
+    std::vector<vk::DescriptorSetLayout> layouts{num_sets, *m_cull_descriptor_set_layout};
+    vk::DescriptorSetAllocateInfo ds_ai = vk::DescriptorSetAllocateInfo{
+        .descriptorPool = *gfx->uniforms().descriptorPool(),
+    }.setSetLayouts(layouts);
+    m_cull_descriptor_sets = gfx->device().allocateDescriptorSets(ds_ai);
+}
+
+void gfx::TerrainPipeline::retireCullBuffers() {
+    // The descriptor sets are kept, to be pointed at the new buffers.
+    RetiredBuffers retired{};
+    for (size_t i = 0; i < m_draw_buffers.size(); ++i) {
+        retired.buffers.push_back(std::move(m_draw_buffers[i]));
+        retired.allocations.push_back(m_draw_buffer_allocations[i]);
+        retired.buffers.push_back(std::move(m_draw_count_buffers[i]));
+        retired.allocations.push_back(m_draw_count_buffer_allocations[i]);
+    }
+    m_draw_buffers.clear();
+    m_draw_buffer_allocations.clear();
+    m_draw_count_buffers.clear();
+    m_draw_count_buffer_allocations.clear();
+    m_draw_capacity = 0;
+    retire(std::move(retired));
+}
+
+void gfx::TerrainPipeline::freeCullBuffers() {
+    VmaAllocator allocator = m_renderer->system()->allocator();
+
+    // The descriptor sets refer to the buffers, so they go first.
+    m_cull_descriptor_sets.clear();
+    m_cull_descriptor_levels.clear();
+    m_draw_capacity = 0;
+
+    for (auto &alloc : m_draw_buffer_allocations) {
+        vmaFreeMemory(allocator, alloc);
+    }
+    m_draw_buffers.clear();
+    m_draw_buffer_allocations.clear();
+
+    for (auto &alloc : m_draw_count_buffer_allocations) {
+        vmaFreeMemory(allocator, alloc);
+    }
+    m_draw_count_buffers.clear();
+    m_draw_count_buffer_allocations.clear();
+}
+
+void gfx::TerrainPipeline::freeChunkBuffers() {
+    VmaAllocator allocator = m_renderer->system()->allocator();
+
+    if (m_chunk_vertex_buffer_allocation != nullptr) {
+        vmaFreeMemory(allocator, m_chunk_vertex_buffer_allocation);
+        m_chunk_vertex_buffer_allocation = nullptr;
+    }
+    m_chunk_vertex_buffer = nullptr;
+
+    if (m_chunk_index_buffer_allocation != nullptr) {
+        vmaFreeMemory(allocator, m_chunk_index_buffer_allocation);
+        m_chunk_index_buffer_allocation = nullptr;
+    }
+    m_chunk_index_buffer = nullptr;
+
+    for (auto &alloc : m_chunk_staging_allocations) {
+        vmaFreeMemory(allocator, alloc);
+    }
+    m_chunk_staging_buffers.clear();
+    m_chunk_staging_allocations.clear();
+    m_chunk_copies.clear();
+}
+
+void gfx::TerrainPipeline::initMeshPipeline() {
+    const vk::raii::Device &device = m_renderer->system()->device();
+    const Uniforms &uniforms = m_renderer->system()->uniforms();
+    vk::ShaderStageFlags mesh_stages = vk::ShaderStageFlagBits::eTaskEXT | vk::ShaderStageFlagBits::eMeshEXT;
+
+    // Meshlets, meshlet vertices, meshlet triangles, terrain vertices and
+    // the visible meshlet count.
+    std::array<vk::DescriptorSetLayoutBinding, 5> bindings{};
+    for (uint32_t b = 0; b < bindings.size(); ++b) {
+        bindings[b] = vk::DescriptorSetLayoutBinding{
+            .binding = b,
+            .descriptorType = vk::DescriptorType::eStorageBuffer,
+            .descriptorCount = 1,
+            .stageFlags = mesh_stages,
+        };
+    }
+    m_mesh_descriptor_set_layout = device.createDescriptorSetLayout(
+        vk::DescriptorSetLayoutCreateInfo{}.setBindings(bindings)
+    );
+
+    std::array<vk::DescriptorSetLayout, 3> layouts{
+        *uniforms.sceneDescriptorSetLayout(),
+        *uniforms.modelDescriptorSetLayout(),
+        *m_mesh_descriptor_set_layout,
+    };
+    vk::PushConstantRange push_range{
+        .stageFlags = mesh_stages,
+        .offset = 0,
+        .size = sizeof(TerrainMeshParameters),
+    };
+    vk::PipelineLayoutCreateInfo pl_ci = vk::PipelineLayoutCreateInfo{}
+        .setSetLayouts(layouts)
+        .setPushConstantRanges(push_range);
+    m_mesh_pipeline_layout = device.createPipelineLayout(pl_ci);
+
+    m_mesh_pipelines.get(1, [this](uint32_t light_count) {
+        return createMeshPipeline(light_count);
+    });
+}
+
+vk::raii::Pipeline gfx::TerrainPipeline::createMeshPipeline(uint32_t light_count) {
+    System *system = m_renderer->system();
+    const ShaderLibrary &shaders = system->shaders();
+    vk::raii::ShaderModule mesh_shader = shaders.createModule(system->device(), TERRAIN_MESH_SHADER);
+    // The fragment shader is the same one the vertex pipelines use.
+    vk::raii::ShaderModule fragment_shader = shaders.createModule(system->device(), TERRAIN_SHADER);
+
+    ShaderSpecialization specialization{light_count};
+    std::vector<vk::PipelineShaderStageCreateInfo> shader_stages{
+        vk::PipelineShaderStageCreateInfo{
+            .stage = vk::ShaderStageFlagBits::eTaskEXT,
+            .module = *mesh_shader,
+            .pName = "ts_main",
+        },
+        vk::PipelineShaderStageCreateInfo{
+            .stage = vk::ShaderStageFlagBits::eMeshEXT,
+            .module = *mesh_shader,
+            .pName = "ms_main",
+        },
+        vk::PipelineShaderStageCreateInfo{
+            .stage = vk::ShaderStageFlagBits::eFragment,
+            .module = *fragment_shader,
+            .pName = "fs_main",
+            .pSpecializationInfo = specialization.info(),
+        },
+    };
+
+    vk::raii::Pipeline pipeline = createPipeline(shader_stages, nullptr, nullptr, m_mesh_pipeline_layout, DrawPass::eColor);
+    std::cerr << "Created terrain mesh shading pipeline " << *pipeline << " for " << light_count << " lights\n";
+    return pipeline;
+}
+
+void gfx::TerrainPipeline::initMeshBuffers() {
+    System *gfx = m_renderer->system();
+    const vk::raii::Device &device = gfx->device();
+    uint32_t num_sets = gfx->numFrames();
+
+    for (uint32_t i = 0; i < num_sets; ++i) {
+        auto [count_buffer, count_allocation] = gfx->createBuffer(
+            sizeof(uint32_t),
+            vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+            VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+            "terrain meshlet count"
+        );
+        m_meshlet_count_buffers.emplace_back(std::move(count_buffer));
+        m_meshlet_count_buffer_allocations.push_back(count_allocation);
+    }
+
+    std::vector<vk::DescriptorSetLayout> layouts{num_sets, *m_mesh_descriptor_set_layout};
+    vk::DescriptorSetAllocateInfo ds_ai = vk::DescriptorSetAllocateInfo{
+        .descriptorPool = *gfx->uniforms().descriptorPool(),
+    }.setSetLayouts(layouts);
+    m_mesh_descriptor_sets = device.allocateDescriptorSets(ds_ai);
+
+    // The mesh bindings are filled in by prepareMeshlets().
+    m_mesh_descriptor_levels.assign(num_sets, UINT32_MAX);
+
+    for (uint32_t i = 0; i < num_sets; ++i) {
+        vk::DescriptorBufferInfo count_info{
+            .buffer = *m_meshlet_count_buffers[i],
+            .offset = 0,
+            .range = vk::WholeSize,
+        };
+        vk::WriteDescriptorSet write = vk::WriteDescriptorSet{
+            .dstSet = *m_mesh_descriptor_sets[i],
+            .dstBinding = 4,
+            .dstArrayElement = 0,
+            .descriptorType = vk::DescriptorType::eStorageBuffer,
+        }.setBufferInfo(count_info);
+        device.updateDescriptorSets(write, {});
+    }
+}
+
+void gfx::TerrainPipeline::freeMeshBuffers() {
+    VmaAllocator allocator = m_renderer->system()->allocator();
+
+    m_mesh_descriptor_sets.clear();
+    m_mesh_descriptor_levels.clear();
+
+    for (auto &alloc : m_meshlet_count_buffer_allocations) {
+        vmaFreeMemory(allocator, alloc);
+    }
+    m_meshlet_count_buffers.clear();
+    m_meshlet_count_buffer_allocations.clear();
 }
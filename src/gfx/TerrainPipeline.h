@@ -3,20 +3,68 @@
 #ifndef _VPLANET_GFX_TERRAIN_PIPELINE_H_
 #define _VPLANET_GFX_TERRAIN_PIPELINE_H_
 
+#include <map>
+#include <memory>
+#include <set>
+#include <span>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "../glm.h"
 #include "../vulkan.h"
 #include "../VmaUsage.h"
 
+#include "../Culling.h"
 #include "../Terrain.h"
+#include "../TerrainLod.h"
+#include "ComputeContext.h"
 #include "Pipeline.h"
 #include "Resource.h"
+#include "TerrainGenerator.h"
+#include "TopologyCache.h"
 #include "Uniforms.h"
 
 namespace gfx {
     class Renderer;
 
+    // Push constants for the patch culling compute shader. The layout matches
+    // CullParameters in terrain_cull.slang.
+    struct TerrainCullParameters {
+        glm::vec4 frustum_planes[6];
+        glm::vec4 eye; // xyz: eye position in model space, w: occluder radius
+        float max_radius;
+        uint32_t patch_count;
+        float padding[2];
+    };
+
+    // Push constants for the meshlet pipeline. The layout matches
+    // MeshParameters in terrain_mesh.slang. The frustum comes from the
+    // transforms in the uniforms instead, to stay within the 128 bytes every
+    // device allows.
+    struct TerrainMeshParameters {
+        DrawParameters draw;
+        glm::vec4 eye; // xyz: eye position in model space, w: occluder radius
+        float max_radius;
+        uint32_t meshlet_count;
+        float padding[2];
+    };
+
+    // Push constants for the shadow map pipelines. The layout matches
+    // ShadowDrawParameters in terrain_shadow.slang.
+    struct TerrainShadowParameters {
+        glm::mat4x4 light_view_projection; // from model space to the cascade
+        glm::vec4 eye;                     // xyz: eye position in model space
+        DrawParameters draw;
+    };
+
+    enum class CullMode {
+        eNone, // Draw the whole planet.
+        eCpu,  // Test patches on the CPU, one draw per visible run.
+        eGpu,  // Test patches in a compute pass and draw indirectly.
+        eMesh, // Test meshlets in a task shader and draw them with mesh shaders.
+    };
+
     class TerrainPipeline : public Pipeline {
     public:
         TerrainPipeline();
@@ -29,19 +77,231 @@ namespace gfx {
         TerrainPipeline &operator=(const TerrainPipeline &other) = delete;
         TerrainPipeline &operator=(TerrainPipeline &&other) = default;
 
-        void setGeometry(const std::vector<TerrainVertex> &verts, const std::vector<uint32_t> &elems);
+        // Meshes stay resident per refinement level, so switching levels
+        // doesn't upload anything. The vertices' radii are quantized between
+        // min_radius and max_radius, and min_radius doubles as the horizon
+        // occluder. The meshlets are only uploaded if mesh shading is
+        // supported. Given short_elems, the mesh is drawn with those instead
+        // of elems, batch by batch. The buffers are staged and copied at the
+        // start of the frame's commands, like the chunks, and a level they
+        // replace is freed once no frame in flight can be drawing it.
+        void setGeometry(
+            uint32_t level,
+            std::span<const CompactTerrainVertex> verts,
+            const std::vector<uint32_t> &elems,
+            const ShortElements *short_elems,
+            const std::vector<TerrainPatch> &patches,
+            const Meshlets &meshlets,
+            float min_radius,
+            float max_radius,
+            uint32_t frame_index
+        );
+        bool hasLevel(uint32_t level) const;
+        uint32_t level() const;
+        void setLevel(uint32_t level);
+        void setMorphRange(float start, float end);
         void setTransform(const glm::mat4x4 &xform);
+        const glm::mat4x4 &transform() const;
         void writeTransform(uint32_t buffer_index);
 
-        void recordCommands(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index);
+        CullMode cullMode() const;
+        // Modes the device can't do fall back to the next simplest one.
+        void setCullMode(CullMode mode);
+        bool cullModeSupported(CullMode mode) const;
+        bool gpuCullingSupported() const;
+        bool meshShadingSupported() const;
+
+        // Patches, or meshlets when mesh shading.
+        uint32_t numPatches() const;
+        uint32_t numPatchesDrawn() const;
+
+        // Chunked LOD terrain: chunks share one index list and each occupies
+        // a fixed size slot of a pooled vertex buffer. Uploads are staged
+        // when queued and copied at the start of the frame's commands, so
+        // at most uploads_per_frame can be queued per frame. Chunks small
+        // enough get 16-bit indices.
+        void setChunkTopology(
+            const std::vector<uint32_t> &indices,
+            uint32_t vertices_per_chunk,
+            uint32_t capacity,
+            uint32_t uploads_per_frame
+        );
+        void uploadChunks(const std::vector<TerrainChunkUpload> &uploads, uint32_t frame_index);
+        // Chunks can also be generated on the GPU, straight into their
+        // slots, once the noise is given, after the topology; see
+        // TerrainGenerator. Generated chunks are recorded with the uploads,
+        // and count against the same uploads_per_frame.
+        void setChunkNoise(const TerrainNoiseTables &noise, float radius, uint32_t resolution);
+        bool chunkGenerationSupported() const;
+        void generateChunks(const std::vector<TerrainChunkGeneration> &chunks, uint32_t frame_index);
+        // As TerrainGenerator::generateNow().
+        std::vector<TerrainChunkVertex> generateChunksNow(const std::vector<TerrainChunkGeneration> &chunks);
+        void setChunkDraws(const std::vector<uint32_t> &slots);
+        // The chunks drawn into the shadow maps, each culled against the
+        // cascade's own frustum; see TerrainLod::shadowCasters().
+        void setChunkShadowCasters(const std::vector<TerrainShadowCaster> &casters);
+        bool chunksEnabled() const;
+        void setChunksEnabled(bool enabled);
+        uint32_t numChunksDrawn() const;
+
+        void recordUploads(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index);
+        void recordCulling(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index);
+        virtual void recordCommands(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index, DrawPass pass);
+        void recordReadback(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index);
+
+        // The mesh shading path culls in its task shader, and counts what
+        // it keeps, so it isn't run twice for a prepass.
+        virtual bool depthPrepassSupported() const;
+        virtual bool drawsMeshTasks(DrawPass pass) const;
+        virtual void addReloadJobs(const std::set<std::string> &shaders, std::vector<ReloadJob> &jobs);
+        // World space bounds of every resident mesh, as center and radius.
+        glm::vec4 boundingSphere() const;
+        // The radius under the current mesh, below which nothing shows.
+        float occluderRadius() const;
+
+        // Draws the terrain's depth into a cascade of the shadow map, in a
+        // rendering pass over its layer alone. Nothing is culled against
+        // the view, since what shadows it may well be out of it: resident
+        // meshes are drawn whole, chunks are the shadow casters culled
+        // against the cascade, and mesh shading draws with the vertex
+        // pipeline here.
+        void recordShadowCommands(const vk::raii::CommandBuffer &cmd_buf, const glm::mat4x4 &light_view_projection);
+        // Counts changes to the geometry recordShadowCommands() draws from,
+        // not to what the view sees of it, so that shadows drawn from it
+        // can be kept until it changes.
+        uint64_t geometryGeneration() const;
 
     private:
+        // The index buffer is shared with anything else built on an
+        // icosphere of the same level.
+        struct Mesh {
+            vk::raii::Buffer vertex_buffer, patch_buffer;
+            VmaAllocation vertex_buffer_allocation, patch_buffer_allocation;
+            std::shared_ptr<const SharedIndexBuffer> index_buffer;
+            std::vector<TerrainPatch> patches;
+            vk::raii::Buffer meshlet_buffer, meshlet_vertex_buffer, meshlet_triangle_buffer;
+            VmaAllocation meshlet_buffer_allocation, meshlet_vertex_buffer_allocation, meshlet_triangle_buffer_allocation;
+            uint32_t num_meshlets;
+            float occluder_radius, max_radius;
+            float min_vertex_radius, vertex_radius_range;
+        };
+
+        // Buffers that frames in flight may still be using when they're
+        // replaced or done with.
+        struct RetiredBuffers {
+            std::vector<vk::raii::Buffer> buffers;
+            std::vector<VmaAllocation> allocations;
+            std::shared_ptr<const SharedIndexBuffer> index_buffer;
+        };
+
+        const Mesh *currentMesh() const;
+        glm::vec3 modelSpaceEye() const;
+        void freeMesh(Mesh &mesh);
+        void retireMesh(Mesh &mesh);
+        void retire(RetiredBuffers &&retired);
+        void freeRetired(RetiredBuffers &retired);
+
+        void cullOnCpu(const Mesh &mesh, const glm::vec3 &eye, const Frustum &frustum);
+        void cullOnGpu(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index, const Mesh &mesh, const glm::vec3 &eye, const Frustum &frustum);
+        void prepareMeshlets(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index, const Mesh &mesh);
+        void drawMeshlets(const vk::raii::CommandBuffer &cmd_buf, uint32_t frame_index, const Mesh &mesh);
+
         virtual void initPipeline();
+        // The light count only matters to the colour pass.
+        template <typename Vertex>
+        vk::raii::Pipeline createGraphicsPipeline(const char *vertex_entry_point, DrawPass pass, uint32_t light_count);
+        vk::raii::Pipeline createPipeline(
+            const std::vector<vk::PipelineShaderStageCreateInfo> &shader_stages,
+            const vk::PipelineVertexInputStateCreateInfo *vertex_input_ci,
+            const vk::PipelineInputAssemblyStateCreateInfo *input_assembly_ci,
+            const vk::raii::PipelineLayout &layout,
+            DrawPass pass
+        );
+        void initShadowPipeline();
+        void initCullPipeline();
+        vk::raii::Pipeline createCullPipeline();
+        void initCullBuffers(uint32_t num_patches);
+        void initCullDescriptorSets();
+        void retireCullBuffers();
+        void freeCullBuffers();
+        void freeChunkBuffers();
+        void initMeshPipeline();
+        vk::raii::Pipeline createMeshPipeline(uint32_t light_count);
+        void initMeshBuffers();
+        void freeMeshBuffers();
+
+        // Depth only copies of m_pipelines and m_chunk_pipelines, with no
+        // fragment shader, for the prepass.
+        vk::raii::Pipeline m_depth_pipeline;
+        vk::raii::Pipeline m_chunk_depth_pipeline;
+
+        // Depth only pipelines for the shadow map, with the transform to
+        // the cascade in their push constants and no descriptor sets.
+        vk::raii::PipelineLayout m_shadow_pipeline_layout;
+        vk::raii::Pipeline m_shadow_pipeline;
+        vk::raii::Pipeline m_chunk_shadow_pipeline;
+        uint64_t m_geometry_generation;
 
         ModelUniformSet m_uniform_set;
-        uint32_t m_num_indices;
-        vk::raii::Buffer m_vertex_buffer, m_index_buffer;
-        VmaAllocation m_vertex_buffer_allocation, m_index_buffer_allocation;
+        std::map<uint32_t, Mesh> m_meshes;
+        // Per frame in flight: the levels' uploads waiting to be recorded.
+        std::vector<std::vector<StagedCopy>> m_level_copies;
+        // As Renderer's retired pipelines: each with the frames left to
+        // record before none in flight can be using them.
+        std::vector<std::pair<uint32_t, RetiredBuffers>> m_retired_buffers;
+        uint32_t m_level;
+        DrawParameters m_draw_parameters;
+
+        CullMode m_cull_mode;
+        uint32_t m_num_patches_drawn;
+
+        // CPU culling: visible patches, merged into contiguous index ranges.
+        std::vector<IndexBatch> m_visible_ranges;
+
+        // GPU-driven patch culling. The compute pass reads the patch bounds
+        // and writes one indirect draw per visible patch, plus the count.
+        // Each frame's descriptor set is pointed at the current level's
+        // patches, and at its draw buffers, when it is next used.
+        vk::raii::DescriptorSetLayout m_cull_descriptor_set_layout;
+        vk::raii::PipelineLayout m_cull_pipeline_layout;
+        vk::raii::Pipeline m_cull_pipeline;
+        std::vector<vk::raii::DescriptorSet> m_cull_descriptor_sets;
+        std::vector<uint32_t> m_cull_descriptor_levels;
+        uint32_t m_draw_capacity;
+        std::vector<vk::raii::Buffer> m_draw_buffers, m_draw_count_buffers;
+        std::vector<VmaAllocation> m_draw_buffer_allocations, m_draw_count_buffer_allocations;
+
+        // Mesh shading. The task shader does the same tests per meshlet and
+        // launches a mesh shader workgroup for each one that survives. The
+        // scene and model sets are shared with the other pipelines, and a
+        // third set per frame holds the current level's meshlets and
+        // vertices, plus a count of visible meshlets read back for the
+        // stats.
+        vk::raii::DescriptorSetLayout m_mesh_descriptor_set_layout;
+        vk::raii::PipelineLayout m_mesh_pipeline_layout;
+        PipelineVariants m_mesh_pipelines;
+        std::vector<vk::raii::DescriptorSet> m_mesh_descriptor_sets;
+        std::vector<uint32_t> m_mesh_descriptor_levels;
+        std::vector<vk::raii::Buffer> m_meshlet_count_buffers;
+        std::vector<VmaAllocation> m_meshlet_count_buffer_allocations;
+
+        // Chunk pool. Chunks keep full precision vertices, so they have their
+        // own pipelines.
+        PipelineVariants m_chunk_pipelines;
+        bool m_chunks_enabled;
+        uint32_t m_chunk_vertices, m_chunk_indices, m_chunk_capacity, m_chunk_uploads_per_frame;
+        vk::IndexType m_chunk_index_type;
+        vk::raii::Buffer m_chunk_vertex_buffer, m_chunk_index_buffer;
+        VmaAllocation m_chunk_vertex_buffer_allocation, m_chunk_index_buffer_allocation;
+        std::vector<uint32_t> m_chunk_draws;
+        std::vector<TerrainShadowCaster> m_chunk_shadow_casters;
+
+        // Per frame in flight: mapped staging memory and the copies waiting
+        // to be recorded.
+        std::vector<vk::raii::Buffer> m_chunk_staging_buffers;
+        std::vector<VmaAllocation> m_chunk_staging_allocations;
+        std::vector<std::vector<vk::BufferCopy>> m_chunk_copies;
+        std::unique_ptr<TerrainGenerator> m_chunk_generator;
     };
 }
 
@@ -0,0 +1,127 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#include <cassert>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "../vulkan.h"
+#include "../VmaUsage.h"
+
+#include "System.h"
+#include "TopologyCache.h"
+
+gfx::SharedIndexBuffer::SharedIndexBuffer(System *system, const std::vector<uint32_t> &indices, const std::string &name, std::vector<StagedCopy> *copies)
+: m_system{system},
+  m_num_indices{static_cast<uint32_t>(indices.size())},
+  m_index_type{vk::IndexType::eUint32},
+  m_batches{{ 0, static_cast<unsigned int>(indices.size()), 0 }},
+  m_buffer{nullptr},
+  m_allocation{nullptr}
+{
+    if (copies != nullptr) {
+        std::tie(m_buffer, m_allocation) = m_system->createBufferWithStagedData(
+            indices.data(), indices.size() * sizeof(uint32_t),
+            vk::BufferUsageFlagBits::eIndexBuffer, 0,
+            name, *copies
+        );
+    } else {
+        std::tie(m_buffer, m_allocation) = m_system->createBufferWithData(
+            indices.data(), indices.size() * sizeof(uint32_t),
+            vk::BufferUsageFlagBits::eIndexBuffer, 0,
+            name
+        );
+    }
+}
+
+gfx::SharedIndexBuffer::SharedIndexBuffer(System *system, const ShortElements &indices, const std::string &name, std::vector<StagedCopy> *copies)
+: m_system{system},
+  m_num_indices{static_cast<uint32_t>(indices.elements.size())},
+  m_index_type{vk::IndexType::eUint16},
+  m_batches{indices.batches},
+  m_buffer{nullptr},
+  m_allocation{nullptr}
+{
+    if (copies != nullptr) {
+        std::tie(m_buffer, m_allocation) = m_system->createBufferWithStagedData(
+            indices.elements.data(), indices.elements.size() * sizeof(uint16_t),
+            vk::BufferUsageFlagBits::eIndexBuffer, 0,
+            name, *copies
+        );
+    } else {
+        std::tie(m_buffer, m_allocation) = m_system->createBufferWithData(
+            indices.elements.data(), indices.elements.size() * sizeof(uint16_t),
+            vk::BufferUsageFlagBits::eIndexBuffer, 0,
+            name
+        );
+    }
+}
+
+gfx::SharedIndexBuffer::~SharedIndexBuffer() {
+    if (m_allocation != nullptr) {
+        vmaFreeMemory(m_system->allocator(), m_allocation);
+        m_allocation = nullptr;
+    }
+}
+
+uint32_t gfx::SharedIndexBuffer::numIndices() const {
+    return m_num_indices;
+}
+
+vk::IndexType gfx::SharedIndexBuffer::indexType() const {
+    return m_index_type;
+}
+
+const std::vector<IndexBatch> &gfx::SharedIndexBuffer::batches() const {
+    return m_batches;
+}
+
+const vk::raii::Buffer &gfx::SharedIndexBuffer::buffer() const {
+    return m_buffer;
+}
+
+gfx::TopologyCache::TopologyCache(System *system)
+: m_system{system},
+  m_icospheres{},
+  m_short_icospheres{}
+{}
+
+std::shared_ptr<const gfx::SharedIndexBuffer> gfx::TopologyCache::icosphereIndices(
+    uint32_t refinements,
+    const std::vector<uint32_t> &indices,
+    std::vector<StagedCopy> *copies
+) {
+    std::shared_ptr<const SharedIndexBuffer> buffer = m_icospheres[refinements].lock();
+    if (buffer) {
+        assert(buffer->numIndices() == indices.size());
+        return buffer;
+    }
+
+    buffer = std::make_shared<const SharedIndexBuffer>(
+        m_system, indices, std::format("icosphere level {} index", refinements), copies
+    );
+    m_icospheres[refinements] = buffer;
+    std::cerr << "Uploaded shared index buffer for icosphere level " << refinements << "\n";
+    return buffer;
+}
+
+std::shared_ptr<const gfx::SharedIndexBuffer> gfx::TopologyCache::icosphereIndices(
+    uint32_t refinements,
+    const ShortElements &indices,
+    std::vector<StagedCopy> *copies
+) {
+    std::shared_ptr<const SharedIndexBuffer> buffer = m_short_icospheres[refinements].lock();
+    if (buffer) {
+        assert(buffer->numIndices() == indices.elements.size());
+        return buffer;
+    }
+
+    buffer = std::make_shared<const SharedIndexBuffer>(
+        m_system, indices, std::format("icosphere level {} 16-bit index", refinements), copies
+    );
+    m_short_icospheres[refinements] = buffer;
+    std::cerr << "Uploaded shared 16-bit index buffer for icosphere level " << refinements
+              << " in " << indices.batches.size() << " batches\n";
+    return buffer;
+}
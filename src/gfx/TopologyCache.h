@@ -0,0 +1,80 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+#ifndef _VPLANET_GFX_TOPOLOGY_CACHE_H_
+#define _VPLANET_GFX_TOPOLOGY_CACHE_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../Models.h"
+#include "../vulkan.h"
+#include "../VmaUsage.h"
+#include "ComputeContext.h"
+
+namespace gfx {
+    class System;
+
+    // An index buffer that several meshes with the same topology draw from.
+    // 32-bit indices are drawn as a single batch; 16-bit ones in batches
+    // with their own base vertex. Given copies, the indices are staged
+    // there rather than uploaded straight away.
+    class SharedIndexBuffer {
+    public:
+        SharedIndexBuffer(System *system, const std::vector<uint32_t> &indices, const std::string &name, std::vector<StagedCopy> *copies);
+        SharedIndexBuffer(System *system, const ShortElements &indices, const std::string &name, std::vector<StagedCopy> *copies);
+        SharedIndexBuffer(const SharedIndexBuffer &other) = delete;
+
+        ~SharedIndexBuffer();
+
+        SharedIndexBuffer &operator=(const SharedIndexBuffer &other) = delete;
+
+        uint32_t numIndices() const;
+        vk::IndexType indexType() const;
+        const std::vector<IndexBatch> &batches() const;
+        const vk::raii::Buffer &buffer() const;
+
+    private:
+        System *m_system;
+        uint32_t m_num_indices;
+        vk::IndexType m_index_type;
+        std::vector<IndexBatch> m_batches;
+        vk::raii::Buffer m_buffer;
+        VmaAllocation m_allocation;
+    };
+
+    // Index buffers for icospheres, keyed by refinement level, so that the
+    // terrain, the ocean and any other shells of the same level only differ
+    // in their vertex buffers. A buffer lives as long as some mesh uses it.
+    class TopologyCache {
+    public:
+        TopologyCache(System *system);
+        TopologyCache(const TopologyCache &other) = delete;
+
+        TopologyCache &operator=(const TopologyCache &other) = delete;
+
+        // Uploads the indices the first time a level is asked for; after
+        // that they're expected to match what's already there. Given
+        // copies, a new buffer's upload is added to them for the caller to
+        // record before anything draws from it, instead of being waited
+        // for here.
+        std::shared_ptr<const SharedIndexBuffer> icosphereIndices(
+            uint32_t refinements,
+            const std::vector<uint32_t> &indices,
+            std::vector<StagedCopy> *copies = nullptr
+        );
+        std::shared_ptr<const SharedIndexBuffer> icosphereIndices(
+            uint32_t refinements,
+            const ShortElements &indices,
+            std::vector<StagedCopy> *copies = nullptr
+        );
+
+    private:
+        System *m_system;
+        std::map<uint32_t, std::weak_ptr<const SharedIndexBuffer>> m_icospheres;
+        std::map<uint32_t, std::weak_ptr<const SharedIndexBuffer>> m_short_icospheres;
+    };
+}
+
+#endif
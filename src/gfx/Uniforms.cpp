@@ -1,7 +1,10 @@
 // -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
 
+#include <algorithm>
+#include <array>
 #include <cstring>
 #include <iostream>
+#include <span>
 #include <vector>
 
 #include "../glm.h"
@@ -53,14 +56,31 @@ const vk::raii::DescriptorSetLayout &gfx::Uniforms::modelDescriptorSetLayout() c
 void gfx::Uniforms::initDescriptorPool() {
     const vk::raii::Device &device = m_system->device();
 
-    vk::DescriptorPoolSize pool_size{
-        .type = vk::DescriptorType::eUniformBuffer,
-        .descriptorCount = 4 * m_num_frames,
+    // Images are the atmosphere's lookup tables, the depth buffer it
+    // reads and the shadow map. Storage buffers include the terrain chunk
+    // generator's noise tables, jobs and vertices.
+    std::array<vk::DescriptorPoolSize, 4> pool_sizes{
+        vk::DescriptorPoolSize{
+            .type = vk::DescriptorType::eUniformBuffer,
+            .descriptorCount = 10 * m_num_frames,
+        },
+        vk::DescriptorPoolSize{
+            .type = vk::DescriptorType::eStorageBuffer,
+            .descriptorCount = 16 * m_num_frames,
+        },
+        vk::DescriptorPoolSize{
+            .type = vk::DescriptorType::eStorageImage,
+            .descriptorCount = 4 * m_num_frames,
+        },
+        vk::DescriptorPoolSize{
+            .type = vk::DescriptorType::eCombinedImageSampler,
+            .descriptorCount = 8 * m_num_frames,
+        },
     };
     vk::DescriptorPoolCreateInfo dp_ci = vk::DescriptorPoolCreateInfo{
         .flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
-        .maxSets = 4 * m_num_frames,
-    }.setPoolSizes(pool_size);
+        .maxSets = 9 * m_num_frames,
+    }.setPoolSizes(pool_sizes);
 
     m_descriptor_pool = device.createDescriptorPool(dp_ci);
     std::cerr << "Created descriptor pool: " << *m_descriptor_pool << "\n";
@@ -99,7 +119,22 @@ gfx::SceneUniformSet::SceneUniformSet()
   m_view_projection_buffers{},
   m_view_projection_buffer_allocations{},
   m_light_list_buffers{},
-  m_light_list_buffer_allocations{}
+  m_light_list_buffer_allocations{},
+  m_light_counts{},
+  m_point_lights{},
+  m_point_light_counts{},
+  m_light_cluster_z_near{0.01f},
+  m_light_cluster_z_far{100.0f},
+  m_light_cluster_buffers{},
+  m_light_cluster_buffer_allocations{},
+  m_point_light_buffers{},
+  m_point_light_buffer_allocations{},
+  m_view_light_buffers{},
+  m_view_light_buffer_allocations{},
+  m_cluster_light_buffers{},
+  m_cluster_light_buffer_allocations{},
+  m_shadow_buffers{},
+  m_shadow_buffer_allocations{}
 {}
 
 gfx::SceneUniformSet::SceneUniformSet(Uniforms *uniforms)
@@ -109,7 +144,22 @@ gfx::SceneUniformSet::SceneUniformSet(Uniforms *uniforms)
   m_view_projection_buffers{},
   m_view_projection_buffer_allocations{},
   m_light_list_buffers{},
-  m_light_list_buffer_allocations{}
+  m_light_list_buffer_allocations{},
+  m_light_counts{},
+  m_point_lights{},
+  m_point_light_counts{},
+  m_light_cluster_z_near{0.01f},
+  m_light_cluster_z_far{100.0f},
+  m_light_cluster_buffers{},
+  m_light_cluster_buffer_allocations{},
+  m_point_light_buffers{},
+  m_point_light_buffer_allocations{},
+  m_view_light_buffers{},
+  m_view_light_buffer_allocations{},
+  m_cluster_light_buffers{},
+  m_cluster_light_buffer_allocations{},
+  m_shadow_buffers{},
+  m_shadow_buffer_allocations{}
 {
     m_view_projection.projection = glm::mat4x4(1.0);
     m_view_projection.view = glm::mat4x4(1.0);
@@ -134,26 +184,37 @@ gfx::SceneUniformSet::~SceneUniformSet() {
             std::cerr << "Freeing light list buffer allocation " << alloc << "\n";
             vmaFreeMemory(m_uniforms->system()->allocator(), alloc);
         }
+
+        for (auto *allocs : {
+            &m_light_cluster_buffer_allocations,
+            &m_point_light_buffer_allocations,
+            &m_view_light_buffer_allocations,
+            &m_cluster_light_buffer_allocations,
+            &m_shadow_buffer_allocations,
+        }) {
+            for (auto &alloc : *allocs) {
+                vmaFreeMemory(m_uniforms->system()->allocator(), alloc);
+            }
+        }
     }
 }
 
 vk::raii::DescriptorSetLayout gfx::SceneUniformSet::createDescriptorSetLayout(System *gfx) {
     const vk::raii::Device &device = gfx->device();
 
-    std::array<vk::DescriptorSetLayoutBinding, 2> bindings{
-        vk::DescriptorSetLayoutBinding{
-            .binding = 0,
-            .descriptorType = vk::DescriptorType::eUniformBuffer,
+    // View projection, light list, light cluster parameters, point
+    // lights, their view space spheres, the clusters' light lists, the
+    // shadow parameters and the shadow map.
+    std::array<vk::DescriptorSetLayoutBinding, 8> bindings{};
+    for (uint32_t b = 0; b < bindings.size(); ++b) {
+        bindings[b] = vk::DescriptorSetLayoutBinding{
+            .binding = b,
+            .descriptorType = b < 3 || b == 6 ? vk::DescriptorType::eUniformBuffer :
+                b == 7 ? vk::DescriptorType::eCombinedImageSampler : vk::DescriptorType::eStorageBuffer,
             .descriptorCount = 1,
             .stageFlags = vk::ShaderStageFlagBits::eAll,
-        },
-        vk::DescriptorSetLayoutBinding{
-            .binding = 1,
-            .descriptorType = vk::DescriptorType::eUniformBuffer,
-            .descriptorCount = 1,
-            .stageFlags = vk::ShaderStageFlagBits::eAll,
-        },
-    };
+        };
+    }
 
     vk::DescriptorSetLayoutCreateInfo dsl_ci = vk::DescriptorSetLayoutCreateInfo{}
         .setBindings(bindings);
@@ -169,6 +230,10 @@ void gfx::SceneUniformSet::setTransforms(const ViewProjectionTransform &xform) {
     m_view_projection = xform;
 }
 
+const gfx::ViewProjectionTransform &gfx::SceneUniformSet::transforms() const {
+    return m_view_projection;
+}
+
 void gfx::SceneUniformSet::updateViewProjectionBuffer(uint32_t buffer_index) {
     VmaAllocator allocator = m_uniforms->system()->allocator();
 
@@ -203,14 +268,27 @@ void gfx::SceneUniformSet::disableLight(uint32_t index) {
     }
 }
 
+uint32_t gfx::SceneUniformSet::lightCount(uint32_t buffer_index) const {
+    return m_light_counts[buffer_index];
+}
+
 void gfx::SceneUniformSet::updateLightListBuffer(uint32_t buffer_index) {
     VmaAllocator allocator = m_uniforms->system()->allocator();
 
+    // The shaders only look at the first lightCount() lights.
+    LightInfo packed[MAX_LIGHTS]{};
+    uint32_t count = 0;
+    for (const LightInfo &light : m_lights) {
+        if (light.enabled) {
+            packed[count++] = light;
+        }
+    }
+
     VkResult rslt = vmaCopyMemoryToAllocation(
         allocator,
-        &m_lights,
+        &packed,
         m_light_list_buffer_allocations[buffer_index],
-        0, sizeof(m_lights)
+        0, sizeof(packed)
     );
 
     if (rslt != VK_SUCCESS) {
@@ -221,6 +299,112 @@ void gfx::SceneUniformSet::updateLightListBuffer(uint32_t buffer_index) {
             )
         );
     }
+    m_light_counts[buffer_index] = count;
+}
+
+std::optional<glm::vec3> gfx::SceneUniformSet::sunDirection() const {
+    for (const LightInfo &light : m_lights) {
+        if (light.enabled) {
+            return light.direction;
+        }
+    }
+    return std::nullopt;
+}
+
+void gfx::SceneUniformSet::setPointLights(std::span<const PointLight> lights) {
+    m_point_lights.assign(lights.begin(), lights.begin() + std::min<size_t>(lights.size(), MAX_POINT_LIGHTS));
+}
+
+void gfx::SceneUniformSet::updatePointLightBuffer(uint32_t buffer_index) {
+    if (!m_point_lights.empty()) {
+        VkResult rslt = vmaCopyMemoryToAllocation(
+            m_uniforms->system()->allocator(),
+            m_point_lights.data(),
+            m_point_light_buffer_allocations[buffer_index],
+            0, m_point_lights.size() * sizeof(PointLight)
+        );
+        if (rslt != VK_SUCCESS) {
+            throw std::runtime_error(
+                std::format(
+                    "Unable to update point light buffer. Error code: {}",
+                    vk::to_string(vk::Result(rslt))
+                )
+            );
+        }
+    }
+    m_point_light_counts[buffer_index] = static_cast<uint32_t>(m_point_lights.size());
+}
+
+uint32_t gfx::SceneUniformSet::pointLightCount(uint32_t buffer_index) const {
+    return m_point_light_counts[buffer_index];
+}
+
+void gfx::SceneUniformSet::setLightClusterRange(float z_near, float z_far) {
+    m_light_cluster_z_near = z_near;
+    m_light_cluster_z_far = z_far;
+}
+
+void gfx::SceneUniformSet::updateLightClusterBuffer(uint32_t buffer_index, const glm::mat4x4 &light_transform, vk::Extent2D extent) {
+    LightClusterParameters params{
+        .model_view = m_view_projection.view * light_transform,
+        .projection_scale = glm::vec2{m_view_projection.projection[0][0], m_view_projection.projection[1][1]},
+        .extent = glm::vec2{static_cast<float>(extent.width), static_cast<float>(extent.height)},
+        .grid = glm::uvec4{LIGHT_CLUSTER_TILES_X, LIGHT_CLUSTER_TILES_Y, LIGHT_CLUSTER_SLICES, m_point_light_counts[buffer_index]},
+        .z_near = m_light_cluster_z_near,
+        .z_far = m_light_cluster_z_far,
+        .padding = {0.0f, 0.0f},
+    };
+
+    VkResult rslt = vmaCopyMemoryToAllocation(
+        m_uniforms->system()->allocator(),
+        &params,
+        m_light_cluster_buffer_allocations[buffer_index],
+        0, sizeof(params)
+    );
+    if (rslt != VK_SUCCESS) {
+        throw std::runtime_error(
+            std::format(
+                "Unable to update light cluster buffer. Error code: {}",
+                vk::to_string(vk::Result(rslt))
+            )
+        );
+    }
+}
+
+void gfx::SceneUniformSet::setShadowMap(const vk::raii::ImageView &image_view, const vk::raii::Sampler &sampler) {
+    vk::DescriptorImageInfo image_info{
+        .sampler = *sampler,
+        .imageView = *image_view,
+        .imageLayout = vk::ImageLayout::eDepthReadOnlyOptimal,
+    };
+
+    std::vector<vk::WriteDescriptorSet> writes;
+    for (const vk::raii::DescriptorSet &set : m_descriptor_sets) {
+        writes.push_back(vk::WriteDescriptorSet{
+            .dstSet = *set,
+            .dstBinding = 7,
+            .dstArrayElement = 0,
+            .descriptorType = vk::DescriptorType::eCombinedImageSampler,
+        }.setImageInfo(image_info));
+    }
+    m_uniforms->system()->device().updateDescriptorSets(writes, {});
+}
+
+void gfx::SceneUniformSet::updateShadowBuffer(uint32_t buffer_index, const ShadowParameters &params) {
+    VkResult rslt = vmaCopyMemoryToAllocation(
+        m_uniforms->system()->allocator(),
+        &params,
+        m_shadow_buffer_allocations[buffer_index],
+        0, sizeof(params)
+    );
+    if (rslt != VK_SUCCESS) {
+        throw std::runtime_error(
+            std::format(
+                "Unable to update shadow buffer. Error code: {}",
+                vk::to_string(vk::Result(rslt))
+            )
+        );
+    }
 }
 
 void gfx::SceneUniformSet::initUniformBuffers() {
@@ -267,6 +451,59 @@ void gfx::SceneUniformSet::initUniformBuffers() {
         m_light_list_buffers.emplace_back(std::move(buffer));
         m_light_list_buffer_allocations.push_back(allocation);
     }
+    m_light_counts.assign(num_buffers, 0);
+
+    // The binning pass writes the view lights and cluster lists on the
+    // device, for the fragment shaders to read.
+    for (uint32_t i = 0; i < num_buffers; ++i) {
+        auto [cluster_buffer, cluster_allocation] = gfx->createBuffer(
+            sizeof(LightClusterParameters),
+            vk::BufferUsageFlagBits::eUniformBuffer,
+            VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+            "light cluster uniform"
+        );
+        m_light_cluster_buffers.emplace_back(std::move(cluster_buffer));
+        m_light_cluster_buffer_allocations.push_back(cluster_allocation);
+
+        auto [point_buffer, point_allocation] = gfx->createBuffer(
+            MAX_POINT_LIGHTS * sizeof(PointLight),
+            vk::BufferUsageFlagBits::eStorageBuffer,
+            VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+            "point light storage"
+        );
+        m_point_light_buffers.emplace_back(std::move(point_buffer));
+        m_point_light_buffer_allocations.push_back(point_allocation);
+
+        auto [view_buffer, view_allocation] = gfx->createBuffer(
+            MAX_POINT_LIGHTS * sizeof(glm::vec4),
+            vk::BufferUsageFlagBits::eStorageBuffer,
+            0,
+            "view light storage"
+        );
+        m_view_light_buffers.emplace_back(std::move(view_buffer));
+        m_view_light_buffer_allocations.push_back(view_allocation);
+
+        auto [list_buffer, list_allocation] = gfx->createBuffer(
+            LIGHT_CLUSTER_COUNT * (MAX_LIGHTS_PER_CLUSTER + 1) * sizeof(uint32_t),
+            vk::BufferUsageFlagBits::eStorageBuffer,
+            0,
+            "cluster light storage"
+        );
+        m_cluster_light_buffers.emplace_back(std::move(list_buffer));
+        m_cluster_light_buffer_allocations.push_back(list_allocation);
+    }
+    m_point_light_counts.assign(num_buffers, 0);
+
+    for (uint32_t i = 0; i < num_buffers; ++i) {
+        auto [buffer, allocation] = gfx->createBuffer(
+            sizeof(ShadowParameters),
+            vk::BufferUsageFlagBits::eUniformBuffer,
+            VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+            "shadow uniform"
+        );
+        m_shadow_buffers.emplace_back(std::move(buffer));
+        m_shadow_buffer_allocations.push_back(allocation);
+    }
 }
 
 void gfx::SceneUniformSet::initDescriptorSets() {
@@ -322,6 +559,59 @@ void gfx::SceneUniformSet::initDescriptorSets() {
         writes.push_back(light_list_write);
     }
 
+    // The writes point at these, so they're kept until the update.
+    std::vector<vk::DescriptorBufferInfo> cluster_buffer_infos;
+    cluster_buffer_infos.reserve(4 * num_sets);
+    for (uint32_t i = 0; i < num_sets; ++i) {
+        cluster_buffer_infos.push_back(vk::DescriptorBufferInfo{
+            .buffer = *m_light_cluster_buffers[i],
+            .offset = 0,
+            .range = vk::WholeSize,
+        });
+        cluster_buffer_infos.push_back(vk::DescriptorBufferInfo{
+            .buffer = *m_point_light_buffers[i],
+            .offset = 0,
+            .range = vk::WholeSize,
+        });
+        cluster_buffer_infos.push_back(vk::DescriptorBufferInfo{
+            .buffer = *m_view_light_buffers[i],
+            .offset = 0,
+            .range = vk::WholeSize,
+        });
+        cluster_buffer_infos.push_back(vk::DescriptorBufferInfo{
+            .buffer = *m_cluster_light_buffers[i],
+            .offset = 0,
+            .range = vk::WholeSize,
+        });
+        for (uint32_t b = 0; b < 4; ++b) {
+            writes.push_back(vk::WriteDescriptorSet{
+                .dstSet = *m_descriptor_sets[i],
+                .dstBinding = 2 + b,
+                .dstArrayElement = 0,
+                .descriptorType = b == 0 ? vk::DescriptorType::eUniformBuffer : vk::DescriptorType::eStorageBuffer,
+            }.setBufferInfo(cluster_buffer_infos[4 * i + b]));
+        }
+    }
+
+    // Nothing samples the shadow map without shadow parameters that say
+    // so, so they start out with no cascades.
+    std::vector<vk::DescriptorBufferInfo> shadow_buffer_infos;
+    shadow_buffer_infos.reserve(num_sets);
+    for (uint32_t i = 0; i < num_sets; ++i) {
+        shadow_buffer_infos.push_back(vk::DescriptorBufferInfo{
+            .buffer = *m_shadow_buffers[i],
+            .offset = 0,
+            .range = sizeof(ShadowParameters),
+        });
+        writes.push_back(vk::WriteDescriptorSet{
+            .dstSet = *m_descriptor_sets[i],
+            .dstBinding = 6,
+            .dstArrayElement = 0,
+            .descriptorType = vk::DescriptorType::eUniformBuffer,
+        }.setBufferInfo(shadow_buffer_infos.back()));
+        updateShadowBuffer(i, ShadowParameters{});
+    }
+
     device.updateDescriptorSets(writes, {});
 }
 
@@ -375,6 +665,10 @@ void gfx::ModelUniformSet::setTransform(const glm::mat4x4 &model) {
 
 }
 
+const glm::mat4x4 &gfx::ModelUniformSet::transform() const {
+    return m_model_transform;
+}
+
 void gfx::ModelUniformSet::updateModelBuffer(uint32_t buffer_index) {
     VmaAllocator allocator = m_uniforms->system()->allocator();
 
@@ -3,6 +3,8 @@
 #ifndef _VPLANET_GFX_UNIFORMS_H_
 #define _VPLANET_GFX_UNIFORMS_H_
 
+#include <optional>
+#include <span>
 #include <vector>
 
 #include "../glm.h"
@@ -25,6 +27,74 @@ namespace gfx {
         uint32_t enabled;
     };
 
+    // Point lights are binned into clusters of the view each frame (see
+    // LightClusters.h), so a fragment only looks at those that reach it.
+    // The view is split into tiles across the screen and slices in depth.
+    const uint32_t MAX_POINT_LIGHTS = 4096;
+    const uint32_t LIGHT_CLUSTER_TILES_X = 16;
+    const uint32_t LIGHT_CLUSTER_TILES_Y = 9;
+    const uint32_t LIGHT_CLUSTER_SLICES = 24;
+    const uint32_t LIGHT_CLUSTER_COUNT = LIGHT_CLUSTER_TILES_X * LIGHT_CLUSTER_TILES_Y * LIGHT_CLUSTER_SLICES;
+    // Lights past this in a cluster go unlit there. Each cluster's list is
+    // a count and this many indices.
+    const uint32_t MAX_LIGHTS_PER_CLUSTER = 63;
+
+    // In the terrain's model space, lighting what's within `radius`. The
+    // layout matches PointLight in light_clusters.slang.
+    struct PointLight {
+        glm::vec3 position;
+        float radius;
+        glm::vec3 color;
+        float padding;
+    };
+
+    // Written each frame for the binning pass and the fragment shaders.
+    // The layout matches LightClusterParameters in light_clusters.slang.
+    struct LightClusterParameters {
+        glm::mat4x4 model_view;
+        glm::vec2 projection_scale;
+        glm::vec2 extent;
+        glm::uvec4 grid; // xyz: tiles across and down, slices; w: light count
+        float z_near;
+        float z_far;
+        float padding[2];
+    };
+
+    // The sun's shadows are drawn into cascades of a shadow map (see
+    // ShadowMaps.h), each covering a stretch of the view further out.
+    const uint32_t SHADOW_CASCADES = 4;
+
+    // Written each frame for the fragment shaders. The cascades are looked
+    // up from world space, and a cascade not drawn yet is left out of
+    // valid_mask. The layout matches ShadowParameters in shadows.slang.
+    struct ShadowParameters {
+        glm::mat4x4 world_to_shadow[SHADOW_CASCADES];
+        glm::vec4 split_depths;   // the view depth each cascade reaches
+        glm::vec4 normal_offsets; // how far to push lookups off the surface
+        uint32_t valid_mask;
+        uint32_t cascade_count;   // 0 without a sun
+        float texel_size;         // of the shadow map, in texture coordinates
+        float padding;
+    };
+
+    // Pushed before each model draw. The layout matches DrawParameters in the
+    // shaders.
+    struct DrawParameters {
+        float morph_start;
+        float morph_end;
+        float min_radius;
+        float radius_range;
+    };
+
+    // The ocean's draw parameters, pushed into the same range. The layout
+    // matches OceanDrawParameters in ocean.slang.
+    struct OceanDrawParameters {
+        glm::vec4 color;
+        float radius;
+        float time;
+        float padding[2];
+    };
+
     class Uniforms {
     public:
         Uniforms();
@@ -85,11 +155,34 @@ namespace gfx {
         const vk::raii::DescriptorSetLayout &descriptorSetLayout() const;
 
         void setTransforms(const ViewProjectionTransform &xform);
+        const ViewProjectionTransform &transforms() const;
         void updateViewProjectionBuffer(uint32_t buffer_index);
 
         void enableLight(uint32_t index, const glm::vec3 &direction);
         void disableLight(uint32_t index);
+        // Packs the enabled lights at the front of the buffer's list, and
+        // remembers how many there are, for the pipelines to be specialized
+        // for.
         void updateLightListBuffer(uint32_t buffer_index);
+        uint32_t lightCount(uint32_t buffer_index) const;
+        // The direction the first enabled light shines in, if any; the
+        // atmosphere takes it for the sun.
+        std::optional<glm::vec3> sunDirection() const;
+
+        // Keeps the first MAX_POINT_LIGHTS.
+        void setPointLights(std::span<const PointLight> lights);
+        void updatePointLightBuffer(uint32_t buffer_index);
+        uint32_t pointLightCount(uint32_t buffer_index) const;
+
+        // The depths the clusters' slices span. Point lights don't light
+        // anything nearer or further.
+        void setLightClusterRange(float z_near, float z_far);
+        void updateLightClusterBuffer(uint32_t buffer_index, const glm::mat4x4 &light_transform, vk::Extent2D extent);
+
+        // The shadow map is the same for every frame, and has to be set
+        // before anything is drawn that samples it.
+        void setShadowMap(const vk::raii::ImageView &image_view, const vk::raii::Sampler &sampler);
+        void updateShadowBuffer(uint32_t buffer_index, const ShadowParameters &params);
 
     protected:
         friend class Uniforms;
@@ -104,6 +197,24 @@ namespace gfx {
         std::vector<VmaAllocation> m_view_projection_buffer_allocations;
         std::vector<vk::raii::Buffer> m_light_list_buffers;
         std::vector<VmaAllocation> m_light_list_buffer_allocations;
+        std::vector<uint32_t> m_light_counts;
+
+        // Point lights, their view space spheres and the clusters' light
+        // lists. The last two are written by the binning pass.
+        std::vector<PointLight> m_point_lights;
+        std::vector<uint32_t> m_point_light_counts;
+        float m_light_cluster_z_near, m_light_cluster_z_far;
+        std::vector<vk::raii::Buffer> m_light_cluster_buffers;
+        std::vector<VmaAllocation> m_light_cluster_buffer_allocations;
+        std::vector<vk::raii::Buffer> m_point_light_buffers;
+        std::vector<VmaAllocation> m_point_light_buffer_allocations;
+        std::vector<vk::raii::Buffer> m_view_light_buffers;
+        std::vector<VmaAllocation> m_view_light_buffer_allocations;
+        std::vector<vk::raii::Buffer> m_cluster_light_buffers;
+        std::vector<VmaAllocation> m_cluster_light_buffer_allocations;
+
+        std::vector<vk::raii::Buffer> m_shadow_buffers;
+        std::vector<VmaAllocation> m_shadow_buffer_allocations;
     };
 
     class ModelUniformSet : public UniformSet {
@@ -122,6 +233,7 @@ namespace gfx {
         const vk::raii::DescriptorSetLayout &descriptorSetLayout() const;
 
         void setTransform(const glm::mat4x4 &model);
+        const glm::mat4x4 &transform() const;
         void updateModelBuffer(uint32_t buffer_index);
 
     protected:
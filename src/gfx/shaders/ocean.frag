@@ -6,6 +6,9 @@ struct LightInfo {
     bool enabled;
 };
 
+// Enabled lights are packed at the front of the list.
+layout(constant_id = 0) const int LIGHT_COUNT = 1;
+
 layout(location = 0) in vec4 inColor;
 layout(location = 1) in vec3 inNormal;
 layout(location = 2) in vec3 inEyeDir;
@@ -17,37 +20,22 @@ layout(set = 0, binding = 1) uniform LightList {
 layout(location = 0) out vec4 outColor;
 
 void main(void) {
-    int enabled_lights = 0;
-    vec3 diffuse_colors[MAX_LIGHTS];
-    for (int i = 0; i < MAX_LIGHTS; ++i) {
-        if (lights[i].enabled) {
-            enabled_lights += 1;
-            diffuse_colors[i] = inColor.rgb * dot(inNormal, -1 * lights[i].direction);
-        }
-    }
-
     vec3 ambient_color = inColor.rgb;
 
-    vec3 diffuse_color = vec3(0.0, 0.0, 0.0);
-    for (int i = 0; i < MAX_LIGHTS; ++i) {
-        if (lights[i].enabled) {
-            diffuse_color += (1.0 / enabled_lights) * diffuse_colors[i];
-        }
-    }
-    diffuse_color = clamp(diffuse_color, 0.0, 1.0);
-
     float specular_pow = 12.0;
+    vec3 diffuse_color = vec3(0.0, 0.0, 0.0);
     vec3 specular_color = vec3(0.0, 0.0, 0.0);
-    for (int i = 0; i < MAX_LIGHTS; ++i) {
-        if (lights[i].enabled) {
-            vec3 reflected = normalize(reflect(lights[i].direction, inNormal));
-            float specular_cos = dot(reflected, inEyeDir);
-            if (specular_cos > 0) {
-                float specular = pow(specular_cos, specular_pow);
-                specular_color += specular * vec3(0.5, 0.5, 1.0);
-            }
+    for (int i = 0; i < LIGHT_COUNT; ++i) {
+        diffuse_color += inColor.rgb * dot(inNormal, -1 * lights[i].direction);
+
+        vec3 reflected = normalize(reflect(lights[i].direction, inNormal));
+        float specular_cos = dot(reflected, inEyeDir);
+        if (specular_cos > 0) {
+            float specular = pow(specular_cos, specular_pow);
+            specular_color += specular * vec3(0.5, 0.5, 1.0);
         }
     }
+    diffuse_color = clamp(diffuse_color / max(LIGHT_COUNT, 1), 0.0, 1.0);
     specular_color = clamp(specular_color, 0.0, 1.0);
 
     outColor = vec4(0.1*ambient_color + 0.9*diffuse_color + 0.5*specular_color, inColor.a);
@@ -1,9 +1,7 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec4 inColor;
-layout(location = 2) in vec3 inNormal;
+layout(location = 0) in vec2 inDirection;
 
 layout(set = 0, binding = 0) uniform ViewProjectionTransformation {
     mat4x4 view;
@@ -15,6 +13,26 @@ layout(set = 1, binding = 0) uniform ModelTransformation {
     mat4x4 model;
 };
 
+layout(push_constant) uniform OceanDrawParameters {
+    vec4 color;
+    float radius;
+    float time;
+} params;
+
+const int NUM_WAVES = 4;
+const vec4 WAVE_DIRECTIONS[NUM_WAVES] = vec4[](
+    vec4(1.0, 0.2, 0.3, 0.9),
+    vec4(-0.4, 1.0, 0.1, 0.6),
+    vec4(0.3, -0.5, 1.0, 0.45),
+    vec4(0.8, 0.6, -0.7, 0.3)
+);
+const vec3 WAVE_SHAPES[NUM_WAVES] = vec3[](
+    vec3(0.004, 0.05, 0.6),
+    vec3(0.003, 0.04, 0.6),
+    vec3(0.002, 0.035, 0.6),
+    vec3(0.0015, 0.03, 0.6)
+);
+
 out gl_PerVertex {
     vec4 gl_Position;
 };
@@ -23,15 +41,45 @@ layout(location = 0) out vec4 outColor;
 layout(location = 1) out vec3 outNormal;
 layout(location = 2) out vec3 outEyeDir;
 
+vec3 octahedralDecode(vec2 e) {
+    vec3 n = vec3(e.x, e.y, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+        n.xy = (1.0 - abs(n.yx)) * signs;
+    }
+    return normalize(n);
+}
+
 void main(void) {
-    vec4 wld_vert_pos4 = model * vec4(inPosition, 1.0);
+    vec3 up = octahedralDecode(inDirection * 2.0 - 1.0);
+    vec3 surface = up * params.radius;
+    vec3 position = surface;
+    vec3 normal = up;
+    for (int i = 0; i < NUM_WAVES; ++i) {
+        vec3 direction = normalize(WAVE_DIRECTIONS[i].xyz);
+        float k = 2.0 * 3.14159265 / WAVE_DIRECTIONS[i].w;
+        float amplitude = WAVE_SHAPES[i].x;
+        float steepness = WAVE_SHAPES[i].z;
+        float phase = k * (dot(surface, direction) - WAVE_SHAPES[i].y * params.time);
+
+        vec3 tangent = direction - dot(direction, up) * up;
+        float tangent_length = length(tangent);
+        tangent = tangent_length > 1e-4 ? tangent / tangent_length : vec3(0.0);
+
+        float s = sin(phase);
+        float c = cos(phase);
+        position += steepness * amplitude * c * tangent + amplitude * s * up;
+        normal -= k * amplitude * c * tangent + steepness * k * amplitude * s * up;
+    }
+
+    vec4 wld_vert_pos4 = model * vec4(position, 1.0);
     vec3 wld_vert_pos = wld_vert_pos4.xyz / wld_vert_pos4.w;
 
     vec4 wld_eye_pos4 = view_inv * vec4(0.0, 0.0, 0.0, 1.0);
     vec3 wld_eye_pos = wld_eye_pos4.xyz / wld_eye_pos4.w;
 
-    gl_Position = projection * view * model * vec4(inPosition, 1.0);
-    outColor = inColor;
-    outNormal = normalize(mat3x3(model) * inNormal);
+    gl_Position = projection * view * wld_vert_pos4;
+    outColor = params.color;
+    outNormal = normalize(mat3x3(model) * normalize(normal));
     outEyeDir = normalize(wld_eye_pos - wld_vert_pos);
 }
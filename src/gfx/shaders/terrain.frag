@@ -6,6 +6,9 @@ struct LightInfo {
     bool enabled;
 };
 
+// Enabled lights are packed at the front of the list.
+layout(constant_id = 0) const int LIGHT_COUNT = 1;
+
 layout(location = 0) in float inHeight;
 layout(location = 1) in vec3 inNormal;
 
@@ -28,25 +31,14 @@ void main(void) {
     }
 
     // No specular highlight for the terrain. Just an ambient and a diffuse
-    // term.
-    int enabled_lights = 0;
-    vec3 diffuse_colors[MAX_LIGHTS];
-    for (int i = 0; i < MAX_LIGHTS; ++i) {
-        if (lights[i].enabled) {
-            enabled_lights += 1;
-            diffuse_colors[i] = color * dot(inNormal, -1 * lights[i].direction);
-        }
-    }
-
+    // term, averaged over the lights.
     vec3 ambient_color = color;
 
     vec3 diffuse_color = vec3(0.0, 0.0, 0.0);
-    for (int i = 0; i < MAX_LIGHTS; ++i) {
-        if (lights[i].enabled) {
-            diffuse_color += (1.0 / enabled_lights) * diffuse_colors[i];
-        }
+    for (int i = 0; i < LIGHT_COUNT; ++i) {
+        diffuse_color += color * dot(inNormal, -1 * lights[i].direction);
     }
-    diffuse_color = clamp(diffuse_color, 0.0, 1.0);
+    diffuse_color = clamp(diffuse_color / max(LIGHT_COUNT, 1), 0.0, 1.0);
 
     outColor = vec4(0.1*ambient_color + 0.9*diffuse_color, 1.0);
 }
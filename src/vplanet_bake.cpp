@@ -0,0 +1,222 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+// Bakes the chunk tree of a planet into a tile set (see TerrainTiles.h) for
+// the viewer to stream. Tiles are dealt out round robin by their index in
+// a fixed, coarse to fine order, to `--shards` machines sharing the output
+// directory and to `--jobs` worker processes on each, so every tile has
+// exactly one owner. Tiles already on disk are skipped, so an interrupted
+// bake picks up where it left off when run again with the same arguments.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Noise.h"
+#include "TerrainChunks.h"
+#include "TerrainTiles.h"
+#include "ToolOptions.h"
+
+namespace {
+    // The viewer's defaults, so its tiles match the planet it generates.
+    struct BakeOptions {
+        std::filesystem::path output;
+        uint32_t max_level = 6;
+        uint32_t resolution = 16;
+        float radius = 2.0f;
+        uint32_t seed = 1;
+        uint32_t jobs = 1;
+        uint32_t shard = 0;
+        uint32_t num_shards = 1;
+    };
+
+    // Counts of one worker's tiles.
+    struct BakeCounts {
+        uint64_t baked = 0;
+        uint64_t skipped = 0;
+    };
+
+    void usage(const char *argv0) {
+        std::cerr
+            << "Usage: " << argv0 << " --output DIR [options]\n"
+            << "\n"
+            << "  --output DIR       tile set directory, created if need be\n"
+            << "  --max-level N      deepest level of the chunk tree to bake (default 6)\n"
+            << "  --resolution N     grid triangles along a chunk edge (default 16)\n"
+            << "  --radius R         planet radius (default 2.0)\n"
+            << "  --seed N           noise seed (default 1)\n"
+            << "  --jobs N           worker processes on this machine (default 1)\n"
+            << "  --shard I/N        bake this machine's share, I of N (default 0/1)\n"
+            << "\n"
+            << "A level has 20 * 4^level tiles of resolution^2 triangles, so level L at\n"
+            << "resolution 2^R is as fine as an icosphere of L + R refinements.\n";
+    }
+
+    BakeOptions parseOptions(int argc, char **argv) {
+        BakeOptions options;
+        tool_options::parseOptions(argc, argv, usage, [&options](const std::string &arg, const std::string &value) {
+            if (arg == "--output") {
+                options.output = value;
+            } else if (arg == "--max-level") {
+                options.max_level = tool_options::parseCount(value, "--max-level");
+            } else if (arg == "--resolution") {
+                options.resolution = tool_options::parseCount(value, "--resolution");
+            } else if (arg == "--radius") {
+                options.radius = tool_options::parseLength(value, "--radius");
+            } else if (arg == "--seed") {
+                options.seed = tool_options::parseCount(value, "--seed");
+            } else if (arg == "--jobs") {
+                options.jobs = tool_options::parseCount(value, "--jobs");
+            } else if (arg == "--shard") {
+                size_t slash = value.find('/');
+                if (slash == std::string::npos) {
+                    throw std::runtime_error("--shard takes I/N");
+                }
+                options.shard = tool_options::parseCount(value.substr(0, slash), "--shard");
+                options.num_shards = tool_options::parseCount(value.substr(slash + 1), "--shard");
+            } else {
+                throw std::runtime_error(std::format("Unknown option {}", arg));
+            }
+        });
+
+        if (options.output.empty()) {
+            throw std::runtime_error("--output is required");
+        }
+        // Two bits of path per level, and the path is printed in the tile
+        // names.
+        if (options.max_level > 31) {
+            throw std::runtime_error("--max-level can be at most 31");
+        }
+        if (options.resolution == 0 || options.jobs == 0 || options.num_shards == 0 || options.shard >= options.num_shards) {
+            throw std::runtime_error("--resolution, --jobs and --shard must be positive, with I < N");
+        }
+        return options;
+    }
+
+    // Bakes every tile whose index is `worker` modulo `num_workers`.
+    BakeCounts bakeTiles(
+        const TerrainChunkGenerator &generator,
+        const TerrainTileSet &tiles,
+        uint32_t max_level,
+        uint64_t worker,
+        uint64_t num_workers
+    ) {
+        BakeCounts counts;
+        auto last_report = std::chrono::steady_clock::now();
+        uint64_t index = 0;
+        for (uint32_t level = 0; level <= max_level; ++level) {
+            uint64_t paths = uint64_t{1} << (2 * level);
+            for (uint32_t face = 0; face < TerrainChunkGenerator::NUM_FACES; ++face) {
+                for (uint64_t path = 0; path < paths; ++path, ++index) {
+                    if (index % num_workers != worker) {
+                        continue;
+                    }
+
+                    TerrainChunkKey key{face, level, path};
+                    if (tiles.hasTile(key)) {
+                        ++counts.skipped;
+                        continue;
+                    }
+                    tiles.writeTile(generator.generate(key, generator.corners(key)));
+                    ++counts.baked;
+
+                    auto now = std::chrono::steady_clock::now();
+                    if (now - last_report >= std::chrono::seconds{10}) {
+                        std::cout << std::format("Worker {}: level {}, {} baked, {} skipped", worker, level, counts.baked, counts.skipped) << std::endl;
+                        last_report = now;
+                    }
+                }
+            }
+        }
+        return counts;
+    }
+}
+
+int main(int argc, char **argv) {
+    BakeOptions options;
+    try {
+        options = parseOptions(argc, argv);
+    } catch (std::runtime_error &ex) {
+        std::cerr << ex.what() << "\n\n";
+        usage(argv[0]);
+        return 2;
+    }
+
+    TerrainNoise noise{options.seed};
+    TerrainChunkGenerator generator{options.radius, noise.function(), options.resolution};
+    uint64_t key = TerrainTileSet::tileKey(options.radius, noise.function(), options.resolution);
+    TerrainTileSet tiles{options.output, key};
+
+    // Never mix tiles from different parameters in one directory. Every
+    // worker writes the same manifest, so it doesn't matter which lands.
+    try {
+        std::optional<TerrainTileSetInfo> existing = TerrainTileSet::readManifest(options.output, key);
+        if (!existing && std::filesystem::exists(TerrainTileSet::manifestPath(options.output))) {
+            std::cerr << "Error: " << options.output << " holds tiles baked with other parameters\n";
+            return 1;
+        }
+        TerrainTileSetInfo info{
+            .key = key,
+            .radius = options.radius,
+            .resolution = options.resolution,
+            .max_level = std::max(options.max_level, existing ? existing->max_level : 0u),
+            .padding = 0,
+        };
+        TerrainTileSet::writeManifest(options.output, info);
+    } catch (std::runtime_error &ex) {
+        std::cerr << "Error writing manifest: " << ex.what() << "\n";
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t num_workers = static_cast<uint64_t>(options.num_shards) * options.jobs;
+    std::vector<pid_t> children;
+    for (uint32_t job = 0; job < options.jobs; ++job) {
+        uint64_t worker = static_cast<uint64_t>(options.shard) * options.jobs + job;
+        pid_t pid = fork();
+        if (pid < 0) {
+            std::cerr << "Error: couldn't start worker " << worker << "\n";
+            break;
+        }
+        if (pid > 0) {
+            children.push_back(pid);
+            continue;
+        }
+
+        try {
+            BakeCounts counts = bakeTiles(generator, tiles, options.max_level, worker, num_workers);
+            std::cout << std::format("Worker {} done: {} baked, {} already there", worker, counts.baked, counts.skipped) << std::endl;
+            std::_Exit(0);
+        } catch (std::exception &ex) {
+            std::cerr << "Worker " << worker << " failed: " << ex.what() << std::endl;
+            std::_Exit(1);
+        }
+    }
+
+    int failures = static_cast<int>(options.jobs - children.size());
+    for (pid_t pid : children) {
+        int status = 0;
+        if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            ++failures;
+        }
+    }
+
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    if (failures > 0) {
+        std::cerr << std::format("{} of {} workers failed after {:.1f} s; run again to finish", failures, options.jobs, seconds) << "\n";
+        return 1;
+    }
+    std::cout << std::format("Shard {}/{} baked to level {} in {:.1f} s", options.shard, options.num_shards, options.max_level, seconds) << std::endl;
+    return 0;
+}
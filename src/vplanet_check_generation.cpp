@@ -0,0 +1,118 @@
+// -*- mode: c++; c-basic-offset: 4; encoding: utf-8; -*-
+
+// Checks that the GPU generates LOD terrain chunks as the CPU does, the way
+// the viewer does at startup, but on a compute-only device with no window,
+// so it can run unattended. Exits with 0 if the GPU's chunks are within
+// tolerance, 1 if they aren't, 2 on bad arguments and 77, which ctest takes
+// as a skip, if there's no device to run on.
+
+#include <cstdint>
+#include <exception>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "gfx/HeadlessDevice.h"
+#include "gfx/TerrainGenerator.h"
+#include "Noise.h"
+#include "TerrainChunks.h"
+#include "ToolOptions.h"
+
+namespace {
+    const int EXIT_NO_DEVICE = 77;
+
+    // The viewer's defaults, so it checks the planet the viewer generates.
+    struct CheckOptions {
+        uint32_t resolution = 16;
+        float radius = 2.0f;
+        uint32_t seed = 1;
+        std::string device;
+    };
+
+    // Enough for every chunk compareTerrainGeneration() generates.
+    const uint32_t CHUNKS_PER_DISPATCH = 64;
+
+    void usage(const char *argv0) {
+        std::cerr
+            << "Usage: " << argv0 << " [options]\n"
+            << "\n"
+            << "  --resolution N     grid triangles along a chunk edge (default 16)\n"
+            << "  --radius R         planet radius (default 2.0)\n"
+            << "  --seed N           noise seed (default 1)\n"
+            << "  --device NAME      use the first device whose name contains NAME\n";
+    }
+
+    CheckOptions parseOptions(int argc, char **argv) {
+        CheckOptions options;
+        tool_options::parseOptions(argc, argv, usage, [&options](const std::string &arg, const std::string &value) {
+            if (arg == "--resolution") {
+                options.resolution = tool_options::parseCount(value, "--resolution");
+            } else if (arg == "--radius") {
+                options.radius = tool_options::parseLength(value, "--radius");
+            } else if (arg == "--seed") {
+                options.seed = tool_options::parseCount(value, "--seed");
+            } else if (arg == "--device") {
+                options.device = value;
+            } else {
+                throw std::runtime_error(std::format("Unknown option {}", arg));
+            }
+        });
+
+        if (options.resolution == 0) {
+            throw std::runtime_error("--resolution must be positive");
+        }
+        return options;
+    }
+}
+
+int main(int argc, char **argv) {
+    CheckOptions options;
+    try {
+        options = parseOptions(argc, argv);
+    } catch (std::runtime_error &ex) {
+        std::cerr << ex.what() << "\n\n";
+        usage(argv[0]);
+        return 2;
+    }
+
+    std::unique_ptr<gfx::HeadlessDevice> device;
+    try {
+        device = std::make_unique<gfx::HeadlessDevice>(options.device);
+    } catch (std::exception &ex) {
+        std::cerr << "No device to check terrain generation on: " << ex.what() << "\n";
+        return EXIT_NO_DEVICE;
+    }
+
+    TerrainNoise noise{options.seed};
+    TerrainChunkGenerator generator{options.radius, noise.function(), options.resolution};
+    std::optional<gfx::TerrainGenerationError> error;
+    try {
+        gfx::TerrainGenerator gpu{device.get(), noise.tables(), options.radius, options.resolution, CHUNKS_PER_DISPATCH};
+        error = gfx::compareTerrainGeneration(
+            generator,
+            [&gpu](const std::vector<TerrainChunkGeneration> &chunks) {
+                return gpu.generateNow(chunks);
+            }
+        );
+    } catch (std::exception &ex) {
+        std::cerr << "Error: " << ex.what() << "\n";
+        return 1;
+    }
+    if (!error) {
+        std::cerr << "Couldn't generate terrain chunks on the GPU to check them\n";
+        return 1;
+    }
+
+    bool matches = error->withinTolerance();
+    std::cout << std::format(
+        "GPU terrain generation is within {:.2g} of the CPU's positions (tolerance {:.2g}) and {:.2g} degrees of its normals (tolerance {:.2g}) over {} chunks: {}",
+        error->position, gfx::TerrainGenerationError::POSITION_TOLERANCE,
+        error->normal, gfx::TerrainGenerationError::NORMAL_TOLERANCE,
+        error->chunks, matches ? "pass" : "FAIL"
+    ) << std::endl;
+    return matches ? 0 : 1;
+}
@@ -23,7 +23,10 @@ import vulkan_hpp;
 
 // GLFW has to be included *after* Vulkan. The Vulkan RAII include and the C++20
 // module will both ultimately include the main vulkan.h header, so this
-// include will work.
+// include will work. Tools that never open a window define
+// VPLANET_NO_WINDOW and do without it.
+#ifndef VPLANET_NO_WINDOW
 #include <GLFW/glfw3.h>
+#endif
 
 #endif